@@ -0,0 +1,192 @@
+#include "BenchData.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace miniwr {
+namespace bench {
+
+namespace {
+    constexpr std::array<const char*, 24> WORDS = {
+        "the", "archive", "of", "compressed", "data", "and", "a", "file",
+        "block", "to", "stream", "is", "in", "header", "with", "entry",
+        "directory", "for", "size", "buffer", "that", "level", "on", "writer"
+    };
+
+    constexpr size_t MIXED_RUN_SIZE = 4096;
+    constexpr size_t COMPRESSIBLE_RUN_SIZE = 256;
+
+    /**
+     * @brief Small fast PRNG (xorshift32), stable across platforms
+     */
+    class Random {
+    public:
+        explicit Random(uint32_t seed) : state_(seed ? seed : 0x9E3779B9u) {}
+
+        uint32_t next() {
+            state_ ^= state_ << 13;
+            state_ ^= state_ >> 17;
+            state_ ^= state_ << 5;
+            return state_;
+        }
+
+    private:
+        uint32_t state_;
+    };
+
+    void appendText(std::vector<uint8_t>& out, size_t size, Random& random) {
+        size_t end = out.size() + size;
+        size_t column = 0;
+        while (out.size() < end) {
+            for (const char* c = WORDS[random.next() % WORDS.size()]; *c && out.size() < end; ++c) {
+                out.push_back(static_cast<uint8_t>(*c));
+                ++column;
+            }
+            if (out.size() < end) {
+                out.push_back(column > 72 ? '\n' : ' ');
+                column = column > 72 ? 0 : column + 1;
+            }
+        }
+    }
+
+    void appendBinary(std::vector<uint8_t>& out, size_t size, Random& random) {
+        for (size_t i = 0; i < size; ++i) {
+            out.push_back(static_cast<uint8_t>(random.next() >> 24));
+        }
+    }
+
+    void appendRepetitive(std::vector<uint8_t>& out, size_t size, Random& random) {
+        std::array<uint8_t, 64> pattern;
+        for (auto& byte : pattern) {
+            byte = static_cast<uint8_t>(random.next() >> 24);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            // About one edit per 4 KB
+            if ((random.next() & 0xFFF) == 0) {
+                pattern[i % pattern.size()] = static_cast<uint8_t>(random.next() >> 24);
+            }
+            out.push_back(pattern[i % pattern.size()]);
+        }
+    }
+
+    void appendCompressed(std::vector<uint8_t>& out, size_t size, Random& random) {
+        size_t end = out.size() + size;
+        std::vector<uint8_t> text;
+        std::vector<uint8_t> packed;
+
+        while (out.size() < end) {
+            text.clear();
+            appendText(text, MIXED_RUN_SIZE * 16, random);
+            uLongf packedSize = compressBound(static_cast<uLong>(text.size()));
+            packed.resize(packedSize);
+            compress2(packed.data(), &packedSize, text.data(), static_cast<uLong>(text.size()), Z_BEST_SPEED);
+            out.insert(out.end(), packed.begin(),
+                       packed.begin() + static_cast<std::ptrdiff_t>(std::min<size_t>(packedSize, end - out.size())));
+        }
+    }
+}
+
+const char* inputClassName(InputClass inputClass) {
+    switch (inputClass) {
+        case InputClass::Text: return "text";
+        case InputClass::Binary: return "binary";
+        case InputClass::Repetitive: return "repetitive";
+        case InputClass::Mixed: return "mixed";
+        case InputClass::Compressed: return "compressed";
+    }
+    return "unknown";
+}
+
+std::vector<uint8_t> generateInput(InputClass inputClass, size_t size, uint32_t seed) {
+    Random random(seed);
+    std::vector<uint8_t> out;
+    out.reserve(size);
+
+    switch (inputClass) {
+        case InputClass::Text:
+            appendText(out, size, random);
+            break;
+        case InputClass::Binary:
+            appendBinary(out, size, random);
+            break;
+        case InputClass::Repetitive:
+            appendRepetitive(out, size, random);
+            break;
+        case InputClass::Compressed:
+            appendCompressed(out, size, random);
+            break;
+        case InputClass::Mixed:
+            for (size_t run = 0; out.size() < size; ++run) {
+                size_t length = std::min(MIXED_RUN_SIZE, size - out.size());
+                if (run % 2 == 0) {
+                    appendText(out, length, random);
+                } else {
+                    appendBinary(out, length, random);
+                }
+            }
+            break;
+    }
+
+    return out;
+}
+
+std::vector<uint8_t> generateCompressible(size_t size, double compressibility, uint32_t seed) {
+    Random random(seed);
+    std::vector<uint8_t> out;
+    out.reserve(size);
+
+    auto threshold = static_cast<uint32_t>(std::clamp(compressibility, 0.0, 1.0) * 65536.0);
+    while (out.size() < size) {
+        size_t length = std::min(COMPRESSIBLE_RUN_SIZE, size - out.size());
+        if ((random.next() >> 16) < threshold) {
+            appendText(out, length, random);
+        } else {
+            appendBinary(out, length, random);
+        }
+    }
+
+    return out;
+}
+
+uint64_t generateTree(const std::filesystem::path& root,
+                      size_t fileCount,
+                      size_t fileSize,
+                      uint32_t seed) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < fileCount; ++i) {
+        // Up to 64 files per directory, two levels deep
+        auto dir = root / ("d" + std::to_string(i / 4096)) / ("d" + std::to_string(i / 64 % 64));
+        std::filesystem::create_directories(dir);
+
+        auto inputClass = static_cast<InputClass>(i % INPUT_CLASS_COUNT);
+        auto data = generateInput(inputClass, fileSize, seed + static_cast<uint32_t>(i));
+        auto path = dir / ("f" + std::to_string(i) + "." + inputClassName(inputClass));
+
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file) {
+            throw std::runtime_error("Failed to write " + path.string());
+        }
+        total += data.size();
+    }
+    return total;
+}
+
+ScratchDir::ScratchDir(const std::string& name)
+    : path_(std::filesystem::temp_directory_path() / ("miniwr_bench_" + name)),
+      previous_(std::filesystem::current_path()) {
+    std::filesystem::remove_all(path_);
+    std::filesystem::create_directories(path_);
+    std::filesystem::current_path(path_);
+}
+
+ScratchDir::~ScratchDir() {
+    std::error_code error;
+    std::filesystem::current_path(previous_, error);
+    std::filesystem::remove_all(path_, error);
+}
+
+} // namespace bench
+} // namespace miniwr
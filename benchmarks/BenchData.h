@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace miniwr {
+namespace bench {
+
+/**
+ * @brief Kinds of generated benchmark input
+ */
+enum class InputClass {
+    Text = 0,       ///< English-like words from a small vocabulary
+    Binary = 1,     ///< Uniform random bytes, incompressible
+    Repetitive = 2, ///< Short patterns with rare edits, highly compressible
+    Mixed = 3,      ///< Alternating text and binary runs
+    Compressed = 4  ///< Deflated text, like media and nested archives
+};
+
+inline constexpr int INPUT_CLASS_COUNT = 5;
+
+const char* inputClassName(InputClass inputClass);
+
+/**
+ * @brief Generate deterministic input data
+ * @param inputClass Shape of the data
+ * @param size Number of bytes
+ * @param seed Generator seed
+ * @return Generated bytes
+ */
+std::vector<uint8_t> generateInput(InputClass inputClass, size_t size, uint32_t seed = 1);
+
+/**
+ * @brief Generate data with a tunable share of redundancy
+ *
+ * The output is a sequence of short runs, each either random bytes or text;
+ * the compressed size shrinks roughly linearly as compressibility grows.
+ *
+ * @param size Number of bytes
+ * @param compressibility Share of text runs, from 0 (random) to 1 (all text)
+ * @param seed Generator seed
+ * @return Generated bytes
+ */
+std::vector<uint8_t> generateCompressible(size_t size, double compressibility, uint32_t seed = 1);
+
+/**
+ * @brief Write a directory tree of generated files, cycling through the input classes
+ * @param root Directory to create
+ * @param fileCount Number of files
+ * @param fileSize Size of each file
+ * @param seed Generator seed
+ * @return Total number of bytes written
+ */
+uint64_t generateTree(const std::filesystem::path& root,
+                      size_t fileCount,
+                      size_t fileSize,
+                      uint32_t seed = 1);
+
+/**
+ * @brief Temporary working directory
+ *
+ * The process changes into the directory for its lifetime, so archives can
+ * be built from relative paths and extracted next to them. The directory is
+ * removed on destruction.
+ */
+class ScratchDir {
+public:
+    explicit ScratchDir(const std::string& name);
+    ~ScratchDir();
+
+    ScratchDir(const ScratchDir&) = delete;
+    ScratchDir& operator=(const ScratchDir&) = delete;
+
+    const std::filesystem::path& path() const { return path_; }
+
+private:
+    std::filesystem::path path_;
+    std::filesystem::path previous_;
+};
+
+} // namespace bench
+} // namespace miniwr
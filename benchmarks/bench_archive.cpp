@@ -0,0 +1,90 @@
+#include <benchmark/benchmark.h>
+#include "BenchData.h"
+#include "../src/core/ArchiveReader.h"
+#include "../src/core/ArchiveWriter.h"
+#include <string>
+
+namespace miniwr {
+namespace bench {
+
+namespace {
+    constexpr size_t DEFAULT_SOLID_BLOCK_SIZE = 16 * 1024 * 1024;
+
+    uint64_t writeArchive(const std::string& archive, size_t fileCount,
+                          size_t fileSize, bool solid) {
+        uint64_t total = generateTree("tree", fileCount, fileSize);
+        ArchiveWriter writer(archive);
+        writer.setSolidMode(solid ? DEFAULT_SOLID_BLOCK_SIZE : 0);
+        writer.addDirectory("tree");
+        writer.close();
+        return total;
+    }
+}
+
+// Arg: entry count; measures opening an archive, which parses the central
+// directory and builds the name index
+static void BM_ParseCentralDirectory(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    ScratchDir scratch("cdir_" + std::to_string(count));
+    writeArchive("archive.zip", count, 64, false);
+
+    for (auto _ : state) {
+        ArchiveReader reader("archive.zip");
+        benchmark::DoNotOptimize(reader.findEntry("tree/d0/d0/f0.text"));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_ParseCentralDirectory)
+    ->RangeMultiplier(10)->Range(10, 10000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Args: file count, file size, solid mode
+static void BM_WriteArchive(benchmark::State& state) {
+    auto fileCount = static_cast<size_t>(state.range(0));
+    auto fileSize = static_cast<size_t>(state.range(1));
+    bool solid = state.range(2) != 0;
+    ScratchDir scratch("write");
+    uint64_t total = generateTree("tree", fileCount, fileSize);
+
+    for (auto _ : state) {
+        ArchiveWriter writer("archive.zip");
+        writer.setSolidMode(solid ? DEFAULT_SOLID_BLOCK_SIZE : 0);
+        writer.addDirectory("tree");
+        writer.close();
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * total));
+    state.counters["ratio"] = static_cast<double>(std::filesystem::file_size("archive.zip")) /
+                              static_cast<double>(total);
+}
+
+// Args: file count, file size, solid mode
+static void BM_ExtractArchive(benchmark::State& state) {
+    auto fileCount = static_cast<size_t>(state.range(0));
+    auto fileSize = static_cast<size_t>(state.range(1));
+    bool solid = state.range(2) != 0;
+    ScratchDir scratch("extract");
+    uint64_t total = writeArchive("archive.zip", fileCount, fileSize, solid);
+
+    for (auto _ : state) {
+        ArchiveReader reader("archive.zip");
+        reader.extractAll("out", true);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * total));
+}
+
+// Many small files, with and without solid blocks, and a few large ones
+static void archiveTrees(benchmark::internal::Benchmark* bench) {
+    bench->Args({1000, 4 << 10, 0})
+         ->Args({1000, 4 << 10, 1})
+         ->Args({16, 4 << 20, 0})
+         ->ArgNames({"files", "size", "solid"})
+         ->Unit(benchmark::kMillisecond)
+         ->UseRealTime();  // Solid workers run on other threads
+}
+BENCHMARK(BM_WriteArchive)->Apply(archiveTrees);
+BENCHMARK(BM_ExtractArchive)->Apply(archiveTrees);
+
+} // namespace bench
+} // namespace miniwr
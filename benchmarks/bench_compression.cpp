@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+#include "BenchData.h"
+#include "../src/core/DeflateCompressor.h"
+#include <zlib.h>
+
+namespace miniwr {
+namespace bench {
+
+namespace {
+    constexpr size_t INPUT_SIZE = 1024 * 1024;
+
+    void describe(benchmark::State& state, InputClass inputClass,
+                  size_t inputSize, size_t compressedSize) {
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * inputSize));
+        state.SetLabel(inputClassName(inputClass));
+        state.counters["ratio"] = static_cast<double>(compressedSize) / static_cast<double>(inputSize);
+    }
+}
+
+// Args: input class, zlib level (0-9)
+static void BM_Compress(benchmark::State& state) {
+    auto inputClass = static_cast<InputClass>(state.range(0));
+    auto level = static_cast<CompressionLevel>(state.range(1));
+    auto input = generateInput(inputClass, INPUT_SIZE);
+
+    DeflateCompressor compressor;
+    Buffer output;
+    for (auto _ : state) {
+        compressor.compress(input, output, level);
+        benchmark::DoNotOptimize(output.data());
+    }
+
+    describe(state, inputClass, input.size(), output.size());
+}
+BENCHMARK(BM_Compress)
+    ->ArgsProduct({benchmark::CreateDenseRange(0, INPUT_CLASS_COUNT - 1, 1),
+                   benchmark::CreateDenseRange(0, 9, 1)})
+    ->ArgNames({"class", "level"})
+    ->Unit(benchmark::kMillisecond);
+
+// Args: input class, zlib level the input was compressed with; throughput
+// is measured on the uncompressed size
+static void BM_Decompress(benchmark::State& state) {
+    auto inputClass = static_cast<InputClass>(state.range(0));
+    auto level = static_cast<CompressionLevel>(state.range(1));
+    auto input = generateInput(inputClass, INPUT_SIZE);
+
+    DeflateCompressor compressor;
+    Buffer compressed;
+    compressor.compress(input, compressed, level);
+
+    Buffer output;
+    for (auto _ : state) {
+        compressor.decompress(compressed, output, input.size());
+        benchmark::DoNotOptimize(output.data());
+    }
+
+    describe(state, inputClass, input.size(), compressed.size());
+}
+BENCHMARK(BM_Decompress)
+    ->ArgsProduct({benchmark::CreateDenseRange(0, INPUT_CLASS_COUNT - 1, 1),
+                   benchmark::CreateDenseRange(0, 9, 1)})
+    ->ArgNames({"class", "level"})
+    ->Unit(benchmark::kMillisecond);
+
+// Arg: buffer size
+static void BM_Crc32(benchmark::State& state) {
+    auto input = generateInput(InputClass::Binary, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(crc32(0L, input.data(), static_cast<uInt>(input.size())));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK(BM_Crc32)->RangeMultiplier(8)->Range(4 << 10, 64 << 20);
+
+} // namespace bench
+} // namespace miniwr
@@ -7,23 +7,104 @@ namespace miniwr {
 
 namespace {
     constexpr const char* VERSION = "1.0.0";
+    constexpr size_t DEFAULT_SOLID_BLOCK_SIZE = 16 * 1024 * 1024;
+    constexpr size_t MAX_SOLID_BLOCK_SIZE = 1024 * 1024 * 1024;
+    constexpr size_t MIN_MEMORY_LIMIT = 4 * 1024 * 1024;
     constexpr const char* USAGE = R"(MiniWinRAR - Simple compression utility
 
 Usage:
     miniwr a <archive.zip> <file|folder> [file2 ...] [-m0..9] [--threads N]
-    miniwr x <archive.zip> [-C <dir_out>] [--force]
+             [--solid] [--solid-block SIZE] [--train-dict] [--dict-size SIZE]
+             [--base <base.zip>] [--memory-limit SIZE] [--huge-pages]
+             [--stats] [--stats-json FILE] [--trace FILE] [--progress MODE]
+             [--io BACKEND] [--drop-cache] [--sparse] [--pin-threads]
+             [--out-of-order]
+    miniwr x <archive.zip> [-C <dir_out>] [--force | --update | --freshen]
+             [--threads N] [--base <base.zip>] [--memory-limit SIZE] [--huge-pages] [--stats]
+             [--stats-json FILE] [--trace FILE] [--progress MODE] [--io BACKEND]
+             [--drop-cache] [--sparse]
+    miniwr t <archive.zip> [--threads N] [--base <base.zip>] [--memory-limit SIZE]
+             [--progress MODE] [--drop-cache] [--pin-threads]
+    miniwr l <archive.zip> [pattern ...] [--json]
+    miniwr d <archive.zip> <pattern> [pattern ...]
+    miniwr merge <out.zip> <in1.zip> <in2.zip> [...] [--duplicates POLICY]
+             [--stats] [--progress MODE] [--drop-cache]
+    miniwr recompress <archive.zip> [-m0..9] [--threads N] [--min-size SIZE]
+             [--min-ratio PERCENT] [--memory-limit SIZE] [--stats] [--progress MODE]
     miniwr --help
     miniwr --version
 
 Commands:
     a     Add files/folders to archive
     x     Extract archive contents
+    t     Test archive integrity without extracting
+    l     List archive contents with sizes, ratio, method, CRC, date and mode
+    d     Delete matching entries and compact the archive in place
+    merge Combine archives into one without recompressing their entries
+    recompress
+          Recompress the entries that gain from it (default: -m9) and copy
+          the others as they are
 
 Options:
     -m0..9        Set compression level (0=store, 9=max)
     -C <dir>      Extract to specified directory
     --force       Overwrite existing files without asking
-    --threads N   Use N threads for compression (default: 1)
+    --update      Extract new files and files that changed; files whose size
+                  and time (or else CRC) match the archive are left alone
+    --freshen     Like --update, but never create files that do not exist
+    --base <zip>  Delta mode: store (a) or expand (x, t) files against the
+                  same files in a previous archive
+    --threads N   Run up to N compression, extraction or test tasks at once,
+                  at most one per CPU (default: 1); x only extracts side by
+                  side with --force, --update or --freshen
+    --pin-threads Pin the worker threads to CPUs, filling one NUMA node
+                  before the next
+    --out-of-order
+                  Compress files on --threads tasks and write each one as soon
+                  as it is done, not in input order (a); listings stay sorted
+                  by name
+    --solid       Pack small files into shared solid blocks
+    --solid-block SIZE
+                  Solid block size, e.g. 4M or 64M (default: 16M, implies --solid)
+    --train-dict  Train a shared preset dictionary from the input files
+    --dict-size SIZE
+                  Dictionary size, at most 32K (default: 32K, implies --train-dict)
+    --memory-limit SIZE
+                  Hard cap on buffer memory, e.g. 512M; larger entries are
+                  streamed (minimum: 4M)
+    --huge-pages  Back large buffers with transparent huge pages
+    --stats       Print per-phase timings, throughput, thread utilization,
+                  compression ratios, slowest entries and peak RSS
+    --stats-json FILE
+                  Write the same report as JSON
+    --trace FILE  Record every pipeline step per thread and write it in
+                  Chrome Trace Event format (chrome://tracing, Perfetto)
+    --progress MODE
+                  bar: progress bar with throughput and ETA (default on a
+                  terminal), json: one JSON object per line on stderr,
+                  none: no progress output
+    --io BACKEND  Batch the opens, stats, reads, writes and closes of small
+                  files, 64 at a time. uring: io_uring (threads where the
+                  kernel lacks it), threads: blocking calls on a thread pool,
+                  sync: one file after another (default)
+    --drop-cache  Keep the job from filling the page cache: files of 16M and
+                  more bypass it with O_DIRECT, everything else is dropped
+                  from it once read or written
+    --sparse      a: leave the zero blocks of files of 1M and more out of the
+                  archive and record them as holes; x: also write the zero
+                  blocks of other files as holes
+    --json        List as JSON
+    --duplicates POLICY
+                  Names found more than once in the merged archives. error:
+                  refuse to merge (default), first: keep the earliest, last:
+                  keep the latest
+    --min-size SIZE
+                  Only recompress entries of at least SIZE, e.g. 64K
+    --min-ratio PERCENT
+                  Only recompress entries whose packed size is at least
+                  PERCENT of their size, e.g. 60 (as listed by l)
+    pattern       Only list (l) or delete (d) entries matching a glob, e.g.
+                  '*.txt' or 'src/*'
     --help        Show this help message
     --version     Show version information
 )";
@@ -57,33 +138,128 @@ Arguments ArgParser::parse(int argc, char* argv[]) {
     args.archivePath = argv[2];
 
     // Parse remaining arguments
+    bool levelGiven = false;
     for (int i = 3; i < argc; ++i) {
         std::string arg = argv[i];
 
         if (arg.starts_with("-m")) {
             args.compressionLevel = parseCompressionLevel(arg.substr(2));
+            levelGiven = true;
         }
         else if (arg == "-C" && i + 1 < argc) {
             args.outputDir = argv[++i];
         }
+        else if (arg == "--memory-limit" && i + 1 < argc) {
+            args.memoryLimit = parseSize(argv[++i]);
+            if (args.memoryLimit < MIN_MEMORY_LIMIT) {
+                throw std::runtime_error("Memory limit must be at least 4M");
+            }
+        }
+        else if (arg == "--huge-pages") {
+            args.hugePages = true;
+        }
+        else if (arg == "--sparse") {
+            args.sparse = true;
+        }
+        else if (arg == "--drop-cache") {
+            args.dropCache = true;
+        }
+        else if (arg == "--stats") {
+            args.stats = true;
+        }
+        else if (arg == "--stats-json" && i + 1 < argc) {
+            args.statsJsonPath = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            args.tracePath = argv[++i];
+        }
+        else if (arg == "--progress" && i + 1 < argc) {
+            args.progress = parseProgressMode(argv[++i]);
+        }
+        else if (arg == "--io" && i + 1 < argc) {
+            args.io = parseIoBackend(argv[++i]);
+        }
+        else if (arg == "--base" && i + 1 < argc) {
+            args.basePath = argv[++i];
+        }
+        else if (arg == "--duplicates" && i + 1 < argc) {
+            args.duplicates = parseDuplicatePolicy(argv[++i]);
+        }
+        else if (arg == "--min-size" && i + 1 < argc) {
+            args.minSize = parseSize(argv[++i]);
+        }
+        else if (arg == "--min-ratio" && i + 1 < argc) {
+            args.minRatio = parsePercentage(argv[++i]);
+        }
+        else if (arg == "--json") {
+            args.json = true;
+        }
         else if (arg == "--force") {
             args.force = true;
         }
+        else if (arg == "--update") {
+            args.update = true;
+        }
+        else if (arg == "--freshen") {
+            args.freshen = true;
+        }
         else if (arg == "--threads" && i + 1 < argc) {
             args.numThreads = std::stoi(argv[++i]);
             if (args.numThreads < 1) {
                 throw std::runtime_error("Number of threads must be >= 1");
             }
         }
-        else if (args.command == Command::Add) {
+        else if (arg == "--pin-threads") {
+            args.pinThreads = true;
+        }
+        else if (arg == "--out-of-order") {
+            args.outOfOrder = true;
+        }
+        else if (arg == "--solid") {
+            if (args.solidBlockSize == 0) {
+                args.solidBlockSize = DEFAULT_SOLID_BLOCK_SIZE;
+            }
+        }
+        else if (arg == "--solid-block" && i + 1 < argc) {
+            args.solidBlockSize = parseSize(argv[++i]);
+            if (args.solidBlockSize == 0 || args.solidBlockSize > MAX_SOLID_BLOCK_SIZE) {
+                throw std::runtime_error("Solid block size must be between 1 and 1G");
+            }
+        }
+        else if (arg == "--train-dict") {
+            args.trainDictionary = true;
+        }
+        else if (arg == "--dict-size" && i + 1 < argc) {
+            args.dictionarySize = parseSize(argv[++i]);
+            args.trainDictionary = true;
+            if (args.dictionarySize == 0 || args.dictionarySize > 32 * 1024) {
+                throw std::runtime_error("Dictionary size must be between 1 and 32K");
+            }
+        }
+        else if (args.command == Command::Add || args.command == Command::Merge) {
             args.inputPaths.push_back(arg);
         }
+        else if (args.command == Command::List || args.command == Command::Delete) {
+            args.patterns.push_back(arg);
+        }
     }
 
     // Validate arguments
     if (args.command == Command::Add && args.inputPaths.empty()) {
         throw std::runtime_error("No input files specified");
     }
+    if (args.command == Command::Delete && args.patterns.empty()) {
+        throw std::runtime_error("No entries to delete specified");
+    }
+    if (args.command == Command::Merge && args.inputPaths.empty()) {
+        throw std::runtime_error("No input archives specified");
+    }
+    if (args.command == Command::Recompress && !levelGiven) {
+        args.compressionLevel = CompressionLevel::Maximum;
+    }
+    if (args.update && args.freshen) {
+        throw std::runtime_error("--update and --freshen cannot be combined");
+    }
 
     return args;
 }
@@ -99,6 +275,11 @@ void ArgParser::printVersion() {
 Command ArgParser::parseCommand(const std::string& cmd) {
     if (cmd == "a") return Command::Add;
     if (cmd == "x") return Command::Extract;
+    if (cmd == "t") return Command::Test;
+    if (cmd == "l") return Command::List;
+    if (cmd == "d") return Command::Delete;
+    if (cmd == "merge") return Command::Merge;
+    if (cmd == "recompress") return Command::Recompress;
     return Command::Invalid;
 }
 
@@ -117,4 +298,58 @@ CompressionLevel ArgParser::parseCompressionLevel(const std::string& level) {
         throw std::runtime_error("Invalid compression level: " + level);
     }
 }
-} 
\ No newline at end of file
+
+size_t ArgParser::parseSize(const std::string& size) {
+    size_t consumed = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull(size, &consumed);
+    }
+    catch (const std::exception&) {
+        throw std::runtime_error("Invalid size: " + size);
+    }
+
+    std::string suffix = size.substr(consumed);
+    if (suffix.empty() || suffix == "B") return value;
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    throw std::runtime_error("Invalid size suffix: " + size);
+}
+
+double ArgParser::parsePercentage(const std::string& percentage) {
+    size_t consumed = 0;
+    double value = 0;
+    try {
+        value = std::stod(percentage, &consumed);
+    }
+    catch (const std::exception&) {
+        throw std::runtime_error("Invalid percentage: " + percentage);
+    }
+    if (consumed != percentage.size() || value < 0 || value > 100) {
+        throw std::runtime_error("Percentage must be between 0 and 100: " + percentage);
+    }
+    return value;
+}
+
+ProgressMode ArgParser::parseProgressMode(const std::string& mode) {
+    if (mode == "bar") return ProgressMode::Bar;
+    if (mode == "json") return ProgressMode::Json;
+    if (mode == "none") return ProgressMode::None;
+    throw std::runtime_error("Invalid progress mode: " + mode);
+}
+
+std::optional<IoBackend> ArgParser::parseIoBackend(const std::string& backend) {
+    if (backend == "uring") return IoBackend::Uring;
+    if (backend == "threads") return IoBackend::Threads;
+    if (backend == "sync") return std::nullopt;
+    throw std::runtime_error("Invalid I/O backend: " + backend);
+}
+
+DuplicatePolicy ArgParser::parseDuplicatePolicy(const std::string& policy) {
+    if (policy == "error") return DuplicatePolicy::Error;
+    if (policy == "first") return DuplicatePolicy::First;
+    if (policy == "last") return DuplicatePolicy::Last;
+    throw std::runtime_error("Invalid duplicate policy: " + policy);
+}
+}
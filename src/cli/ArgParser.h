@@ -1,7 +1,11 @@
 #pragma once
 
 #include "../core/Compressor.h"
+#include "../core/Merge.h"
+#include "../util/IoEngine.h"
+#include "../util/ProgressBar.h"
 #include <filesystem>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -13,6 +17,11 @@ namespace miniwr {
 enum class Command {
     Add,
     Extract,
+    Test,
+    List,
+    Merge,
+    Delete,
+    Recompress,
     Help,
     Version,
     Invalid
@@ -26,9 +35,31 @@ struct Arguments {
     std::filesystem::path archivePath;
     std::vector<std::filesystem::path> inputPaths;
     std::filesystem::path outputDir;
+    std::filesystem::path basePath;  ///< Base archive for delta mode
     CompressionLevel compressionLevel = CompressionLevel::Default;
     bool force = false;
+    bool update = false;    ///< Extract new and changed files only
+    bool freshen = false;   ///< Extract changed files that already exist only
     int numThreads = 1;
+    bool pinThreads = false;    ///< Pin scheduler workers to CPUs, node by node
+    bool outOfOrder = false;    ///< Write entries as they finish compressing
+    size_t solidBlockSize = 0;  ///< 0 = solid mode disabled
+    bool trainDictionary = false;
+    size_t dictionarySize = 32 * 1024;
+    size_t memoryLimit = 0;     ///< 0 = unlimited
+    bool hugePages = false;
+    bool dropCache = false;              ///< Keep file data out of the page cache
+    bool sparse = false;                 ///< Record (a) or write (x) zero blocks as holes
+    bool stats = false;                  ///< Print a per-phase timing report
+    std::filesystem::path statsJsonPath; ///< Write the report as JSON
+    std::filesystem::path tracePath;     ///< Write a Chrome trace of the job
+    ProgressMode progress = ProgressMode::Auto;
+    std::optional<IoBackend> io;         ///< Batched file I/O (unset = file by file)
+    std::vector<std::string> patterns;   ///< Glob filters for listing and deletion
+    bool json = false;                   ///< List as JSON
+    DuplicatePolicy duplicates = DuplicatePolicy::Error;  ///< Names found in several merged archives
+    uint64_t minSize = 0;                ///< Recompress entries of at least this size only
+    double minRatio = 0.0;               ///< Recompress entries packed to at least this percentage only
 };
 
 /**
@@ -57,4 +88,10 @@ public:
 private:
     static Command parseCommand(const std::string& cmd);
     static CompressionLevel parseCompressionLevel(const std::string& level);
-}; 
\ No newline at end of file
+    static size_t parseSize(const std::string& size);
+    static double parsePercentage(const std::string& percentage);
+    static ProgressMode parseProgressMode(const std::string& mode);
+    static std::optional<IoBackend> parseIoBackend(const std::string& backend);
+    static DuplicatePolicy parseDuplicatePolicy(const std::string& policy);
+};
+}
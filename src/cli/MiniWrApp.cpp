@@ -1,8 +1,23 @@
 #include "MiniWrApp.h"
-#include <iostream>
+#include "../core/Compaction.h"
+#include "../core/Dictionary.h"
+#include "../core/Merge.h"
+#include "../core/Recompress.h"
+#include "../util/FileSystem.h"
+#include "../util/Json.h"
+#include "../util/Scheduler.h"
+#include "../util/Trace.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <fstream>
 #include <iomanip>
+#include <iostream>
 #include <chrono>
+#include <sstream>
 #include <thread>
+#include <unistd.h>
+#include <utility>
 
 namespace miniwr {
 
@@ -14,20 +29,125 @@ namespace {
         CompressionError = 3,
         DecompressionError = 4
     };
+
+    const char* storageName(EntryStorage storage) {
+        switch (storage) {
+            case EntryStorage::Stored: return "store";
+            case EntryStorage::Deflated: return "deflate";
+            case EntryStorage::Solid: return "solid";
+            case EntryStorage::Delta: return "delta";
+            case EntryStorage::Sparse: return "sparse";
+        }
+        return "unknown";
+    }
+
+    // DOS date and time, as "YYYY-MM-DD HH:MM:SS"
+    std::string formatModified(const ZipEntry& entry) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d",
+                      1980 + (entry.modificationDate >> 9), (entry.modificationDate >> 5) & 0x0F,
+                      entry.modificationDate & 0x1F, entry.modificationTime >> 11,
+                      (entry.modificationTime >> 5) & 0x3F, (entry.modificationTime & 0x1F) * 2);
+        return text;
+    }
+
+    // POSIX mode from the high 16 bits of the external attributes, as "-rw-r--r--"
+    std::string formatMode(const ZipEntry& entry) {
+        uint32_t mode = entry.externalAttrs >> 16;
+        std::string text = (mode & 0170000) == 0040000 ? "d" : "-";
+        const char* flags = "rwxrwxrwx";
+        for (int bit = 0; bit < 9; ++bit) {
+            text += (mode & (0400 >> bit)) ? flags[bit] : '-';
+        }
+        return text;
+    }
+
+    std::string formatRatio(uint64_t compressed, uint64_t original) {
+        if (original == 0) {
+            return "-";
+        }
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1)
+             << 100.0 * static_cast<double>(compressed) / static_cast<double>(original) << "%";
+        return text.str();
+    }
+
+    // Shell globs where `*` also matches `/`
+    bool matchesAny(const std::vector<std::string>& patterns, const std::string& name) {
+        return std::any_of(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+            return fnmatch(pattern.c_str(), name.c_str(), 0) == 0;
+        });
+    }
+
+    // Flush a file to disk before it replaces another one
+    void syncFile(const std::filesystem::path& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open " + path.string());
+        }
+        int result = ::fsync(fd);
+        ::close(fd);
+        if (result != 0) {
+            throw std::runtime_error("Failed to sync " + path.string());
+        }
+    }
 }
 
 int MiniWrApp::run(int argc, char* argv[]) {
     try {
         Arguments args = ArgParser::parse(argc, argv);
+        configureBuffers(args);
+        if (args.pinThreads) {
+            SchedulerOptions options;
+            options.pinThreads = true;
+            Scheduler::configure(options);
+        }
+
+        if (!args.tracePath.empty()) {
+            Trace::start();
+            Trace::nameThread("main");
+        }
+
+        // A compaction cut short by a crash is completed before anything
+        // else reads the archive
+        if (args.command != Command::Add && args.command != Command::Merge &&
+            Compaction::recover(args.archivePath)) {
+            std::cout << "Completed the interrupted compaction of " << args.archivePath.string()
+                      << std::endl;
+        }
 
+        int result;
         switch (args.command) {
             case Command::Add:
-                return handleAdd(args);
+                result = handleAdd(args);
+                break;
             case Command::Extract:
-                return handleExtract(args);
+                result = handleExtract(args);
+                break;
+            case Command::Test:
+                result = handleTest(args);
+                break;
+            case Command::List:
+                result = handleList(args);
+                break;
+            case Command::Merge:
+                result = handleMerge(args);
+                break;
+            case Command::Delete:
+                result = handleDelete(args);
+                break;
+            case Command::Recompress:
+                result = handleRecompress(args);
+                break;
             default:
                 throw std::runtime_error("Invalid command");
         }
+
+        // Failed jobs are traced too; the trace shows how far they got
+        if (!args.tracePath.empty()) {
+            writeTrace(args.tracePath);
+        }
+        return result;
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -37,43 +157,59 @@ int MiniWrApp::run(int argc, char* argv[]) {
 
 int MiniWrApp::handleAdd(const Arguments& args) {
     try {
+        auto stats = createStats(args);
         ArchiveWriter writer(args.archivePath);
+        writer.setSolidMode(args.solidBlockSize, static_cast<unsigned>(args.numThreads));
+        writer.setCommitOrder(args.outOfOrder ? CommitOrder::Completion : CommitOrder::Input,
+                              static_cast<unsigned>(args.numThreads));
+        auto budget = createMemoryBudget(args);
+        writer.setMemoryBudget(budget);
+        writer.setIoEngine(createIoEngine(args, budget));
+        writer.setSparse(args.sparse);
+        writer.setStats(stats);
+        if (!args.basePath.empty()) {
+            // The writer accounts for reading base versions itself
+            writer.setDeltaBase(std::make_shared<ArchiveReader>(args.basePath));
+        }
 
-        size_t totalFiles = 0;
-        size_t processedFiles = 0;
-
-        // Count total files first
+        // Collect input files first
+        std::vector<std::filesystem::path> files;
+        uint64_t totalBytes = 0;
+        PhaseTimer scanTimer(stats.get(), Phase::Scan);
         for (const auto& path : args.inputPaths) {
             if (std::filesystem::is_directory(path)) {
                 for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
-                    if (std::filesystem::is_regular_file(entry)) {
-                        ++totalFiles;
+                    if (entry.is_regular_file()) {
+                        files.push_back(entry.path());
+                        totalBytes += entry.file_size();
                     }
                 }
             }
             else if (std::filesystem::is_regular_file(path)) {
-                ++totalFiles;
+                files.push_back(path);
+                totalBytes += std::filesystem::file_size(path);
             }
         }
+        scanTimer.stop();
 
-        // Process files
-        for (const auto& path : args.inputPaths) {
-            if (std::filesystem::is_directory(path)) {
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
-                    if (std::filesystem::is_regular_file(entry)) {
-                        showProgress("Compressing", ++processedFiles, totalFiles);
-                        writer.addFile(entry.path(), args.compressionLevel);
-                    }
-                }
-            }
-            else if (std::filesystem::is_regular_file(path)) {
-                showProgress("Compressing", ++processedFiles, totalFiles);
-                writer.addFile(path, args.compressionLevel);
-            }
+        if (args.trainDictionary && args.compressionLevel != CompressionLevel::Store) {
+            auto dictionary = trainDictionary(files, args.dictionarySize, budget);
+            std::cout << "Trained " << dictionary.size() << " byte dictionary" << std::endl;
+            writer.setDictionary(std::move(dictionary));
         }
 
+        // Solid blocks are compressed on close(), so progress runs until then
+        auto progress = std::make_shared<ProgressBar>("Compressing", totalBytes, files.size(),
+                                                      args.progress);
+        writer.setProgress(progress);
+        writer.addFiles(files, args.compressionLevel);
+
         writer.close();
-        std::cout << "\nDone. " << processedFiles << " files compressed." << std::endl;
+        progress->finish();
+        std::cout << "\nDone. " << files.size() << " files compressed." << std::endl;
+        if (stats) {
+            reportStats(args, *stats);
+        }
         return Success;
     }
     catch (const std::exception& e) {
@@ -84,17 +220,43 @@ int MiniWrApp::handleAdd(const Arguments& args) {
 
 int MiniWrApp::handleExtract(const Arguments& args) {
     try {
+        auto stats = createStats(args);
         ArchiveReader reader(args.archivePath);
+        auto budget = createMemoryBudget(args);
+        reader.setMemoryBudget(budget);
+        reader.setIoEngine(createIoEngine(args, budget));
+        reader.setSparse(args.sparse);
+        reader.setStats(stats);
+        reader.setThreads(static_cast<unsigned>(args.numThreads));
+        if (args.update) {
+            reader.setExtractMode(ExtractMode::Update);
+        } else if (args.freshen) {
+            reader.setExtractMode(ExtractMode::Freshen);
+        }
+        if (!args.basePath.empty()) {
+            reader.setDeltaBase(std::make_shared<ArchiveReader>(args.basePath));
+        }
         auto outputDir = args.outputDir.empty() ? std::filesystem::current_path() : args.outputDir;
 
         auto files = reader.listFiles();
         size_t totalFiles = files.size();
-        size_t processedFiles = 0;
 
         std::cout << "Extracting " << totalFiles << " files to " << outputDir << std::endl;
+        auto progress = std::make_shared<ProgressBar>("Extracting", reader.totalSize(), totalFiles,
+                                                      args.progress);
+        reader.setProgress(progress);
         reader.extractAll(outputDir, args.force);
+        progress->finish();
 
-        std::cout << "\nDone. " << totalFiles << " files extracted." << std::endl;
+        if (args.update || args.freshen) {
+            std::cout << "\nDone. " << totalFiles - reader.skippedFiles() << " files extracted, "
+                      << reader.skippedFiles() << " unchanged or absent files skipped." << std::endl;
+        } else {
+            std::cout << "\nDone. " << totalFiles << " files extracted." << std::endl;
+        }
+        if (stats) {
+            reportStats(args, *stats);
+        }
         return Success;
     }
     catch (const std::exception& e) {
@@ -103,25 +265,291 @@ int MiniWrApp::handleExtract(const Arguments& args) {
     }
 }
 
-void MiniWrApp::showProgress(const std::string& operation,
-                           size_t current,
-                           size_t total) {
-    const int barWidth = 50;
-    float progress = static_cast<float>(current) / total;
-    int pos = static_cast<int>(barWidth * progress);
+int MiniWrApp::handleTest(const Arguments& args) {
+    try {
+        ArchiveReader reader(args.archivePath);
+        reader.setMemoryBudget(createMemoryBudget(args));
+        if (!args.basePath.empty()) {
+            reader.setDeltaBase(std::make_shared<ArchiveReader>(args.basePath));
+        }
+
+        auto files = reader.listFiles();
+        std::cout << "Testing " << files.size() << " files in " << args.archivePath << std::endl;
+        auto progress = std::make_shared<ProgressBar>("Testing", reader.totalSize(), files.size(),
+                                                      args.progress);
+        reader.setProgress(progress);
+        auto report = reader.test(static_cast<unsigned>(args.numThreads));
+        progress->finish();
 
-    std::cout << "\r" << operation << ": [";
-    for (int i = 0; i < barWidth; ++i) {
-        if (i < pos) std::cout << "=";
-        else if (i == pos) std::cout << ">";
-        else std::cout << " ";
+        for (const auto& error : report.errors) {
+            std::cerr << "FAILED " << error << std::endl;
+        }
+        if (!report.ok()) {
+            std::cout << "\n" << report.errors.size() << " errors in " << report.entries
+                      << " files." << std::endl;
+            return DecompressionError;
+        }
+        std::cout << "\nDone. " << report.entries << " files OK." << std::endl;
+        return Success;
     }
-    std::cout << "] " << std::fixed << std::setprecision(1)
-              << (progress * 100.0) << "% (" << current << "/" << total << ")"
-              << std::flush;
+    catch (const std::exception& e) {
+        std::cerr << "Test error: " << e.what() << std::endl;
+        return DecompressionError;
+    }
+}
+
+int MiniWrApp::handleList(const Arguments& args) {
+    try {
+        ArchiveReader reader(args.archivePath);
+
+        std::vector<const ZipEntry*> entries;
+        for (const auto& entry : reader.entries()) {
+            if (args.patterns.empty() || matchesAny(args.patterns, entry.filename)) {
+                entries.push_back(&entry);
+            }
+        }
+
+        uint64_t totalSize = 0;
+        uint64_t totalCompressed = 0;
+        for (const auto* entry : entries) {
+            totalSize += reader.fileSize(*entry);
+            totalCompressed += entry->compressedSize;
+        }
 
-    if (current == total) {
-        std::cout << std::endl;
+        if (args.json) {
+            std::cout << "{\n  \"archive\": ";
+            writeJsonString(std::cout, args.archivePath.string());
+            std::cout << ",\n  \"entries\": [";
+            for (size_t i = 0; i < entries.size(); ++i) {
+                const auto& entry = *entries[i];
+                std::cout << (i > 0 ? ",\n    " : "\n    ") << "{\"name\": ";
+                writeJsonString(std::cout, entry.filename);
+                std::cout << ", \"size\": " << reader.fileSize(entry)
+                          << ", \"compressed\": " << entry.compressedSize
+                          << ", \"method\": \"" << storageName(reader.storage(entry)) << "\""
+                          << ", \"crc32\": \"" << std::hex << std::setw(8) << std::setfill('0')
+                          << entry.crc32 << std::dec << std::setfill(' ') << "\""
+                          << ", \"modified\": \"" << formatModified(entry) << "\""
+                          << ", \"mode\": \"" << formatMode(entry) << "\"}";
+            }
+            std::cout << "\n  ],\n  \"totals\": {\"files\": " << entries.size()
+                      << ", \"size\": " << totalSize
+                      << ", \"compressed\": " << totalCompressed << "}\n}" << std::endl;
+            return Success;
+        }
+
+        std::cout << "      Size    Packed   Ratio  Method   CRC32     Modified             Mode        Name\n"
+                  << "----------  --------  ------  -------  --------  -------------------  ----------  ----\n";
+        for (const auto* entry : entries) {
+            uint64_t size = reader.fileSize(*entry);
+            std::cout << std::setw(10) << size << "  "
+                      << std::setw(8) << entry->compressedSize << "  "
+                      << std::setw(6) << formatRatio(entry->compressedSize, size) << "  "
+                      << std::left << std::setw(7) << storageName(reader.storage(*entry)) << std::right << "  "
+                      << std::hex << std::setw(8) << std::setfill('0') << entry->crc32
+                      << std::dec << std::setfill(' ') << "  "
+                      << formatModified(*entry) << "  " << formatMode(*entry) << "  "
+                      << entry->filename << "\n";
+        }
+        std::cout << "----------  --------  ------" << std::string(54, ' ') << "----\n"
+                  << std::setw(10) << totalSize << "  " << std::setw(8) << totalCompressed << "  "
+                  << std::setw(6) << formatRatio(totalCompressed, totalSize) << std::string(52, ' ')
+                  << entries.size() << " files" << std::endl;
+        return Success;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "List error: " << e.what() << std::endl;
+        return FileError;
+    }
+}
+
+int MiniWrApp::handleMerge(const Arguments& args) {
+    try {
+        auto stats = createStats(args);
+
+        // Inputs are opened first; the output must not truncate one of them
+        std::vector<std::shared_ptr<ArchiveReader>> inputs;
+        uint64_t totalBytes = 0;
+        uint64_t totalFiles = 0;
+        for (const auto& path : args.inputPaths) {
+            if (std::filesystem::exists(args.archivePath) &&
+                std::filesystem::equivalent(path, args.archivePath)) {
+                throw std::runtime_error("Output archive is also an input: " + path.string());
+            }
+            auto reader = std::make_shared<ArchiveReader>(path);
+            totalBytes += reader->totalSize();
+            totalFiles += reader->listFiles().size();
+            inputs.push_back(std::move(reader));
+        }
+
+        auto progress = std::make_shared<ProgressBar>("Merging", totalBytes, totalFiles,
+                                                      args.progress);
+        MergeReport report;
+        try {
+            ArchiveWriter writer(args.archivePath);
+            writer.setStats(stats);
+            writer.setProgress(progress);
+            report = mergeArchives(writer, inputs, args.duplicates);
+            writer.close();
+        } catch (...) {
+            // No half-merged archive is left behind
+            std::filesystem::remove(args.archivePath);
+            throw;
+        }
+        progress->finish();
+        std::cout << "\nDone. " << report.entries << " files merged from " << inputs.size()
+                  << " archives";
+        if (report.duplicates > 0) {
+            std::cout << ", " << report.duplicates << " duplicates skipped";
+        }
+        std::cout << "." << std::endl;
+        if (stats) {
+            reportStats(args, *stats);
+        }
+        return Success;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Merge error: " << e.what() << std::endl;
+        return CompressionError;
+    }
+}
+
+int MiniWrApp::handleDelete(const Arguments& args) {
+    try {
+        Compaction compaction(args.archivePath, [&](const ZipEntry& entry) {
+            return matchesAny(args.patterns, entry.filename);
+        });
+        if (compaction.removedEntries() == 0) {
+            std::cout << "No files matched." << std::endl;
+            return Success;
+        }
+
+        compaction.finish();
+        std::cout << "Done. " << compaction.removedEntries() << " files deleted, archive shrank from "
+                  << compaction.originalSize() << " to " << compaction.compactedSize() << " bytes."
+                  << std::endl;
+        return Success;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Delete error: " << e.what() << std::endl;
+        return FileError;
+    }
+}
+
+int MiniWrApp::handleRecompress(const Arguments& args) {
+    // The new archive replaces the old one only once it is complete
+    std::filesystem::path tempPath = args.archivePath.string() + ".recompress";
+    try {
+        auto stats = createStats(args);
+        ArchiveReader reader(args.archivePath);
+
+        RecompressOptions options;
+        options.memoryBudget = createMemoryBudget(args);
+        options.level = args.compressionLevel;
+        options.minSize = args.minSize;
+        options.minRatio = args.minRatio / 100.0;
+        options.threads = static_cast<unsigned>(args.numThreads);
+
+        auto progress = std::make_shared<ProgressBar>("Recompressing", reader.totalSize(),
+                                                      reader.listFiles().size(), args.progress);
+        RecompressReport report;
+        try {
+            ArchiveWriter writer(tempPath);
+            writer.setStats(stats);
+            writer.setProgress(progress);
+            report = recompressArchive(writer, reader, options);
+            writer.close();
+        } catch (...) {
+            std::filesystem::remove(tempPath);
+            throw;
+        }
+        progress->finish();
+
+        for (const auto& entry : report.recompressed) {
+            std::cout << "  " << entry.name << ": " << entry.originalSize << " -> " << entry.newSize
+                      << " bytes (" << formatRatio(entry.newSize, entry.originalSize) << ")"
+                      << std::endl;
+        }
+        if (report.recompressed.empty()) {
+            std::filesystem::remove(tempPath);
+            std::cout << "\nNothing to gain; " << args.archivePath.string() << " is unchanged."
+                      << std::endl;
+        } else {
+            syncFile(tempPath);
+            std::filesystem::rename(tempPath, args.archivePath);
+            int64_t saved = report.savedBytes();
+            std::cout << "\nDone. " << report.recompressed.size() << " files recompressed, "
+                      << report.copied << " copied, "
+                      << (saved >= 0 ? saved : -saved) << (saved >= 0 ? " bytes saved." : " bytes added.")
+                      << std::endl;
+        }
+        if (stats) {
+            reportStats(args, *stats);
+        }
+        return Success;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Recompress error: " << e.what() << std::endl;
+        return CompressionError;
+    }
+}
+
+void MiniWrApp::configureBuffers(const Arguments& args) {
+    auto& pool = BufferPool::instance();
+    pool.setHugePages(args.hugePages);
+    setCachePolicy(args.dropCache ? CachePolicy::DropBehind : CachePolicy::Default);
+
+    // Set before anything is allocated, so idle buffers count from the start
+    pool.setMemoryLimit(args.memoryLimit);
+}
+
+std::shared_ptr<MemoryBudget> MiniWrApp::createMemoryBudget(const Arguments& args) {
+    if (args.memoryLimit == 0) {
+        return nullptr;
+    }
+    return std::make_shared<MemoryBudget>(args.memoryLimit);
+}
+
+std::shared_ptr<IoEngine> MiniWrApp::createIoEngine(const Arguments& args,
+                                                    std::shared_ptr<MemoryBudget> budget) {
+    if (!args.io) {
+        return nullptr;
+    }
+    // Its batch slots come out of the same budget as the entries
+    return IoEngine::create(*args.io, 0, std::move(budget));
+}
+
+std::shared_ptr<Stats> MiniWrApp::createStats(const Arguments& args) {
+    if (!args.stats && args.statsJsonPath.empty()) {
+        return nullptr;
+    }
+    return std::make_shared<Stats>();
+}
+
+void MiniWrApp::reportStats(const Arguments& args, Stats& stats) {
+    stats.finish();
+    if (args.stats) {
+        stats.printReport(std::cout);
+    }
+    if (!args.statsJsonPath.empty()) {
+        std::ofstream json(args.statsJsonPath);
+        if (!json) {
+            throw std::runtime_error("Failed to create stats file: " + args.statsJsonPath.string());
+        }
+        stats.writeJson(json);
+    }
+}
+
+void MiniWrApp::writeTrace(const std::filesystem::path& path) {
+    Trace::stop();
+    std::ofstream trace(path);
+    if (!trace) {
+        throw std::runtime_error("Failed to create trace file: " + path.string());
+    }
+    Trace::writeJson(trace);
+    if (Trace::dropped() > 0) {
+        std::cerr << "Warning: " << Trace::dropped()
+                  << " trace spans were dropped; the trace holds the latest ones" << std::endl;
     }
 }
-} 
\ No newline at end of file
+}
\ No newline at end of file
@@ -23,7 +23,17 @@ public:
 private:
     static int handleAdd(const Arguments& args);
     static int handleExtract(const Arguments& args);
-    static void showProgress(const std::string& operation,
-                           size_t current,
-                           size_t total);
-}; 
\ No newline at end of file
+    static int handleTest(const Arguments& args);
+    static int handleList(const Arguments& args);
+    static int handleMerge(const Arguments& args);
+    static int handleDelete(const Arguments& args);
+    static int handleRecompress(const Arguments& args);
+    static void configureBuffers(const Arguments& args);
+    static std::shared_ptr<MemoryBudget> createMemoryBudget(const Arguments& args);
+    static std::shared_ptr<IoEngine> createIoEngine(const Arguments& args,
+                                                    std::shared_ptr<MemoryBudget> budget);
+    static std::shared_ptr<Stats> createStats(const Arguments& args);
+    static void reportStats(const Arguments& args, Stats& stats);
+    static void writeTrace(const std::filesystem::path& path);
+};
+}
@@ -0,0 +1,384 @@
+#include "ArchiveIO.h"
+#include "../util/FileSystem.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace miniwr {
+
+namespace {
+    constexpr size_t SINK_BUFFER_SIZE = 256 * 1024;
+
+    std::runtime_error systemError(const std::string& what) {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    void checkRange(uint64_t offset, size_t length, uint64_t size) {
+        if (offset > size || length > size - offset) {
+            throw std::runtime_error("Unexpected end of archive");
+        }
+    }
+
+    class DescriptorSink : public ArchiveSink {
+    public:
+        DescriptorSink(int fd, bool owned) : fd_(fd), owned_(owned) {
+            off_t start = ::lseek(fd_, 0, SEEK_CUR);
+            seekable_ = start >= 0;
+            start_ = seekable_ ? static_cast<uint64_t>(start) : 0;
+            pending_.reserve(SINK_BUFFER_SIZE);
+        }
+
+        ~DescriptorSink() override {
+            try {
+                flush();
+            } catch (...) {
+                // Destructor shouldn't throw; close() reports errors
+            }
+            if (owned_ && fd_ >= 0) {
+                ::close(fd_);
+            }
+        }
+
+        void write(std::span<const uint8_t> data) override {
+            if (pending_.size() + data.size() > SINK_BUFFER_SIZE) {
+                flush();
+            }
+            if (data.size() >= SINK_BUFFER_SIZE) {
+                writeAll(data);
+            } else {
+                pending_.insert(pending_.end(), data.begin(), data.end());
+            }
+            position_ += data.size();
+            if (pending_.empty()) {
+                dropBehind();
+            }
+        }
+
+        uint64_t position() const override {
+            return position_;
+        }
+
+        bool seekable() const override {
+            return seekable_;
+        }
+
+        void seek(uint64_t offset) override {
+            if (!seekable_) {
+                ArchiveSink::seek(offset);
+            }
+            flush();
+            if (::lseek(fd_, static_cast<off_t>(start_ + offset), SEEK_SET) < 0) {
+                throw systemError("Failed to seek archive");
+            }
+            position_ = offset;
+        }
+
+        uint64_t copyFrom(int fd, uint64_t offset, uint64_t length) override {
+            flush();
+            uint64_t copied = copyRange(fd, offset, fd_, length);
+            position_ += copied;
+            dropBehind();
+            return copied;
+        }
+
+        bool positional() const override {
+            return seekable_;
+        }
+
+        uint64_t reserve(uint64_t length) override {
+            if (!seekable_) {
+                return ArchiveSink::reserve(length);
+            }
+            flush();
+            uint64_t offset = position_;
+            if (::lseek(fd_, static_cast<off_t>(start_ + offset + length), SEEK_SET) < 0) {
+                throw systemError("Failed to seek archive");
+            }
+            position_ = offset + length;
+            return offset;
+        }
+
+        void writeAt(uint64_t offset, std::span<const uint8_t> data) override {
+            if (!seekable_) {
+                return ArchiveSink::writeAt(offset, data);
+            }
+            size_t total = 0;
+            while (total < data.size()) {
+                ssize_t count = ::pwrite(fd_, data.data() + total, data.size() - total,
+                                         static_cast<off_t>(start_ + offset + total));
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw systemError("Failed to write archive");
+                }
+                total += static_cast<size_t>(count);
+            }
+        }
+
+        void close() override {
+            flush();
+            if (seekable_ && fd_ >= 0) {
+                dropper_.finish(fd_, start_ + position_);
+            }
+            int fd = fd_;
+            fd_ = -1;
+            if (owned_ && fd >= 0 && ::close(fd) != 0) {
+                throw systemError("Failed to close archive");
+            }
+        }
+
+    private:
+        int fd_;
+        bool owned_;
+        bool seekable_ = false;
+        uint64_t start_ = 0;
+        uint64_t position_ = 0;
+        std::vector<uint8_t> pending_;
+        CacheDropper dropper_{true};
+
+        void flush() {
+            if (!pending_.empty()) {
+                writeAll(pending_);
+                pending_.clear();
+                dropBehind();
+            }
+        }
+
+        // Only called with nothing pending, so the file holds everything
+        // before the current position
+        void dropBehind() {
+            if (seekable_) {
+                dropper_.advance(fd_, start_ + position_);
+            }
+        }
+
+        void writeAll(std::span<const uint8_t> data) {
+            size_t total = 0;
+            while (total < data.size()) {
+                ssize_t count = ::write(fd_, data.data() + total, data.size() - total);
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw systemError("Failed to write archive");
+                }
+                total += static_cast<size_t>(count);
+            }
+        }
+    };
+
+    class MemorySink : public ArchiveSink {
+    public:
+        explicit MemorySink(Buffer& out) : out_(out) {}
+
+        void write(std::span<const uint8_t> data) override {
+            // Rewrites after a seek overwrite, writes at the end append
+            size_t overlap = std::min(data.size(), out_.size() - position_);
+            std::copy_n(data.begin(), overlap, out_.data() + position_);
+            out_.append(data.subspan(overlap));
+            position_ += data.size();
+        }
+
+        uint64_t position() const override {
+            return position_;
+        }
+
+        bool seekable() const override {
+            return true;
+        }
+
+        void seek(uint64_t offset) override {
+            if (offset > out_.size()) {
+                throw std::runtime_error("Seek past the end of the archive");
+            }
+            position_ = static_cast<size_t>(offset);
+        }
+
+    private:
+        Buffer& out_;
+        size_t position_ = 0;
+    };
+
+    class CallbackSink : public ArchiveSink {
+    public:
+        explicit CallbackSink(Compressor::WriteChunk write) : write_(std::move(write)) {}
+
+        void write(std::span<const uint8_t> data) override {
+            write_(data);
+            position_ += data.size();
+        }
+
+        uint64_t position() const override {
+            return position_;
+        }
+
+    private:
+        Compressor::WriteChunk write_;
+        uint64_t position_ = 0;
+    };
+
+    class DescriptorSource : public ArchiveSource {
+    public:
+        DescriptorSource(int fd, bool owned) : fd_(fd), owned_(owned) {
+            struct stat info;
+            if (::fstat(fd_, &info) != 0) {
+                int error = errno;
+                if (owned_) {
+                    ::close(fd_);
+                }
+                errno = error;
+                throw systemError("Failed to stat archive");
+            }
+            size_ = static_cast<uint64_t>(info.st_size);
+        }
+
+        ~DescriptorSource() override {
+            if (owned_) {
+                ::close(fd_);
+            }
+        }
+
+        uint64_t size() const override {
+            return size_;
+        }
+
+        int descriptor() const override {
+            return fd_;
+        }
+
+        void readAt(uint64_t offset, std::span<uint8_t> buffer) override {
+            checkRange(offset, buffer.size(), size_);
+            size_t total = 0;
+            while (total < buffer.size()) {
+                ssize_t count = ::pread(fd_, buffer.data() + total, buffer.size() - total,
+                                        static_cast<off_t>(offset + total));
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw systemError("Failed to read archive");
+                }
+                if (count == 0) {
+                    throw std::runtime_error("Unexpected end of archive");
+                }
+                total += static_cast<size_t>(count);
+            }
+            if (cachePolicy() == CachePolicy::DropBehind) {
+                // Entries are read once; keep them from evicting everything else
+                ::posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(buffer.size()),
+                                POSIX_FADV_DONTNEED);
+            }
+        }
+
+    private:
+        int fd_;
+        bool owned_;
+        uint64_t size_ = 0;
+    };
+
+    class MemorySource : public ArchiveSource {
+    public:
+        explicit MemorySource(std::span<const uint8_t> data) : data_(data) {}
+
+        uint64_t size() const override {
+            return data_.size();
+        }
+
+        void readAt(uint64_t offset, std::span<uint8_t> buffer) override {
+            checkRange(offset, buffer.size(), data_.size());
+            std::copy_n(data_.begin() + static_cast<ptrdiff_t>(offset), buffer.size(), buffer.begin());
+        }
+
+    private:
+        std::span<const uint8_t> data_;
+    };
+
+    class CallbackSource : public ArchiveSource {
+    public:
+        CallbackSource(uint64_t size, ReadAt readAt) : size_(size), readAt_(std::move(readAt)) {}
+
+        uint64_t size() const override {
+            return size_;
+        }
+
+        void readAt(uint64_t offset, std::span<uint8_t> buffer) override {
+            checkRange(offset, buffer.size(), size_);
+            readAt_(offset, buffer);
+        }
+
+    private:
+        uint64_t size_;
+        ReadAt readAt_;
+    };
+}
+
+void ArchiveSink::seek(uint64_t offset) {
+    (void)offset;
+    throw std::runtime_error("Archive sink is not seekable");
+}
+
+uint64_t ArchiveSink::copyFrom(int fd, uint64_t offset, uint64_t length) {
+    (void)fd;
+    (void)offset;
+    (void)length;
+    return 0;
+}
+
+uint64_t ArchiveSink::reserve(uint64_t length) {
+    (void)length;
+    throw std::runtime_error("Archive sink does not support positional writes");
+}
+
+void ArchiveSink::writeAt(uint64_t offset, std::span<const uint8_t> data) {
+    (void)offset;
+    (void)data;
+    throw std::runtime_error("Archive sink does not support positional writes");
+}
+
+std::unique_ptr<ArchiveSink> ArchiveSink::file(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create archive file: " + path.string());
+    }
+    return std::make_unique<DescriptorSink>(fd, true);
+}
+
+std::unique_ptr<ArchiveSink> ArchiveSink::descriptor(int fd) {
+    return std::make_unique<DescriptorSink>(fd, false);
+}
+
+std::unique_ptr<ArchiveSink> ArchiveSink::memory(Buffer& out) {
+    return std::make_unique<MemorySink>(out);
+}
+
+std::unique_ptr<ArchiveSink> ArchiveSink::callback(Compressor::WriteChunk write) {
+    return std::make_unique<CallbackSink>(std::move(write));
+}
+
+std::unique_ptr<ArchiveSource> ArchiveSource::file(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open archive file: " + path.string());
+    }
+    return std::make_unique<DescriptorSource>(fd, true);
+}
+
+std::unique_ptr<ArchiveSource> ArchiveSource::descriptor(int fd) {
+    return std::make_unique<DescriptorSource>(fd, false);
+}
+
+std::unique_ptr<ArchiveSource> ArchiveSource::memory(std::span<const uint8_t> data) {
+    return std::make_unique<MemorySource>(data);
+}
+
+std::unique_ptr<ArchiveSource> ArchiveSource::callback(uint64_t size, ReadAt readAt) {
+    return std::make_unique<CallbackSource>(size, std::move(readAt));
+}
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Compressor.h"
+#include "../util/Buffer.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+
+namespace miniwr {
+
+/**
+ * @brief Destination of the bytes of an archive being written
+ *
+ * Small writes are expected (headers are a few dozen bytes); sinks backed by
+ * system calls buffer them.
+ */
+class ArchiveSink {
+public:
+    virtual ~ArchiveSink() = default;
+
+    /**
+     * @brief Append bytes at the current position
+     */
+    virtual void write(std::span<const uint8_t> data) = 0;
+
+    /**
+     * @brief Offset of the next write, relative to the start of the archive
+     */
+    virtual uint64_t position() const = 0;
+
+    /**
+     * @brief Whether seek() is supported
+     *
+     * Streamed entries are finished by rewriting their local header on
+     * seekable sinks and with a trailing data descriptor otherwise.
+     */
+    virtual bool seekable() const { return false; }
+
+    /**
+     * @brief Move the write position (seekable sinks only)
+     */
+    virtual void seek(uint64_t offset);
+
+    /**
+     * @brief Append a range of a file without passing it through user space
+     * @return Number of bytes copied from the start of the range; the caller
+     *         writes the rest (0 for sinks without kernel-side copies)
+     */
+    virtual uint64_t copyFrom(int fd, uint64_t offset, uint64_t length);
+
+    /**
+     * @brief Whether reserve() and writeAt() are supported
+     */
+    virtual bool positional() const { return false; }
+
+    /**
+     * @brief Skip a range at the current position, to be filled with writeAt()
+     * @return Offset of the range
+     */
+    virtual uint64_t reserve(uint64_t length);
+
+    /**
+     * @brief Write into a reserved range (positional sinks only)
+     *
+     * Safe to call from several threads at once, and alongside the other
+     * methods, as long as the ranges do not overlap.
+     */
+    virtual void writeAt(uint64_t offset, std::span<const uint8_t> data);
+
+    /**
+     * @brief Flush and release the destination, reporting errors
+     */
+    virtual void close() {}
+
+    /**
+     * @brief Create or truncate a file
+     */
+    static std::unique_ptr<ArchiveSink> file(const std::filesystem::path& path);
+
+    /**
+     * @brief Write to an open descriptor (not closed by the sink)
+     *
+     * Pipes and sockets are supported; regular files are seekable.
+     */
+    static std::unique_ptr<ArchiveSink> descriptor(int fd);
+
+    /**
+     * @brief Write into a caller-owned buffer, which must outlive the sink
+     */
+    static std::unique_ptr<ArchiveSink> memory(Buffer& out);
+
+    /**
+     * @brief Hand every chunk to a callback (not seekable)
+     */
+    static std::unique_ptr<ArchiveSink> callback(Compressor::WriteChunk write);
+};
+
+/**
+ * @brief Random-access origin of the bytes of an archive being read
+ */
+class ArchiveSource {
+public:
+    /// Fills the buffer with the bytes at the given offset
+    using ReadAt = std::function<void(uint64_t, std::span<uint8_t>)>;
+
+    virtual ~ArchiveSource() = default;
+
+    /**
+     * @brief Total size of the archive
+     */
+    virtual uint64_t size() const = 0;
+
+    /**
+     * @brief Read exactly buffer.size() bytes at an offset
+     * @throws std::runtime_error if the range is not inside the archive
+     */
+    virtual void readAt(uint64_t offset, std::span<uint8_t> buffer) = 0;
+
+    /**
+     * @brief Descriptor for kernel-side copies and mappings, -1 if none
+     *
+     * Offsets in the descriptor are the archive offsets.
+     */
+    virtual int descriptor() const { return -1; }
+
+    /**
+     * @brief Open a file
+     */
+    static std::unique_ptr<ArchiveSource> file(const std::filesystem::path& path);
+
+    /**
+     * @brief Read from an open, seekable descriptor (not closed by the source)
+     */
+    static std::unique_ptr<ArchiveSource> descriptor(int fd);
+
+    /**
+     * @brief Read from caller-owned memory, which must outlive the source
+     */
+    static std::unique_ptr<ArchiveSource> memory(std::span<const uint8_t> data);
+
+    /**
+     * @brief Serve reads from a callback
+     * @param size Total size of the archive
+     * @param readAt Called with ranges inside [0, size) only
+     */
+    static std::unique_ptr<ArchiveSource> callback(uint64_t size, ReadAt readAt);
+};
+}
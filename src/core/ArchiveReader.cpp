@@ -1,4 +1,11 @@
 #include "ArchiveReader.h"
+#include "BinaryIO.h"
+#include "Dictionary.h"
+#include "../util/FileSystem.h"
+#include "../util/Scheduler.h"
+#include "../util/Trace.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -10,49 +17,148 @@ namespace {
     constexpr uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
     constexpr uint32_t ZIP_CENTRAL_DIR_SIGNATURE = 0x02014b50;
     constexpr uint32_t ZIP_END_OF_CENTRAL_DIR_SIGNATURE = 0x06054b50;
+    constexpr uint32_t ZIP_DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+    constexpr uint32_t ZIP64_END_OF_CENTRAL_DIR_SIGNATURE = 0x06064b50;
+    constexpr uint32_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE = 0x07064b50;
+    constexpr uint16_t ZIP64_EXTRA_FIELD_ID = 0x0001;
+    constexpr uint16_t ZIP64_COUNT_MARKER = 0xFFFF;
+    constexpr uint32_t ZIP64_FIELD_MARKER = 0xFFFFFFFF;
+    constexpr uint16_t ZIP_FLAG_DATA_DESCRIPTOR = 0x0008;
+    constexpr uint16_t ZIP_COMPRESSION_METHOD_STORE = 0x0000;
+    constexpr size_t LOCAL_HEADER_SIZE = 30;
     constexpr size_t END_OF_CENTRAL_DIR_SIZE = 22;
+    constexpr size_t ZIP64_END_OF_CENTRAL_DIR_SIZE = 56;
+    constexpr size_t ZIP64_LOCATOR_SIZE = 20;
     constexpr size_t MAX_COMMENT_SIZE = 65535;
+    constexpr size_t TEST_CHUNK_SIZE = 256 * 1024;
+    constexpr size_t COPY_CHUNK_SIZE = 256 * 1024;
+    constexpr size_t COMPARE_CHUNK_SIZE = 256 * 1024;
+
+    // Stored entries are their own decoded form
+    class StoredDecoder : public Compressor::Decoder {
+    public:
+        explicit StoredDecoder(Compressor::ReadChunk read) : read_(std::move(read)) {}
+
+        size_t read(std::span<uint8_t> buffer) override {
+            return read_(buffer);
+        }
+
+    private:
+        Compressor::ReadChunk read_;
+    };
+
+    // A saturated field of a ZIP64 extra field holds its real value
+    uint64_t zip64Field(ByteCursor& cursor, uint32_t value) {
+        return value == ZIP64_FIELD_MARKER ? cursor.fixed<uint64_t>() : value;
+    }
+
+    // The ZIP64 extra field lists the saturated fields of a central
+    // directory header in a fixed order; sizes must still fit in 32 bits
+    uint64_t zip64HeaderOffset(std::span<const uint8_t> extra, const ZipEntry& entry,
+                               uint32_t headerOffset) {
+        ByteCursor fields(extra, "extra field");
+        while (!fields.atEnd()) {
+            uint16_t id = fields.fixed<uint16_t>();
+            auto data = fields.take(fields.fixed<uint16_t>());
+            if (id != ZIP64_EXTRA_FIELD_ID) {
+                continue;
+            }
+
+            ByteCursor zip64(data, "ZIP64 extra field");
+            uint64_t uncompressedSize = zip64Field(zip64, entry.uncompressedSize);
+            uint64_t compressedSize = zip64Field(zip64, entry.compressedSize);
+            if (uncompressedSize > UINT32_MAX || compressedSize > UINT32_MAX) {
+                throw std::runtime_error("Entries of 4 GB or more are not supported: " + entry.filename);
+            }
+            return zip64Field(zip64, headerOffset);
+        }
+        return headerOffset;
+    }
+}
+
+EntryStream::EntryStream(const ZipEntry& entry,
+                         std::unique_ptr<Compressor::Decoder> decoder,
+                         MemoryBudget::Reservation reservation)
+    : entry_(entry),
+      decoder_(std::move(decoder)),
+      reservation_(std::move(reservation)) {}
+
+EntryStream::EntryStream(const ZipEntry& entry, Buffer content)
+    : entry_(entry),
+      content_(std::move(content)) {}
+
+size_t EntryStream::read(std::span<uint8_t> buffer) {
+    if (buffer.empty()) {
+        return 0;
+    }
+
+    // In-memory content was verified when it was expanded
+    if (!decoder_) {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), content_.size() - position_));
+        std::copy_n(content_.data() + position_, count, buffer.data());
+        position_ += count;
+        return count;
+    }
+
+    size_t count = decoder_->read(buffer);
+    crc_ = crc32(crc_, buffer.data(), static_cast<uInt>(count));
+    position_ += count;
+
+    if ((count == 0 && (crc_ != entry_.crc32 || position_ != entry_.uncompressedSize)) ||
+        position_ > entry_.uncompressedSize) {
+        throw std::runtime_error("CRC32 check failed for " + entry_.filename);
+    }
+    return count;
 }
 
 ArchiveReader::ArchiveReader(const std::filesystem::path& archivePath)
-    : archivePath_(archivePath),
-      archive_(archivePath, std::ios::binary),
+    : ArchiveReader(ArchiveSource::file(archivePath)) {}
+
+ArchiveReader::ArchiveReader(std::unique_ptr<ArchiveSource> source)
+    : source_(std::move(source)),
       compressor_(Compressor::create("deflate")) {
-    
-    if (!archive_) {
-        throw std::runtime_error("Failed to open archive file: " + archivePath.string());
-    }
 
     readCentralDirectory();
+    findDictionary();
+    loadDeltaManifest();
+    loadSparseManifest();
+    loadSolidIndex();
+    buildNameIndex();
 }
 
-ArchiveReader::~ArchiveReader() {
-    if (archive_.is_open()) {
-        archive_.close();
-    }
-}
+ArchiveReader::~ArchiveReader() = default;
 
 void ArchiveReader::readCentralDirectory() {
     // Find end of central directory record
-    archive_.seekg(0, std::ios::end);
-    auto fileSize = archive_.tellg();
-
-    // Search for end of central directory signature
-    const size_t bufSize = std::min(static_cast<size_t>(fileSize),
-                                  END_OF_CENTRAL_DIR_SIZE + MAX_COMMENT_SIZE);
-    std::vector<char> buffer(bufSize);
+    uint64_t fileSize = source_->size();
+    if (fileSize < END_OF_CENTRAL_DIR_SIZE) {
+        throw std::runtime_error("Invalid ZIP file: End of central directory not found");
+    }
 
-    archive_.seekg(-static_cast<std::streamoff>(bufSize), std::ios::end);
-    archive_.read(buffer.data(), bufSize);
+    // Archives without a comment end with the record itself, so the last
+    // bytes are read first and the comment window is searched otherwise
+    size_t bufSize = END_OF_CENTRAL_DIR_SIZE;
+    Buffer buffer(bufSize);
+    source_->readAt(fileSize - bufSize, buffer.span());
+    if (ByteCursor(buffer.span(), "ZIP file").fixed<uint32_t>() != ZIP_END_OF_CENTRAL_DIR_SIGNATURE) {
+        bufSize = static_cast<size_t>(
+            std::min<uint64_t>(fileSize, END_OF_CENTRAL_DIR_SIZE + MAX_COMMENT_SIZE));
+        buffer = Buffer(bufSize);
+        source_->readAt(fileSize - bufSize, buffer.span());
+    }
 
     auto pos = bufSize - END_OF_CENTRAL_DIR_SIZE;
     bool found = false;
 
-    while (pos > 0) {
-        if (*reinterpret_cast<uint32_t*>(&buffer[pos]) == ZIP_END_OF_CENTRAL_DIR_SIGNATURE) {
+    while (true) {
+        if (ByteCursor(buffer.span().subspan(pos, 4), "ZIP file").fixed<uint32_t>() ==
+            ZIP_END_OF_CENTRAL_DIR_SIGNATURE) {
             found = true;
             break;
         }
+        if (pos == 0) {
+            break;
+        }
         --pos;
     }
 
@@ -60,77 +166,727 @@ void ArchiveReader::readCentralDirectory() {
         throw std::runtime_error("Invalid ZIP file: End of central directory not found");
     }
 
-    // Read central directory offset
-    uint32_t centralDirOffset = *reinterpret_cast<uint32_t*>(&buffer[pos + 16]);
-    uint16_t numEntries = *reinterpret_cast<uint16_t*>(&buffer[pos + 10]);
+    // Read number of entries, central directory size and offset
+    ByteCursor record(buffer.span().subspan(pos, END_OF_CENTRAL_DIR_SIZE), "end of central directory");
+    record.take(10);
+    uint64_t numEntries = record.fixed<uint16_t>();
+    uint64_t centralDirSize = record.fixed<uint32_t>();
+    uint64_t centralDirOffset = record.fixed<uint32_t>();
 
-    // Read central directory entries
-    archive_.seekg(centralDirOffset);
-    
-    for (uint16_t i = 0; i < numEntries; ++i) {
-        uint32_t signature;
-        archive_.read(reinterpret_cast<char*>(&signature), 4);
-        
-        if (signature != ZIP_CENTRAL_DIR_SIGNATURE) {
+    // Saturated fields are in the ZIP64 record, found through the locator
+    // right before the end record
+    uint64_t recordOffset = fileSize - bufSize + pos;
+    if ((numEntries == ZIP64_COUNT_MARKER || centralDirSize == ZIP64_FIELD_MARKER ||
+         centralDirOffset == ZIP64_FIELD_MARKER) && recordOffset >= ZIP64_LOCATOR_SIZE) {
+        uint8_t locatorData[ZIP64_LOCATOR_SIZE];
+        source_->readAt(recordOffset - ZIP64_LOCATOR_SIZE, locatorData);
+        ByteCursor locator(locatorData, "ZIP64 end of central directory locator");
+        if (locator.fixed<uint32_t>() == ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE) {
+            locator.take(4);  // Disk holding the record
+            uint8_t zip64Data[ZIP64_END_OF_CENTRAL_DIR_SIZE];
+            source_->readAt(locator.fixed<uint64_t>(), zip64Data);
+
+            ByteCursor zip64(zip64Data, "ZIP64 end of central directory");
+            if (zip64.fixed<uint32_t>() != ZIP64_END_OF_CENTRAL_DIR_SIGNATURE) {
+                throw std::runtime_error("Invalid ZIP file: ZIP64 end of central directory not found");
+            }
+            zip64.take(28);  // Record size, versions, disk numbers and entries on this disk
+            numEntries = zip64.fixed<uint64_t>();
+            centralDirSize = zip64.fixed<uint64_t>();
+            centralDirOffset = zip64.fixed<uint64_t>();
+        }
+    }
+
+    // Read the central directory in one piece
+    Buffer directory(centralDirSize);
+    source_->readAt(centralDirOffset, directory.span());
+    ByteCursor cursor(directory.span(), "central directory");
+
+    for (uint64_t i = 0; i < numEntries; ++i) {
+        if (cursor.fixed<uint32_t>() != ZIP_CENTRAL_DIR_SIGNATURE) {
             throw std::runtime_error("Invalid central directory entry");
         }
 
         // Skip version made by and needed
-        archive_.seekg(4, std::ios::cur);
+        cursor.take(4);
+
+        ZipEntry entry;
 
         // Read general purpose flags
-        uint16_t flags;
-        archive_.read(reinterpret_cast<char*>(&flags), 2);
+        entry.flags = cursor.fixed<uint16_t>();
 
         // Read compression method
-        uint16_t compressionMethod;
-        archive_.read(reinterpret_cast<char*>(&compressionMethod), 2);
+        entry.compressionMethod = cursor.fixed<uint16_t>();
 
-        ZipEntry entry;
-        
         // Read modification time and date
-        archive_.read(reinterpret_cast<char*>(&entry.modificationTime), 2);
-        archive_.read(reinterpret_cast<char*>(&entry.modificationDate), 2);
+        entry.modificationTime = cursor.fixed<uint16_t>();
+        entry.modificationDate = cursor.fixed<uint16_t>();
 
         // Read CRC and sizes
-        archive_.read(reinterpret_cast<char*>(&entry.crc32), 4);
-        archive_.read(reinterpret_cast<char*>(&entry.compressedSize), 4);
-        archive_.read(reinterpret_cast<char*>(&entry.uncompressedSize), 4);
+        entry.crc32 = cursor.fixed<uint32_t>();
+        entry.compressedSize = cursor.fixed<uint32_t>();
+        entry.uncompressedSize = cursor.fixed<uint32_t>();
 
         // Read filename length and extra field length
-        uint16_t filenameLength;
-        uint16_t extraFieldLength;
-        uint16_t fileCommentLength;
-        archive_.read(reinterpret_cast<char*>(&filenameLength), 2);
-        archive_.read(reinterpret_cast<char*>(&extraFieldLength), 2);
-        archive_.read(reinterpret_cast<char*>(&fileCommentLength), 2);
+        uint16_t filenameLength = cursor.fixed<uint16_t>();
+        uint16_t extraFieldLength = cursor.fixed<uint16_t>();
+        uint16_t fileCommentLength = cursor.fixed<uint16_t>();
 
         // Skip disk number start and internal attributes
-        archive_.seekg(4, std::ios::cur);
+        cursor.take(4);
 
         // Read external attributes
-        archive_.read(reinterpret_cast<char*>(&entry.externalAttrs), 4);
+        entry.externalAttrs = cursor.fixed<uint32_t>();
 
         // Read local header offset
-        archive_.read(reinterpret_cast<char*>(&entry.headerOffset), 4);
+        uint32_t headerOffset = cursor.fixed<uint32_t>();
 
         // Read filename
-        std::string filename(filenameLength, '\0');
-        archive_.read(&filename[0], filenameLength);
-        entry.filename = filename;
+        auto filename = cursor.take(filenameLength);
+        entry.filename.assign(filename.begin(), filename.end());
 
-        // Skip extra field and file comment
-        archive_.seekg(extraFieldLength + fileCommentLength, std::ios::cur);
+        // Offsets beyond 4 GB are in the extra field; skip the file comment
+        auto extra = cursor.take(extraFieldLength);
+        cursor.take(fileCommentLength);
+        entry.headerOffset = headerOffset;
+        if (headerOffset == ZIP64_FIELD_MARKER || entry.compressedSize == ZIP64_FIELD_MARKER ||
+            entry.uncompressedSize == ZIP64_FIELD_MARKER) {
+            entry.headerOffset = zip64HeaderOffset(extra, entry, headerOffset);
+        }
 
         entries_.push_back(entry);
     }
 }
 
+void ArchiveReader::findDictionary() {
+    auto dictIt = std::find_if(entries_.begin(), entries_.end(),
+        [](const ZipEntry& entry) { return entry.filename == DICTIONARY_ENTRY_NAME; });
+    if (dictIt == entries_.end()) {
+        return;
+    }
+
+    dictionaryEntry_ = std::move(*dictIt);
+    entries_.erase(dictIt);
+}
+
+void ArchiveReader::loadDictionary() {
+    if (!dictionaryEntry_) {
+        return;
+    }
+
+    // Entries compressed against it request the dictionary while inflating
+    dictionary_ = decodeEntry(*dictionaryEntry_, *compressor_);
+    compressor_->setDictionary(dictionary_.span());
+}
+
+Compressor& ArchiveReader::decompressor() {
+    // Listings never get here, so they don't read the dictionary entry
+    std::call_once(dictionaryLoaded_, [this] { loadDictionary(); });
+    return *compressor_;
+}
+
+std::span<const uint8_t> ArchiveReader::dictionary() {
+    decompressor();
+    return dictionary_.span();
+}
+
+void ArchiveReader::loadDeltaManifest() {
+    auto manifestIt = std::find_if(entries_.begin(), entries_.end(),
+        [](const ZipEntry& entry) { return entry.filename == DELTA_MANIFEST_NAME; });
+    if (manifestIt == entries_.end()) {
+        return;
+    }
+
+    // Internal entries are compressed without the dictionary
+    deltaManifest_ = DeltaManifest::parse(decodeEntry(*manifestIt, *compressor_));
+    entries_.erase(manifestIt);
+}
+
+void ArchiveReader::loadSparseManifest() {
+    auto manifestIt = std::find_if(entries_.begin(), entries_.end(),
+        [](const ZipEntry& entry) { return entry.filename == SPARSE_MANIFEST_NAME; });
+    if (manifestIt == entries_.end()) {
+        return;
+    }
+
+    sparseManifest_ = SparseManifest::parse(decodeEntry(*manifestIt, *compressor_));
+    entries_.erase(manifestIt);
+}
+
+void ArchiveReader::loadSolidIndex() {
+    auto indexIt = std::find_if(entries_.begin(), entries_.end(),
+        [](const ZipEntry& entry) { return entry.filename == SOLID_INDEX_NAME; });
+    if (indexIt == entries_.end()) {
+        return;
+    }
+
+    auto index = SolidIndex::parse(decodeEntry(*indexIt, *compressor_));
+
+    // Move block entries out of the regular entry list
+    std::vector<ZipEntry> regular;
+    solidBlocks_.resize(index.blockCount);
+    std::vector<bool> blockFound(index.blockCount, false);
+
+    for (auto& entry : entries_) {
+        if (entry.filename == SOLID_INDEX_NAME) {
+            continue;
+        }
+        // Names that merely look like blocks stay regular entries
+        auto block = SolidIndex::blockIndex(entry.filename);
+        if (block && *block < index.blockCount && !blockFound[*block]) {
+            solidBlocks_[*block] = std::move(entry);
+            blockFound[*block] = true;
+            continue;
+        }
+        regular.push_back(std::move(entry));
+    }
+
+    if (std::find(blockFound.begin(), blockFound.end(), false) != blockFound.end()) {
+        throw std::runtime_error("Invalid ZIP file: solid block missing");
+    }
+
+    entries_ = std::move(regular);
+    solidMembers_ = std::move(index.members);
+
+    // Members get their share of the block for listings and ratios
+    for (auto& member : solidMembers_) {
+        if (member.block < solidBlocks_.size() && solidBlocks_[member.block].uncompressedSize > 0) {
+            const auto& block = solidBlocks_[member.block];
+            member.entry.compressedSize = static_cast<uint32_t>(
+                static_cast<uint64_t>(member.entry.uncompressedSize) * block.compressedSize /
+                block.uncompressedSize);
+        }
+    }
+}
+
+void ArchiveReader::buildNameIndex() {
+    for (const auto& entry : entries_) {
+        nameIndex_.emplace(entry.filename, EntryRef{&entry, nullptr});
+    }
+    for (const auto& member : solidMembers_) {
+        nameIndex_.emplace(member.entry.filename, EntryRef{&member.entry, &member});
+    }
+}
+
 void ArchiveReader::extractAll(const std::filesystem::path& outputDir,
                              bool overwriteAll) {
+    if (ioEngine_) {
+        extractAllBatched(outputDir, overwriteAll);
+        return;
+    }
+
+    // Nothing asks before overwriting, so entries can go side by side
+    if (threads_ > 1 && (overwriteAll || extractMode_ != ExtractMode::Overwrite)) {
+        extractAllConcurrently(outputDir, overwriteAll);
+        return;
+    }
+
     for (const auto& entry : entries_) {
         extractFile(entry, outputDir, overwriteAll);
     }
+
+    // Members are ordered by block, so each block is inflated once
+    for (const auto& member : solidMembers_) {
+        extractSolidMember(member, outputDir, overwriteAll);
+    }
+}
+
+void ArchiveReader::extractAllConcurrently(const std::filesystem::path& outputDir,
+                                         bool overwriteAll) {
+    std::vector<std::vector<const SolidMember*>> blockMembers(solidBlocks_.size());
+    for (const auto& member : solidMembers_) {
+        if (member.block >= solidBlocks_.size()) {
+            throw std::runtime_error("Solid block missing for " + member.entry.filename);
+        }
+        blockMembers[member.block].push_back(&member);
+    }
+
+    // One task per entry or solid block, largest first so that a huge entry
+    // does not start last; delta entries need the base archive, which is
+    // read by one thread at a time
+    constexpr uint32_t NO_BLOCK = UINT32_MAX;
+    std::vector<std::pair<const ZipEntry*, uint32_t>> items;
+    std::vector<const ZipEntry*> deltas;
+    for (const auto& entry : entries_) {
+        if (deltaManifest_.entries.count(entry.filename)) {
+            deltas.push_back(&entry);
+        } else {
+            items.emplace_back(&entry, NO_BLOCK);
+        }
+    }
+    for (uint32_t block = 0; block < solidBlocks_.size(); ++block) {
+        if (!blockMembers[block].empty()) {
+            items.emplace_back(&solidBlocks_[block], block);
+        }
+    }
+    std::stable_sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+        return a.first->compressedSize > b.first->compressedSize;
+    });
+
+    // Tasks only take memory from the budget; a cached block would hold
+    // some of it while they wait
+    dropCachedBlock();
+    TaskGroup group(threads_);
+    for (const auto& [entry, block] : items) {
+        group.run([this, entry, block, &blockMembers, &outputDir, overwriteAll] {
+            if (block == NO_BLOCK) {
+                extractFileConcurrently(*entry, outputDir, overwriteAll);
+            } else {
+                extractSolidBlock(block, blockMembers[block], outputDir, overwriteAll);
+            }
+        });
+    }
+    group.wait();
+
+    for (const ZipEntry* entry : deltas) {
+        extractFile(*entry, outputDir, overwriteAll);
+    }
+}
+
+void ArchiveReader::extractFileConcurrently(const ZipEntry& entry,
+                                          const std::filesystem::path& outputDir,
+                                          bool overwriteAll) {
+    auto outputPath = outputDir / entry.filename;
+    if (!prepareOutputPath(outputPath, entry, overwriteAll)) {
+        return;
+    }
+
+    auto sparseIt = sparseManifest_.entries.find(entry.filename);
+    const SparseMap* layout = sparseIt != sparseManifest_.entries.end() ? &sparseIt->second : nullptr;
+    if (!layout && entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE && !sparse_ &&
+        source_->descriptor() >= 0) {
+        extractStoredFile(entry, outputPath);
+        return;
+    }
+
+    // Streamed with bounded buffers, whatever the entry size
+    auto reservation = acquireMemory(streamingCost(entry, layout));
+    extractFileStreaming(entry, outputPath, layout);
+}
+
+void ArchiveReader::extractSolidBlock(uint32_t block,
+                                    std::span<const SolidMember* const> members,
+                                    const std::filesystem::path& outputDir,
+                                    bool overwriteAll) {
+    // A block whose members are all left alone is not inflated
+    std::vector<std::pair<const SolidMember*, std::filesystem::path>> wanted;
+    for (const SolidMember* member : members) {
+        auto outputPath = outputDir / member->entry.filename;
+        if (prepareOutputPath(outputPath, member->entry, overwriteAll)) {
+            wanted.emplace_back(member, std::move(outputPath));
+        }
+    }
+    if (wanted.empty()) {
+        return;
+    }
+
+    const auto& blockEntry = solidBlocks_[block];
+    size_t cost = extractionCost(blockEntry);
+    if (memoryBudget_ && !memoryBudget_->fits(cost)) {
+        throw std::runtime_error("Solid block " + blockEntry.filename +
+            " does not fit in the memory limit");
+    }
+    auto reservation = acquireMemory(cost);
+    auto started = startTiming();
+    Buffer blockData = inflateEntry(blockEntry);
+    recordEntry(blockEntry, started);
+
+    for (const auto& [member, outputPath] : wanted) {
+        auto data = sliceMember(*member, blockData);
+        writeOutputFile(outputPath, data, member->entry);
+        reportProgress(data.size(), 1);
+    }
+}
+
+void ArchiveReader::extractAllBatched(const std::filesystem::path& outputDir,
+                                    bool overwriteAll) {
+    // Contents and their memory are held until the batch is written
+    std::vector<IoEngine::FileWrite> batch;
+    std::vector<Buffer> contents;
+    std::vector<MemoryBudget::Reservation> reservations;
+    uint64_t batchBytes = 0;
+
+    auto flush = [&] {
+        if (batch.empty()) {
+            return;
+        }
+        {
+            PhaseTimer timer(stats_.get(), Phase::Write, batchBytes);
+            ioEngine_->writeFiles(batch);
+        }
+        reportProgress(batchBytes, batch.size());
+        batch.clear();
+        contents.clear();
+        reservations.clear();
+        batchBytes = 0;
+    };
+
+    auto add = [&](const ZipEntry& entry, std::filesystem::path outputPath,
+                   std::span<const uint8_t> data) {
+        IoEngine::FileWrite file;
+        file.path = std::move(outputPath);
+        file.data = data;
+        if (entry.externalAttrs >> 16) {
+            file.permissions = static_cast<std::filesystem::perms>(entry.externalAttrs >> 16);
+        }
+        if (entry.modificationDate != 0) {
+            file.modified = fromDosDateTime(entry.modificationTime, entry.modificationDate);
+        }
+        batch.push_back(std::move(file));
+        batchBytes += data.size();
+        if (batch.size() == ioEngine_->depth()) {
+            flush();
+        }
+    };
+
+    for (const auto& entry : entries_) {
+        size_t cost = extractionCost(entry);
+        if (entry.uncompressedSize > IoEngine::SLOT_SIZE || deltaManifest_.entries.count(entry.filename) ||
+            sparseManifest_.entries.count(entry.filename) ||
+            (memoryBudget_ && !memoryBudget_->fits(cost))) {
+            // Its reservation must not wait for the pending batch
+            flush();
+            extractFile(entry, outputDir, overwriteAll);
+            continue;
+        }
+
+        auto outputPath = outputDir / entry.filename;
+        if (!prepareOutputPath(outputPath, entry, overwriteAll)) {
+            continue;
+        }
+        MemoryBudget::Reservation reservation;
+        if (memoryBudget_ && !memoryBudget_->tryAcquire(cost, reservation)) {
+            flush();
+            reservation = reserveMemory(cost);
+        }
+        auto started = startTiming();
+        contents.push_back(readEntryData(entry));
+        reservations.push_back(std::move(reservation));
+        recordEntry(entry, started);
+        add(entry, std::move(outputPath), contents.back().span());
+    }
+
+    for (const auto& member : solidMembers_) {
+        auto outputPath = outputDir / member.entry.filename;
+        if (!prepareOutputPath(outputPath, member.entry, overwriteAll)) {
+            continue;
+        }
+        // Pending members point into the cached block
+        if (member.block != cachedBlock_) {
+            flush();
+        }
+        add(member.entry, std::move(outputPath), solidMemberData(member));
+    }
+    flush();
+}
+
+void ArchiveReader::extract(const std::string& filename,
+                          const std::filesystem::path& outputDir,
+                          bool overwriteAll) {
+    auto it = nameIndex_.find(filename);
+    if (it == nameIndex_.end()) {
+        throw std::runtime_error("File not found in archive: " + filename);
+    }
+
+    if (it->second.member) {
+        extractSolidMember(*it->second.member, outputDir, overwriteAll);
+    } else {
+        extractFile(*it->second.entry, outputDir, overwriteAll);
+    }
+}
+
+const ZipEntry* ArchiveReader::findEntry(const std::string& filename) const {
+    auto it = nameIndex_.find(filename);
+    return it == nameIndex_.end() ? nullptr : it->second.entry;
+}
+
+Buffer ArchiveReader::read(const std::string& filename) {
+    auto it = nameIndex_.find(filename);
+    if (it == nameIndex_.end()) {
+        throw std::runtime_error("File not found in archive: " + filename);
+    }
+
+    if (!it->second.member) {
+        Buffer data = readEntryData(*it->second.entry);
+        auto sparseIt = sparseManifest_.entries.find(filename);
+        if (sparseIt == sparseManifest_.entries.end()) {
+            return data;
+        }
+        Buffer content;
+        expandSparse(data, sparseIt->second, content);
+        return content;
+    }
+
+    const auto& member = *it->second.member;
+    const auto& blockData = loadSolidBlock(member.block);
+    if (member.offset + member.entry.uncompressedSize > blockData.size()) {
+        throw std::runtime_error("Solid member out of block bounds: " + filename);
+    }
+    Buffer data;
+    data.append(blockData.span().subspan(member.offset, member.entry.uncompressedSize));
+
+    if (crc32(0L, data.data(), static_cast<uInt>(data.size())) != member.entry.crc32) {
+        throw std::runtime_error("CRC32 check failed for " + filename);
+    }
+    return data;
+}
+
+EntryStream ArchiveReader::open(const ZipEntry& entry) {
+    auto it = nameIndex_.find(entry.filename);
+    if (it == nameIndex_.end()) {
+        throw std::runtime_error("File not found in archive: " + entry.filename);
+    }
+
+    // Solid members are slices of an inflated block, deltas need the whole
+    // base file and sparse entries their holes, so they come from memory
+    const auto& found = *it->second.entry;
+    if (it->second.member || deltaManifest_.entries.count(found.filename) ||
+        sparseManifest_.entries.count(found.filename)) {
+        return EntryStream(found, read(found.filename));
+    }
+
+    auto reservation = acquireMemory(Compressor::STREAMING_MEMORY);
+    uint64_t offset = entryDataOffset(found);
+    uint64_t remaining = found.compressedSize;
+    Compressor::ReadChunk readData =
+        [source = source_.get(), offset, remaining](std::span<uint8_t> buffer) mutable {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+            source->readAt(offset, buffer.first(count));
+            offset += count;
+            remaining -= count;
+            return count;
+        };
+    std::unique_ptr<Compressor::Decoder> decoder;
+    if (found.compressionMethod == ZIP_COMPRESSION_METHOD_STORE) {
+        decoder = std::make_unique<StoredDecoder>(std::move(readData));
+    } else {
+        decoder = decompressor().createDecoder(std::move(readData));
+    }
+    return EntryStream(found, std::move(decoder), std::move(reservation));
+}
+
+TestReport ArchiveReader::test(unsigned threads) {
+    TestReport report;
+    report.entries = entries_.size() + solidMembers_.size();
+    report.bytes = totalSize();
+
+    std::vector<TestItem> items;
+    items.reserve(entries_.size() + solidBlocks_.size());
+    for (const auto& entry : entries_) {
+        items.push_back({&entry, {}, deltaManifest_.entries.count(entry.filename) > 0, {}});
+    }
+    for (const auto& block : solidBlocks_) {
+        items.push_back({&block, {}, false, {}});
+    }
+    for (const auto& member : solidMembers_) {
+        if (member.block >= solidBlocks_.size()) {
+            report.errors.push_back(member.entry.filename + ": solid block missing");
+            continue;
+        }
+        items[entries_.size() + member.block].members.push_back(&member);
+    }
+    for (auto& item : items) {
+        std::sort(item.members.begin(), item.members.end(),
+            [](const SolidMember* a, const SolidMember* b) { return a->offset < b->offset; });
+    }
+
+    // One task per entry, largest first so that a huge entry does not
+    // start last; sources read with pread
+    std::vector<size_t> order(items.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return items[a].entry->compressedSize > items[b].entry->compressedSize;
+    });
+
+    // Tasks only take memory from the budget; a cached block would hold
+    // some of it while they wait
+    dropCachedBlock();
+    TaskGroup group(std::max(threads, 1u));
+    for (size_t i : order) {
+        group.run([this, &item = items[i]] {
+            auto reservation = acquireMemory(Compressor::STREAMING_MEMORY);
+            Buffer scratch(TEST_CHUNK_SIZE);
+            testItem(item, scratch.span());
+        });
+    }
+    group.wait();
+
+    // Delta entries are expanded against the base archive, one at a time
+    for (auto& item : items) {
+        if (item.delta && item.errors.empty()) {
+            try {
+                readEntryData(*item.entry);
+                reportProgress(item.entry->uncompressedSize, 1);
+            } catch (const std::exception& e) {
+                item.errors.push_back(item.entry->filename + ": " + e.what());
+            }
+        }
+        report.errors.insert(report.errors.end(), item.errors.begin(), item.errors.end());
+    }
+    return report;
+}
+
+void ArchiveReader::testItem(TestItem& item, std::span<uint8_t> scratch) {
+    const auto& entry = *item.entry;
+    try {
+        // The local header must agree with the central directory
+        uint8_t header[LOCAL_HEADER_SIZE];
+        source_->readAt(entry.headerOffset, header);
+
+        ByteCursor cursor(header, "local file header");
+        if (cursor.fixed<uint32_t>() != ZIP_LOCAL_HEADER_SIGNATURE) {
+            throw std::runtime_error("Invalid local file header");
+        }
+        cursor.take(2);  // Skip version needed
+        uint16_t flags = cursor.fixed<uint16_t>();
+        uint16_t method = cursor.fixed<uint16_t>();
+        cursor.take(4);  // Skip modification time and date
+        uint32_t crc = cursor.fixed<uint32_t>();
+        uint32_t compressedSize = cursor.fixed<uint32_t>();
+        uint32_t uncompressedSize = cursor.fixed<uint32_t>();
+        uint16_t filenameLength = cursor.fixed<uint16_t>();
+        uint16_t extraFieldLength = cursor.fixed<uint16_t>();
+
+        std::string filename(filenameLength, '\0');
+        source_->readAt(entry.headerOffset + LOCAL_HEADER_SIZE,
+                        {reinterpret_cast<uint8_t*>(filename.data()), filename.size()});
+
+        // With a data descriptor, the local header holds zero CRC and sizes
+        bool descriptor = (flags & ZIP_FLAG_DATA_DESCRIPTOR) != 0;
+        if (filename != entry.filename || flags != entry.flags || method != entry.compressionMethod ||
+            (!descriptor && (crc != entry.crc32 || compressedSize != entry.compressedSize ||
+                             uncompressedSize != entry.uncompressedSize))) {
+            throw std::runtime_error("Local header does not match the central directory");
+        }
+
+        // Delta content is checked against the base archive afterwards
+        uint64_t offset = entry.headerOffset + LOCAL_HEADER_SIZE + filenameLength + extraFieldLength;
+        if (!item.delta) {
+            testContent(item, offset, scratch);
+        }
+
+        if (descriptor) {
+            uint8_t trailer[16];
+            source_->readAt(offset + entry.compressedSize, trailer);
+            ByteCursor fields(trailer, "data descriptor");
+            if (ByteCursor(trailer, "data descriptor").fixed<uint32_t>() == ZIP_DATA_DESCRIPTOR_SIGNATURE) {
+                fields.take(4);  // The signature is optional
+            }
+            if (fields.fixed<uint32_t>() != entry.crc32 ||
+                fields.fixed<uint32_t>() != entry.compressedSize ||
+                fields.fixed<uint32_t>() != entry.uncompressedSize) {
+                throw std::runtime_error("Data descriptor does not match the central directory");
+            }
+        }
+    } catch (const std::exception& e) {
+        item.errors.push_back(entry.filename + ": " + e.what());
+    }
+}
+
+void ArchiveReader::testContent(TestItem& item, uint64_t offset, std::span<uint8_t> scratch) {
+    const auto& entry = *item.entry;
+    uint32_t crc = 0;
+    uint64_t size = 0;
+    std::vector<uint32_t> memberCrcs(item.members.size(), 0);
+    size_t nextMember = 0;
+
+    // Members are checked as the bytes of their block stream past
+    auto checkMembers = [&](std::span<const uint8_t> chunk) {
+        uint64_t chunkEnd = size + chunk.size();
+        while (nextMember < item.members.size()) {
+            const auto& member = *item.members[nextMember];
+            uint64_t begin = member.offset;
+            uint64_t end = member.offset + member.entry.uncompressedSize;
+            if (std::max(begin, size) < std::min(end, chunkEnd)) {
+                uint64_t from = std::max(begin, size);
+                memberCrcs[nextMember] = crc32(memberCrcs[nextMember], chunk.data() + (from - size),
+                                               static_cast<uInt>(std::min(end, chunkEnd) - from));
+            }
+            if (end > chunkEnd) {
+                break;
+            }
+            if (memberCrcs[nextMember] != member.entry.crc32) {
+                item.errors.push_back(member.entry.filename + ": CRC32 check failed");
+            }
+            ++nextMember;
+        }
+    };
+    auto consume = [&](std::span<const uint8_t> chunk) {
+        crc = crc32(crc, chunk.data(), static_cast<uInt>(chunk.size()));
+        checkMembers(chunk);
+        size += chunk.size();
+        reportProgress(chunk.size(), 0);
+    };
+
+    if (entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE) {
+        // Stored data is only checksummed
+        uint64_t remaining = entry.compressedSize;
+        while (remaining > 0) {
+            auto chunk = scratch.first(static_cast<size_t>(std::min<uint64_t>(scratch.size(), remaining)));
+            source_->readAt(offset, chunk);
+            consume(chunk);
+            offset += chunk.size();
+            remaining -= chunk.size();
+        }
+    } else {
+        uint64_t remaining = entry.compressedSize;
+        auto decoder = decompressor().createDecoder(
+            [this, offset, remaining](std::span<uint8_t> buffer) mutable {
+                size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+                source_->readAt(offset, buffer.first(count));
+                offset += count;
+                remaining -= count;
+                return count;
+            });
+        while (size_t count = decoder->read(scratch)) {
+            consume(scratch.first(count));
+        }
+    }
+
+    checkMembers({});
+    for (size_t i = nextMember; i < item.members.size(); ++i) {
+        item.errors.push_back(item.members[i]->entry.filename + ": solid member out of block bounds");
+    }
+    if (crc != entry.crc32 || size != entry.uncompressedSize) {
+        throw std::runtime_error("CRC32 check failed");
+    }
+
+    // The holes of a sparse entry are not stored, so they check out as read
+    reportProgress(fileSize(entry) - entry.uncompressedSize, item.members.empty() ? 1 : item.members.size());
+}
+
+void ArchiveReader::setDeltaBase(std::shared_ptr<ArchiveReader> base) {
+    deltaBase_ = std::move(base);
+}
+
+void ArchiveReader::setSparse(bool sparse) {
+    sparse_ = sparse;
+}
+
+void ArchiveReader::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    memoryBudget_ = std::move(budget);
+}
+
+void ArchiveReader::setIoEngine(std::shared_ptr<IoEngine> engine) {
+    ioEngine_ = std::move(engine);
+}
+
+void ArchiveReader::setStats(std::shared_ptr<Stats> stats) {
+    stats_ = std::move(stats);
+}
+
+void ArchiveReader::setProgress(std::shared_ptr<ProgressBar> progress) {
+    progress_ = std::move(progress);
+}
+
+void ArchiveReader::setExtractMode(ExtractMode mode) {
+    extractMode_ = mode;
+}
+
+void ArchiveReader::setThreads(unsigned threads) {
+    threads_ = std::max(threads, 1u);
 }
 
 void ArchiveReader::extractFile(const ZipEntry& entry,
@@ -138,83 +894,649 @@ void ArchiveReader::extractFile(const ZipEntry& entry,
                               bool overwriteAll) {
     auto outputPath = outputDir / entry.filename;
 
-    // Create directory structure
-    createDirectoryStructure(outputPath.parent_path());
+    if (!prepareOutputPath(outputPath, entry, overwriteAll)) {
+        return;
+    }
 
-    // Check if file exists and should be overwritten
-    if (std::filesystem::exists(outputPath) && !overwriteAll) {
-        if (!shouldOverwrite(outputPath)) {
-            std::cout << "Skipping " << entry.filename << std::endl;
-            return;
+    // Holes are restored as the data streams past, whatever the file size
+    auto sparseIt = sparseManifest_.entries.find(entry.filename);
+    if (sparseIt != sparseManifest_.entries.end()) {
+        auto reservation = reserveMemory(streamingCost(entry, &sparseIt->second));
+        extractFileStreaming(entry, outputPath, &sparseIt->second);
+        return;
+    }
+
+    // Stored entries are copied by the kernel when the archive is a file
+    bool delta = deltaManifest_.entries.count(entry.filename) > 0;
+    if (entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE && !delta && !sparse_ &&
+        source_->descriptor() >= 0) {
+        extractStoredFile(entry, outputPath);
+        return;
+    }
+
+    // Entries too large for the memory budget are inflated in streaming mode
+    size_t cost = extractionCost(entry);
+    if (memoryBudget_ && !memoryBudget_->fits(cost)) {
+        if (delta) {
+            throw std::runtime_error("Delta entry " + entry.filename +
+                " does not fit in the memory limit");
+        }
+        auto reservation = reserveMemory(streamingCost(entry));
+        extractFileStreaming(entry, outputPath);
+        return;
+    }
+    auto reservation = reserveMemory(cost);
+    auto started = startTiming();
+
+    Buffer decompressedData = readEntryData(entry);
+    writeOutputFile(outputPath, decompressedData, entry);
+    recordEntry(entry, started);
+    reportProgress(decompressedData.size(), 1);
+}
+
+void ArchiveReader::extractStoredFile(const ZipEntry& entry,
+                                    const std::filesystem::path& outputPath) {
+    auto started = startTiming();
+    int archive = source_->descriptor();
+    uint64_t offset = entryDataOffset(entry);
+    if (entry.compressedSize != entry.uncompressedSize ||
+        offset + entry.compressedSize > source_->size()) {
+        throw std::runtime_error("Invalid stored entry: " + entry.filename);
+    }
+
+    // Checked before anything is written, from the page cache
+    MappedRange mapped(archive, offset, entry.compressedSize);
+    {
+        PhaseTimer timer(stats_.get(), Phase::Crc, entry.compressedSize);
+        if (crc32(0L, mapped.data().data(), static_cast<uInt>(entry.compressedSize)) != entry.crc32) {
+            throw std::runtime_error("CRC32 check failed for " + entry.filename);
+        }
+    }
+
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write, entry.compressedSize);
+        OutputFile outFile(outputPath);
+        uint64_t copied = copyRange(archive, offset, outFile.descriptor(), entry.compressedSize);
+        if (copied < entry.compressedSize) {
+            outFile.write(mapped.data().subspan(static_cast<size_t>(copied)));
+        }
+        outFile.close();
+    }
+
+    applyMetadata(outputPath, entry);
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
+
+void ArchiveReader::extractFileStreaming(const ZipEntry& entry,
+                                       const std::filesystem::path& outputPath,
+                                       const SparseMap* layout) {
+    auto started = startTiming();
+
+    // Only the data of sparse entries would be worth preallocating
+    OutputFile outFile(outputPath, layout ? 0 : entry.uncompressedSize, sparse_);
+    uint64_t offset = entryDataOffset(entry);
+    uint64_t remaining = entry.compressedSize;
+    uint64_t written = 0;
+    uint32_t crc = 0;
+
+    // The data of sparse entries is laid out around the holes
+    uint64_t fileOffset = 0;
+    size_t nextHole = 0;
+    auto place = [&](std::span<const uint8_t> chunk) {
+        while (true) {
+            if (layout && nextHole < layout->holes.size() &&
+                layout->holes[nextHole].offset == fileOffset) {
+                outFile.skip(layout->holes[nextHole].length);
+                fileOffset += layout->holes[nextHole].length;
+                reportProgress(layout->holes[nextHole].length, 0);
+                ++nextHole;
+                continue;
+            }
+            if (chunk.empty()) {
+                return;
+            }
+            size_t count = chunk.size();
+            if (layout && nextHole < layout->holes.size()) {
+                count = static_cast<size_t>(
+                    std::min<uint64_t>(count, layout->holes[nextHole].offset - fileOffset));
+            }
+            outFile.write(chunk.first(count));
+            fileOffset += count;
+            chunk = chunk.subspan(count);
+        }
+    };
+
+    TimePoint inCallbacks;  // Spent reading and writing, not inflating
+    auto inflateStarted = startTiming();
+    {
+        TraceSpan span("inflate");  // Encloses the read and write spans
+        auto read = [&](std::span<uint8_t> buffer) {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+            PhaseTimer timer(stats_.get(), Phase::Read, count);
+            source_->readAt(offset, buffer.first(count));
+            inCallbacks += timer.stop();
+            offset += count;
+            remaining -= count;
+            return count;
+        };
+        auto write = [&](std::span<const uint8_t> chunk) {
+            PhaseTimer crcTimer(stats_.get(), Phase::Crc, chunk.size());
+            crc = crc32(crc, chunk.data(), static_cast<uInt>(chunk.size()));
+            inCallbacks += crcTimer.stop();
+            written += chunk.size();
+
+            PhaseTimer writeTimer(stats_.get(), Phase::Write, chunk.size());
+            place(chunk);
+            inCallbacks += writeTimer.stop();
+            reportProgress(chunk.size(), 0);
+        };
+
+        // A decoder of its own, so that entries can be extracted side by side
+        std::unique_ptr<Compressor::Decoder> decoder;
+        if (entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE) {
+            decoder = std::make_unique<StoredDecoder>(read);
+        } else {
+            decoder = decompressor().createDecoder(read);
+        }
+        Buffer chunk(COPY_CHUNK_SIZE);
+        while (size_t count = decoder->read(chunk.span())) {
+            write(chunk.span().first(count));
+        }
+        span.setBytes(written);
+    }
+
+    if (stats_) {
+        auto end = TimePoint::now();
+        stats_->addPhase(Phase::Inflate,
+                         end.wallNs - inflateStarted.wallNs - inCallbacks.wallNs,
+                         end.cpuNs - inflateStarted.cpuNs - inCallbacks.cpuNs,
+                         entry.compressedSize, written);
+    }
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write);
+        place({});  // Trailing holes
+        outFile.close();
+    }
+
+    // Verify CRC32
+    if (crc != entry.crc32 || written != entry.uncompressedSize ||
+        (layout && fileOffset != layout->size)) {
+        std::filesystem::remove(outputPath);
+        throw std::runtime_error("CRC32 check failed for " + entry.filename);
+    }
+
+    applyMetadata(outputPath, entry);
+    recordEntry(entry, started);
+    reportProgress(0, 1);
+}
+
+void ArchiveReader::extractSolidMember(const SolidMember& member,
+                                     const std::filesystem::path& outputDir,
+                                     bool overwriteAll) {
+    const auto& entry = member.entry;
+    auto outputPath = outputDir / entry.filename;
+
+    if (!prepareOutputPath(outputPath, entry, overwriteAll)) {
+        return;
+    }
+
+    auto data = solidMemberData(member);
+    writeOutputFile(outputPath, data, entry);
+    reportProgress(data.size(), 1);
+}
+
+std::span<const uint8_t> ArchiveReader::solidMemberData(const SolidMember& member) {
+    return sliceMember(member, loadSolidBlock(member.block));
+}
+
+std::span<const uint8_t> ArchiveReader::sliceMember(const SolidMember& member,
+                                                  const Buffer& blockData) const {
+    const auto& entry = member.entry;
+    if (member.offset + entry.uncompressedSize > blockData.size()) {
+        throw std::runtime_error("Solid member out of block bounds: " + entry.filename);
+    }
+
+    std::span<const uint8_t> data(blockData.data() + member.offset, entry.uncompressedSize);
+
+    // Verify CRC32
+    PhaseTimer crcTimer(stats_.get(), Phase::Crc, data.size());
+    uint32_t crc = crc32(0L, data.data(), static_cast<uInt>(data.size()));
+    crcTimer.stop();
+    if (crc != entry.crc32) {
+        throw std::runtime_error("CRC32 check failed for " + entry.filename);
+    }
+    return data;
+}
+
+const Buffer& ArchiveReader::loadSolidBlock(uint32_t block) {
+    if (cachedBlock_ != block) {
+        const auto& blockEntry = solidBlocks_.at(block);
+        size_t cost = extractionCost(blockEntry);
+        if (memoryBudget_ && !memoryBudget_->fits(cost)) {
+            throw std::runtime_error("Solid block " + blockEntry.filename +
+                " does not fit in the memory limit");
         }
+
+        auto reservation = reserveMemory(cost);
+        auto started = startTiming();
+        cachedBlockData_ = readEntryData(blockEntry);
+        cachedBlockReservation_ = std::move(reservation);
+        cachedBlock_ = block;
+
+        // The block is the unit of compression, so it is reported as one entry
+        recordEntry(blockEntry, started);
     }
+    return cachedBlockData_;
+}
 
+uint64_t ArchiveReader::entryDataOffset(const ZipEntry& entry) {
     // Read local file header
-    archive_.seekg(entry.headerOffset);
+    uint8_t header[LOCAL_HEADER_SIZE];
+    source_->readAt(entry.headerOffset, header);
 
-    uint32_t signature;
-    archive_.read(reinterpret_cast<char*>(&signature), 4);
-    if (signature != ZIP_LOCAL_HEADER_SIGNATURE) {
+    ByteCursor cursor(header, "local file header");
+    if (cursor.fixed<uint32_t>() != ZIP_LOCAL_HEADER_SIGNATURE) {
         throw std::runtime_error("Invalid local file header");
     }
 
     // Skip to the compressed data
-    archive_.seekg(26, std::ios::cur);  // Skip fixed-size fields
-    
-    uint16_t filenameLength;
-    uint16_t extraFieldLength;
-    archive_.read(reinterpret_cast<char*>(&filenameLength), 2);
-    archive_.read(reinterpret_cast<char*>(&extraFieldLength), 2);
-    
-    archive_.seekg(filenameLength + extraFieldLength, std::ios::cur);
+    cursor.take(22);  // Skip fixed-size fields
+    uint16_t filenameLength = cursor.fixed<uint16_t>();
+    uint16_t extraFieldLength = cursor.fixed<uint16_t>();
+
+    return entry.headerOffset + LOCAL_HEADER_SIZE + filenameLength + extraFieldLength;
+}
+
+Buffer ArchiveReader::readCompressedData(const ZipEntry& entry) {
+    uint64_t offset = entryDataOffset(entry);
 
     // Read compressed data
-    std::vector<uint8_t> compressedData(entry.compressedSize);
-    archive_.read(reinterpret_cast<char*>(compressedData.data()),
-                 entry.compressedSize);
+    PhaseTimer timer(stats_.get(), Phase::Read, entry.compressedSize);
+    Buffer compressedData(entry.compressedSize);
+    source_->readAt(offset, compressedData.span());
+
+    return compressedData;
+}
+
+Buffer ArchiveReader::readEntryData(const ZipEntry& entry) {
+    auto deltaIt = deltaManifest_.entries.find(entry.filename);
+    if (deltaIt != deltaManifest_.entries.end()) {
+        return expandDelta(entry, deltaIt->second);
+    }
+    return decodeEntry(entry, decompressor());
+}
+
+Buffer ArchiveReader::decodeEntry(const ZipEntry& entry, Compressor& compressor) {
+    Buffer compressedData = readCompressedData(entry);
 
     // Decompress data
-    std::vector<uint8_t> decompressedData = compressor_->decompress(
-        compressedData, entry.uncompressedSize);
+    Buffer decompressedData;
+    if (entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE) {
+        decompressedData = std::move(compressedData);
+    } else {
+        PhaseTimer timer(stats_.get(), Phase::Inflate);
+        compressor.decompress(compressedData, decompressedData, entry.uncompressedSize);
+        timer.setBytes(compressedData.size(), decompressedData.size());
+    }
 
     // Verify CRC32
+    PhaseTimer crcTimer(stats_.get(), Phase::Crc, decompressedData.size());
     uint32_t crc = crc32(0L, decompressedData.data(), decompressedData.size());
+    crcTimer.stop();
+    if (crc != entry.crc32) {
+        throw std::runtime_error("CRC32 check failed for " + entry.filename);
+    }
+
+    return decompressedData;
+}
+
+Buffer ArchiveReader::inflateEntry(const ZipEntry& entry) {
+    uint64_t offset = entryDataOffset(entry);
+    Buffer data(entry.uncompressedSize);
+    if (entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE) {
+        if (entry.compressedSize != entry.uncompressedSize) {
+            throw std::runtime_error("Invalid stored entry: " + entry.filename);
+        }
+        PhaseTimer timer(stats_.get(), Phase::Read, entry.compressedSize);
+        source_->readAt(offset, data.span());
+    } else {
+        // Unlike readEntryData(), inflates with a decoder of its own
+        PhaseTimer timer(stats_.get(), Phase::Inflate);
+        uint64_t remaining = entry.compressedSize;
+        auto decoder = decompressor().createDecoder(
+            [this, offset, remaining](std::span<uint8_t> buffer) mutable {
+                size_t count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+                source_->readAt(offset, buffer.first(count));
+                offset += count;
+                remaining -= count;
+                return count;
+            });
+        size_t filled = 0;
+        while (filled < data.size()) {
+            size_t count = decoder->read(data.span().subspan(filled));
+            if (count == 0) {
+                break;
+            }
+            filled += count;
+        }
+        uint8_t extra;
+        if (filled != data.size() || decoder->read({&extra, 1}) != 0) {
+            throw std::runtime_error("CRC32 check failed for " + entry.filename);
+        }
+        timer.setBytes(entry.compressedSize, filled);
+    }
+
+    PhaseTimer crcTimer(stats_.get(), Phase::Crc, data.size());
+    uint32_t crc = crc32(0L, data.data(), static_cast<uInt>(data.size()));
+    crcTimer.stop();
     if (crc != entry.crc32) {
         throw std::runtime_error("CRC32 check failed for " + entry.filename);
     }
+    return data;
+}
+
+Buffer ArchiveReader::expandDelta(const ZipEntry& entry,
+                                              const DeltaReference& reference) {
+    if (!deltaBase_) {
+        throw std::runtime_error(entry.filename +
+            " is stored as a delta; the base archive is required");
+    }
+
+    const ZipEntry* baseEntry = deltaBase_->findEntry(entry.filename);
+    if (!baseEntry || baseEntry->crc32 != reference.baseCrc32 ||
+        baseEntry->uncompressedSize != reference.baseSize) {
+        throw std::runtime_error("Base archive does not hold the version " +
+            entry.filename + " was encoded against");
+    }
+    Buffer base;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Read, baseEntry->uncompressedSize);
+        base = deltaBase_->read(entry.filename);
+    }
+    Buffer compressedData = readCompressedData(entry);
+
+    // The delta is deflated against the tail of the base version
+    Buffer content;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Inflate);
+        auto deltaCompressor = Compressor::create("deflate");
+        deltaCompressor->setDictionary(deltaDictionary(base));
+        Buffer delta;
+        deltaCompressor->decompress(compressedData, delta);
+        applyDelta(base, delta, content);
+        timer.setBytes(compressedData.size(), content.size());
+    }
+
+    PhaseTimer crcTimer(stats_.get(), Phase::Crc, content.size());
+    uint32_t crc = crc32(0L, content.data(), static_cast<uInt>(content.size()));
+    crcTimer.stop();
+    if (crc != entry.crc32 || content.size() != entry.uncompressedSize) {
+        throw std::runtime_error("CRC32 check failed for " + entry.filename);
+    }
+
+    return content;
+}
+
+bool ArchiveReader::prepareOutputPath(const std::filesystem::path& outputPath,
+                                    const ZipEntry& entry,
+                                    bool overwriteAll) {
+    if (extractMode_ != ExtractMode::Overwrite) {
+        // Unchanged files are neither inflated nor written
+        bool exists = std::filesystem::exists(outputPath);
+        if ((!exists && extractMode_ == ExtractMode::Freshen) ||
+            (exists && isUnchanged(outputPath, entry))) {
+            ++skippedFiles_;
+            reportProgress(fileSize(entry), 1);
+            return false;
+        }
+        createDirectoryStructure(outputPath.parent_path());
+        return true;
+    }
+
+    // Create directory structure
+    createDirectoryStructure(outputPath.parent_path());
+
+    // Check if file exists and should be overwritten
+    if (std::filesystem::exists(outputPath) && !overwriteAll) {
+        if (!shouldOverwrite(outputPath)) {
+            std::cout << "Skipping " << entry.filename << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ArchiveReader::isUnchanged(const std::filesystem::path& path, const ZipEntry& entry) const {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error) ||
+        std::filesystem::file_size(path, error) != fileSize(entry) || error) {
+        return false;
+    }
+
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (!error && toDosDateTime(modified) ==
+            std::make_pair(entry.modificationTime, entry.modificationDate)) {
+        return true;
+    }
+
+    // The CRC of sparse entries covers their data only
+    if (sparseMap(entry)) {
+        return false;
+    }
+
+    // Same size but another time, e.g. after a checkout: compare content
+    PhaseTimer timer(stats_.get(), Phase::Crc, entry.uncompressedSize);
+    InputFile file(path);
+    Buffer chunk(COMPARE_CHUNK_SIZE);
+    uint32_t crc = 0;
+    while (size_t count = file.read(chunk.span())) {
+        crc = crc32(crc, chunk.data(), static_cast<uInt>(count));
+    }
+    return crc == entry.crc32;
+}
+
+void ArchiveReader::writeOutputFile(const std::filesystem::path& outputPath,
+                                  std::span<const uint8_t> data,
+                                  const ZipEntry& entry) const {
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write, data.size());
+        OutputFile outFile(outputPath, data.size(), sparse_);
+        outFile.write(data);
+        outFile.close();
+    }
+
+    applyMetadata(outputPath, entry);
+}
+
+void ArchiveReader::applyMetadata(const std::filesystem::path& outputPath,
+                                const ZipEntry& entry) const {
+    PhaseTimer timer(stats_.get(), Phase::Permissions);
+
+    // Set file permissions (archives from other tools may not carry any)
+    if (entry.externalAttrs >> 16) {
+        std::filesystem::permissions(outputPath,
+            static_cast<std::filesystem::perms>(entry.externalAttrs >> 16));
+    }
+
+    // Restored times let update mode recognise unchanged files cheaply
+    if (entry.modificationDate != 0) {
+        std::filesystem::last_write_time(outputPath,
+            fromDosDateTime(entry.modificationTime, entry.modificationDate));
+    }
+}
+
+size_t ArchiveReader::extractionCost(const ZipEntry& entry) const {
+    // Buffers count at their pooled size; inflating asks for one spare byte
+    size_t cost = BufferPool::roundUp(entry.compressedSize) +
+                  BufferPool::roundUp(static_cast<size_t>(entry.uncompressedSize) + 1) +
+                  Compressor::WORKING_MEMORY +
+                  OutputFile::memoryFor(entry.uncompressedSize);
+
+    // Delta entries also hold the base version and the inflated delta
+    auto deltaIt = deltaManifest_.entries.find(entry.filename);
+    if (deltaIt != deltaManifest_.entries.end()) {
+        cost += 2 * BufferPool::roundUp(static_cast<size_t>(deltaIt->second.baseSize)) +
+                BufferPool::roundUp(entry.uncompressedSize);
+    }
+    return cost;
+}
+
+size_t ArchiveReader::streamingCost(const ZipEntry& entry, const SparseMap* layout) const {
+    // The output file of a sparse entry is not preallocated or written directly
+    return Compressor::STREAMING_MEMORY + OutputFile::memoryFor(layout ? 0 : entry.uncompressedSize);
+}
+
+TimePoint ArchiveReader::startTiming() const {
+    return stats_ ? TimePoint::now() : TimePoint();
+}
+
+void ArchiveReader::recordEntry(const ZipEntry& entry, const TimePoint& started) {
+    if (stats_) {
+        stats_->addEntry(entry.filename, entry.uncompressedSize, entry.compressedSize,
+                         TimePoint::now().wallNs - started.wallNs);
+    }
+}
+
+void ArchiveReader::reportProgress(uint64_t bytes, uint64_t files) {
+    if (progress_) {
+        progress_->addBytes(bytes);
+        progress_->addFiles(files);
+    }
+}
 
-    // Write output file
-    std::ofstream outFile(outputPath, std::ios::binary);
-    if (!outFile) {
-        throw std::runtime_error("Failed to create output file: " + outputPath.string());
+MemoryBudget::Reservation ArchiveReader::reserveMemory(size_t bytes) {
+    if (!memoryBudget_) {
+        return {};
     }
 
-    outFile.write(reinterpret_cast<const char*>(decompressedData.data()),
-                 decompressedData.size());
-    outFile.close();
+    // This thread must not wait for memory it holds itself
+    dropCachedBlock();
+    return memoryBudget_->acquire(bytes);
+}
+
+MemoryBudget::Reservation ArchiveReader::acquireMemory(size_t bytes) {
+    return memoryBudget_ ? memoryBudget_->acquire(bytes) : MemoryBudget::Reservation();
+}
 
-    // Set file permissions
-    std::filesystem::permissions(outputPath,
-        static_cast<std::filesystem::perms>(entry.externalAttrs >> 16));
+void ArchiveReader::dropCachedBlock() {
+    cachedBlock_ = UINT32_MAX;
+    cachedBlockData_.reset();
+    cachedBlockReservation_.release();
 }
 
 std::vector<std::string> ArchiveReader::listFiles() const {
     std::vector<std::string> files;
-    files.reserve(entries_.size());
+    files.reserve(entries_.size() + solidMembers_.size());
     
     for (const auto& entry : entries_) {
         files.push_back(entry.filename);
     }
+
+    for (const auto& member : solidMembers_) {
+        files.push_back(member.entry.filename);
+    }
     
     return files;
 }
 
+ArchiveReader::EntryRange ArchiveReader::entries() const {
+    return {EntryIterator(this, 0), EntryIterator(this, entries_.size() + solidMembers_.size())};
+}
+
+EntryStorage ArchiveReader::storage(const ZipEntry& entry) const {
+    auto it = nameIndex_.find(entry.filename);
+    if (it != nameIndex_.end() && it->second.member) {
+        return EntryStorage::Solid;
+    }
+    if (deltaManifest_.entries.count(entry.filename)) {
+        return EntryStorage::Delta;
+    }
+    if (sparseManifest_.entries.count(entry.filename)) {
+        return EntryStorage::Sparse;
+    }
+    return entry.compressionMethod == ZIP_COMPRESSION_METHOD_STORE
+        ? EntryStorage::Stored : EntryStorage::Deflated;
+}
+
+const DeltaReference* ArchiveReader::deltaReference(const ZipEntry& entry) const {
+    auto it = deltaManifest_.entries.find(entry.filename);
+    return it != deltaManifest_.entries.end() ? &it->second : nullptr;
+}
+
+uint64_t ArchiveReader::fileSize(const ZipEntry& entry) const {
+    const SparseMap* map = sparseMap(entry);
+    return map ? map->size : entry.uncompressedSize;
+}
+
+const SparseMap* ArchiveReader::sparseMap(const ZipEntry& entry) const {
+    auto it = sparseManifest_.entries.find(entry.filename);
+    return it != sparseManifest_.entries.end() ? &it->second : nullptr;
+}
+
+const SolidMember* ArchiveReader::solidMember(const ZipEntry& entry) const {
+    auto it = nameIndex_.find(entry.filename);
+    return it != nameIndex_.end() ? it->second.member : nullptr;
+}
+
+const ZipEntry& ArchiveReader::solidBlock(uint32_t block) const {
+    return solidBlocks_.at(block);
+}
+
+void ArchiveReader::copyRawData(const ZipEntry& entry, ArchiveSink& sink) {
+    uint64_t offset = entryDataOffset(entry);
+    uint64_t remaining = entry.compressedSize;
+    if (offset + remaining > source_->size()) {
+        throw std::runtime_error("Invalid entry: " + entry.filename);
+    }
+
+    PhaseTimer timer(stats_.get(), Phase::Read, remaining);
+    if (source_->descriptor() >= 0 && remaining > 0) {
+        uint64_t copied = sink.copyFrom(source_->descriptor(), offset, remaining);
+        offset += copied;
+        remaining -= copied;
+    }
+
+    // Whatever the kernel did not copy goes through a bounded buffer
+    Buffer chunk(static_cast<size_t>(std::min<uint64_t>(remaining, COPY_CHUNK_SIZE)));
+    while (remaining > 0) {
+        auto part = chunk.span().first(static_cast<size_t>(std::min<uint64_t>(remaining, chunk.size())));
+        source_->readAt(offset, part);
+        sink.write(part);
+        offset += part.size();
+        remaining -= part.size();
+    }
+}
+
+const ZipEntry& ArchiveReader::entryAt(size_t index) const {
+    return index < entries_.size() ? entries_[index] : solidMembers_[index - entries_.size()].entry;
+}
+
+uint64_t ArchiveReader::totalSize() const {
+    uint64_t size = 0;
+    for (const auto& entry : entries_) {
+        size += fileSize(entry);
+    }
+    for (const auto& member : solidMembers_) {
+        size += member.entry.uncompressedSize;
+    }
+    return size;
+}
+
 bool ArchiveReader::shouldOverwrite(const std::filesystem::path& path) const {
+    // The bar would redraw over the question and the answer being typed
+    if (progress_) {
+        progress_->pause();
+    }
     std::cout << "File already exists: " << path.string() << std::endl;
     std::cout << "Overwrite? (y/N/all): ";
     
     std::string response;
     std::getline(std::cin, response);
+    if (progress_) {
+        progress_->resume();
+    }
     
     if (response == "all") {
         return true;  // Caller should set overwriteAll = true
@@ -225,6 +1547,7 @@ bool ArchiveReader::shouldOverwrite(const std::filesystem::path& path) const {
 
 void ArchiveReader::createDirectoryStructure(const std::filesystem::path& path) const {
     if (!path.empty() && !std::filesystem::exists(path)) {
+        PhaseTimer timer(stats_.get(), Phase::Mkdir);
         std::filesystem::create_directories(path);
     }
 }
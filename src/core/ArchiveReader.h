@@ -1,22 +1,151 @@
 #pragma once
 
+#include "ArchiveIO.h"
 #include "Compressor.h"
+#include "Delta.h"
+#include "SolidBlock.h"
+#include "Sparse.h"
+#include "ZipEntry.h"
+#include "../util/IoEngine.h"
+#include "../util/MemoryBudget.h"
+#include "../util/ProgressBar.h"
+#include "../util/Stats.h"
+#include <atomic>
 #include <filesystem>
-#include <fstream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace miniwr {
 
-struct ZipEntry;  // Forward declaration
+/**
+ * @brief How an entry is stored in the archive
+ */
+enum class EntryStorage {
+    Stored,    ///< Uncompressed
+    Deflated,  ///< Compressed on its own
+    Solid,     ///< Slice of a solid block; compressedSize is its share of the block
+    Delta,     ///< Compressed against the same file in a base archive
+    Sparse     ///< Holes left out; uncompressedSize is that of the data between them (see fileSize())
+};
+
+/**
+ * @brief What extraction does with files that already exist
+ */
+enum class ExtractMode {
+    Overwrite,  ///< Ask before overwriting, unless overwriteAll is set
+    Update,     ///< Write new and changed files, skip unchanged ones
+    Freshen     ///< Only rewrite existing files that changed
+};
+
+/**
+ * @brief Pull-based reader of the uncompressed content of one entry
+ *
+ * Returned by ArchiveReader::open(); must not outlive the reader.
+ */
+class EntryStream {
+public:
+    /**
+     * @brief Metadata of the entry being read
+     */
+    const ZipEntry& entry() const { return entry_; }
+
+    /**
+     * @brief Read the next bytes of the entry
+     * @param buffer Destination
+     * @return Number of bytes read, 0 at the end of the entry
+     * @throws std::runtime_error on corrupt data; the CRC is checked at the end
+     */
+    size_t read(std::span<uint8_t> buffer);
+
+private:
+    friend class ArchiveReader;
+
+    EntryStream(const ZipEntry& entry,
+                std::unique_ptr<Compressor::Decoder> decoder,
+                MemoryBudget::Reservation reservation);
+    EntryStream(const ZipEntry& entry, Buffer content);
+
+    ZipEntry entry_;
+    std::unique_ptr<Compressor::Decoder> decoder_;
+    Buffer content_;  // Entries that are expanded in memory anyway
+    MemoryBudget::Reservation reservation_;
+    uint64_t position_ = 0;
+    uint32_t crc_ = 0;
+};
+
+/**
+ * @brief Outcome of ArchiveReader::test()
+ */
+struct TestReport {
+    uint64_t entries = 0;             ///< Entries checked
+    uint64_t bytes = 0;               ///< Size of the files checked, holes included
+    std::vector<std::string> errors;  ///< One message per damaged entry
+
+    bool ok() const { return errors.empty(); }
+};
 
 /**
  * @brief ZIP archive reader
  */
 class ArchiveReader {
 public:
+    /**
+     * @brief Forward iterator over the entries, solid members included
+     */
+    class EntryIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ZipEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ZipEntry*;
+        using reference = const ZipEntry&;
+
+        EntryIterator() = default;
+
+        reference operator*() const { return reader_->entryAt(index_); }
+        pointer operator->() const { return &reader_->entryAt(index_); }
+        EntryIterator& operator++() { ++index_; return *this; }
+        EntryIterator operator++(int) { auto previous = *this; ++index_; return previous; }
+        bool operator==(const EntryIterator& other) const = default;
+
+    private:
+        friend class ArchiveReader;
+        EntryIterator(const ArchiveReader* reader, size_t index) : reader_(reader), index_(index) {}
+
+        const ArchiveReader* reader_ = nullptr;
+        size_t index_ = 0;
+    };
+
+    /**
+     * @brief Range of entries, usable in range-based for loops
+     */
+    struct EntryRange {
+        EntryIterator first;
+        EntryIterator last;
+
+        EntryIterator begin() const { return first; }
+        EntryIterator end() const { return last; }
+    };
+
+    /**
+     * @brief Open an archive
+     *
+     * Reads the central directory and the solid, delta and sparse indexes
+     * when present, each through its local header. The preset dictionary
+     * and file data are read on first decompression.
+     */
     explicit ArchiveReader(const std::filesystem::path& archivePath);
+
+    /**
+     * @brief Read the archive from a source, e.g. ArchiveSource::memory()
+     */
+    explicit ArchiveReader(std::unique_ptr<ArchiveSource> source);
     ~ArchiveReader();
 
     /**
@@ -27,22 +156,316 @@ public:
     void extractAll(const std::filesystem::path& outputDir,
                    bool overwriteAll = false);
 
+    /**
+     * @brief Extract a single file from the archive
+     *
+     * Solid members only inflate the block that holds them.
+     *
+     * @param filename Name of the entry to extract
+     * @param outputDir Output directory path
+     * @param overwriteAll If true, overwrite existing files without asking
+     */
+    void extract(const std::string& filename,
+                 const std::filesystem::path& outputDir,
+                 bool overwriteAll = false);
+
     /**
      * @brief List all files in the archive
      * @return Vector of filenames
      */
     std::vector<std::string> listFiles() const;
 
+    /**
+     * @brief Total size of the listed files once extracted
+     */
+    uint64_t totalSize() const;
+
+    /**
+     * @brief Size of the file an entry extracts to
+     *
+     * The uncompressed size, except for sparse entries, whose data leaves
+     * out their holes.
+     */
+    uint64_t fileSize(const ZipEntry& entry) const;
+
+    /**
+     * @brief All entries with their metadata, in the order of listFiles()
+     *
+     * Served from what the constructor read: the central directory and the
+     * small internal indexes, never file data or the dictionary.
+     */
+    EntryRange entries() const;
+
+    /**
+     * @brief How an entry returned by entries() or findEntry() is stored
+     */
+    EntryStorage storage(const ZipEntry& entry) const;
+
+    /**
+     * @brief Base version a delta entry was encoded against, nullptr for other entries
+     */
+    const DeltaReference* deltaReference(const ZipEntry& entry) const;
+
+    /**
+     * @brief Holes left out of a sparse entry, nullptr for other entries
+     */
+    const SparseMap* sparseMap(const ZipEntry& entry) const;
+
+    /**
+     * @brief Location of a solid member, nullptr for other entries
+     */
+    const SolidMember* solidMember(const ZipEntry& entry) const;
+
+    /**
+     * @brief Archive entry holding a solid block
+     * @param block Block index, e.g. SolidMember::block
+     */
+    const ZipEntry& solidBlock(uint32_t block) const;
+
+    /**
+     * @brief Preset dictionary the entries were compressed against, empty if none
+     *
+     * Read from the archive on first use, like any decompression.
+     */
+    std::span<const uint8_t> dictionary();
+
+    /**
+     * @brief Append the compressed data of an entry to a sink as is
+     *
+     * Used to copy entries between archives without recompressing them.
+     * File-backed archives are copied by the kernel where the sink allows.
+     *
+     * @param entry Archive entry; solid members are copied with their block
+     * @param sink Destination
+     */
+    void copyRawData(const ZipEntry& entry, ArchiveSink& sink);
+
+    /**
+     * @brief Open an entry for reading without extracting it
+     *
+     * Regular entries are inflated on demand from the archive with bounded
+     * buffers (Compressor::STREAMING_MEMORY, reserved from the memory budget).
+     * Solid members, delta and sparse entries are expanded in memory first.
+     * Regular entries may be opened from several threads at once; the
+     * memory of the cached solid block, if any, stays reserved meanwhile.
+     *
+     * @param entry Entry, e.g. from entries() or findEntry()
+     * @return Stream of the uncompressed content
+     */
+    EntryStream open(const ZipEntry& entry);
+
+    /**
+     * @brief Verify every entry without writing anything
+     *
+     * Entries are inflated into a scratch buffer that is discarded, and
+     * their CRC and sizes are checked against both the local and the
+     * central header. Stored entries are only checksummed. Delta entries
+     * are checked against the base archive (setDeltaBase()) after the
+     * others, on the calling thread.
+     *
+     * @param threads Number of entries checked in parallel
+     * @return Damaged entries; corruption is reported, not thrown
+     */
+    TestReport test(unsigned threads = 1);
+
+    /**
+     * @brief Look up an entry by name
+     * @param filename Name of the entry
+     * @return Entry metadata, or nullptr if the archive has no such entry
+     */
+    const ZipEntry* findEntry(const std::string& filename) const;
+
+    /**
+     * @brief Read the content of an entry into memory
+     * @param filename Name of the entry
+     * @return Uncompressed, CRC-verified content
+     */
+    Buffer read(const std::string& filename);
+
+    /**
+     * @brief Set the archive that delta entries were encoded against
+     * @param base Base archive reader
+     */
+    void setDeltaBase(std::shared_ptr<ArchiveReader> base);
+
+    /**
+     * @brief Write the all-zero blocks of extracted files as holes
+     *
+     * Holes recorded in the archive (ArchiveWriter::setSparse()) are
+     * restored either way. Stored entries are then written instead of
+     * copied by the kernel.
+     *
+     * @param sparse Whether to scan extracted data for zero blocks
+     */
+    void setSparse(bool sparse);
+
+    /**
+     * @brief Cap the memory held by extraction buffers
+     *
+     * Entries whose in-memory extraction would not fit are inflated in
+     * streaming mode with bounded buffers.
+     *
+     * @param budget Shared memory budget (nullptr for unlimited)
+     */
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+
+    /**
+     * @brief Create the small files of extractAll() in batches
+     *
+     * Entries up to IoEngine::SLOT_SIZE are inflated into memory and
+     * written IoEngine::depth() files at a time.
+     *
+     * @param engine I/O engine (nullptr writes files one by one)
+     */
+    void setIoEngine(std::shared_ptr<IoEngine> engine);
+
+    /**
+     * @brief Collect per-phase timings of the entries extracted from now on
+     * @param stats Statistics collector (nullptr disables collection)
+     */
+    void setStats(std::shared_ptr<Stats> stats);
+
+    /**
+     * @brief Report output bytes and files as they are extracted
+     * @param progress Progress counters (nullptr disables reporting)
+     */
+    void setProgress(std::shared_ptr<ProgressBar> progress);
+
+    /**
+     * @brief Choose how existing files are handled by extraction
+     *
+     * In Update and Freshen mode an existing file is left alone when its
+     * size and modification time match the entry, or, if only the time
+     * differs, when its CRC does. Other files are overwritten without asking.
+     */
+    void setExtractMode(ExtractMode mode);
+
+    /**
+     * @brief Extract up to this many entries at once
+     *
+     * Applies where nothing can prompt: extractAll() with overwriteAll, or
+     * in Update and Freshen mode. Each task streams its entry to disk with
+     * a decoder of its own, and a solid block is inflated whole by one task;
+     * delta entries follow one at a time. The batched I/O engine, when set,
+     * takes precedence.
+     *
+     * @param threads Number of entries extracted concurrently
+     */
+    void setThreads(unsigned threads);
+
+    /**
+     * @brief Number of entries left alone by Update or Freshen mode so far
+     */
+    uint64_t skippedFiles() const { return skippedFiles_; }
+
 private:
-    std::filesystem::path archivePath_;
-    std::ifstream archive_;
+    std::unique_ptr<ArchiveSource> source_;
     std::unique_ptr<Compressor> compressor_;
     std::vector<ZipEntry> entries_;
 
+    // Preset dictionary: located when opening, read on first decompression
+    std::optional<ZipEntry> dictionaryEntry_;
+    Buffer dictionary_;
+    std::once_flag dictionaryLoaded_;
+
+    // Solid mode: block entries by index and the members packed into them
+    std::vector<ZipEntry> solidBlocks_;
+    std::vector<SolidMember> solidMembers_;
+    uint32_t cachedBlock_ = UINT32_MAX;
+    Buffer cachedBlockData_;
+    MemoryBudget::Reservation cachedBlockReservation_;
+
+    std::shared_ptr<MemoryBudget> memoryBudget_;
+    std::shared_ptr<IoEngine> ioEngine_;
+    std::shared_ptr<Stats> stats_;
+    std::shared_ptr<ProgressBar> progress_;
+    ExtractMode extractMode_ = ExtractMode::Overwrite;
+    std::atomic<uint64_t> skippedFiles_{0};
+    unsigned threads_ = 1;
+
+    // Delta mode: entries encoded against the same file in a base archive
+    DeltaManifest deltaManifest_;
+    std::shared_ptr<ArchiveReader> deltaBase_;
+
+    // Sparse mode: entries stored without their holes
+    SparseManifest sparseManifest_;
+    bool sparse_ = false;
+
+    struct EntryRef {
+        const ZipEntry* entry;
+        const SolidMember* member;  // Set for solid members only
+    };
+    std::unordered_map<std::string, EntryRef> nameIndex_;
+
+    // test(): one archive entry, with the members of a solid block
+    struct TestItem {
+        const ZipEntry* entry;
+        std::vector<const SolidMember*> members;  // By offset in the block
+        bool delta = false;
+        std::vector<std::string> errors;
+    };
+
+    const ZipEntry& entryAt(size_t index) const;
     void readCentralDirectory();
+    void findDictionary();
+    void loadDictionary();
+    Compressor& decompressor();
+    void loadDeltaManifest();
+    void loadSparseManifest();
+    void loadSolidIndex();
+    void buildNameIndex();
+    uint64_t entryDataOffset(const ZipEntry& entry);
+    Buffer readCompressedData(const ZipEntry& entry);
+    void testItem(TestItem& item, std::span<uint8_t> scratch);
+    void testContent(TestItem& item, uint64_t offset, std::span<uint8_t> scratch);
+    Buffer readEntryData(const ZipEntry& entry);
+    Buffer decodeEntry(const ZipEntry& entry, Compressor& compressor);
+    Buffer expandDelta(const ZipEntry& entry,
+                      const DeltaReference& reference);
+    const Buffer& loadSolidBlock(uint32_t block);
+    std::span<const uint8_t> solidMemberData(const SolidMember& member);
+    std::span<const uint8_t> sliceMember(const SolidMember& member, const Buffer& blockData) const;
+    void extractAllBatched(const std::filesystem::path& outputDir,
+                          bool overwriteAll);
+    void extractAllConcurrently(const std::filesystem::path& outputDir,
+                               bool overwriteAll);
+    void extractFileConcurrently(const ZipEntry& entry,
+                                const std::filesystem::path& outputDir,
+                                bool overwriteAll);
+    void extractSolidBlock(uint32_t block,
+                          std::span<const SolidMember* const> members,
+                          const std::filesystem::path& outputDir,
+                          bool overwriteAll);
+    Buffer inflateEntry(const ZipEntry& entry);
     void extractFile(const ZipEntry& entry,
                     const std::filesystem::path& outputDir,
                     bool overwriteAll);
+    void extractStoredFile(const ZipEntry& entry,
+                          const std::filesystem::path& outputPath);
+    void extractFileStreaming(const ZipEntry& entry,
+                             const std::filesystem::path& outputPath,
+                             const SparseMap* layout = nullptr);
+    void extractSolidMember(const SolidMember& member,
+                           const std::filesystem::path& outputDir,
+                           bool overwriteAll);
+    bool prepareOutputPath(const std::filesystem::path& outputPath,
+                          const ZipEntry& entry,
+                          bool overwriteAll);
+    bool isUnchanged(const std::filesystem::path& path, const ZipEntry& entry) const;
+    void writeOutputFile(const std::filesystem::path& outputPath,
+                        std::span<const uint8_t> data,
+                        const ZipEntry& entry) const;
+    void applyMetadata(const std::filesystem::path& outputPath,
+                      const ZipEntry& entry) const;
+    size_t extractionCost(const ZipEntry& entry) const;
+    size_t streamingCost(const ZipEntry& entry, const SparseMap* layout = nullptr) const;
+    TimePoint startTiming() const;
+    void recordEntry(const ZipEntry& entry, const TimePoint& started);
+    void reportProgress(uint64_t bytes, uint64_t files);
+    MemoryBudget::Reservation reserveMemory(size_t bytes);     // Calling thread only: evicts the cached block
+    MemoryBudget::Reservation acquireMemory(size_t bytes);     // Any thread: leaves the cache alone
+    void dropCachedBlock();
     bool shouldOverwrite(const std::filesystem::path& path) const;
     void createDirectoryStructure(const std::filesystem::path& path) const;
-}; 
\ No newline at end of file
+};
+}
@@ -1,7 +1,19 @@
 #include "ArchiveWriter.h"
+#include "BinaryIO.h"
+#include "Dictionary.h"
+#include "../util/FileSystem.h"
+#include "../util/Scheduler.h"
+#include "../util/Trace.h"
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <exception>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 #include <zlib.h>
 
 namespace miniwr {
@@ -10,26 +22,82 @@ namespace {
     constexpr uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
     constexpr uint32_t ZIP_CENTRAL_DIR_SIGNATURE = 0x02014b50;
     constexpr uint32_t ZIP_END_OF_CENTRAL_DIR_SIGNATURE = 0x06054b50;
+    constexpr uint32_t ZIP_DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+    constexpr uint32_t ZIP64_END_OF_CENTRAL_DIR_SIGNATURE = 0x06064b50;
+    constexpr uint32_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE = 0x07064b50;
     constexpr uint16_t ZIP_VERSION_MADE_BY = 0x033F;  // UNIX + Version 6.3
     constexpr uint16_t ZIP_VERSION_NEEDED = 0x0014;   // Version 2.0
-    constexpr uint16_t ZIP_GENERAL_PURPOSE_FLAGS = 0x0000;
-    constexpr uint16_t ZIP_COMPRESSION_METHOD_DEFLATE = 0x0008;
+    constexpr uint16_t ZIP64_VERSION_NEEDED = 0x002D; // Version 4.5
+    constexpr uint16_t ZIP64_EXTRA_FIELD_ID = 0x0001;
+    constexpr uint16_t ZIP64_COUNT_MARKER = 0xFFFF;
+    constexpr uint32_t ZIP64_FIELD_MARKER = 0xFFFFFFFF;
+    constexpr uint16_t ZIP_FLAG_DATA_DESCRIPTOR = 0x0008;
     constexpr uint16_t ZIP_COMPRESSION_METHOD_STORE = 0x0000;
-}
 
-ArchiveWriter::ArchiveWriter(const std::filesystem::path& archivePath)
-    : archivePath_(archivePath),
-      archive_(archivePath, std::ios::binary),
-      compressor_(Compressor::create("deflate")) {
-    
-    if (!archive_) {
-        throw std::runtime_error("Failed to create archive file: " + archivePath.string());
+    // Sizes go in 32-bit fields, where all ones means ZIP64, which this
+    // writer does not produce
+    uint32_t entrySize(uint64_t size, const std::string& name) {
+        if (size >= ZIP64_FIELD_MARKER) {
+            throw std::runtime_error("Entries of 4 GB or more are not supported: " + name);
+        }
+        return static_cast<uint32_t>(size);
+    }
+
+    // The archive's own indexes and blocks live under the internal prefix,
+    // where files would be mistaken for them
+    void checkEntryName(const std::string& name) {
+        if (name.starts_with(INTERNAL_ENTRY_PREFIX)) {
+            throw std::runtime_error("Entry names starting with " + std::string(INTERNAL_ENTRY_PREFIX) +
+                                     " are reserved: " + name);
+        }
+    }
+
+    // Compressed output of an out-of-order streamed entry kept in memory
+    // before its range is claimed; larger output is written in place
+    constexpr size_t STREAMING_SPILL_SIZE = 1024 * 1024;
+
+    // Compressed output, which may slightly exceed the input, at the size
+    // the buffer pool rounds it to
+    size_t outputCost(uint64_t size) {
+        return BufferPool::roundUp(static_cast<size_t>(compressBound(static_cast<uLong>(size))));
+    }
+
+    // Content plus compressed output
+    size_t inMemoryCost(uint64_t size) {
+        return BufferPool::roundUp(static_cast<size_t>(size)) + outputCost(size) +
+               Compressor::WORKING_MEMORY;
+    }
+
+    // Base version (compressed and inflated) plus content, delta and output
+    size_t deltaCost(uint64_t baseSize, uint64_t size) {
+        return 2 * BufferPool::roundUp(static_cast<size_t>(baseSize)) +
+               2 * BufferPool::roundUp(static_cast<size_t>(size)) + outputCost(size) +
+               Compressor::WORKING_MEMORY;
+    }
+
+    uint64_t solidBlockSize(const std::vector<SolidCandidate>& files) {
+        uint64_t size = 0;
+        for (const auto& file : files) {
+            size += file.size;
+        }
+        return size;
+    }
+
+    size_t solidBlockCost(const std::vector<SolidCandidate>& files) {
+        return inMemoryCost(solidBlockSize(files));
     }
 }
 
+ArchiveWriter::ArchiveWriter(const std::filesystem::path& archivePath)
+    : ArchiveWriter(ArchiveSink::file(archivePath)) {}
+
+ArchiveWriter::ArchiveWriter(std::unique_ptr<ArchiveSink> sink)
+    : sink_(std::move(sink)),
+      compressor_(Compressor::create("deflate")) {}
+
 ArchiveWriter::~ArchiveWriter() {
     try {
-        if (archive_.is_open()) {
+        if (open_) {
             close();
         }
     } catch (...) {
@@ -42,238 +110,1262 @@ void ArchiveWriter::addFile(const std::filesystem::path& filepath,
     if (!std::filesystem::exists(filepath)) {
         throw std::runtime_error("File not found: " + filepath.string());
     }
+    checkEntryName(filepath.generic_string());
+
+    auto fileSize = std::filesystem::file_size(filepath);
+
+    // Files present in the base archive are stored as deltas
+    if (deltaBase_) {
+        const ZipEntry* baseEntry = deltaBase_->findEntry(filepath.generic_string());
+        if (baseEntry && fitsInMemory(deltaCost(baseEntry->uncompressedSize, fileSize))) {
+            writePending(true);
+            auto reservation = reserveMemory(deltaCost(baseEntry->uncompressedSize, fileSize));
+            addDeltaFile(filepath, *baseEntry, level);
+            return;
+        }
+    }
+
+    // Zero blocks of large files are recorded as holes, not compressed
+    if (sparse_ && fileSize >= SPARSE_MIN_SIZE) {
+        writePending(true);
+        addSparseFile(filepath, level);
+        return;
+    }
+
+    // Refused before anything is read; holes above may bring a file under the limit
+    entrySize(fileSize, filepath.generic_string());
+
+    // Small files are packed into solid blocks on close()
+    if (solidBlockSize_ > 0 && fileSize < solidBlockLimit()) {
+        solidQueue_.push_back({filepath, fileSize, level});
+        return;
+    }
+
+    // Stored files are copied by the kernel, whatever the memory limit
+    if (level == CompressionLevel::Store) {
+        writePending(true);
+        addFileStored(filepath);
+        return;
+    }
+
+    // Entries too large for the memory budget are streamed
+    if (!fitsInMemory(inMemoryCost(fileSize))) {
+        writePending(true);
+        addFileStreaming(filepath, level);
+        return;
+    }
+    if (commitOrder_ == CommitOrder::Completion) {
+        addFileConcurrently(filepath, fileSize, level);
+        return;
+    }
+    if (commitThreads_ > 1) {
+        addFileInOrder(filepath, fileSize, level);
+        return;
+    }
+    auto reservation = reserveMemory(inMemoryCost(fileSize));
+    auto started = startTiming();
 
     // Read file content
-    std::ifstream file(filepath, std::ios::binary);
-    std::vector<uint8_t> content((std::istreambuf_iterator<char>(file)),
-                                std::istreambuf_iterator<char>());
-    file.close();
+    Buffer content;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Read, fileSize);
+        readFile(filepath, content);
+    }
 
-    // Prepare entry
-    ZipEntry entry;
-    entry.filename = filepath.generic_string();
-    entry.uncompressedSize = static_cast<uint32_t>(content.size());
-    entry.crc32 = calculateCrc32(content);
+    ZipEntry entry = describeFile(filepath);
+    writeContent(entry, content, level, *compressor_);
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
 
-    auto [modTime, modDate] = getModificationTimeAndDate(
-        std::filesystem::last_write_time(filepath));
-    entry.modificationTime = modTime;
-    entry.modificationDate = modDate;
+void ArchiveWriter::addFileConcurrently(const std::filesystem::path& filepath,
+                                      uint64_t fileSize,
+                                      CompressionLevel level) {
+    // Tasks free their memory themselves, so waiting for it here is safe
+    auto reservation = std::make_shared<MemoryBudget::Reservation>(
+        reserveMemory(inMemoryCost(fileSize)));
+    if (!commitTasks_) {
+        commitTasks_ = std::make_unique<TaskGroup>(commitThreads_);
+    }
 
-    // Set POSIX permissions
-    auto perms = std::filesystem::status(filepath).permissions();
-    entry.externalAttrs = static_cast<uint16_t>(
-        static_cast<uint32_t>(perms) & 0xFFFF) << 16;
+    commitTasks_->run([this, filepath, fileSize, level, reservation] {
+        auto started = startTiming();
+        Buffer content;
+        {
+            PhaseTimer timer(stats_.get(), Phase::Read, fileSize);
+            readFile(filepath, content);
+        }
 
-    // Store header position
-    entry.headerOffset = archive_.tellp();
+        // Each task needs its own stream state
+        auto compressor = takeCompressor();
+        ZipEntry entry = describeFile(filepath);
+        writeContent(entry, content, level, *compressor);
+        returnCompressor(std::move(compressor));
+        recordEntry(entry, started);
+        reportProgress(entry.uncompressedSize, 1);
+    });
+}
+
+void ArchiveWriter::addFileInOrder(const std::filesystem::path& filepath,
+                                 uint64_t fileSize,
+                                 CompressionLevel level) {
+    writePending(false);
+    while (pending_.size() >= 2 * static_cast<size_t>(commitThreads_)) {
+        writeNextPending();
+    }
+
+    // Pending results hold memory only this thread releases, by writing
+    // them, so it only waits for the budget with none left
+    size_t cost = inMemoryCost(fileSize);
+    MemoryBudget::Reservation reservation;
+    bool reserved = false;
+    while (!pending_.empty() && !(reserved = tryReserveMemory(cost, reservation))) {
+        writeNextPending();
+    }
+    if (!reserved) {
+        reservation = reserveMemory(cost);
+    }
+
+    auto item = std::make_shared<PendingEntry>();
+    item->started = startTiming();
+    item->reservation = std::move(reservation);
+    pending_.push_back(item);
+    if (!commitTasks_) {
+        commitTasks_ = std::make_unique<TaskGroup>(commitThreads_);
+    }
+
+    commitTasks_->run([this, filepath, fileSize, level, item] {
+        try {
+            Buffer content;
+            {
+                PhaseTimer timer(stats_.get(), Phase::Read, fileSize);
+                readFile(filepath, content);
+            }
+            item->entry = describeFile(filepath);
+            auto compressor = takeCompressor();
+            auto compressed = compressContent(item->entry, content, level, *compressor);
+            returnCompressor(std::move(compressor));
+            item->data = compressed ? std::move(*compressed) : std::move(content);
+        } catch (...) {
+            item->error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            item->done = true;
+        }
+        pendingDone_.notify_all();
+    });
+}
+
+void ArchiveWriter::writePending(bool wait) {
+    while (!pending_.empty()) {
+        if (!wait) {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            if (!pending_.front()->done) {
+                return;
+            }
+        }
+        writeNextPending();
+    }
+}
+
+void ArchiveWriter::writeNextPending() {
+    auto item = std::move(pending_.front());
+    pending_.pop_front();
+    {
+        std::unique_lock<std::mutex> lock(pendingMutex_);
+        pendingDone_.wait(lock, [&] { return item->done; });
+    }
+    if (item->error) {
+        std::rethrow_exception(item->error);
+    }
+
+    writeEntry(item->entry, item->data.span());
+    recordEntry(item->entry, item->started);
+    reportProgress(item->entry.uncompressedSize, 1);
+}
+
+void ArchiveWriter::finishCommits() {
+    writePending(true);
+    if (commitTasks_) {
+        commitTasks_->wait();
+    }
+}
+
+std::unique_ptr<Compressor> ArchiveWriter::takeCompressor() {
+    {
+        std::lock_guard<std::mutex> lock(compressorMutex_);
+        if (!idleCompressors_.empty()) {
+            auto compressor = std::move(idleCompressors_.back());
+            idleCompressors_.pop_back();
+            return compressor;
+        }
+    }
+    auto compressor = Compressor::create("deflate");
+    compressor->setDictionary(dictionary_);
+    return compressor;
+}
+
+void ArchiveWriter::returnCompressor(std::unique_ptr<Compressor> compressor) {
+    std::lock_guard<std::mutex> lock(compressorMutex_);
+    idleCompressors_.push_back(std::move(compressor));
+}
+
+void ArchiveWriter::addFiles(std::span<const std::filesystem::path> paths,
+                           CompressionLevel level) {
+    // Solid, delta and stored files have read paths of their own, and
+    // files compressed on tasks are read by them
+    if (!ioEngine_ || solidBlockSize_ > 0 || deltaBase_ || level == CompressionLevel::Store ||
+        commitOrder_ == CommitOrder::Completion || commitThreads_ > 1) {
+        for (const auto& path : paths) {
+            addFile(path, level);
+        }
+        return;
+    }
+
+    ioEngine_->readFiles(paths, [&](size_t index, const IoEngine::FileInfo& info,
+                                    std::span<const uint8_t> content) {
+        // Larger than a batch slot: read on its own, streamed if need be
+        if (content.size() != info.size || !fitsInMemory(inMemoryCost(info.size))) {
+            addFile(paths[index], level);
+            return;
+        }
+        auto reservation = reserveMemory(inMemoryCost(info.size));
+        auto started = startTiming();
+
+        ZipEntry entry = describeEntry(paths[index].generic_string(),
+                                       {info.modified, info.permissions});
+        writeContent(entry, content, level, *compressor_);
+        recordEntry(entry, started);
+        reportProgress(entry.uncompressedSize, 1);
+    });
+}
+
+void ArchiveWriter::addEntry(const std::string& name,
+                           std::span<const uint8_t> data,
+                           const EntryMetadata& metadata,
+                           CompressionLevel level) {
+    writePending(true);
+    ZipEntry entry = describeEntry(name, metadata);
+
+    // The content is already in memory; only the compressed copy is reserved
+    size_t cost = outputCost(data.size()) + Compressor::WORKING_MEMORY;
+    if (!fitsInMemory(cost)) {
+        size_t offset = 0;
+        writeStreamingEntry(entry, [&](std::span<uint8_t> buffer) {
+            size_t count = std::min(buffer.size(), data.size() - offset);
+            std::copy_n(data.begin() + static_cast<ptrdiff_t>(offset), count, buffer.begin());
+            offset += count;
+            return count;
+        }, level);
+        return;
+    }
+    auto reservation = reserveMemory(cost);
+    auto started = startTiming();
+
+    writeContent(entry, data, level, *compressor_);
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
+
+ZipEntry ArchiveWriter::addEntry(const std::string& name,
+                               const Compressor::ReadChunk& read,
+                               const EntryMetadata& metadata,
+                               CompressionLevel level) {
+    writePending(true);
+    ZipEntry entry = describeEntry(name, metadata);
+    writeStreamingEntry(entry, read, level);
+    return entry;
+}
+
+void ArchiveWriter::addFileStreaming(const std::filesystem::path& filepath,
+                                   CompressionLevel level) {
+    InputFile file(filepath);
+    ZipEntry entry = describeFile(filepath);
+    writeStreamingEntry(entry, [&](std::span<uint8_t> buffer) { return file.read(buffer); }, level);
+}
+
+void ArchiveWriter::addFileStored(const std::filesystem::path& filepath) {
+    auto started = startTiming();
+    InputFile file(filepath);
+    ZipEntry entry = describeFile(filepath);
+    entry.compressionMethod = ZIP_COMPRESSION_METHOD_STORE;
+    entry.uncompressedSize = entrySize(file.size(), entry.filename);
+    entry.compressedSize = entry.uncompressedSize;
+
+    // The CRC is computed from the page cache; the data never enters a buffer
+    MappedRange mapped(file.descriptor(), 0, static_cast<size_t>(file.size()));
+    {
+        PhaseTimer timer(stats_.get(), Phase::Crc, file.size());
+        entry.crc32 = calculateCrc32(mapped.data());
+    }
+
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write, file.size());
+        std::lock_guard<std::mutex> lock(sinkMutex_);
+        entry.headerOffset = sink_->position();
+        writeLocalFileHeader(entry);
+        uint64_t copied = sink_->copyFrom(file.descriptor(), 0, file.size());
+        if (copied < file.size()) {
+            sink_->write(mapped.data().subspan(static_cast<size_t>(copied)));
+        }
+        entries_.push_back(entry);
+    }
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
+
+void ArchiveWriter::addSparseFile(const std::filesystem::path& filepath,
+                                 CompressionLevel level) {
+    InputFile file(filepath);
+    ZipEntry entry = describeFile(filepath);
+    SparseMap map;
+    writeStreamingEntry(entry, [&](std::span<uint8_t> buffer) {
+        while (true) {
+            // Holes of the file are recorded without reading them
+            bool hole;
+            uint64_t length = file.extent(hole);
+            if (length == 0) {
+                return size_t{0};
+            }
+            if (hole) {
+                addHole(map.holes, map.size, length);
+                file.skip(length);
+                map.size += length;
+                reportProgress(length, 0);
+                continue;
+            }
+
+            // Zero blocks written out in full are left out as well; a chunk
+            // of them only leaves nothing to compress, so read on
+            size_t count = file.read(buffer.first(static_cast<size_t>(
+                std::min<uint64_t>(buffer.size(), length))));
+            if (count == 0) {
+                return size_t{0};
+            }
+            size_t kept = removeZeroBlocks(buffer.first(count), map.size, map.holes);
+            map.size += count;
+            reportProgress(count - kept, 0);  // The rest is counted once compressed
+            if (kept > 0) {
+                return kept;
+            }
+        }
+    }, level);
+
+    if (!map.holes.empty()) {
+        sparseManifest_.entries[entry.filename] = std::move(map);
+    }
+}
+
+void ArchiveWriter::writeStreamingEntry(ZipEntry& entry,
+                                      const Compressor::ReadChunk& read,
+                                      CompressionLevel level) {
+    // Out of order, the compressed output is first kept in a bounded spill,
+    // so that the entry claims a range of its exact size once it is known
+    // and commit tasks keep writing meanwhile. Output outgrowing the spill,
+    // like any streamed entry in input order, is written in place with the
+    // archive held and the header rewritten afterwards.
+    bool spilling = commitOrder_ == CommitOrder::Completion && sink_->positional() &&
+                    fitsInMemory(Compressor::STREAMING_MEMORY + STREAMING_SPILL_SIZE);
+    auto reservation = reserveMemory(Compressor::STREAMING_MEMORY +
+                                     (spilling ? STREAMING_SPILL_SIZE : 0));
+    auto started = startTiming();
+    std::unique_lock<std::mutex> lock(sinkMutex_, std::defer_lock);
+    Buffer spill;
+
+    // Sizes and CRC are unknown until the data is written; the local header
+    // is rewritten afterwards, or followed by a data descriptor if the sink
+    // cannot seek back
+    bool seekable = sink_->seekable();
+    auto writeInPlace = [&] {
+        lock.lock();
+        if (!seekable) {
+            entry.flags |= ZIP_FLAG_DATA_DESCRIPTOR;
+        }
+        entry.headerOffset = sink_->position();
+        writeLocalFileHeader(entry);
+        sink_->write(spill.span());
+        spill.reset();
+        spilling = false;
+    };
+    if (!spilling) {
+        writeInPlace();
+    } else {
+        spill.reserve(STREAMING_SPILL_SIZE);
+    }
+
+    uint32_t crc = 0;
+    uint64_t inputSize = 0;
+    uint64_t written = 0;
+    TimePoint inCallbacks;  // Spent reading and writing, not compressing
+    auto compressStarted = startTiming();
+    {
+        TraceSpan span("compress");  // Encloses the read and write spans
+        compressor_->compressStream(
+            [&](std::span<uint8_t> buffer) {
+                PhaseTimer readTimer(stats_.get(), Phase::Read);
+                size_t count = read(buffer);
+                readTimer.setBytes(count, 0);
+                inCallbacks += readTimer.stop();
+
+                PhaseTimer crcTimer(stats_.get(), Phase::Crc, count);
+                crc = crc32(crc, buffer.data(), static_cast<uInt>(count));
+                inCallbacks += crcTimer.stop();
+                inputSize += count;
+                entrySize(inputSize, entry.filename);
+                reportProgress(count, 0);
+                return count;
+            },
+            [&](std::span<const uint8_t> chunk) {
+                PhaseTimer timer(stats_.get(), Phase::Write, chunk.size());
+                if (spilling && spill.size() + chunk.size() > STREAMING_SPILL_SIZE) {
+                    writeInPlace();
+                }
+                if (spilling) {
+                    spill.append(chunk);
+                } else {
+                    sink_->write(chunk);
+                }
+                written += chunk.size();
+                inCallbacks += timer.stop();
+            },
+            level);
+        span.setBytes(inputSize);
+    }
+
+    entry.crc32 = crc;
+    entry.uncompressedSize = entrySize(inputSize, entry.filename);
+    entry.compressedSize = entrySize(written, entry.filename);
+
+    if (stats_) {
+        auto end = TimePoint::now();
+        stats_->addPhase(Phase::Compress,
+                         end.wallNs - compressStarted.wallNs - inCallbacks.wallNs,
+                         end.cpuNs - compressStarted.cpuNs - inCallbacks.cpuNs,
+                         inputSize, entry.compressedSize);
+    }
+
+    if (spilling) {
+        auto header = localFileHeader(entry);
+        lock.lock();
+        entry.headerOffset = sink_->reserve(header.size() + spill.size());
+        lock.unlock();
+        sink_->writeAt(entry.headerOffset, header);
+        sink_->writeAt(entry.headerOffset + header.size(), spill.span());
+        lock.lock();
+    } else if (seekable) {
+        uint64_t endOffset = sink_->position();
+        sink_->seek(entry.headerOffset);
+        writeLocalFileHeader(entry);
+        sink_->seek(endOffset);
+    } else {
+        writeDataDescriptor(entry);
+    }
+
+    entries_.push_back(entry);
+    lock.unlock();
+    recordEntry(entry, started);
+    reportProgress(0, 1);
+}
+
+void ArchiveWriter::addDeltaFile(const std::filesystem::path& filepath,
+                               const ZipEntry& baseEntry,
+                               CompressionLevel level) {
+    auto started = startTiming();
+    ZipEntry entry = describeFile(filepath);
+    Buffer base;
+    Buffer content;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Read, baseEntry.uncompressedSize);
+        base = deltaBase_->read(entry.filename);
+        readFile(filepath, content);
+        timer.setBytes(base.size() + content.size(), 0);
+    }
+    entry.uncompressedSize = entrySize(content.size(), entry.filename);
+    {
+        PhaseTimer timer(stats_.get(), Phase::Crc, content.size());
+        entry.crc32 = calculateCrc32(content);
+    }
+
+    // Long matches come from the rolling-hash match finder; the tail of the
+    // base version as preset dictionary catches short ones in the literals
+    Buffer compressedData;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Compress);
+        deltaCompressor_->setDictionary(deltaDictionary(base));
+        deltaCompressor_->compress(encodeDelta(base, content), compressedData, level);
+        timer.setBytes(content.size(), compressedData.size());
+    }
+
+    deltaManifest_.entries[entry.filename] = {baseEntry.crc32, baseEntry.uncompressedSize};
+    writeEntry(entry, compressedData);
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
+
+void ArchiveWriter::writeContent(ZipEntry& entry,
+                               std::span<const uint8_t> content,
+                               CompressionLevel level,
+                               Compressor& compressor) {
+    auto compressed = compressContent(entry, content, level, compressor);
+    writeEntry(entry, compressed ? compressed->span() : content);
+}
+
+std::optional<Buffer> ArchiveWriter::compressContent(ZipEntry& entry,
+                                                   std::span<const uint8_t> content,
+                                                   CompressionLevel level,
+                                                   Compressor& compressor) {
+    entry.uncompressedSize = entrySize(content.size(), entry.filename);
+    {
+        PhaseTimer timer(stats_.get(), Phase::Crc, content.size());
+        entry.crc32 = calculateCrc32(content);
+    }
 
     // Compress content if needed
-    std::vector<uint8_t> compressedData;
-    uint16_t compressionMethod;
-    
     if (level == CompressionLevel::Store) {
-        compressedData = std::move(content);
-        compressionMethod = ZIP_COMPRESSION_METHOD_STORE;
-    } else {
-        compressedData = compressor_->compress(content, level);
-        compressionMethod = ZIP_COMPRESSION_METHOD_DEFLATE;
+        entry.compressionMethod = ZIP_COMPRESSION_METHOD_STORE;
+        return std::nullopt;
+    }
+
+    Buffer compressedData;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Compress);
+        compressor.compress(content, compressedData, level);
+        timer.setBytes(content.size(), compressedData.size());
+    }
+
+    // Incompressible data is stored, so extraction can copy it as is
+    if (compressedData.size() >= content.size()) {
+        entry.compressionMethod = ZIP_COMPRESSION_METHOD_STORE;
+        return std::nullopt;
+    }
+    return compressedData;
+}
+
+void ArchiveWriter::writeEntry(ZipEntry& entry, std::span<const uint8_t> data) {
+    PhaseTimer timer(stats_.get(), Phase::Write, data.size());
+    entry.compressedSize = entrySize(data.size(), entry.filename);
+    std::unique_lock<std::mutex> lock(sinkMutex_);
+
+    // Commit tasks only claim their range under the lock and write it
+    // alongside each other
+    if (commitOrder_ == CommitOrder::Completion && sink_->positional()) {
+        auto header = localFileHeader(entry);
+        entry.headerOffset = sink_->reserve(header.size() + data.size());
+        entries_.push_back(entry);
+        lock.unlock();
+
+        sink_->writeAt(entry.headerOffset, header);
+        sink_->writeAt(entry.headerOffset + header.size(), data);
+        return;
     }
-    
-    entry.compressedSize = static_cast<uint32_t>(compressedData.size());
+
+    // Store header position
+    entry.headerOffset = sink_->position();
 
     // Write local file header
     writeLocalFileHeader(entry);
 
     // Write file data
-    archive_.write(reinterpret_cast<const char*>(compressedData.data()),
-                  compressedData.size());
+    sink_->write(data);
 
     entries_.push_back(entry);
 }
 
+void ArchiveWriter::writeInternalEntry(const std::string& name,
+                                     std::span<const uint8_t> data) {
+    ZipEntry entry;
+    entry.filename = name;
+    entry.uncompressedSize = static_cast<uint32_t>(data.size());
+    {
+        PhaseTimer timer(stats_.get(), Phase::Crc, data.size());
+        entry.crc32 = calculateCrc32(data);
+    }
+    auto [modTime, modDate] = toDosDateTime(
+        std::filesystem::file_time_type::clock::now());
+    entry.modificationTime = modTime;
+    entry.modificationDate = modDate;
+
+    // Compressed without the dictionary, so that readers can load the
+    // indexes when opening the archive without reading the dictionary too
+    Buffer compressedData;
+    {
+        PhaseTimer timer(stats_.get(), Phase::Compress);
+        Compressor::create("deflate")->compress(data, compressedData, CompressionLevel::Default);
+        timer.setBytes(data.size(), compressedData.size());
+    }
+    writeEntry(entry, compressedData);
+}
+
+void ArchiveWriter::copyEntries(ArchiveReader& source,
+                              const std::function<bool(const ZipEntry&)>& select) {
+    writePending(true);
+    auto dictionary = source.dictionary();
+    if (!dictionary.empty()) {
+        if (dictionary_.empty()) {
+            setDictionary(std::vector<uint8_t>(dictionary.begin(), dictionary.end()));
+        } else if (!std::equal(dictionary.begin(), dictionary.end(),
+                               dictionary_.begin(), dictionary_.end())) {
+            throw std::runtime_error("Archives were compressed against different dictionaries");
+        }
+    }
+
+    // Entries are copied in archive order, so the source is read front to
+    // back; solid members sort with their block and keep their block order
+    auto position = [&](const ZipEntry& entry) {
+        const SolidMember* member = source.solidMember(entry);
+        return member ? source.solidBlock(member->block).headerOffset : entry.headerOffset;
+    };
+    std::vector<const ZipEntry*> selected;
+    for (const auto& entry : source.entries()) {
+        if (!select || select(entry)) {
+            selected.push_back(&entry);
+        }
+    }
+    std::stable_sort(selected.begin(), selected.end(), [&](const ZipEntry* a, const ZipEntry* b) {
+        return position(*a) < position(*b);
+    });
+
+    // Solid blocks are renumbered after the blocks already copied
+    std::unordered_map<uint32_t, uint32_t> blockNumbers;
+
+    for (const ZipEntry* selectedEntry : selected) {
+        const ZipEntry& entry = *selectedEntry;
+        if (const SolidMember* member = source.solidMember(entry)) {
+            auto [it, inserted] = blockNumbers.try_emplace(member->block, solidBlockCount_);
+            if (inserted) {
+                const ZipEntry& block = source.solidBlock(member->block);
+                ZipEntry copy = block;
+                copy.filename = SolidIndex::blockName(solidBlockCount_++);
+                copyRawEntry(source, block, std::move(copy));
+            }
+            SolidMember copy = *member;
+            copy.block = it->second;
+            solidMembers_.push_back(std::move(copy));
+            reportProgress(entry.uncompressedSize, 1);
+            continue;
+        }
+
+        if (const DeltaReference* reference = source.deltaReference(entry)) {
+            deltaManifest_.entries[entry.filename] = *reference;
+        }
+        if (const SparseMap* map = source.sparseMap(entry)) {
+            sparseManifest_.entries[entry.filename] = *map;
+        }
+        copyRawEntry(source, entry, entry);
+        reportProgress(source.fileSize(entry), 1);
+    }
+}
+
+void ArchiveWriter::addCompressedEntry(ZipEntry entry, std::span<const uint8_t> data) {
+    writePending(true);
+    auto started = startTiming();
+    entry.flags &= static_cast<uint16_t>(~ZIP_FLAG_DATA_DESCRIPTOR);
+    writeEntry(entry, data);
+    recordEntry(entry, started);
+    reportProgress(entry.uncompressedSize, 1);
+}
+
+void ArchiveWriter::copyRawEntry(ArchiveReader& source, const ZipEntry& original, ZipEntry entry) {
+    auto started = startTiming();
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write, entry.compressedSize);
+
+        // Sizes are known up front, so the copy needs no data descriptor
+        entry.flags &= static_cast<uint16_t>(~ZIP_FLAG_DATA_DESCRIPTOR);
+        std::lock_guard<std::mutex> lock(sinkMutex_);
+        entry.headerOffset = sink_->position();
+        writeLocalFileHeader(entry);
+        source.copyRawData(original, *sink_);
+        entries_.push_back(entry);
+    }
+    recordEntry(entry, started);
+}
+
+TimePoint ArchiveWriter::startTiming() const {
+    return stats_ ? TimePoint::now() : TimePoint();
+}
+
+void ArchiveWriter::recordEntry(const ZipEntry& entry, const TimePoint& started) {
+    if (stats_) {
+        stats_->addEntry(entry.filename, entry.uncompressedSize, entry.compressedSize,
+                         TimePoint::now().wallNs - started.wallNs);
+    }
+}
+
+void ArchiveWriter::reportProgress(uint64_t bytes, uint64_t files) {
+    if (progress_) {
+        progress_->addBytes(bytes);
+        progress_->addFiles(files);
+    }
+}
+
 void ArchiveWriter::addDirectory(const std::filesystem::path& dirpath,
                                CompressionLevel level) {
     if (!std::filesystem::exists(dirpath)) {
         throw std::runtime_error("Directory not found: " + dirpath.string());
     }
 
+    std::vector<std::filesystem::path> files;
     for (const auto& entry : std::filesystem::recursive_directory_iterator(dirpath)) {
         if (std::filesystem::is_regular_file(entry)) {
-            addFile(entry.path(), level);
+            files.push_back(entry.path());
         }
     }
+    addFiles(files, level);
+}
+
+void ArchiveWriter::setSolidMode(size_t blockSize, unsigned numThreads) {
+    solidBlockSize_ = blockSize;
+    solidThreads_ = std::max(1u, numThreads);
+}
+
+void ArchiveWriter::setCommitOrder(CommitOrder order, unsigned numThreads) {
+    finishCommits();
+    commitOrder_ = order;
+    commitThreads_ = std::max(1u, numThreads);
+    commitTasks_.reset();
+}
+
+void ArchiveWriter::setDictionary(std::vector<uint8_t> dictionary) {
+    if (dictionary.empty()) {
+        return;
+    }
+    if (!dictionary_.empty()) {
+        throw std::runtime_error("Archive dictionary already set");
+    }
+
+    // Files already handed to tasks are compressed without it, as they
+    // would have been in input order
+    finishCommits();
+
+    writeInternalEntry(DICTIONARY_ENTRY_NAME, dictionary);
+
+    dictionary_ = std::move(dictionary);
+    compressor_->setDictionary(dictionary_);
+    for (auto& compressor : idleCompressors_) {
+        compressor->setDictionary(dictionary_);
+    }
+}
+
+void ArchiveWriter::setDeltaBase(std::shared_ptr<ArchiveReader> base) {
+    deltaBase_ = std::move(base);
+    if (deltaBase_ && !deltaCompressor_) {
+        deltaCompressor_ = Compressor::create("deflate");
+    }
+}
+
+void ArchiveWriter::setSparse(bool sparse) {
+    sparse_ = sparse;
+}
+
+void ArchiveWriter::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    memoryBudget_ = std::move(budget);
+}
+
+void ArchiveWriter::setIoEngine(std::shared_ptr<IoEngine> engine) {
+    ioEngine_ = std::move(engine);
+}
+
+void ArchiveWriter::setStats(std::shared_ptr<Stats> stats) {
+    stats_ = std::move(stats);
+}
+
+void ArchiveWriter::setProgress(std::shared_ptr<ProgressBar> progress) {
+    progress_ = std::move(progress);
 }
 
 void ArchiveWriter::close() {
-    if (!archive_.is_open()) {
+    if (!open_) {
         return;
     }
+    open_ = false;
+
+    // Files still being compressed come before the blocks and indexes
+    finishCommits();
+
+    if (!solidQueue_.empty()) {
+        writeSolidBlocks();
+    }
+
+    // Completion order leaves members in the order their blocks finished
+    if (commitOrder_ == CommitOrder::Completion) {
+        std::stable_sort(solidMembers_.begin(), solidMembers_.end(),
+                         [](const SolidMember& a, const SolidMember& b) {
+                             return std::tie(a.block, a.offset) < std::tie(b.block, b.offset);
+                         });
+    }
+
+    if (solidBlockCount_ > 0) {
+        SolidIndex index;
+        index.blockCount = solidBlockCount_;
+        index.members = std::move(solidMembers_);
+        writeInternalEntry(SOLID_INDEX_NAME, index.serialize());
+    }
+
+    if (!deltaManifest_.entries.empty()) {
+        writeInternalEntry(DELTA_MANIFEST_NAME, deltaManifest_.serialize());
+    }
+
+    if (!sparseManifest_.entries.empty()) {
+        writeInternalEntry(SPARSE_MANIFEST_NAME, sparseManifest_.serialize());
+    }
+
+    // The data layout depends on timing; listings should not
+    if (commitOrder_ == CommitOrder::Completion) {
+        std::stable_sort(entries_.begin(), entries_.end(), [](const ZipEntry& a, const ZipEntry& b) {
+            return a.filename < b.filename;
+        });
+    }
+
+    {
+        PhaseTimer timer(stats_.get(), Phase::Write);
+        writeCentralDirectory();
+    }
+
+    PhaseTimer timer(stats_.get(), Phase::Flush);
+    sink_->close();
+}
+
+void ArchiveWriter::writeSolidBlocks() {
+    auto blocks = planSolidBlocks(std::move(solidQueue_), solidBlockLimit());
+    solidQueue_.clear();
+
+    // Numbered after the blocks copied from other archives
+    const uint32_t firstBlock = solidBlockCount_;
+    if (commitOrder_ == CommitOrder::Completion) {
+        writeSolidBlocksConcurrently(blocks, firstBlock);
+        return;
+    }
+
+    // Scheduler tasks compress blocks; this thread hands them out and writes
+    // the results in block order, so the archive layout is deterministic. At
+    // most `window` blocks are in flight, each only once its memory is reserved.
+    const size_t window = 2 * static_cast<size_t>(solidThreads_);
+    std::vector<std::optional<SolidBlockResult>> results(blocks.size());
+    std::vector<MemoryBudget::Reservation> reservations(blocks.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto compress = [&](size_t block) {
+        SolidBlockResult result;
+        try {
+            result = compressSolidBlock(blocks[block], firstBlock + static_cast<uint32_t>(block),
+                                        dictionary_, stats_.get());
+            reportProgress(result.blockEntry.uncompressedSize, result.members.size());
+        } catch (...) {
+            result.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            results[block] = std::move(result);
+        }
+        finished.notify_all();
+    };
+
+    // Destroyed first, so running tasks finish before what they use
+    TaskGroup group(solidThreads_);
+
+    try {
+        size_t dispatched = 0;
+        for (size_t written = 0; written < blocks.size(); ++written) {
+            while (dispatched < blocks.size() && dispatched < written + window) {
+                size_t cost = solidBlockCost(blocks[dispatched]);
+
+                // Waiting is only safe with nothing in flight; otherwise the
+                // blocks ahead must be written to release their memory first
+                if (dispatched == written) {
+                    reservations[dispatched] = reserveMemory(cost);
+                } else if (!tryReserveMemory(cost, reservations[dispatched])) {
+                    break;
+                }
+
+                group.run([&compress, block = dispatched] { compress(block); });
+                ++dispatched;
+            }
+
+            {
+                SolidBlockResult result;
+                {
+                    TraceSpan span("wait-block");
+                    std::unique_lock<std::mutex> lock(mutex);
+                    finished.wait(lock, [&] { return results[written].has_value(); });
+                    result = std::move(*results[written]);
+                    results[written].reset();
+                }
+
+                if (result.error) {
+                    std::rethrow_exception(result.error);
+                }
+                commitSolidBlock(result);
+            }
+            reservations[written].release();
+        }
+    } catch (...) {
+        group.cancel();
+        throw;
+    }
+    group.wait();
+}
+
+void ArchiveWriter::writeSolidBlocksConcurrently(
+    const std::vector<std::vector<SolidCandidate>>& blocks,
+    uint32_t firstBlock) {
+    // Every task writes its own block, so a slow block only holds its own
+    // slot. Memory is reserved up front and freed by the task, so waiting
+    // for it here is safe.
+    TaskGroup group(solidThreads_);
+    try {
+        for (size_t block = 0; block < blocks.size(); ++block) {
+            auto reservation = std::make_shared<MemoryBudget::Reservation>(
+                reserveMemory(solidBlockCost(blocks[block])));
+            group.run([this, &blocks, block, firstBlock, reservation] {
+                auto result = compressSolidBlock(blocks[block],
+                                                 firstBlock + static_cast<uint32_t>(block),
+                                                 dictionary_, stats_.get());
+                reportProgress(result.blockEntry.uncompressedSize, result.members.size());
+                commitSolidBlock(result);
+            });
+        }
+    } catch (...) {
+        group.cancel();
+        throw;
+    }
+    group.wait();
+}
+
+void ArchiveWriter::commitSolidBlock(SolidBlockResult& result) {
+    writeEntry(result.blockEntry, result.compressedData);
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    ++solidBlockCount_;
+    for (auto& member : result.members) {
+        solidMembers_.push_back(std::move(member));
+    }
+}
+
+size_t ArchiveWriter::solidBlockLimit() const {
+    if (!memoryBudget_) {
+        return solidBlockSize_;
+    }
+
+    // A block and its compressed copy must fit in the budget at once, at
+    // the sizes the pool rounds them to
+    size_t low = 0;
+    size_t high = solidBlockSize_;
+    while (low < high) {
+        size_t size = low + (high - low + 1) / 2;
+        if (memoryBudget_->fits(inMemoryCost(size))) {
+            low = size;
+        } else {
+            high = size - 1;
+        }
+    }
+    return low;
+}
+
+MemoryBudget::Reservation ArchiveWriter::reserveMemory(size_t bytes) {
+    return memoryBudget_ ? memoryBudget_->acquire(bytes) : MemoryBudget::Reservation();
+}
+
+bool ArchiveWriter::tryReserveMemory(size_t bytes, MemoryBudget::Reservation& reservation) {
+    return !memoryBudget_ || memoryBudget_->tryAcquire(bytes, reservation);
+}
+
+bool ArchiveWriter::fitsInMemory(size_t bytes) const {
+    return !memoryBudget_ || memoryBudget_->fits(bytes);
+}
+
+ArchiveWriter::SolidBlockResult ArchiveWriter::compressSolidBlock(
+    const std::vector<SolidCandidate>& files,
+    uint32_t block,
+    std::span<const uint8_t> dictionary,
+    Stats* stats) {
+
+    auto started = stats ? TimePoint::now() : TimePoint();
+    SolidBlockResult result;
+    Buffer content;
+    content.reserve(static_cast<size_t>(solidBlockSize(files)));
+
+    // Members are read straight into the block
+    for (const auto& file : files) {
+        SolidMember member;
+        member.entry = describeFile(file.path);
+        member.block = block;
+        member.offset = content.size();
+
+        {
+            PhaseTimer timer(stats, Phase::Read, file.size);
+            readFile(file.path, content);
+        }
+        auto data = std::span<const uint8_t>(content).subspan(member.offset);
+        member.entry.uncompressedSize = static_cast<uint32_t>(data.size());
+        {
+            PhaseTimer timer(stats, Phase::Crc, data.size());
+            member.entry.crc32 = calculateCrc32(data);
+        }
+
+        result.members.push_back(std::move(member));
+    }
 
-    writeCentralDirectory();
-    writeEndOfCentralDirectory();
-    archive_.close();
+    result.blockEntry.filename = SolidIndex::blockName(block);
+    result.blockEntry.uncompressedSize = static_cast<uint32_t>(content.size());
+    {
+        PhaseTimer timer(stats, Phase::Crc, content.size());
+        result.blockEntry.crc32 = calculateCrc32(content);
+    }
+    result.blockEntry.modificationTime = result.members.front().entry.modificationTime;
+    result.blockEntry.modificationDate = result.members.front().entry.modificationDate;
+
+    // Each worker needs its own stream state; the files of a block share a level
+    auto compressor = Compressor::create("deflate");
+    compressor->setDictionary(dictionary);
+    {
+        PhaseTimer timer(stats, Phase::Compress);
+        compressor->compress(content, result.compressedData, files.front().level);
+        timer.setBytes(content.size(), result.compressedData.size());
+    }
+
+    // The block is the unit of compression, so it is reported as one entry
+    if (stats) {
+        stats->addEntry(result.blockEntry.filename, content.size(), result.compressedData.size(),
+                        TimePoint::now().wallNs - started.wallNs);
+    }
+    return result;
 }
 
 void ArchiveWriter::writeLocalFileHeader(const ZipEntry& entry) {
+    sink_->write(localFileHeader(entry));
+}
+
+std::vector<uint8_t> ArchiveWriter::localFileHeader(const ZipEntry& entry) {
+    std::vector<uint8_t> header;
+    header.reserve(30 + entry.filename.length());
+
     // Local file header signature
-    archive_.write(reinterpret_cast<const char*>(&ZIP_LOCAL_HEADER_SIGNATURE), 4);
+    putFixed(header, ZIP_LOCAL_HEADER_SIGNATURE);
 
     // Version needed to extract
-    archive_.write(reinterpret_cast<const char*>(&ZIP_VERSION_NEEDED), 2);
+    putFixed(header, ZIP_VERSION_NEEDED);
 
     // General purpose bit flag
-    archive_.write(reinterpret_cast<const char*>(&ZIP_GENERAL_PURPOSE_FLAGS), 2);
+    putFixed(header, entry.flags);
 
-    // Compression method (DEFLATE)
-    archive_.write(reinterpret_cast<const char*>(&ZIP_COMPRESSION_METHOD_DEFLATE), 2);
+    // Compression method
+    putFixed(header, entry.compressionMethod);
 
     // Last mod time and date
-    archive_.write(reinterpret_cast<const char*>(&entry.modificationTime), 2);
-    archive_.write(reinterpret_cast<const char*>(&entry.modificationDate), 2);
+    putFixed(header, entry.modificationTime);
+    putFixed(header, entry.modificationDate);
 
     // CRC-32
-    archive_.write(reinterpret_cast<const char*>(&entry.crc32), 4);
+    putFixed(header, entry.crc32);
 
     // Compressed size
-    archive_.write(reinterpret_cast<const char*>(&entry.compressedSize), 4);
+    putFixed(header, entry.compressedSize);
 
     // Uncompressed size
-    archive_.write(reinterpret_cast<const char*>(&entry.uncompressedSize), 4);
+    putFixed(header, entry.uncompressedSize);
 
     // Filename length
-    uint16_t filenameLength = static_cast<uint16_t>(entry.filename.length());
-    archive_.write(reinterpret_cast<const char*>(&filenameLength), 2);
+    putFixed(header, static_cast<uint16_t>(entry.filename.length()));
 
     // Extra field length (none)
-    uint16_t extraFieldLength = 0;
-    archive_.write(reinterpret_cast<const char*>(&extraFieldLength), 2);
+    putFixed(header, uint16_t{0});
 
     // Filename
-    archive_.write(entry.filename.c_str(), filenameLength);
+    header.insert(header.end(), entry.filename.begin(), entry.filename.end());
+
+    return header;
+}
+
+void ArchiveWriter::writeDataDescriptor(const ZipEntry& entry) {
+    std::vector<uint8_t> descriptor;
+    putFixed(descriptor, ZIP_DATA_DESCRIPTOR_SIGNATURE);
+    putFixed(descriptor, entry.crc32);
+    putFixed(descriptor, entry.compressedSize);
+    putFixed(descriptor, entry.uncompressedSize);
+    sink_->write(descriptor);
 }
 
 void ArchiveWriter::writeCentralDirectory() {
-    auto centralDirOffset = archive_.tellp();
+    uint64_t centralDirOffset = sink_->position();
+    std::vector<uint8_t> directory;
 
     for (const auto& entry : entries_) {
+        // Local headers beyond 4 GB are located through a ZIP64 extra field
+        bool zip64 = entry.headerOffset >= ZIP64_FIELD_MARKER;
+
         // Central directory header signature
-        archive_.write(reinterpret_cast<const char*>(&ZIP_CENTRAL_DIR_SIGNATURE), 4);
+        putFixed(directory, ZIP_CENTRAL_DIR_SIGNATURE);
 
         // Version made by
-        archive_.write(reinterpret_cast<const char*>(&ZIP_VERSION_MADE_BY), 2);
+        putFixed(directory, ZIP_VERSION_MADE_BY);
 
         // Version needed to extract
-        archive_.write(reinterpret_cast<const char*>(&ZIP_VERSION_NEEDED), 2);
+        putFixed(directory, zip64 ? ZIP64_VERSION_NEEDED : ZIP_VERSION_NEEDED);
 
         // General purpose bit flag
-        archive_.write(reinterpret_cast<const char*>(&ZIP_GENERAL_PURPOSE_FLAGS), 2);
+        putFixed(directory, entry.flags);
 
         // Compression method
-        archive_.write(reinterpret_cast<const char*>(&ZIP_COMPRESSION_METHOD_DEFLATE), 2);
+        putFixed(directory, entry.compressionMethod);
 
         // Last mod time and date
-        archive_.write(reinterpret_cast<const char*>(&entry.modificationTime), 2);
-        archive_.write(reinterpret_cast<const char*>(&entry.modificationDate), 2);
+        putFixed(directory, entry.modificationTime);
+        putFixed(directory, entry.modificationDate);
 
         // CRC-32
-        archive_.write(reinterpret_cast<const char*>(&entry.crc32), 4);
+        putFixed(directory, entry.crc32);
 
         // Compressed size
-        archive_.write(reinterpret_cast<const char*>(&entry.compressedSize), 4);
+        putFixed(directory, entry.compressedSize);
 
         // Uncompressed size
-        archive_.write(reinterpret_cast<const char*>(&entry.uncompressedSize), 4);
+        putFixed(directory, entry.uncompressedSize);
 
         // Filename length
-        uint16_t filenameLength = static_cast<uint16_t>(entry.filename.length());
-        archive_.write(reinterpret_cast<const char*>(&filenameLength), 2);
+        putFixed(directory, static_cast<uint16_t>(entry.filename.length()));
 
-        // Extra field length (none)
-        uint16_t extraFieldLength = 0;
-        archive_.write(reinterpret_cast<const char*>(&extraFieldLength), 2);
+        // Extra field length (the ZIP64 header offset, if any)
+        putFixed(directory, static_cast<uint16_t>(zip64 ? 12 : 0));
 
         // File comment length (none)
-        uint16_t fileCommentLength = 0;
-        archive_.write(reinterpret_cast<const char*>(&fileCommentLength), 2);
+        putFixed(directory, uint16_t{0});
 
         // Disk number start
-        uint16_t diskNumberStart = 0;
-        archive_.write(reinterpret_cast<const char*>(&diskNumberStart), 2);
+        putFixed(directory, uint16_t{0});
 
         // Internal file attributes
-        uint16_t internalFileAttrs = 0;
-        archive_.write(reinterpret_cast<const char*>(&internalFileAttrs), 2);
+        putFixed(directory, uint16_t{0});
 
         // External file attributes (POSIX permissions)
-        archive_.write(reinterpret_cast<const char*>(&entry.externalAttrs), 4);
+        putFixed(directory, entry.externalAttrs);
 
         // Relative offset of local header
-        uint32_t localHeaderOffset = static_cast<uint32_t>(entry.headerOffset);
-        archive_.write(reinterpret_cast<const char*>(&localHeaderOffset), 4);
+        putFixed(directory, zip64 ? ZIP64_FIELD_MARKER : static_cast<uint32_t>(entry.headerOffset));
 
         // Filename
-        archive_.write(entry.filename.c_str(), filenameLength);
+        directory.insert(directory.end(), entry.filename.begin(), entry.filename.end());
+
+        // ZIP64 extended information: the header offset only
+        if (zip64) {
+            putFixed(directory, ZIP64_EXTRA_FIELD_ID);
+            putFixed(directory, uint16_t{8});
+            putFixed(directory, entry.headerOffset);
+        }
     }
 
-    auto centralDirSize = archive_.tellp() - centralDirOffset;
+    writeEndOfCentralDirectory(directory, centralDirOffset, directory.size());
+    sink_->write(directory);
+}
+
+void ArchiveWriter::writeEndOfCentralDirectory(std::vector<uint8_t>& out,
+                                             uint64_t centralDirOffset,
+                                             uint64_t centralDirSize) {
+    uint64_t numEntries = entries_.size();
+
+    // Counts and offsets that do not fit the classic record are promoted
+    // to a ZIP64 record, which the fields of the classic one point to
+    if (numEntries >= ZIP64_COUNT_MARKER || centralDirSize >= ZIP64_FIELD_MARKER ||
+        centralDirOffset >= ZIP64_FIELD_MARKER) {
+        uint64_t recordOffset = centralDirOffset + centralDirSize;
+
+        // ZIP64 end of central directory record
+        putFixed(out, ZIP64_END_OF_CENTRAL_DIR_SIGNATURE);
+
+        // Size of the rest of the record
+        putFixed(out, uint64_t{44});
+
+        // Version made by and needed to extract
+        putFixed(out, ZIP_VERSION_MADE_BY);
+        putFixed(out, ZIP64_VERSION_NEEDED);
+
+        // Number of this disk and disk where central directory starts
+        putFixed(out, uint32_t{0});
+        putFixed(out, uint32_t{0});
+
+        // Number of central directory records on this disk and in total
+        putFixed(out, numEntries);
+        putFixed(out, numEntries);
+
+        // Size and offset of central directory
+        putFixed(out, centralDirSize);
+        putFixed(out, centralDirOffset);
+
+        // ZIP64 end of central directory locator
+        putFixed(out, ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE);
+
+        // Disk holding the ZIP64 record, its offset and the number of disks
+        putFixed(out, uint32_t{0});
+        putFixed(out, recordOffset);
+        putFixed(out, uint32_t{1});
+    }
 
     // End of central directory record
-    archive_.write(reinterpret_cast<const char*>(&ZIP_END_OF_CENTRAL_DIR_SIGNATURE), 4);
+    putFixed(out, ZIP_END_OF_CENTRAL_DIR_SIGNATURE);
 
     // Number of this disk
-    uint16_t diskNumber = 0;
-    archive_.write(reinterpret_cast<const char*>(&diskNumber), 2);
+    putFixed(out, uint16_t{0});
 
     // Disk where central directory starts
-    archive_.write(reinterpret_cast<const char*>(&diskNumber), 2);
+    putFixed(out, uint16_t{0});
 
     // Number of central directory records on this disk
-    uint16_t numEntries = static_cast<uint16_t>(entries_.size());
-    archive_.write(reinterpret_cast<const char*>(&numEntries), 2);
+    auto count = static_cast<uint16_t>(std::min<uint64_t>(numEntries, ZIP64_COUNT_MARKER));
+    putFixed(out, count);
 
     // Total number of central directory records
-    archive_.write(reinterpret_cast<const char*>(&numEntries), 2);
+    putFixed(out, count);
 
     // Size of central directory
-    archive_.write(reinterpret_cast<const char*>(&centralDirSize), 4);
+    putFixed(out, static_cast<uint32_t>(std::min<uint64_t>(centralDirSize, ZIP64_FIELD_MARKER)));
 
     // Offset of start of central directory
-    archive_.write(reinterpret_cast<const char*>(&centralDirOffset), 4);
+    putFixed(out, static_cast<uint32_t>(std::min<uint64_t>(centralDirOffset, ZIP64_FIELD_MARKER)));
 
     // ZIP file comment length (none)
-    uint16_t zipCommentLength = 0;
-    archive_.write(reinterpret_cast<const char*>(&zipCommentLength), 2);
+    putFixed(out, uint16_t{0});
 }
 
-void ArchiveWriter::writeEndOfCentralDirectory() {
-    // Already written as part of writeCentralDirectory()
-}
+ZipEntry ArchiveWriter::describeFile(const std::filesystem::path& filepath) {
+    ZipEntry entry;
+    entry.filename = filepath.generic_string();
+
+    auto [modTime, modDate] = toDosDateTime(
+        std::filesystem::last_write_time(filepath));
+    entry.modificationTime = modTime;
+    entry.modificationDate = modDate;
+
+    // Set POSIX permissions
+    auto perms = std::filesystem::status(filepath).permissions();
+    entry.externalAttrs = (static_cast<uint32_t>(perms) & 0xFFFF) << 16;
 
-uint32_t ArchiveWriter::calculateCrc32(const std::vector<uint8_t>& data) {
-    return crc32(0L, data.data(), data.size());
+    return entry;
 }
 
-std::pair<uint16_t, uint16_t> ArchiveWriter::getModificationTimeAndDate(
-    const std::filesystem::file_time_type& ftime) {
-    
-    using namespace std::chrono;
-    auto sctp = time_point_cast<system_clock::duration>(
-        ftime - std::filesystem::file_time_type::clock::now() + system_clock::now());
-    
-    std::time_t tt = system_clock::to_time_t(sctp);
-    std::tm* tm = std::localtime(&tt);
+ZipEntry ArchiveWriter::describeEntry(const std::string& name, const EntryMetadata& metadata) {
+    checkEntryName(name);
+    ZipEntry entry;
+    entry.filename = name;
 
-    uint16_t time = static_cast<uint16_t>(
-        (tm->tm_hour << 11) |    // 5 bits
-        (tm->tm_min << 5) |      // 6 bits
-        (tm->tm_sec >> 1));      // 5 bits
+    auto [modTime, modDate] = toDosDateTime(metadata.modified);
+    entry.modificationTime = modTime;
+    entry.modificationDate = modDate;
+    entry.externalAttrs = (static_cast<uint32_t>(metadata.permissions) & 0xFFFF) << 16;
 
-    uint16_t date = static_cast<uint16_t>(
-        ((tm->tm_year - 80) << 9) |  // 7 bits
-        ((tm->tm_mon + 1) << 5) |    // 4 bits
-        tm->tm_mday);                // 5 bits
+    return entry;
+}
 
-    return {time, date};
+uint32_t ArchiveWriter::calculateCrc32(std::span<const uint8_t> data) {
+    // zlib takes 32-bit lengths
+    uLong crc = crc32(0L, Z_NULL, 0);
+    while (!data.empty()) {
+        size_t count = std::min<size_t>(data.size(), UINT32_MAX);
+        crc = crc32(crc, data.data(), static_cast<uInt>(count));
+        data = data.subspan(count);
+    }
+    return static_cast<uint32_t>(crc);
 }
 } 
\ No newline at end of file
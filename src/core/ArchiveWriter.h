@@ -1,26 +1,47 @@
 #pragma once
 
+#include "ArchiveIO.h"
+#include "ArchiveReader.h"
 #include "Compressor.h"
+#include "Delta.h"
+#include "SolidBlock.h"
+#include "Sparse.h"
+#include "ZipEntry.h"
+#include "../util/IoEngine.h"
+#include "../util/MemoryBudget.h"
+#include "../util/ProgressBar.h"
+#include "../util/Scheduler.h"
+#include "../util/Stats.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <filesystem>
-#include <fstream>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
 namespace miniwr {
 
 /**
- * @brief ZIP file entry metadata
+ * @brief Metadata of entries added from memory or a stream
  */
-struct ZipEntry {
-    std::string filename;
-    uint32_t crc32;
-    uint32_t compressedSize;
-    uint32_t uncompressedSize;
-    uint16_t modificationTime;  // DOS format
-    uint16_t modificationDate;  // DOS format
-    uint16_t externalAttrs;     // POSIX permissions in high byte
-    std::streampos headerOffset;  // Local file header position
+struct EntryMetadata {
+    std::filesystem::file_time_type modified = std::filesystem::file_time_type::clock::now();
+    std::filesystem::perms permissions = std::filesystem::perms::owner_read |
+                                         std::filesystem::perms::owner_write |
+                                         std::filesystem::perms::group_read |
+                                         std::filesystem::perms::others_read;
+};
+
+/**
+ * @brief Order in which entries reach the archive
+ */
+enum class CommitOrder {
+    Input,      ///< The order they were added in; the layout is reproducible
+    Completion  ///< As soon as they are compressed; listings are sorted by name
 };
 
 /**
@@ -29,16 +50,35 @@ struct ZipEntry {
 class ArchiveWriter {
 public:
     explicit ArchiveWriter(const std::filesystem::path& archivePath);
+
+    /**
+     * @brief Write the archive to a sink, e.g. ArchiveSink::memory()
+     */
+    explicit ArchiveWriter(std::unique_ptr<ArchiveSink> sink);
     ~ArchiveWriter();
 
     /**
      * @brief Add a file to the archive
      * @param filepath Path to the file to add
      * @param level Compression level
+     * @throws std::runtime_error if the path starts with INTERNAL_ENTRY_PREFIX
      */
     void addFile(const std::filesystem::path& filepath,
                 CompressionLevel level = CompressionLevel::Default);
 
+    /**
+     * @brief Add files in order, reading small ones in batches
+     *
+     * Equivalent to addFile() for each path. With an I/O engine set, the
+     * files deflated from memory are opened, stat'ed and read
+     * IoEngine::depth() at a time.
+     *
+     * @param paths Files to add
+     * @param level Compression level
+     */
+    void addFiles(std::span<const std::filesystem::path> paths,
+                 CompressionLevel level = CompressionLevel::Default);
+
     /**
      * @brief Add a directory to the archive recursively
      * @param dirpath Path to the directory
@@ -47,22 +87,291 @@ public:
     void addDirectory(const std::filesystem::path& dirpath,
                      CompressionLevel level = CompressionLevel::Default);
 
+    /**
+     * @brief Add an entry from memory
+     *
+     * In-memory entries are written right away; they are never packed into
+     * solid blocks or delta-encoded.
+     *
+     * @param name Entry name inside the archive
+     * @param data Entry content
+     * @param metadata Modification time and permissions
+     * @param level Compression level
+     * @throws std::runtime_error if the name starts with INTERNAL_ENTRY_PREFIX
+     */
+    void addEntry(const std::string& name,
+                  std::span<const uint8_t> data,
+                  const EntryMetadata& metadata = {},
+                  CompressionLevel level = CompressionLevel::Default);
+
+    /**
+     * @brief Add an entry of unknown length from a stream
+     *
+     * The content is compressed in bounded chunks as it is read.
+     *
+     * @param name Entry name inside the archive
+     * @param read Content source, returns 0 at the end
+     * @param metadata Modification time and permissions
+     * @param level Compression level
+     * @return The entry as written, with its sizes and CRC
+     * @throws std::runtime_error if the name starts with INTERNAL_ENTRY_PREFIX
+     */
+    ZipEntry addEntry(const std::string& name,
+                      const Compressor::ReadChunk& read,
+                      const EntryMetadata& metadata = {},
+                      CompressionLevel level = CompressionLevel::Default);
+
+    /**
+     * @brief Copy entries of another archive without recompressing them
+     *
+     * Local headers are rewritten and the compressed data is copied byte for
+     * byte, by the kernel where both archives are files. Delta and sparse
+     * entries keep their records. Solid members bring their whole block
+     * along, so a block copied for some of its members still holds the
+     * bytes of the others. The source dictionary is adopted if this archive
+     * has none yet.
+     *
+     * @param source Archive to copy from
+     * @param select Returns whether to copy an entry (all entries if empty)
+     * @throws std::runtime_error if both archives have different dictionaries
+     */
+    void copyEntries(ArchiveReader& source,
+                     const std::function<bool(const ZipEntry&)>& select = {});
+
+    /**
+     * @brief Add an entry whose data was compressed elsewhere
+     *
+     * Lets entries be compressed on other threads; the data is written as
+     * is, with the compressed size taken from it.
+     *
+     * @param entry Name, metadata, CRC, uncompressed size and method
+     * @param data Data in entry.compressionMethod, against this archive's dictionary
+     */
+    void addCompressedEntry(ZipEntry entry, std::span<const uint8_t> data);
+
+    /**
+     * @brief Enable solid mode
+     *
+     * Files smaller than the block size are queued and, on close(), packed
+     * into shared blocks that are each compressed as a single stream. Files
+     * keep the level they were added with; each block holds one level only.
+     *
+     * @param blockSize Target uncompressed size of one solid block (0 disables)
+     * @param numThreads Number of blocks compressed concurrently
+     */
+    void setSolidMode(size_t blockSize, unsigned numThreads = 1);
+
+    /**
+     * @brief Compress files on scheduler tasks, optionally writing them as
+     * they finish instead of in input order
+     *
+     * With more than one thread, addFile() hands files compressed from
+     * memory to up to numThreads scheduler tasks, each reusing a compressor
+     * of its own. In CommitOrder::Input the calling thread writes the
+     * results in input order, compressing at most two files per thread
+     * ahead of the one it writes next; any other entry is written after
+     * them.
+     *
+     * With CommitOrder::Completion, solid blocks are also written by the
+     * tasks that compress them. Once a task knows the
+     * compressed size it reserves the entry's range of the archive and
+     * writes it there, concurrently with other tasks where the sink
+     * supports positional writes; a large file no longer holds back the
+     * small ones added after it. Streamed, stored, delta and sparse entries
+     * are still written by the calling thread, which holds the archive
+     * while it does. The data order then depends on timing, so the central
+     * directory and the solid index are sorted by name and block.
+     *
+     * @param order Input (the default) or Completion
+     * @param numThreads Files compressed concurrently
+     */
+    void setCommitOrder(CommitOrder order, unsigned numThreads = 1);
+
+    /**
+     * @brief Compress subsequent entries against a shared preset dictionary
+     *
+     * The dictionary is stored once in the archive, so the reader can load
+     * it before inflating the entries that need it.
+     *
+     * @param dictionary Dictionary content (deflate uses the last 32 KB)
+     */
+    void setDictionary(std::vector<uint8_t> dictionary);
+
+    /**
+     * @brief Store files as deltas against their previous version
+     *
+     * Files that also exist in the base archive are encoded as copies from
+     * the base version plus literals; the result can only be extracted
+     * together with the base archive.
+     *
+     * @param base Reader of the previous archive
+     */
+    void setDeltaBase(std::shared_ptr<ArchiveReader> base);
+
+    /**
+     * @brief Record the holes of large files instead of compressing them
+     *
+     * Files of SPARSE_MIN_SIZE and more are scanned for all-zero blocks
+     * while they are compressed; the blocks are left out of the entry and
+     * listed in the archive, and extraction restores them as holes. Holes
+     * the file already has are found with SEEK_DATA/SEEK_HOLE and never
+     * read. The entries of such files only hold their data for other ZIP
+     * tools.
+     *
+     * @param sparse Whether to scan for holes
+     */
+    void setSparse(bool sparse);
+
+    /**
+     * @brief Cap the memory held by in-flight entry buffers
+     *
+     * Entries whose in-memory processing would not fit are compressed in
+     * streaming mode with bounded buffers, and solid blocks are shrunk to
+     * fit. Producers block while the budget is exhausted.
+     *
+     * @param budget Shared memory budget (nullptr for unlimited)
+     */
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+
+    /**
+     * @brief Batch the system calls of addFiles() and addDirectory()
+     * @param engine I/O engine (nullptr reads files one by one)
+     */
+    void setIoEngine(std::shared_ptr<IoEngine> engine);
+
+    /**
+     * @brief Collect per-phase timings of the entries written from now on
+     * @param stats Statistics collector (nullptr disables collection)
+     */
+    void setStats(std::shared_ptr<Stats> stats);
+
+    /**
+     * @brief Report input bytes and files as they are archived
+     * @param progress Progress counters (nullptr disables reporting)
+     */
+    void setProgress(std::shared_ptr<ProgressBar> progress);
+
     /**
      * @brief Finalize and close the archive
      */
     void close();
 
 private:
-    std::filesystem::path archivePath_;
-    std::ofstream archive_;
+    std::unique_ptr<ArchiveSink> sink_;
+    bool open_ = true;
     std::unique_ptr<Compressor> compressor_;
     std::vector<ZipEntry> entries_;
+    std::vector<uint8_t> dictionary_;
+
+    size_t solidBlockSize_ = 0;
+    unsigned solidThreads_ = 1;
+    std::vector<SolidCandidate> solidQueue_;
+    std::vector<SolidMember> solidMembers_;  // Members of the blocks written so far
+    uint32_t solidBlockCount_ = 0;
+
+    std::shared_ptr<ArchiveReader> deltaBase_;
+    std::unique_ptr<Compressor> deltaCompressor_;
+    DeltaManifest deltaManifest_;
+
+    bool sparse_ = false;
+    SparseManifest sparseManifest_;
 
+    std::shared_ptr<MemoryBudget> memoryBudget_;
+    std::shared_ptr<IoEngine> ioEngine_;
+    std::shared_ptr<Stats> stats_;
+    std::shared_ptr<ProgressBar> progress_;
+
+    CommitOrder commitOrder_ = CommitOrder::Input;
+    unsigned commitThreads_ = 1;
+    std::mutex sinkMutex_;  // Guards sink_, entries_ and solid blocks against commit tasks
+
+    // Compressors of finished commit tasks, taken up by the next ones: at
+    // most one per task running at once
+    std::mutex compressorMutex_;
+    std::vector<std::unique_ptr<Compressor>> idleCompressors_;
+
+    struct SolidBlockResult {
+        ZipEntry blockEntry;
+        Buffer compressedData;
+        std::vector<SolidMember> members;
+        std::exception_ptr error;
+    };
+
+    // Files compressed on tasks in input order, oldest first; only the
+    // calling thread writes them
+    struct PendingEntry {
+        ZipEntry entry;
+        Buffer data;  // Compressed, or the content itself if stored
+        TimePoint started;
+        MemoryBudget::Reservation reservation;
+        bool done = false;  // Guarded by pendingMutex_
+        std::exception_ptr error;
+    };
+    std::deque<std::shared_ptr<PendingEntry>> pending_;
+    std::mutex pendingMutex_;
+    std::condition_variable pendingDone_;
+
+    // Last, so that its destructor waits for the tasks before anything they use goes
+    std::unique_ptr<TaskGroup> commitTasks_;
+
+    void addFileConcurrently(const std::filesystem::path& filepath,
+                            uint64_t fileSize,
+                            CompressionLevel level);
+    void addFileInOrder(const std::filesystem::path& filepath,
+                       uint64_t fileSize,
+                       CompressionLevel level);
+    void writePending(bool wait);
+    void writeNextPending();
+    void finishCommits();
+    std::unique_ptr<Compressor> takeCompressor();
+    void returnCompressor(std::unique_ptr<Compressor> compressor);
+    void addFileStreaming(const std::filesystem::path& filepath,
+                         CompressionLevel level);
+    void addFileStored(const std::filesystem::path& filepath);
+    void addSparseFile(const std::filesystem::path& filepath,
+                      CompressionLevel level);
+    void writeStreamingEntry(ZipEntry& entry,
+                            const Compressor::ReadChunk& read,
+                            CompressionLevel level);
+    void writeContent(ZipEntry& entry,
+                     std::span<const uint8_t> content,
+                     CompressionLevel level,
+                     Compressor& compressor);
+    std::optional<Buffer> compressContent(ZipEntry& entry,
+                                          std::span<const uint8_t> content,
+                                          CompressionLevel level,
+                                          Compressor& compressor);
+    void addDeltaFile(const std::filesystem::path& filepath,
+                     const ZipEntry& baseEntry,
+                     CompressionLevel level);
+    void writeEntry(ZipEntry& entry, std::span<const uint8_t> data);
+    void writeInternalEntry(const std::string& name, std::span<const uint8_t> data);
+    void copyRawEntry(ArchiveReader& source, const ZipEntry& original, ZipEntry entry);
+    TimePoint startTiming() const;
+    void recordEntry(const ZipEntry& entry, const TimePoint& started);
+    void reportProgress(uint64_t bytes, uint64_t files);
+    void writeSolidBlocks();
+    void writeSolidBlocksConcurrently(const std::vector<std::vector<SolidCandidate>>& blocks,
+                                     uint32_t firstBlock);
+    size_t solidBlockLimit() const;
+    MemoryBudget::Reservation reserveMemory(size_t bytes);
+    bool tryReserveMemory(size_t bytes, MemoryBudget::Reservation& reservation);
+    bool fitsInMemory(size_t bytes) const;
     void writeLocalFileHeader(const ZipEntry& entry);
+    void commitSolidBlock(SolidBlockResult& result);
+    void writeDataDescriptor(const ZipEntry& entry);
     void writeCentralDirectory();
-    void writeEndOfCentralDirectory();
+    void writeEndOfCentralDirectory(std::vector<uint8_t>& out,
+                                   uint64_t centralDirOffset,
+                                   uint64_t centralDirSize);
 
-    static uint32_t calculateCrc32(const std::vector<uint8_t>& data);
-    static std::pair<uint16_t, uint16_t> getModificationTimeAndDate(
-        const std::filesystem::file_time_type& ftime);
-}; 
\ No newline at end of file
+    static SolidBlockResult compressSolidBlock(const std::vector<SolidCandidate>& files,
+                                               uint32_t block,
+                                               std::span<const uint8_t> dictionary,
+                                               Stats* stats);
+    static std::vector<uint8_t> localFileHeader(const ZipEntry& entry);
+    static ZipEntry describeFile(const std::filesystem::path& filepath);
+    static ZipEntry describeEntry(const std::string& name, const EntryMetadata& metadata);
+    static uint32_t calculateCrc32(std::span<const uint8_t> data);
+};
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace miniwr {
+
+/**
+ * @brief Append a LEB128 variable-length integer
+ */
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * @brief Append a little-endian fixed-size integer
+ */
+template <typename T>
+void putFixed(std::vector<uint8_t>& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+/**
+ * @brief Bounds-checked reader for data written with putVarint/putFixed
+ */
+class ByteCursor {
+public:
+    /**
+     * @param data Bytes to read
+     * @param what Name of the structure, used in error messages
+     */
+    ByteCursor(std::span<const uint8_t> data, std::string what)
+        : data_(data), what_(std::move(what)) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = take(1)[0];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Invalid " + what_ + ": varint too long");
+    }
+
+    template <typename T>
+    T fixed() {
+        auto bytes = take(sizeof(T));
+        T value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            value |= static_cast<T>(static_cast<T>(bytes[i]) << (8 * i));
+        }
+        return value;
+    }
+
+    std::span<const uint8_t> take(uint64_t count) {
+        if (count > data_.size() - pos_) {
+            throw std::runtime_error("Invalid " + what_ + ": truncated");
+        }
+        auto bytes = data_.subspan(pos_, static_cast<size_t>(count));
+        pos_ += static_cast<size_t>(count);
+        return bytes;
+    }
+
+    /**
+     * @brief Consume and check a signature
+     */
+    void expect(std::span<const uint8_t> magic) {
+        auto bytes = take(magic.size());
+        if (!std::equal(bytes.begin(), bytes.end(), magic.begin())) {
+            throw std::runtime_error("Invalid " + what_ + ": bad signature");
+        }
+    }
+
+    bool atEnd() const {
+        return pos_ == data_.size();
+    }
+
+    /**
+     * @brief Number of bytes consumed so far
+     */
+    size_t offset() const {
+        return pos_;
+    }
+
+private:
+    std::span<const uint8_t> data_;
+    std::string what_;
+    size_t pos_ = 0;
+};
+}
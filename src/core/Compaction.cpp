@@ -0,0 +1,546 @@
+#include "Compaction.h"
+#include "ArchiveReader.h"
+#include "ArchiveWriter.h"
+#include "BinaryIO.h"
+#include "../util/Buffer.h"
+#include "../util/FileSystem.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <zlib.h>
+
+namespace miniwr {
+
+namespace {
+    constexpr uint8_t JOURNAL_MAGIC[4] = {'M', 'W', 'C', 'J'};
+    constexpr uint8_t JOURNAL_VERSION = 1;
+    constexpr uint64_t LITERAL = UINT64_MAX;
+    constexpr size_t COMMIT_SLOT_SIZE = 16;
+    constexpr size_t SAVED_WINDOW_HEADER_SIZE = 16;
+
+    std::runtime_error systemError(const std::string& what) {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    void readAt(int fd, std::span<uint8_t> buffer, uint64_t offset) {
+        size_t total = 0;
+        while (total < buffer.size()) {
+            ssize_t count = ::pread(fd, buffer.data() + total, buffer.size() - total,
+                                    static_cast<off_t>(offset + total));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw systemError("Failed to read archive");
+            }
+            if (count == 0) {
+                throw std::runtime_error("Unexpected end of archive");
+            }
+            total += static_cast<size_t>(count);
+        }
+    }
+
+    void writeAt(int fd, std::span<const uint8_t> data, uint64_t offset) {
+        size_t total = 0;
+        while (total < data.size()) {
+            ssize_t count = ::pwrite(fd, data.data() + total, data.size() - total,
+                                     static_cast<off_t>(offset + total));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw systemError("Failed to write archive");
+            }
+            total += static_cast<size_t>(count);
+        }
+    }
+
+    void syncData(int fd) {
+        if (::fdatasync(fd) != 0) {
+            throw systemError("Failed to sync archive");
+        }
+    }
+
+    // Makes the creation or removal of a journal durable
+    void syncDirectory(const std::filesystem::path& path) {
+        auto directory = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // Closes a descriptor unless released, so that constructors that throw
+    // after opening it don't leak it (their destructor never runs)
+    class DescriptorGuard {
+    public:
+        explicit DescriptorGuard(int fd) : fd_(fd) {}
+        ~DescriptorGuard() {
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+        }
+
+        DescriptorGuard(const DescriptorGuard&) = delete;
+        DescriptorGuard& operator=(const DescriptorGuard&) = delete;
+
+        int get() const { return fd_; }
+        int release() { return std::exchange(fd_, -1); }
+
+    private:
+        int fd_;
+    };
+
+    uint32_t checksum(std::span<const uint8_t> data, uint32_t crc = 0) {
+        return static_cast<uint32_t>(crc32(crc, data.data(), static_cast<uInt>(data.size())));
+    }
+}
+
+struct Compaction::Operation {
+    uint64_t length = 0;
+    uint64_t source = LITERAL;  // Archive offset of copied bytes
+    uint64_t literal = 0;       // Offset in Plan::literals otherwise
+};
+
+/**
+ * @brief Compacted archive as a sequence of copies and new bytes
+ */
+struct Compaction::Plan {
+    uint64_t window = COMPACTION_WINDOW;
+    uint64_t originalSize = 0;
+    uint64_t compactedSize = 0;
+    std::vector<Operation> ops;
+    std::vector<uint8_t> literals;
+
+    uint64_t windowCount() const {
+        return (compactedSize + window - 1) / window;
+    }
+
+    std::vector<uint8_t> serialize() const {
+        std::vector<uint8_t> out(std::begin(JOURNAL_MAGIC), std::end(JOURNAL_MAGIC));
+        out.push_back(JOURNAL_VERSION);
+        putVarint(out, window);
+        putVarint(out, originalSize);
+        putVarint(out, compactedSize);
+        putVarint(out, ops.size());
+        for (const auto& op : ops) {
+            putVarint(out, op.length);
+            putVarint(out, op.source == LITERAL ? 0 : op.source + 1);
+        }
+        putVarint(out, literals.size());
+        out.insert(out.end(), literals.begin(), literals.end());
+        putFixed(out, checksum(out));
+        return out;
+    }
+
+    // A journal cut short while it was written is rejected here
+    static Plan parse(std::span<const uint8_t> data, uint64_t& size) {
+        ByteCursor cursor(data, "compaction journal");
+        cursor.expect(JOURNAL_MAGIC);
+        if (cursor.take(1)[0] != JOURNAL_VERSION) {
+            throw std::runtime_error("Unsupported compaction journal version");
+        }
+
+        Plan plan;
+        plan.window = cursor.varint();
+        plan.originalSize = cursor.varint();
+        plan.compactedSize = cursor.varint();
+        uint64_t opCount = cursor.varint();
+        uint64_t position = 0;
+        uint64_t literalSize = 0;
+        for (uint64_t i = 0; i < opCount; ++i) {
+            Operation op;
+            op.length = cursor.varint();
+            uint64_t source = cursor.varint();
+            if (source == 0) {
+                op.literal = literalSize;
+                literalSize += op.length;
+            } else {
+                op.source = source - 1;
+                if (op.source < position || op.source + op.length > plan.originalSize) {
+                    throw std::runtime_error("Invalid compaction journal: bad copy");
+                }
+            }
+            position += op.length;
+            plan.ops.push_back(op);
+        }
+        auto literals = cursor.take(cursor.varint());
+        plan.literals.assign(literals.begin(), literals.end());
+
+        size_t checked = cursor.offset();
+        if (cursor.fixed<uint32_t>() != checksum(data.first(checked))) {
+            throw std::runtime_error("Invalid compaction journal: bad checksum");
+        }
+        if (plan.window == 0 || position != plan.compactedSize || literalSize != plan.literals.size()) {
+            throw std::runtime_error("Invalid compaction journal: inconsistent plan");
+        }
+        size = cursor.offset();
+        return plan;
+    }
+};
+
+// Records the archive written by ArchiveWriter as copies of the bytes
+// already in the file plus new bytes. New bytes identical to the ones that
+// would be copied next extend the copy, so runs of surviving records become
+// a single move.
+class Compaction::PlanSink : public ArchiveSink {
+public:
+    PlanSink(Plan& plan, int archive) : plan_(plan), archive_(archive) {}
+
+    void write(std::span<const uint8_t> data) override {
+        auto& ops = plan_.ops;
+        uint64_t next = !ops.empty() && ops.back().source != LITERAL
+            ? ops.back().source + ops.back().length : position_;
+        if (next >= position_ && next + data.size() <= plan_.originalSize && matches(next, data)) {
+            append(next, data.size());
+            return;
+        }
+
+        if (ops.empty() || ops.back().source != LITERAL) {
+            ops.push_back({0, LITERAL, plan_.literals.size()});
+        }
+        ops.back().length += data.size();
+        plan_.literals.insert(plan_.literals.end(), data.begin(), data.end());
+        position_ += data.size();
+    }
+
+    uint64_t position() const override {
+        return position_;
+    }
+
+    uint64_t copyFrom(int fd, uint64_t offset, uint64_t length) override {
+        (void)fd;
+        // Bytes below the write position are already overwritten by then
+        if (offset < position_) {
+            throw std::runtime_error("Archive records cannot be moved in place");
+        }
+        append(offset, length);
+        return length;
+    }
+
+private:
+    Plan& plan_;
+    int archive_;
+    uint64_t position_ = 0;
+
+    void append(uint64_t source, uint64_t length) {
+        auto& ops = plan_.ops;
+        if (!ops.empty() && ops.back().source != LITERAL &&
+            ops.back().source + ops.back().length == source) {
+            ops.back().length += length;
+        } else {
+            ops.push_back({length, source, 0});
+        }
+        position_ += length;
+    }
+
+    bool matches(uint64_t offset, std::span<const uint8_t> data) const {
+        std::vector<uint8_t> current(data.size());
+        readAt(archive_, current, offset);
+        return std::equal(current.begin(), current.end(), data.begin());
+    }
+};
+
+Compaction::Compaction(const std::filesystem::path& archivePath,
+                       const std::function<bool(const ZipEntry&)>& remove,
+                       size_t window)
+    : archivePath_(archivePath),
+      journalPath_(archivePath.string() + COMPACTION_JOURNAL_SUFFIX),
+      plan_(std::make_unique<Plan>()) {
+
+    if (window == 0) {
+        throw std::runtime_error("Compaction window must not be empty");
+    }
+    plan_->window = window;
+    plan_->originalSize = std::filesystem::file_size(archivePath);
+
+    DescriptorGuard archive(::open(archivePath.c_str(), O_RDWR | O_CLOEXEC));
+    if (archive.get() < 0) {
+        throw std::runtime_error("Failed to open archive file: " + archivePath.string());
+    }
+
+    // The surviving entries are "copied" into the plan, front to back
+    ArchiveReader reader(archivePath);
+    ArchiveWriter writer(std::make_unique<PlanSink>(*plan_, archive.get()));
+    writer.copyEntries(reader, [&](const ZipEntry& entry) {
+        if (remove(entry)) {
+            ++removed_;
+            return false;
+        }
+        return true;
+    });
+    writer.close();
+
+    for (const auto& op : plan_->ops) {
+        plan_->compactedSize += op.length;
+    }
+    archive_ = archive.release();
+}
+
+Compaction::Compaction(const std::filesystem::path& archivePath, std::unique_ptr<Plan> plan)
+    : archivePath_(archivePath),
+      journalPath_(archivePath.string() + COMPACTION_JOURNAL_SUFFIX),
+      plan_(std::move(plan)) {
+
+    DescriptorGuard archive(::open(archivePath.c_str(), O_RDWR | O_CLOEXEC));
+    if (archive.get() < 0) {
+        throw std::runtime_error("Failed to open archive file: " + archivePath.string());
+    }
+    DescriptorGuard journal(::open(journalPath_.c_str(), O_RDWR | O_CLOEXEC));
+    if (journal.get() < 0) {
+        throw std::runtime_error("Failed to open journal: " + journalPath_.string());
+    }
+    archive_ = archive.release();
+    journal_ = journal.release();
+}
+
+// Without finish(), the journal is left for recover()
+Compaction::~Compaction() {
+    if (archive_ >= 0) {
+        ::close(archive_);
+    }
+    if (journal_ >= 0) {
+        ::close(journal_);
+    }
+}
+
+uint64_t Compaction::originalSize() const {
+    return plan_->originalSize;
+}
+
+uint64_t Compaction::compactedSize() const {
+    return removed_ > 0 ? plan_->compactedSize : plan_->originalSize;
+}
+
+bool Compaction::step() {
+    if (removed_ == 0 && journal_ < 0) {
+        return false;
+    }
+    uint64_t windows = plan_->windowCount();
+    if (nextWindow_ >= windows) {
+        return false;
+    }
+    if (journal_ < 0) {
+        writeJournal();
+    }
+
+    uint64_t start = nextWindow_ * plan_->window;
+    size_t size = static_cast<size_t>(std::min(plan_->window, plan_->compactedSize - start));
+
+    // Windows of unmoved bytes, such as the records before the first
+    // removed one, are left alone
+    auto op = op_;
+    auto opOffset = opOffset_;
+    auto position = position_;
+    uint64_t lowestSource = UINT64_MAX;
+    bool unchanged = true;
+    consume(size, [&](const Operation& part, uint64_t offset, uint64_t, uint64_t at) {
+        if (part.source == LITERAL) {
+            unchanged = false;
+            return;
+        }
+        lowestSource = std::min(lowestSource, part.source + offset);
+        unchanged = unchanged && part.source + offset == at;
+    });
+    if (unchanged) {
+        ++nextWindow_;
+        return nextWindow_ < windows;
+    }
+
+    Buffer window(size);
+    if (savedWindow_ == nextWindow_) {
+        // Its source may be partly overwritten; the journal has a copy
+        std::copy(saved_.begin(), saved_.end(), window.data());
+    } else {
+        op_ = op;
+        opOffset_ = opOffset;
+        position_ = position;
+        consume(size, [&](const Operation& part, uint64_t offset, uint64_t length, uint64_t at) {
+            auto target = window.span().subspan(static_cast<size_t>(at - start), static_cast<size_t>(length));
+            if (part.source == LITERAL) {
+                std::copy_n(plan_->literals.begin() + static_cast<ptrdiff_t>(part.literal + offset),
+                            target.size(), target.begin());
+            } else {
+                readAt(archive_, target, part.source + offset);
+            }
+        });
+
+        // Writing the window overwrites some of its own source bytes
+        if (lowestSource < start + size) {
+            saveWindow(window.span());
+        }
+    }
+
+    writeAt(archive_, window.span(), start);
+    syncData(archive_);
+    ++nextWindow_;
+    commit();
+    return nextWindow_ < windows;
+}
+
+void Compaction::finish() {
+    if (removed_ == 0 && journal_ < 0) {
+        return;
+    }
+    while (step()) {
+    }
+
+    if (::ftruncate(archive_, static_cast<off_t>(plan_->compactedSize)) != 0) {
+        throw systemError("Failed to truncate archive");
+    }
+    if (::fsync(archive_) != 0) {
+        throw systemError("Failed to sync archive");
+    }
+    ::close(archive_);
+    archive_ = -1;
+    ::close(journal_);
+    journal_ = -1;
+    std::filesystem::remove(journalPath_);
+    syncDirectory(journalPath_);
+}
+
+bool Compaction::recover(const std::filesystem::path& archivePath) {
+    std::filesystem::path journalPath = archivePath.string() + COMPACTION_JOURNAL_SUFFIX;
+    if (!std::filesystem::exists(journalPath)) {
+        return false;
+    }
+
+    Buffer journal;
+    readFile(journalPath, journal);
+    uint64_t headerSize = 0;
+    std::unique_ptr<Plan> plan;
+    try {
+        plan = std::make_unique<Plan>(Plan::parse(journal.span(), headerSize));
+    } catch (const std::runtime_error&) {
+        // Never completely written, so the archive was not touched
+        std::filesystem::remove(journalPath);
+        syncDirectory(journalPath);
+        return true;
+    }
+
+    // The last valid commit slot holds the number of windows on disk; the
+    // next commit overwrites the other one
+    uint64_t committed = 0;
+    size_t lastSlot = 1;
+    for (size_t slot = 0; slot < 2; ++slot) {
+        uint64_t offset = headerSize + slot * COMMIT_SLOT_SIZE;
+        if (offset + COMMIT_SLOT_SIZE > journal.size()) {
+            break;
+        }
+        ByteCursor cursor(journal.span().subspan(static_cast<size_t>(offset), COMMIT_SLOT_SIZE),
+                          "compaction journal");
+        uint64_t windows = cursor.fixed<uint64_t>();
+        if (cursor.fixed<uint32_t>() == checksum(journal.span().subspan(static_cast<size_t>(offset), 8)) &&
+            windows >= committed) {
+            committed = windows;
+            lastSlot = slot;
+        }
+    }
+
+    uint64_t size = std::filesystem::file_size(archivePath);
+    if (size != plan->originalSize &&
+        !(committed == plan->windowCount() && size == plan->compactedSize)) {
+        throw std::runtime_error("Archive changed since its compaction was interrupted: " +
+                                 archivePath.string());
+    }
+
+    Compaction compaction(archivePath, std::move(plan));
+    compaction.journalHeaderSize_ = headerSize;
+    compaction.commitSlot_ = lastSlot ^ 1;
+    compaction.nextWindow_ = std::min(committed, compaction.plan_->windowCount());
+    compaction.consume(std::min(compaction.nextWindow_ * compaction.plan_->window,
+                                compaction.plan_->compactedSize),
+                       [](const Operation&, uint64_t, uint64_t, uint64_t) {});
+
+    // A window saved before its write is replayed from the journal
+    uint64_t savedOffset = headerSize + 2 * COMMIT_SLOT_SIZE;
+    if (savedOffset + SAVED_WINDOW_HEADER_SIZE + 4 <= journal.size()) {
+        auto record = journal.span().subspan(static_cast<size_t>(savedOffset));
+        ByteCursor cursor(record, "compaction journal");
+        uint64_t window = cursor.fixed<uint64_t>();
+        uint64_t length = cursor.fixed<uint64_t>();
+        if (window == compaction.nextWindow_ && length <= record.size() - SAVED_WINDOW_HEADER_SIZE - 4) {
+            auto data = cursor.take(length);
+            auto covered = record.first(static_cast<size_t>(SAVED_WINDOW_HEADER_SIZE + length));
+            if (cursor.fixed<uint32_t>() == checksum(covered)) {
+                compaction.savedWindow_ = window;
+                compaction.saved_.assign(data.begin(), data.end());
+            }
+        }
+    }
+
+    compaction.finish();
+    return true;
+}
+
+void Compaction::writeJournal() {
+    auto header = plan_->serialize();
+    journalHeaderSize_ = header.size();
+
+    // Both commit slots start at zero windows
+    for (int slot = 0; slot < 2; ++slot) {
+        std::vector<uint8_t> record;
+        putFixed(record, uint64_t{0});
+        putFixed(record, checksum(record));
+        putFixed(record, uint32_t{0});
+        header.insert(header.end(), record.begin(), record.end());
+    }
+
+    journal_ = ::open(journalPath_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (journal_ < 0) {
+        throw std::runtime_error("Failed to create journal: " + journalPath_.string());
+    }
+    writeAt(journal_, header, 0);
+    if (::fsync(journal_) != 0) {
+        throw systemError("Failed to sync journal");
+    }
+    syncDirectory(journalPath_);
+}
+
+void Compaction::saveWindow(std::span<const uint8_t> data) {
+    uint64_t offset = journalHeaderSize_ + 2 * COMMIT_SLOT_SIZE;
+    std::vector<uint8_t> header;
+    putFixed(header, nextWindow_);
+    putFixed(header, static_cast<uint64_t>(data.size()));
+    std::vector<uint8_t> trailer;
+    putFixed(trailer, checksum(data, checksum(header)));
+
+    writeAt(journal_, header, offset);
+    writeAt(journal_, data, offset + header.size());
+    writeAt(journal_, trailer, offset + header.size() + data.size());
+    syncData(journal_);
+}
+
+// Slots alternate, so a torn write leaves the previous commit intact
+void Compaction::commit() {
+    std::vector<uint8_t> record;
+    putFixed(record, nextWindow_);
+    putFixed(record, checksum(record));
+    putFixed(record, uint32_t{0});
+    writeAt(journal_, record, journalHeaderSize_ + commitSlot_ * COMMIT_SLOT_SIZE);
+    syncData(journal_);
+    commitSlot_ ^= 1;
+}
+
+void Compaction::consume(uint64_t length, const Part& part) {
+    while (length > 0) {
+        const auto& op = plan_->ops.at(op_);
+        uint64_t count = std::min(length, op.length - opOffset_);
+        part(op, opOffset_, count, position_);
+        opOffset_ += count;
+        position_ += count;
+        length -= count;
+        if (opOffset_ == op.length) {
+            ++op_;
+            opOffset_ = 0;
+        }
+    }
+}
+}
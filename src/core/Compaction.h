@@ -0,0 +1,118 @@
+#pragma once
+
+#include "ZipEntry.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace miniwr {
+
+/// Appended to the archive path to name the journal of a compaction
+inline constexpr const char* COMPACTION_JOURNAL_SUFFIX = ".journal";
+
+/// Bytes of the compacted archive written per step
+inline constexpr size_t COMPACTION_WINDOW = 32 * 1024 * 1024;
+
+/**
+ * @brief Removal of entries from an archive, compacting it in place
+ *
+ * The compacted archive is planned up front with
+ * ArchiveWriter::copyEntries(): surviving records slide towards the start
+ * of the file with their compressed data untouched, and a new central
+ * directory (plus solid index and manifests) ends the file. Each record
+ * only ever moves down, so the archive is rewritten front to back, one
+ * window at a time.
+ *
+ * The plan is stored in a journal next to the archive before the archive
+ * is touched. Every window is committed to the journal once it is on disk;
+ * a window whose source bytes it overwrites is saved in the journal first.
+ * An interrupted compaction is completed by recover().
+ */
+class Compaction {
+public:
+    /**
+     * @brief Plan the removal; nothing is written yet
+     * @param archivePath Archive to compact
+     * @param remove Returns whether to remove an entry
+     * @param window Bytes written per step
+     * @throws std::runtime_error if the records cannot be moved in place
+     */
+    Compaction(const std::filesystem::path& archivePath,
+               const std::function<bool(const ZipEntry&)>& remove,
+               size_t window = COMPACTION_WINDOW);
+    ~Compaction();
+
+    Compaction(const Compaction&) = delete;
+    Compaction& operator=(const Compaction&) = delete;
+
+    /**
+     * @brief Number of entries removed, solid members included
+     */
+    uint64_t removedEntries() const { return removed_; }
+
+    /**
+     * @brief Archive size before and after compaction
+     */
+    uint64_t originalSize() const;
+    uint64_t compactedSize() const;
+
+    /**
+     * @brief Move the next window, writing the journal first if needed
+     * @return Whether windows are left to move
+     */
+    bool step();
+
+    /**
+     * @brief Move the remaining windows, truncate the archive and remove the journal
+     */
+    void finish();
+
+    /**
+     * @brief Complete a compaction interrupted by a crash
+     *
+     * A journal that was never completely written is discarded; the
+     * archive had not been touched yet.
+     *
+     * @param archivePath Archive that was being compacted
+     * @return Whether a journal was found
+     */
+    static bool recover(const std::filesystem::path& archivePath);
+
+private:
+    struct Plan;
+    struct Operation;
+    class PlanSink;
+    using Part = std::function<void(const Operation& op, uint64_t offset, uint64_t length,
+                                    uint64_t position)>;
+
+    Compaction(const std::filesystem::path& archivePath, std::unique_ptr<Plan> plan);
+
+    void writeJournal();
+    void saveWindow(std::span<const uint8_t> data);
+    void commit();
+    void consume(uint64_t length, const Part& part);
+
+    std::filesystem::path archivePath_;
+    std::filesystem::path journalPath_;
+    std::unique_ptr<Plan> plan_;
+    uint64_t removed_ = 0;
+    int archive_ = -1;
+    int journal_ = -1;
+    uint64_t journalHeaderSize_ = 0;
+    size_t commitSlot_ = 0;
+
+    // Windows before nextWindow_ are committed; the plan is consumed up to
+    // byte opOffset_ of operation op_, which writes at position_
+    uint64_t nextWindow_ = 0;
+    size_t op_ = 0;
+    uint64_t opOffset_ = 0;
+    uint64_t position_ = 0;
+
+    // Window saved in the journal by an interrupted run
+    uint64_t savedWindow_ = UINT64_MAX;
+    std::vector<uint8_t> saved_;
+};
+}
@@ -0,0 +1,13 @@
+#include "Compressor.h"
+#include "DeflateCompressor.h"
+#include <stdexcept>
+
+namespace miniwr {
+
+std::unique_ptr<Compressor> Compressor::create(const std::string& type) {
+    if (type == "deflate") {
+        return std::make_unique<DeflateCompressor>();
+    }
+    throw std::runtime_error("Unsupported compression type: " + type);
+}
+}
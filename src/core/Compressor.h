@@ -1,6 +1,8 @@
 #pragma once
 
+#include "../util/Buffer.h"
 #include <cstdint>
+#include <functional>
 #include <span>
 #include <string>
 #include <vector>
@@ -23,17 +25,72 @@ enum class CompressionLevel {
  */
 class Compressor {
 public:
+    /// Fills the buffer, returns the number of bytes read (0 at end of input)
+    using ReadChunk = std::function<size_t(std::span<uint8_t>)>;
+    /// Consumes a chunk of output
+    using WriteChunk = std::function<void(std::span<const uint8_t>)>;
+
+    /// Upper bound of the memory used by compressStream()/decompressStream()
+    static constexpr size_t STREAMING_MEMORY = 1024 * 1024;
+
+    /// Upper bound of the codec state used besides the input and output data
+    static constexpr size_t WORKING_MEMORY = 512 * 1024;
+
+    /**
+     * @brief Pull-based decompression of a single stream
+     *
+     * The caller asks for output and the decoder reads compressed input as
+     * needed, holding at most STREAMING_MEMORY.
+     */
+    class Decoder {
+    public:
+        virtual ~Decoder() = default;
+
+        /**
+         * @brief Decompress into a buffer
+         * @param output Destination (must not be empty)
+         * @return Number of bytes produced, 0 at the end of the stream
+         */
+        virtual size_t read(std::span<uint8_t> output) = 0;
+    };
+
     virtual ~Compressor() = default;
 
+    /**
+     * @brief Compress a block of data into a pooled buffer
+     * @param input Input data span
+     * @param output Receives the compressed data (previous content is dropped)
+     * @param level Compression level
+     */
+    virtual void compress(
+        std::span<const uint8_t> input,
+        Buffer& output,
+        CompressionLevel level = CompressionLevel::Default) = 0;
+
+    /**
+     * @brief Decompress a block of data into a pooled buffer
+     * @param input Compressed data span
+     * @param output Receives the decompressed data (previous content is dropped)
+     * @param expectedSize Expected size of decompressed data (if known)
+     */
+    virtual void decompress(
+        std::span<const uint8_t> input,
+        Buffer& output,
+        size_t expectedSize = 0) = 0;
+
     /**
      * @brief Compress a block of data
      * @param input Input data span
      * @param level Compression level
      * @return Compressed data vector
      */
-    virtual std::vector<uint8_t> compress(
+    std::vector<uint8_t> compress(
         std::span<const uint8_t> input,
-        CompressionLevel level = CompressionLevel::Default) = 0;
+        CompressionLevel level = CompressionLevel::Default) {
+        Buffer output;
+        compress(input, output, level);
+        return std::vector<uint8_t>(output.begin(), output.end());
+    }
 
     /**
      * @brief Decompress a block of data
@@ -41,14 +98,60 @@ public:
      * @param expectedSize Expected size of decompressed data (if known)
      * @return Decompressed data vector
      */
-    virtual std::vector<uint8_t> decompress(
+    std::vector<uint8_t> decompress(
         std::span<const uint8_t> input,
-        size_t expectedSize = 0) = 0;
+        size_t expectedSize = 0) {
+        Buffer output;
+        decompress(input, output, expectedSize);
+        return std::vector<uint8_t>(output.begin(), output.end());
+    }
+
+    /**
+     * @brief Compress a stream of unknown length with bounded buffers
+     * @param read Input source
+     * @param write Output sink
+     * @param level Compression level
+     */
+    virtual void compressStream(
+        const ReadChunk& read,
+        const WriteChunk& write,
+        CompressionLevel level = CompressionLevel::Default) = 0;
+
+    /**
+     * @brief Decompress a stream with bounded buffers
+     * @param read Compressed input source
+     * @param write Output sink
+     */
+    virtual void decompressStream(
+        const ReadChunk& read,
+        const WriteChunk& write) = 0;
+
+    /**
+     * @brief Start pull-based decompression of a stream
+     *
+     * The decoder has its own codec state, so several can be open at once;
+     * it takes a copy of the current preset dictionary.
+     *
+     * @param read Compressed input source
+     */
+    virtual std::unique_ptr<Decoder> createDecoder(ReadChunk read) = 0;
+
+    /**
+     * @brief Set a preset dictionary shared by compress() and decompress()
+     *
+     * Backends without dictionary support ignore it.
+     *
+     * @param dictionary Dictionary content (empty to clear)
+     */
+    virtual void setDictionary(std::span<const uint8_t> dictionary) {
+        (void)dictionary;
+    }
 
     /**
      * @brief Create a new compressor instance
-     * @param type Compression type string ("deflate", "gzip")
+     * @param type Compression type string ("deflate")
      * @return Unique pointer to compressor instance
      */
     static std::unique_ptr<Compressor> create(const std::string& type);
-}; 
\ No newline at end of file
+};
+}
@@ -3,122 +3,307 @@
 
 namespace miniwr {
 
-DeflateCompressor::DeflateCompressor() : streamInitialized_(false) {
-    initStream();
+namespace {
+    constexpr size_t DECODER_INPUT_SIZE = 128 * 1024;
+
+    class DeflateDecoder : public Compressor::Decoder {
+    public:
+        DeflateDecoder(Compressor::ReadChunk read, std::vector<uint8_t> dictionary)
+            : read_(std::move(read)),
+              dictionary_(std::move(dictionary)),
+              input_(DECODER_INPUT_SIZE) {
+            if (inflateInit(&stream_) != Z_OK) {
+                throw std::runtime_error("Failed to initialize inflate");
+            }
+        }
+
+        ~DeflateDecoder() override {
+            inflateEnd(&stream_);
+        }
+
+        size_t read(std::span<uint8_t> output) override {
+            if (finished_) {
+                return 0;
+            }
+
+            stream_.next_out = output.data();
+            stream_.avail_out = static_cast<uInt>(output.size());
+
+            while (true) {
+                if (stream_.avail_in == 0) {
+                    size_t have = read_(input_.span());
+                    if (have == 0) {
+                        if (!started_) {
+                            finished_ = true;  // Empty input, as in decompress()
+                            return 0;
+                        }
+                        throw std::runtime_error("Decompression error: truncated stream");
+                    }
+                    started_ = true;
+                    stream_.next_in = input_.data();
+                    stream_.avail_in = static_cast<uInt>(have);
+                }
+
+                int ret = inflate(&stream_, Z_NO_FLUSH);
+                if (ret == Z_NEED_DICT && !dictionary_.empty()) {
+                    if (inflateSetDictionary(&stream_, dictionary_.data(),
+                                             static_cast<uInt>(dictionary_.size())) != Z_OK) {
+                        throw std::runtime_error("Preset dictionary mismatch");
+                    }
+                    continue;
+                }
+                if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+                    ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) {
+                    throw std::runtime_error("Decompression error");
+                }
+
+                size_t produced = output.size() - stream_.avail_out;
+                if (ret == Z_STREAM_END) {
+                    finished_ = true;
+                    return produced;
+                }
+                if (produced > 0) {
+                    return produced;
+                }
+            }
+        }
+
+    private:
+        Compressor::ReadChunk read_;
+        std::vector<uint8_t> dictionary_;
+        Buffer input_;
+        z_stream stream_{};
+        bool started_ = false;
+        bool finished_ = false;
+    };
 }
 
+DeflateCompressor::DeflateCompressor() = default;
+
 DeflateCompressor::~DeflateCompressor() {
-    if (streamInitialized_) {
-        endStream();
+    if (deflateInitialized_) {
+        deflateEnd(&deflateStream_);
+    }
+    if (inflateInitialized_) {
+        inflateEnd(&inflateStream_);
+    }
+}
+
+void DeflateCompressor::resetDeflate(CompressionLevel level) {
+    if (deflateInitialized_ && deflateLevel_ != level) {
+        deflateEnd(&deflateStream_);
+        deflateInitialized_ = false;
+    }
+
+    int ret = deflateInitialized_
+        ? deflateReset(&deflateStream_)
+        : deflateInit(&deflateStream_, static_cast<int>(level));
+    if (ret != Z_OK) {
+        throw std::runtime_error("Failed to initialize deflate");
+    }
+    deflateInitialized_ = true;
+    deflateLevel_ = level;
+
+    if (!dictionary_.empty()) {
+        ret = deflateSetDictionary(&deflateStream_, dictionary_.data(),
+                                   static_cast<uInt>(dictionary_.size()));
+        if (ret != Z_OK) {
+            throw std::runtime_error("Failed to set deflate dictionary");
+        }
     }
 }
 
-void DeflateCompressor::initStream() {
-    stream_ = {};
-    streamInitialized_ = true;
+void DeflateCompressor::resetInflate() {
+    int ret = inflateInitialized_
+        ? inflateReset(&inflateStream_)
+        : inflateInit(&inflateStream_);
+    if (ret != Z_OK) {
+        throw std::runtime_error("Failed to initialize inflate");
+    }
+    inflateInitialized_ = true;
 }
 
-void DeflateCompressor::endStream() {
-    if (streamInitialized_) {
-        deflateEnd(&stream_);
-        streamInitialized_ = false;
+bool DeflateCompressor::applyInflateDictionary() {
+    // Streams compressed against a preset dictionary ask for it first
+    if (dictionary_.empty()) {
+        return false;
+    }
+    if (inflateSetDictionary(&inflateStream_, dictionary_.data(),
+                             static_cast<uInt>(dictionary_.size())) != Z_OK) {
+        throw std::runtime_error("Preset dictionary mismatch");
     }
+    return true;
 }
 
-std::vector<uint8_t> DeflateCompressor::compress(
+void DeflateCompressor::compress(
     std::span<const uint8_t> input,
+    Buffer& output,
     CompressionLevel level) {
-    
-    if (input.empty()) {
-        return {};
-    }
-
-    // Initialize deflate
-    stream_.zalloc = Z_NULL;
-    stream_.zfree = Z_NULL;
-    stream_.opaque = Z_NULL;
 
-    int ret = deflateInit(&stream_, static_cast<int>(level));
-    if (ret != Z_OK) {
-        throw std::runtime_error("Failed to initialize deflate");
+    output.clear();
+    if (input.empty()) {
+        return;
     }
 
-    // Set input
-    stream_.avail_in = static_cast<uInt>(input.size());
-    stream_.next_in = const_cast<Bytef*>(input.data());
+    resetDeflate(level);
+    deflateStream_.avail_in = static_cast<uInt>(input.size());
+    deflateStream_.next_in = const_cast<Bytef*>(input.data());
 
-    // Prepare output buffer
-    std::vector<uint8_t> output;
-    output.reserve(input.size());  // Initial guess
-    std::vector<uint8_t> buffer(CHUNK_SIZE);
+    // The bound is exact enough that a single call normally finishes
+    output.resize(deflateBound(&deflateStream_, static_cast<uLong>(input.size())));
+    size_t produced = 0;
 
-    // Compress data
-    do {
-        stream_.avail_out = CHUNK_SIZE;
-        stream_.next_out = buffer.data();
+    while (true) {
+        deflateStream_.next_out = output.data() + produced;
+        deflateStream_.avail_out = static_cast<uInt>(output.size() - produced);
 
-        ret = deflate(&stream_, Z_FINISH);
-        if (ret == Z_STREAM_ERROR) {
-            deflateEnd(&stream_);
+        int ret = deflate(&deflateStream_, Z_FINISH);
+        produced = static_cast<size_t>(deflateStream_.next_out - output.data());
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
             throw std::runtime_error("Compression error");
         }
+        output.resize(output.size() * 2);
+    }
 
-        size_t have = CHUNK_SIZE - stream_.avail_out;
-        output.insert(output.end(), buffer.begin(), buffer.begin() + have);
-    } while (stream_.avail_out == 0);
-
-    deflateEnd(&stream_);
-    return output;
+    output.resize(produced);
 }
 
-std::vector<uint8_t> DeflateCompressor::decompress(
+void DeflateCompressor::decompress(
     std::span<const uint8_t> input,
+    Buffer& output,
     size_t expectedSize) {
-    
+
+    output.clear();
     if (input.empty()) {
-        return {};
+        return;
     }
 
-    // Initialize inflate
-    stream_.zalloc = Z_NULL;
-    stream_.zfree = Z_NULL;
-    stream_.opaque = Z_NULL;
-    stream_.avail_in = 0;
-    stream_.next_in = Z_NULL;
+    resetInflate();
+    inflateStream_.avail_in = static_cast<uInt>(input.size());
+    inflateStream_.next_in = const_cast<Bytef*>(input.data());
 
-    int ret = inflateInit(&stream_);
-    if (ret != Z_OK) {
-        throw std::runtime_error("Failed to initialize inflate");
+    // One spare byte lets inflate reach the end of the stream without growing
+    output.resize(expectedSize > 0 ? expectedSize + 1 : input.size() * 2);
+    size_t produced = 0;
+
+    while (true) {
+        inflateStream_.next_out = output.data() + produced;
+        inflateStream_.avail_out = static_cast<uInt>(output.size() - produced);
+
+        int ret = inflate(&inflateStream_, Z_NO_FLUSH);
+        produced = static_cast<size_t>(inflateStream_.next_out - output.data());
+
+        if (ret == Z_NEED_DICT && applyInflateDictionary()) {
+            continue;
+        }
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            throw std::runtime_error("Decompression error");
+        }
+        if (inflateStream_.avail_out != 0) {
+            throw std::runtime_error("Decompression error: truncated stream");
+        }
+        output.resize(output.size() * 2);
     }
 
-    // Set input
-    stream_.avail_in = static_cast<uInt>(input.size());
-    stream_.next_in = const_cast<Bytef*>(input.data());
+    output.resize(produced);
+}
+
+void DeflateCompressor::compressStream(
+    const ReadChunk& read,
+    const WriteChunk& write,
+    CompressionLevel level) {
 
-    // Prepare output buffer
-    std::vector<uint8_t> output;
-    output.reserve(expectedSize > 0 ? expectedSize : input.size() * 2);
-    std::vector<uint8_t> buffer(CHUNK_SIZE);
+    resetDeflate(level);
+
+    Buffer in(STREAM_CHUNK_SIZE);
+    Buffer out(STREAM_CHUNK_SIZE);
+    int flush;
 
-    // Decompress data
     do {
-        stream_.avail_out = CHUNK_SIZE;
-        stream_.next_out = buffer.data();
-
-        ret = inflate(&stream_, Z_NO_FLUSH);
-        switch (ret) {
-            case Z_NEED_DICT:
-            case Z_DATA_ERROR:
-            case Z_MEM_ERROR:
-                inflateEnd(&stream_);
+        size_t have = read(in.span());
+        flush = have == 0 ? Z_FINISH : Z_NO_FLUSH;
+        deflateStream_.avail_in = static_cast<uInt>(have);
+        deflateStream_.next_in = in.data();
+
+        do {
+            deflateStream_.avail_out = static_cast<uInt>(out.size());
+            deflateStream_.next_out = out.data();
+
+            if (deflate(&deflateStream_, flush) == Z_STREAM_ERROR) {
+                throw std::runtime_error("Compression error");
+            }
+
+            size_t produced = out.size() - deflateStream_.avail_out;
+            if (produced > 0) {
+                write({out.data(), produced});
+            }
+        } while (deflateStream_.avail_out == 0);
+    } while (flush != Z_FINISH);
+}
+
+void DeflateCompressor::decompressStream(
+    const ReadChunk& read,
+    const WriteChunk& write) {
+
+    Buffer in(STREAM_CHUNK_SIZE);
+    size_t have = read(in.span());
+    if (have == 0) {
+        return;  // Empty input, as in decompress()
+    }
+
+    resetInflate();
+    Buffer out(STREAM_CHUNK_SIZE);
+    int ret = Z_OK;
+
+    while (have > 0 && ret != Z_STREAM_END) {
+        inflateStream_.avail_in = static_cast<uInt>(have);
+        inflateStream_.next_in = in.data();
+
+        while (true) {
+            inflateStream_.avail_out = static_cast<uInt>(out.size());
+            inflateStream_.next_out = out.data();
+
+            ret = inflate(&inflateStream_, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT && applyInflateDictionary()) {
+                continue;
+            }
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+                ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) {
                 throw std::runtime_error("Decompression error");
+            }
+
+            size_t produced = out.size() - inflateStream_.avail_out;
+            if (produced > 0) {
+                write({out.data(), produced});
+            }
+
+            if (ret == Z_STREAM_END ||
+                (inflateStream_.avail_in == 0 && inflateStream_.avail_out != 0)) {
+                break;
+            }
         }
 
-        size_t have = CHUNK_SIZE - stream_.avail_out;
-        output.insert(output.end(), buffer.begin(), buffer.begin() + have);
-    } while (stream_.avail_out == 0);
+        if (ret != Z_STREAM_END) {
+            have = read(in.span());
+        }
+    }
 
-    inflateEnd(&stream_);
-    return output;
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("Decompression error: truncated stream");
+    }
+}
+
+std::unique_ptr<Compressor::Decoder> DeflateCompressor::createDecoder(ReadChunk read) {
+    return std::make_unique<DeflateDecoder>(std::move(read), dictionary_);
+}
+
+void DeflateCompressor::setDictionary(std::span<const uint8_t> dictionary) {
+    dictionary_.assign(dictionary.begin(), dictionary.end());
+}
 }
-} 
\ No newline at end of file
@@ -13,19 +13,46 @@ public:
     DeflateCompressor();
     ~DeflateCompressor() override;
 
-    std::vector<uint8_t> compress(
+    using Compressor::compress;
+    using Compressor::decompress;
+
+    void compress(
         std::span<const uint8_t> input,
+        Buffer& output,
         CompressionLevel level = CompressionLevel::Default) override;
 
-    std::vector<uint8_t> decompress(
+    void decompress(
         std::span<const uint8_t> input,
+        Buffer& output,
         size_t expectedSize = 0) override;
 
+    void compressStream(
+        const ReadChunk& read,
+        const WriteChunk& write,
+        CompressionLevel level = CompressionLevel::Default) override;
+
+    void decompressStream(
+        const ReadChunk& read,
+        const WriteChunk& write) override;
+
+    std::unique_ptr<Decoder> createDecoder(ReadChunk read) override;
+
+    void setDictionary(std::span<const uint8_t> dictionary) override;
+
 private:
-    static constexpr size_t CHUNK_SIZE = 16384;  // 16KB chunks
-    z_stream stream_;
-    bool streamInitialized_;
+    static constexpr size_t STREAM_CHUNK_SIZE = 128 * 1024;
+
+    // Streams are kept across calls and reset per entry, so zlib's window
+    // and hash tables are allocated once instead of for every entry
+    z_stream deflateStream_{};
+    z_stream inflateStream_{};
+    bool deflateInitialized_ = false;
+    bool inflateInitialized_ = false;
+    CompressionLevel deflateLevel_ = CompressionLevel::Default;
+    std::vector<uint8_t> dictionary_;
 
-    void initStream();
-    void endStream();
-}; 
\ No newline at end of file
+    void resetDeflate(CompressionLevel level);
+    void resetInflate();
+    bool applyInflateDictionary();
+};
+}
@@ -0,0 +1,272 @@
+#include "Delta.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace miniwr {
+
+namespace {
+    constexpr uint8_t DELTA_MAGIC[4] = {'M', 'W', 'D', '1'};
+    constexpr uint8_t MANIFEST_MAGIC[4] = {'M', 'W', 'D', 'M'};
+    constexpr uint8_t MANIFEST_VERSION = 1;
+
+    constexpr size_t MIN_BLOCK_SIZE = 64;
+    constexpr size_t MAX_BLOCK_SIZE = 16 * 1024;
+    constexpr size_t MAX_PROBES = 64;
+    constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    constexpr uint64_t OP_LITERAL = 0;
+    constexpr uint64_t OP_COPY = 1;
+
+    // Roughly sqrt(base size), like rsync, rounded to a power of two
+    size_t chooseBlockSize(size_t baseSize) {
+        size_t size = MIN_BLOCK_SIZE;
+        while (size < MAX_BLOCK_SIZE && size * size < baseSize) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    /**
+     * @brief rsync weak checksum over a sliding window
+     */
+    class RollingChecksum {
+    public:
+        void reset(const uint8_t* data, size_t length) {
+            a_ = 0;
+            b_ = 0;
+            length_ = static_cast<uint32_t>(length);
+            for (size_t i = 0; i < length; ++i) {
+                a_ += data[i];
+                b_ += static_cast<uint32_t>(length - i) * data[i];
+            }
+        }
+
+        void roll(uint8_t out, uint8_t in) {
+            a_ = a_ - out + in;
+            b_ = b_ - length_ * out + a_;
+        }
+
+        uint32_t value() const {
+            return (a_ & 0xFFFF) | (b_ << 16);
+        }
+
+    private:
+        uint32_t a_ = 0;
+        uint32_t b_ = 0;
+        uint32_t length_ = 0;
+    };
+
+    /**
+     * @brief Open-addressing table of base blocks keyed by weak checksum
+     */
+    class BlockTable {
+    public:
+        BlockTable(std::span<const uint8_t> base, size_t blockSize)
+            : base_(base), blockSize_(blockSize) {
+            size_t count = base.size() / blockSize;
+            size_t capacity = 16;
+            while (capacity < 2 * count) {
+                capacity <<= 1;
+            }
+            mask_ = capacity - 1;
+            blocks_.assign(capacity, EMPTY_SLOT);
+            weaks_.assign(capacity, 0);
+
+            RollingChecksum checksum;
+            for (size_t block = 0; block < count; ++block) {
+                const uint8_t* data = base.data() + block * blockSize;
+                checksum.reset(data, blockSize);
+                insert(checksum.value(), static_cast<uint32_t>(block), data);
+            }
+        }
+
+        /**
+         * @brief Find a base block with the same content as data
+         * @return Offset of the block in base, or SIZE_MAX
+         */
+        size_t find(uint32_t weak, const uint8_t* data) const {
+            size_t slot = mix(weak) & mask_;
+            for (size_t probe = 0; probe < MAX_PROBES && blocks_[slot] != EMPTY_SLOT; ++probe) {
+                size_t offset = static_cast<size_t>(blocks_[slot]) * blockSize_;
+                if (weaks_[slot] == weak && std::memcmp(base_.data() + offset, data, blockSize_) == 0) {
+                    return offset;
+                }
+                slot = (slot + 1) & mask_;
+            }
+            return SIZE_MAX;
+        }
+
+    private:
+        std::span<const uint8_t> base_;
+        size_t blockSize_;
+        size_t mask_ = 0;
+        std::vector<uint32_t> blocks_;
+        std::vector<uint32_t> weaks_;
+
+        static size_t mix(uint32_t weak) {
+            return static_cast<size_t>((weak * 0x9E3779B1u) ^ (weak >> 15));
+        }
+
+        void insert(uint32_t weak, uint32_t block, const uint8_t* data) {
+            // Repeated blocks (e.g. zero runs) are indexed once, which keeps
+            // probe chains short on highly redundant bases
+            if (find(weak, data) != SIZE_MAX) {
+                return;
+            }
+            size_t slot = mix(weak) & mask_;
+            while (blocks_[slot] != EMPTY_SLOT) {
+                slot = (slot + 1) & mask_;
+            }
+            blocks_[slot] = block;
+            weaks_[slot] = weak;
+        }
+    };
+}
+
+std::vector<uint8_t> DeltaManifest::serialize() const {
+    std::vector<uint8_t> out(std::begin(MANIFEST_MAGIC), std::end(MANIFEST_MAGIC));
+    out.push_back(MANIFEST_VERSION);
+    putVarint(out, entries.size());
+
+    for (const auto& [name, reference] : entries) {
+        putVarint(out, name.size());
+        out.insert(out.end(), name.begin(), name.end());
+        putFixed(out, reference.baseCrc32);
+        putVarint(out, reference.baseSize);
+    }
+
+    return out;
+}
+
+DeltaManifest DeltaManifest::parse(std::span<const uint8_t> data) {
+    ByteCursor cursor(data, "delta manifest");
+    cursor.expect(MANIFEST_MAGIC);
+    if (cursor.take(1)[0] != MANIFEST_VERSION) {
+        throw std::runtime_error("Unsupported delta manifest version");
+    }
+
+    DeltaManifest manifest;
+    uint64_t count = cursor.varint();
+    for (uint64_t i = 0; i < count; ++i) {
+        auto name = cursor.take(cursor.varint());
+        DeltaReference reference;
+        reference.baseCrc32 = cursor.fixed<uint32_t>();
+        reference.baseSize = static_cast<uint32_t>(cursor.varint());
+        manifest.entries.emplace(std::string(name.begin(), name.end()), reference);
+    }
+
+    return manifest;
+}
+
+std::vector<uint8_t> encodeDelta(std::span<const uint8_t> base,
+                                 std::span<const uint8_t> target) {
+    std::vector<uint8_t> out(std::begin(DELTA_MAGIC), std::end(DELTA_MAGIC));
+    putVarint(out, base.size());
+    putVarint(out, target.size());
+
+    size_t literalStart = 0;
+    auto emitLiteral = [&](size_t end) {
+        if (end > literalStart) {
+            putVarint(out, ((end - literalStart) << 1) | OP_LITERAL);
+            out.insert(out.end(), target.begin() + literalStart, target.begin() + end);
+        }
+    };
+
+    size_t blockSize = chooseBlockSize(base.size());
+    if (base.size() >= blockSize && target.size() >= blockSize) {
+        BlockTable table(base, blockSize);
+        RollingChecksum checksum;
+        checksum.reset(target.data(), blockSize);
+        size_t pos = 0;
+
+        while (pos + blockSize <= target.size()) {
+            size_t match = table.find(checksum.value(), target.data() + pos);
+            if (match == SIZE_MAX) {
+                if (pos + blockSize < target.size()) {
+                    checksum.roll(target[pos], target[pos + blockSize]);
+                }
+                ++pos;
+                continue;
+            }
+
+            // Grow the match over pending literals and past the block end
+            size_t start = pos;
+            size_t baseStart = match;
+            while (start > literalStart && baseStart > 0 &&
+                   target[start - 1] == base[baseStart - 1]) {
+                --start;
+                --baseStart;
+            }
+            size_t end = pos + blockSize;
+            size_t baseEnd = match + blockSize;
+            while (end < target.size() && baseEnd < base.size() && target[end] == base[baseEnd]) {
+                ++end;
+                ++baseEnd;
+            }
+
+            emitLiteral(start);
+            putVarint(out, ((end - start) << 1) | OP_COPY);
+            putVarint(out, baseStart);
+
+            literalStart = end;
+            pos = end;
+            if (pos + blockSize <= target.size()) {
+                checksum.reset(target.data() + pos, blockSize);
+            }
+        }
+    }
+
+    emitLiteral(target.size());
+    return out;
+}
+
+std::vector<uint8_t> applyDelta(std::span<const uint8_t> base,
+                                std::span<const uint8_t> delta) {
+    Buffer out;
+    applyDelta(base, delta, out);
+    return std::vector<uint8_t>(out.begin(), out.end());
+}
+
+void applyDelta(std::span<const uint8_t> base,
+                std::span<const uint8_t> delta,
+                Buffer& out) {
+    ByteCursor cursor(delta, "delta");
+    cursor.expect(DELTA_MAGIC);
+    if (cursor.varint() != base.size()) {
+        throw std::runtime_error("Delta base size mismatch");
+    }
+
+    uint64_t targetSize = cursor.varint();
+    out.clear();
+    out.reserve(static_cast<size_t>(targetSize));
+
+    while (!cursor.atEnd()) {
+        uint64_t op = cursor.varint();
+        uint64_t length = op >> 1;
+
+        if ((op & 1) == OP_LITERAL) {
+            out.append(cursor.take(length));
+        } else {
+            uint64_t offset = cursor.varint();
+            if (offset > base.size() || length > base.size() - offset) {
+                throw std::runtime_error("Invalid delta: copy outside base");
+            }
+            out.append(base.subspan(offset, length));
+        }
+
+        if (out.size() > targetSize) {
+            throw std::runtime_error("Invalid delta: output too large");
+        }
+    }
+
+    if (out.size() != targetSize) {
+        throw std::runtime_error("Invalid delta: output size mismatch");
+    }
+}
+
+std::span<const uint8_t> deltaDictionary(std::span<const uint8_t> base) {
+    return base.size() > DELTA_DICTIONARY_SIZE ? base.last(DELTA_DICTIONARY_SIZE) : base;
+}
+}
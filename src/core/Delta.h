@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../util/Buffer.h"
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace miniwr {
+
+/// Archive entry listing the entries stored as deltas against a base archive
+inline constexpr const char* DELTA_MANIFEST_NAME = ".miniwr/delta.idx";
+
+/// Amount of base data used as the deflate preset dictionary of a delta
+inline constexpr size_t DELTA_DICTIONARY_SIZE = 32 * 1024;
+
+/**
+ * @brief Base version a delta entry was encoded against
+ */
+struct DeltaReference {
+    uint32_t baseCrc32 = 0;
+    uint32_t baseSize = 0;
+};
+
+/**
+ * @brief Delta entries of an archive, keyed by entry name
+ */
+struct DeltaManifest {
+    std::map<std::string, DeltaReference> entries;
+
+    std::vector<uint8_t> serialize() const;
+    static DeltaManifest parse(std::span<const uint8_t> data);
+};
+
+/**
+ * @brief Encode target as copies from base plus literal runs
+ *
+ * Uses an rsync-style match finder: base is split into fixed blocks indexed
+ * by a rolling weak checksum, the checksum is rolled over target one byte at
+ * a time and every candidate block is confirmed and then extended in both
+ * directions. Matches are found at any distance, independently of the
+ * 32 KB deflate window.
+ *
+ * @param base Previous version of the file
+ * @param target New version of the file
+ * @return Serialized delta operations
+ */
+std::vector<uint8_t> encodeDelta(std::span<const uint8_t> base,
+                                 std::span<const uint8_t> target);
+
+/**
+ * @brief Rebuild the target from base and the output of encodeDelta()
+ * @param base Previous version of the file
+ * @param delta Serialized delta operations
+ * @return Reconstructed target
+ */
+std::vector<uint8_t> applyDelta(std::span<const uint8_t> base,
+                                std::span<const uint8_t> delta);
+
+/**
+ * @brief Rebuild the target into a pooled buffer
+ * @param base Previous version of the file
+ * @param delta Serialized delta operations
+ * @param out Receives the reconstructed target
+ */
+void applyDelta(std::span<const uint8_t> base,
+                std::span<const uint8_t> delta,
+                Buffer& out);
+
+/**
+ * @brief Tail of base used as the preset dictionary when deflating a delta
+ */
+std::span<const uint8_t> deltaDictionary(std::span<const uint8_t> base);
+}
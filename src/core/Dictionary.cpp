@@ -0,0 +1,237 @@
+#include "Dictionary.h"
+#include "../util/Buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <span>
+
+namespace miniwr {
+
+namespace {
+    constexpr size_t DMER_SIZE = 8;         // Substring length used for scoring
+    constexpr size_t SEGMENT_SIZE = 64;     // Unit of dictionary content
+    constexpr size_t MAX_SAMPLE_FILES = 4096;
+    constexpr size_t MAX_SAMPLE_BYTES = 128 * 1024;            // Per file
+    constexpr size_t MAX_TOTAL_SAMPLE_BYTES = 16 * 1024 * 1024;
+    constexpr unsigned HASH_BITS = 20;
+    constexpr unsigned MIN_HASH_BITS = 12;  // Under small memory budgets
+    constexpr uint32_t NO_DMER = UINT32_MAX;  // Hash of positions without a whole d-mer
+
+    uint32_t hashDmer(const uint8_t* data, unsigned hashBits) {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return static_cast<uint32_t>((value * 0x9E3779B97F4A7C15ULL) >> (64 - hashBits));
+    }
+
+    struct Segment {
+        size_t offset;
+        uint64_t score;
+    };
+
+    // Sample data and hash table sizes that fit the memory to train in
+    struct TrainingSize {
+        size_t sampleBytes;
+        unsigned hashBits;
+    };
+
+    size_t tableCost(unsigned hashBits) {
+        return BufferPool::roundUp(sizeof(uint32_t) << hashBits);
+    }
+
+    // Samples, their d-mer hashes and the frequency and last-sample tables
+    size_t trainingCost(size_t sampleBytes, unsigned hashBits) {
+        return BufferPool::roundUp(sampleBytes) + BufferPool::roundUp(sampleBytes * sizeof(uint32_t)) +
+               2 * tableCost(hashBits);
+    }
+
+    TrainingSize trainingSize(const MemoryBudget* budget, size_t wanted) {
+        if (!budget) {
+            return {wanted, HASH_BITS};
+        }
+
+        // Half of the limit, leaving the rest for the archive being written;
+        // the tables take at most a quarter of that
+        size_t available = budget->limit() / 2;
+        unsigned hashBits = HASH_BITS;
+        while (hashBits > MIN_HASH_BITS && 2 * tableCost(hashBits) > available / 4) {
+            --hashBits;
+        }
+
+        size_t low = 0;
+        size_t high = wanted;
+        while (low < high) {
+            size_t size = low + (high - low + 1) / 2;
+            if (trainingCost(size, hashBits) <= available) {
+                low = size;
+            } else {
+                high = size - 1;
+            }
+        }
+        return {low, hashBits};
+    }
+
+    std::span<uint32_t> words(Buffer& buffer) {
+        return {reinterpret_cast<uint32_t*>(buffer.data()), buffer.size() / sizeof(uint32_t)};
+    }
+
+    std::vector<uint8_t> train(std::span<const uint8_t> data, const std::vector<size_t>& sampleEnds,
+                               size_t dictionarySize, unsigned hashBits) {
+        dictionarySize = std::min(dictionarySize, MAX_DICTIONARY_SIZE);
+
+        if (data.size() < 2 * SEGMENT_SIZE || dictionarySize < SEGMENT_SIZE) {
+            return {};
+        }
+        if (data.size() <= dictionarySize) {
+            return {data.begin(), data.end()};
+        }
+
+        // Count in how many samples each d-mer occurs; d-mers that cross a
+        // sample boundary are never counted
+        Buffer frequencyTable(sizeof(uint32_t) << hashBits);
+        Buffer lastSampleTable(sizeof(uint32_t) << hashBits);
+        Buffer hashes(data.size() * sizeof(uint32_t));
+        auto frequency = words(frequencyTable);
+        auto lastSample = words(lastSampleTable);
+        auto dmerHash = words(hashes);
+        std::fill(frequency.begin(), frequency.end(), 0);
+        std::fill(lastSample.begin(), lastSample.end(), UINT32_MAX);
+        std::fill(dmerHash.begin(), dmerHash.end(), NO_DMER);
+
+        size_t sampleStart = 0;
+        for (uint32_t s = 0; s < sampleEnds.size(); ++s) {
+            for (size_t pos = sampleStart; pos + DMER_SIZE <= sampleEnds[s]; ++pos) {
+                uint32_t hash = hashDmer(&data[pos], hashBits);
+                dmerHash[pos] = hash;
+                if (lastSample[hash] != s) {
+                    lastSample[hash] = s;
+                    ++frequency[hash];
+                }
+            }
+            sampleStart = sampleEnds[s];
+        }
+
+        // A d-mer seen in a single sample is not worth sharing
+        auto score = [&](size_t pos) -> uint64_t {
+            if (dmerHash[pos] == NO_DMER) {
+                return 0;
+            }
+            uint32_t count = frequency[dmerHash[pos]];
+            return count > 1 ? count : 0;
+        };
+
+        // Pick the best segment of each epoch
+        size_t numEpochs = std::min(dictionarySize / SEGMENT_SIZE, data.size() / SEGMENT_SIZE);
+        size_t epochSize = data.size() / numEpochs;
+        constexpr size_t WINDOW_DMERS = SEGMENT_SIZE - DMER_SIZE + 1;
+        std::vector<Segment> segments;
+
+        for (size_t epoch = 0; epoch < numEpochs; ++epoch) {
+            size_t begin = epoch * epochSize;
+            size_t end = std::min(begin + epochSize, data.size());
+            if (end - begin < SEGMENT_SIZE) {
+                continue;
+            }
+
+            uint64_t windowScore = 0;
+            for (size_t pos = begin; pos < begin + WINDOW_DMERS; ++pos) {
+                windowScore += score(pos);
+            }
+
+            Segment best{begin, windowScore};
+            for (size_t pos = begin + 1; pos + SEGMENT_SIZE <= end; ++pos) {
+                windowScore += score(pos + WINDOW_DMERS - 1);
+                windowScore -= score(pos - 1);
+                if (windowScore > best.score) {
+                    best = {pos, windowScore};
+                }
+            }
+
+            if (best.score == 0) {
+                continue;
+            }
+
+            // Later epochs should favour content not yet in the dictionary
+            for (size_t pos = best.offset; pos < best.offset + WINDOW_DMERS; ++pos) {
+                if (dmerHash[pos] != NO_DMER) {
+                    frequency[dmerHash[pos]] = 0;
+                }
+            }
+            segments.push_back(best);
+        }
+
+        // Most valuable segments go last, closest to the data being compressed
+        std::stable_sort(segments.begin(), segments.end(),
+            [](const Segment& a, const Segment& b) { return a.score < b.score; });
+
+        std::vector<uint8_t> dictionary;
+        dictionary.reserve(segments.size() * SEGMENT_SIZE);
+        for (const auto& segment : segments) {
+            dictionary.insert(dictionary.end(),
+                              data.begin() + static_cast<ptrdiff_t>(segment.offset),
+                              data.begin() + static_cast<ptrdiff_t>(segment.offset + SEGMENT_SIZE));
+        }
+
+        if (dictionary.size() > dictionarySize) {
+            dictionary.erase(dictionary.begin(), dictionary.end() - static_cast<ptrdiff_t>(dictionarySize));
+        }
+
+        return dictionary;
+    }
+}
+
+std::vector<uint8_t> trainDictionary(const std::vector<std::filesystem::path>& files,
+                                     size_t dictionarySize,
+                                     std::shared_ptr<MemoryBudget> budget) {
+    auto size = trainingSize(budget.get(), MAX_TOTAL_SAMPLE_BYTES);
+    auto reservation = budget ? budget->acquire(trainingCost(size.sampleBytes, size.hashBits))
+                              : MemoryBudget::Reservation();
+
+    // Samples are read straight into one buffer, remembering where each one ends
+    Buffer data;
+    data.reserve(size.sampleBytes);
+    std::vector<size_t> sampleEnds;
+    size_t stride = std::max<size_t>(1, files.size() / MAX_SAMPLE_FILES);
+
+    for (size_t i = 0; i < files.size() && data.size() < size.sampleBytes; i += stride) {
+        std::ifstream file(files[i], std::ios::binary);
+        if (!file) {
+            continue;
+        }
+
+        size_t start = data.size();
+        data.resize(start + std::min(MAX_SAMPLE_BYTES, size.sampleBytes - start));
+        file.read(reinterpret_cast<char*>(data.data() + start), static_cast<std::streamsize>(data.size() - start));
+        data.resize(start + static_cast<size_t>(file.gcount()));
+        sampleEnds.push_back(data.size());
+    }
+
+    return train(data.span(), sampleEnds, dictionarySize, size.hashBits);
+}
+
+std::vector<uint8_t> trainDictionary(const std::vector<std::vector<uint8_t>>& samples,
+                                     size_t dictionarySize,
+                                     std::shared_ptr<MemoryBudget> budget) {
+    size_t totalBytes = 0;
+    for (const auto& sample : samples) {
+        totalBytes += sample.size();
+    }
+    auto size = trainingSize(budget.get(), totalBytes);
+    auto reservation = budget ? budget->acquire(trainingCost(size.sampleBytes, size.hashBits))
+                              : MemoryBudget::Reservation();
+
+    // Concatenate samples, remembering where each one ends
+    Buffer data;
+    data.reserve(size.sampleBytes);
+    std::vector<size_t> sampleEnds;
+    for (const auto& sample : samples) {
+        if (data.size() == size.sampleBytes) {
+            break;
+        }
+        size_t count = std::min(sample.size(), size.sampleBytes - data.size());
+        data.append({sample.data(), count});
+        sampleEnds.push_back(data.size());
+    }
+
+    return train(data.span(), sampleEnds, dictionarySize, size.hashBits);
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../util/MemoryBudget.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace miniwr {
+
+/// Archive entry holding the shared preset dictionary
+inline constexpr const char* DICTIONARY_ENTRY_NAME = ".miniwr/dictionary";
+
+/// Largest useful dictionary for deflate (its window size)
+inline constexpr size_t MAX_DICTIONARY_SIZE = 32 * 1024;
+
+/**
+ * @brief Train a preset dictionary from sample files
+ *
+ * Samples are read from an evenly spaced subset of the files. The sample
+ * data is split into one epoch per dictionary segment and the segment whose
+ * 8-byte substrings occur in the most samples is kept from each epoch. The
+ * best segments are placed at the end of the dictionary, where deflate
+ * reaches them with the shortest distances.
+ *
+ * Training holds about five bytes per sample byte plus two hash tables.
+ * Under a memory budget, the sample data and the tables are sized to half
+ * of its limit and reserved from it while training runs.
+ *
+ * @param files Candidate sample files
+ * @param dictionarySize Target dictionary size (at most MAX_DICTIONARY_SIZE)
+ * @param budget Memory budget to train within (nullptr for the default size)
+ * @return Dictionary content, empty if there was too little sample data
+ */
+std::vector<uint8_t> trainDictionary(const std::vector<std::filesystem::path>& files,
+                                     size_t dictionarySize = MAX_DICTIONARY_SIZE,
+                                     std::shared_ptr<MemoryBudget> budget = nullptr);
+
+/**
+ * @brief Train a preset dictionary from in-memory samples
+ * @param samples Sample contents (the tail is ignored beyond what the budget allows)
+ * @param dictionarySize Target dictionary size (at most MAX_DICTIONARY_SIZE)
+ * @param budget Memory budget to train within (nullptr for no limit)
+ * @return Dictionary content, empty if there was too little sample data
+ */
+std::vector<uint8_t> trainDictionary(const std::vector<std::vector<uint8_t>>& samples,
+                                     size_t dictionarySize = MAX_DICTIONARY_SIZE,
+                                     std::shared_ptr<MemoryBudget> budget = nullptr);
+}
@@ -0,0 +1,42 @@
+#include "Merge.h"
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace miniwr {
+
+MergeReport mergeArchives(ArchiveWriter& output,
+                          std::span<const std::shared_ptr<ArchiveReader>> inputs,
+                          DuplicatePolicy policy) {
+    MergeReport report;
+
+    // Entry supplying each name; names can repeat within one input too, so
+    // the entry itself is kept rather than its input (readers hand out
+    // stable references, the same ones copyEntries() selects from)
+    std::unordered_map<std::string, const ZipEntry*> owners;
+    for (const auto& input : inputs) {
+        for (const auto& entry : input->entries()) {
+            auto [it, inserted] = owners.try_emplace(entry.filename, &entry);
+            if (inserted) {
+                continue;
+            }
+            if (policy == DuplicatePolicy::Error) {
+                throw std::runtime_error("Duplicate entry: " + entry.filename);
+            }
+            if (policy == DuplicatePolicy::Last) {
+                it->second = &entry;
+            }
+            ++report.duplicates;
+        }
+    }
+
+    for (const auto& input : inputs) {
+        output.copyEntries(*input, [&](const ZipEntry& entry) {
+            return owners.at(entry.filename) == &entry;
+        });
+    }
+
+    report.entries = owners.size();
+    return report;
+}
+}
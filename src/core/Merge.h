@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ArchiveReader.h"
+#include "ArchiveWriter.h"
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace miniwr {
+
+/**
+ * @brief What merging does with names found more than once, in different
+ *        inputs or within one
+ */
+enum class DuplicatePolicy {
+    Error,  ///< Refuse to merge
+    First,  ///< Keep the earliest entry, in input then archive order
+    Last    ///< Keep the latest entry, in input then archive order
+};
+
+/**
+ * @brief Outcome of mergeArchives()
+ */
+struct MergeReport {
+    uint64_t entries = 0;     ///< Entries written
+    uint64_t duplicates = 0;  ///< Entries left out because another entry won
+};
+
+/**
+ * @brief Combine archives into one without recompressing anything
+ *
+ * Names are resolved across all inputs, and within each of them, before
+ * anything is written; the entries are then copied input by input with
+ * ArchiveWriter::copyEntries().
+ * The output is promoted to ZIP64 when it grows past 4 GB or 65535 entries.
+ * Delta entries still need the base archive they were encoded against.
+ *
+ * @param output Archive receiving the entries
+ * @param inputs Archives to combine, in order
+ * @param policy What to do with names found more than once
+ * @throws std::runtime_error naming the first duplicate under DuplicatePolicy::Error
+ */
+MergeReport mergeArchives(ArchiveWriter& output,
+                          std::span<const std::shared_ptr<ArchiveReader>> inputs,
+                          DuplicatePolicy policy = DuplicatePolicy::Error);
+}
@@ -0,0 +1,247 @@
+#include "Recompress.h"
+#include "../util/Buffer.h"
+#include "../util/Scheduler.h"
+#include "../util/Trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+
+namespace miniwr {
+
+namespace {
+    constexpr uint16_t ZIP_COMPRESSION_METHOD_STORE = 0x0000;
+    constexpr uint16_t ZIP_COMPRESSION_METHOD_DEFLATE = 0x0008;
+    constexpr size_t INFLATE_CHUNK_SIZE = 256 * 1024;
+
+    // Thrown out of compressStream() once the output is no smaller than
+    // the data it would replace
+    struct NoGain {};
+
+    struct Result {
+        Buffer data;
+        bool gained = false;
+        std::exception_ptr error;
+    };
+
+    bool isCandidate(ArchiveReader& input, const ZipEntry& entry, const RecompressOptions& options) {
+        switch (input.storage(entry)) {
+            case EntryStorage::Stored:
+                if (options.level == CompressionLevel::Store) {
+                    return false;
+                }
+                break;
+            case EntryStorage::Deflated:
+                break;
+            default:
+                return false;
+        }
+        if (entry.uncompressedSize == 0 || entry.uncompressedSize < options.minSize) {
+            return false;
+        }
+        return static_cast<double>(entry.compressedSize) >=
+            options.minRatio * static_cast<double>(entry.uncompressedSize);
+    }
+
+    // The recompressed copy plus the compressor and the inflating stream
+    size_t taskCost(const ZipEntry& entry, CompressionLevel level) {
+        uint64_t output = level == CompressionLevel::Store ? entry.uncompressedSize : entry.compressedSize;
+        return BufferPool::roundUp(static_cast<size_t>(output)) + Compressor::WORKING_MEMORY +
+               Compressor::STREAMING_MEMORY;
+    }
+
+    Buffer recompressEntry(ArchiveReader& input, const ZipEntry& entry, Compressor& compressor,
+                           CompressionLevel level) {
+        // The stream checks the CRC once it reaches the end
+        EntryStream stream = input.open(entry);
+        Buffer data;
+        if (level == CompressionLevel::Store) {
+            data.reserve(entry.uncompressedSize);
+            Buffer chunk(INFLATE_CHUNK_SIZE);
+            while (size_t count = stream.read(chunk.span())) {
+                data.append(chunk.span().first(count));
+            }
+            return data;
+        }
+
+        // Sized once, so the copy never outgrows its reservation
+        data.reserve(entry.compressedSize);
+        compressor.compressStream(
+            [&](std::span<uint8_t> buffer) {
+                return stream.read(buffer);
+            },
+            [&](std::span<const uint8_t> chunk) {
+                if (data.size() + chunk.size() >= entry.compressedSize) {
+                    throw NoGain{};
+                }
+                data.append(chunk);
+            },
+            level);
+        return data;
+    }
+}
+
+int64_t RecompressReport::savedBytes() const {
+    int64_t saved = 0;
+    for (const auto& entry : recompressed) {
+        saved += static_cast<int64_t>(entry.originalSize) - static_cast<int64_t>(entry.newSize);
+    }
+    return saved;
+}
+
+RecompressReport recompressArchive(ArchiveWriter& output, ArchiveReader& input,
+                                   const RecompressOptions& options) {
+    RecompressReport report;
+
+    const auto& budget = options.memoryBudget;
+
+    // Candidates are handed out in archive order, so the input is read
+    // front to back. Those whose copy would not fit in the memory budget
+    // are streamed into the writer one at a time instead.
+    std::vector<const ZipEntry*> candidates;
+    std::vector<const ZipEntry*> streamed;
+    std::unordered_set<std::string> candidateNames;
+    for (const auto& entry : input.entries()) {
+        if (isCandidate(input, entry, options)) {
+            bool fits = !budget || budget->fits(taskCost(entry, options.level));
+            (fits ? candidates : streamed).push_back(&entry);
+            candidateNames.insert(entry.filename);
+        }
+    }
+    auto byOffset = [](const ZipEntry* a, const ZipEntry* b) {
+        return a->headerOffset < b->headerOffset;
+    };
+    std::stable_sort(candidates.begin(), candidates.end(), byOffset);
+    std::stable_sort(streamed.begin(), streamed.end(), byOffset);
+
+    // Scheduler tasks recompress up to `window` candidates ahead of the one
+    // this thread writes next, in candidate order
+    const unsigned threads = std::max(1u, options.threads);
+    const size_t window = 2 * static_cast<size_t>(threads);
+    std::vector<std::optional<Result>> results(candidates.size());
+    std::vector<MemoryBudget::Reservation> reservations(candidates.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto recompress = [&](size_t index) {
+        Result result;
+        try {
+            TraceSpan span("recompress");
+            auto compressor = Compressor::create("deflate");
+            compressor->setDictionary(input.dictionary());
+            result.data = recompressEntry(input, *candidates[index], *compressor, options.level);
+            result.gained = true;
+        } catch (const NoGain&) {
+            result.data.reset();
+        } catch (...) {
+            result.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            results[index] = std::move(result);
+        }
+        finished.notify_all();
+    };
+
+    // Destroyed first, so running tasks finish before what they use
+    TaskGroup group(threads);
+
+    // A candidate starts once its memory is reserved; waiting is only safe
+    // with nothing in flight, otherwise the results ahead must be written
+    // to release their memory first
+    size_t dispatched = 0;
+    auto dispatch = [&](size_t written) {
+        for (; dispatched < candidates.size() && dispatched < written + window; ++dispatched) {
+            if (budget) {
+                size_t cost = taskCost(*candidates[dispatched], options.level);
+                if (dispatched == written) {
+                    reservations[dispatched] = budget->acquire(cost);
+                } else if (!budget->tryAcquire(cost, reservations[dispatched])) {
+                    break;
+                }
+            }
+            group.run([&recompress, index = dispatched] { recompress(index); });
+        }
+    };
+
+    std::unordered_set<std::string> unchanged;
+    try {
+        // Everything else is copied while the first candidates are recompressed
+        dispatch(0);
+        output.copyEntries(input, [&](const ZipEntry& entry) {
+            if (candidateNames.count(entry.filename)) {
+                return false;
+            }
+            ++report.copied;
+            return true;
+        });
+
+        for (size_t index = 0; index < candidates.size(); ++index) {
+            dispatch(index);
+            Result result;
+            {
+                TraceSpan span("wait-entry");
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return results[index].has_value(); });
+                result = std::move(*results[index]);
+                results[index].reset();
+            }
+
+            if (result.error) {
+                std::rethrow_exception(result.error);
+            }
+            const ZipEntry& original = *candidates[index];
+            if (result.gained) {
+                ZipEntry entry = original;
+                entry.compressionMethod = options.level == CompressionLevel::Store
+                    ? ZIP_COMPRESSION_METHOD_STORE : ZIP_COMPRESSION_METHOD_DEFLATE;
+                output.addCompressedEntry(entry, result.data.span());
+                report.recompressed.push_back({original.filename, original.compressedSize,
+                                               result.data.size()});
+            } else {
+                unchanged.insert(original.filename);
+            }
+            result.data.reset();
+            reservations[index].release();
+        }
+    } catch (...) {
+        group.cancel();
+        throw;
+    }
+    group.wait();
+
+    // The writer cannot back out of a streamed entry, so these are kept
+    // whatever their new size
+    for (const ZipEntry* original : streamed) {
+        MemoryBudget::Reservation reservation;
+        if (budget) {
+            reservation = budget->acquire(Compressor::WORKING_MEMORY + Compressor::STREAMING_MEMORY);
+        }
+        EntryStream stream = input.open(*original);
+        EntryMetadata metadata;
+        metadata.modified = fromDosDateTime(original->modificationTime, original->modificationDate);
+        if (original->externalAttrs >> 16) {
+            metadata.permissions = static_cast<std::filesystem::perms>(original->externalAttrs >> 16);
+        }
+        ZipEntry entry = output.addEntry(original->filename,
+                                         [&](std::span<uint8_t> buffer) { return stream.read(buffer); },
+                                         metadata, options.level);
+        report.recompressed.push_back({original->filename, original->compressedSize,
+                                       entry.compressedSize});
+    }
+
+    // Entries that would have grown keep their original data
+    if (!unchanged.empty()) {
+        output.copyEntries(input, [&](const ZipEntry& entry) {
+            return unchanged.count(entry.filename) > 0;
+        });
+        report.copied += unchanged.size();
+    }
+    return report;
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ArchiveReader.h"
+#include "ArchiveWriter.h"
+#include "Compressor.h"
+#include "../util/MemoryBudget.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace miniwr {
+
+/**
+ * @brief Which entries recompressArchive() recompresses, and how
+ */
+struct RecompressOptions {
+    CompressionLevel level = CompressionLevel::Maximum;  ///< Target; Store inflates deflated entries
+    uint64_t minSize = 0;    ///< Entries with less uncompressed data are copied
+    double minRatio = 0.0;   ///< Entries packed to less than this share of their size are copied
+    unsigned threads = 1;    ///< Entries recompressed concurrently
+
+    /// Caps the recompressed copies held at once, with their streams (nullptr for
+    /// unlimited); give it here rather than to the reader, which would count the streams twice
+    std::shared_ptr<MemoryBudget> memoryBudget;
+};
+
+/**
+ * @brief An entry written in its new form
+ */
+struct RecompressedEntry {
+    std::string name;
+    uint64_t originalSize = 0;  ///< Compressed size before
+    uint64_t newSize = 0;       ///< Compressed size after
+};
+
+/**
+ * @brief Outcome of recompressArchive()
+ */
+struct RecompressReport {
+    std::vector<RecompressedEntry> recompressed;  ///< In archive order
+    uint64_t copied = 0;  ///< Entries copied as they were, solid members included
+
+    /// Compressed bytes saved over all recompressed entries (negative when storing)
+    int64_t savedBytes() const;
+};
+
+/**
+ * @brief Recompress the entries of an archive that gain from it
+ *
+ * Plain stored and deflated entries that pass the size and ratio filters
+ * are inflated and deflated again at the target level by a pool of
+ * workers, while the writer copies every other entry without
+ * recompressing it (ArchiveWriter::copyEntries()). A recompressed entry is
+ * only kept if it came out smaller; workers give up on an entry as soon as
+ * its output reaches the original size, and the entry is copied instead.
+ * With CompressionLevel::Store as the target, deflated entries are stored.
+ *
+ * Each worker's copy is reserved from RecompressOptions::memoryBudget
+ * before it starts. Entries whose copy could never fit are streamed into
+ * the writer one at a time at the end; since a streamed entry cannot be
+ * taken back, they are kept whatever their new size.
+ *
+ * Solid, delta and sparse entries are always copied. Entries keep their
+ * names and metadata; the CRC of each inflated entry is checked.
+ *
+ * @param output Archive receiving the entries
+ * @param input Archive to recompress
+ * @param options Target and filters
+ * @throws std::runtime_error if an entry is corrupt
+ */
+RecompressReport recompressArchive(ArchiveWriter& output, ArchiveReader& input,
+                                   const RecompressOptions& options = {});
+}
@@ -0,0 +1,159 @@
+#include "SolidBlock.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <stdexcept>
+#include <tuple>
+
+namespace miniwr {
+
+namespace {
+    constexpr uint8_t SOLID_INDEX_MAGIC[4] = {'M', 'W', 'S', 'I'};
+    constexpr uint8_t SOLID_INDEX_VERSION = 1;
+    constexpr uint8_t SOLID_INDEX_VERSION_GAPS = 2;  // Members may skip bytes of their block
+
+    std::string lowercaseExtension(const std::filesystem::path& path) {
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ext;
+    }
+}
+
+std::vector<uint8_t> SolidIndex::serialize() const {
+    // Bytes of each block skipped before each member, all zero unless members
+    // were dropped when the block was copied from another archive. Members
+    // without an offset past the previous one follow it directly.
+    std::vector<uint64_t> gaps;
+    gaps.reserve(members.size());
+    uint32_t currentBlock = 0;
+    uint64_t offset = 0;
+    for (const auto& member : members) {
+        if (member.block != currentBlock) {
+            currentBlock = member.block;
+            offset = 0;
+        }
+        uint64_t gap = member.offset > offset ? member.offset - offset : 0;
+        gaps.push_back(gap);
+        offset += gap + member.entry.uncompressedSize;
+    }
+    bool hasGaps = std::any_of(gaps.begin(), gaps.end(), [](uint64_t gap) { return gap > 0; });
+
+    std::vector<uint8_t> out(std::begin(SOLID_INDEX_MAGIC), std::end(SOLID_INDEX_MAGIC));
+    out.push_back(hasGaps ? SOLID_INDEX_VERSION_GAPS : SOLID_INDEX_VERSION);
+    putVarint(out, blockCount);
+    putVarint(out, members.size());
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        const auto& member = members[i];
+        const auto& entry = member.entry;
+        putVarint(out, member.block);
+        if (hasGaps) {
+            putVarint(out, gaps[i]);
+        }
+        putVarint(out, entry.uncompressedSize);
+        putFixed(out, entry.crc32);
+        putFixed(out, entry.modificationTime);
+        putFixed(out, entry.modificationDate);
+        putFixed(out, entry.externalAttrs);
+        putVarint(out, entry.filename.size());
+        out.insert(out.end(), entry.filename.begin(), entry.filename.end());
+    }
+
+    return out;
+}
+
+SolidIndex SolidIndex::parse(std::span<const uint8_t> data) {
+    ByteCursor cursor(data, "solid index");
+    cursor.expect(SOLID_INDEX_MAGIC);
+    uint8_t version = cursor.take(1)[0];
+    if (version != SOLID_INDEX_VERSION && version != SOLID_INDEX_VERSION_GAPS) {
+        throw std::runtime_error("Unsupported solid index version");
+    }
+
+    SolidIndex index;
+    index.blockCount = static_cast<uint32_t>(cursor.varint());
+    uint64_t memberCount = cursor.varint();
+
+    uint32_t currentBlock = 0;
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < memberCount; ++i) {
+        SolidMember member;
+        member.block = static_cast<uint32_t>(cursor.varint());
+        if (member.block >= index.blockCount || member.block < currentBlock) {
+            throw std::runtime_error("Invalid solid index: bad block reference");
+        }
+        if (member.block != currentBlock) {
+            currentBlock = member.block;
+            offset = 0;
+        }
+        if (version == SOLID_INDEX_VERSION_GAPS) {
+            offset += cursor.varint();
+        }
+
+        auto& entry = member.entry;
+        entry.uncompressedSize = static_cast<uint32_t>(cursor.varint());
+        entry.crc32 = cursor.fixed<uint32_t>();
+        entry.modificationTime = cursor.fixed<uint16_t>();
+        entry.modificationDate = cursor.fixed<uint16_t>();
+        entry.externalAttrs = cursor.fixed<uint32_t>();
+        auto name = cursor.take(cursor.varint());
+        entry.filename.assign(name.begin(), name.end());
+
+        member.offset = offset;
+        offset += entry.uncompressedSize;
+        index.members.push_back(std::move(member));
+    }
+
+    return index;
+}
+
+std::string SolidIndex::blockName(uint32_t block) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "%06u", block);
+    return std::string(SOLID_BLOCK_PREFIX) + number;
+}
+
+std::optional<uint32_t> SolidIndex::blockIndex(std::string_view name) {
+    std::string_view prefix(SOLID_BLOCK_PREFIX);
+    if (!name.starts_with(prefix) || name.size() == prefix.size()) {
+        return std::nullopt;
+    }
+
+    // from_chars takes no sign or whitespace for unsigned types, and must
+    // consume the whole number without overflowing
+    uint32_t block = 0;
+    auto [end, error] = std::from_chars(name.data() + prefix.size(), name.data() + name.size(), block);
+    if (error != std::errc() || end != name.data() + name.size()) {
+        return std::nullopt;
+    }
+    return block;
+}
+
+std::vector<std::vector<SolidCandidate>> planSolidBlocks(
+    std::vector<SolidCandidate> files, size_t blockSize) {
+
+    std::stable_sort(files.begin(), files.end(),
+        [](const SolidCandidate& a, const SolidCandidate& b) {
+            return std::make_tuple(a.level, lowercaseExtension(a.path), a.path.filename(), a.path)
+                 < std::make_tuple(b.level, lowercaseExtension(b.path), b.path.filename(), b.path);
+        });
+
+    std::vector<std::vector<SolidCandidate>> blocks;
+    uint64_t currentSize = 0;
+
+    for (auto& file : files) {
+        if (blocks.empty() || blocks.back().front().level != file.level ||
+            (currentSize > 0 && currentSize + file.size > blockSize)) {
+            blocks.emplace_back();
+            currentSize = 0;
+        }
+        currentSize += file.size;
+        blocks.back().push_back(std::move(file));
+    }
+
+    return blocks;
+}
+}
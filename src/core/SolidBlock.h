@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Compressor.h"
+#include "ZipEntry.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace miniwr {
+
+/// Archive entry holding the solid index
+inline constexpr const char* SOLID_INDEX_NAME = ".miniwr/solid.idx";
+
+/// Prefix of the archive entries holding solid blocks
+inline constexpr const char* SOLID_BLOCK_PREFIX = ".miniwr/solid/";
+
+/**
+ * @brief A file packed inside a solid block
+ */
+struct SolidMember {
+    ZipEntry entry;       ///< Member metadata (headerOffset unused)
+    uint32_t block = 0;   ///< Index of the block holding the member
+    uint64_t offset = 0;  ///< Offset of the member in the uncompressed block
+};
+
+/**
+ * @brief Compact index locating solid members inside their blocks
+ *
+ * Members are serialized in block order, so their offsets are implied by
+ * the sizes of the preceding members of the same block. Blocks copied from
+ * another archive without some of their members record the bytes skipped
+ * before each member instead.
+ */
+struct SolidIndex {
+    uint32_t blockCount = 0;
+    std::vector<SolidMember> members;
+
+    /**
+     * @brief Serialize the index to its on-disk representation
+     * @return Serialized index bytes
+     */
+    std::vector<uint8_t> serialize() const;
+
+    /**
+     * @brief Parse a serialized index
+     * @param data Serialized index bytes
+     * @return Parsed index with member offsets filled in
+     */
+    static SolidIndex parse(std::span<const uint8_t> data);
+
+    /**
+     * @brief Archive entry name of a solid block
+     * @param block Block index
+     * @return Entry name, e.g. ".miniwr/solid/000003"
+     */
+    static std::string blockName(uint32_t block);
+
+    /**
+     * @brief Block index of a solid block entry name
+     * @param name Entry name, e.g. ".miniwr/solid/000003"
+     * @return Block index, nothing unless the name is the prefix followed
+     *         by decimal digits only
+     */
+    static std::optional<uint32_t> blockIndex(std::string_view name);
+};
+
+/**
+ * @brief A file queued for solid packing
+ */
+struct SolidCandidate {
+    std::filesystem::path path;
+    uint64_t size = 0;
+    CompressionLevel level = CompressionLevel::Default;  ///< Level the file was added with
+};
+
+/**
+ * @brief Order files for solid packing and split them into blocks
+ *
+ * Files are sorted by extension, then by base name, so similar content
+ * ends up in the same deflate window. A block is compressed as one stream,
+ * so files added with different levels go into separate blocks.
+ *
+ * @param files Files to pack
+ * @param blockSize Target uncompressed size of one block
+ * @return Files of each block, in block order
+ */
+std::vector<std::vector<SolidCandidate>> planSolidBlocks(
+    std::vector<SolidCandidate> files, size_t blockSize);
+}
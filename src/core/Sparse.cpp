@@ -0,0 +1,126 @@
+#include "Sparse.h"
+#include "BinaryIO.h"
+#include "../util/FileSystem.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace miniwr {
+
+namespace {
+    constexpr uint8_t MANIFEST_MAGIC[4] = {'M', 'W', 'S', 'M'};
+    constexpr uint8_t MANIFEST_VERSION = 1;
+}
+
+std::vector<uint8_t> SparseManifest::serialize() const {
+    std::vector<uint8_t> out(std::begin(MANIFEST_MAGIC), std::end(MANIFEST_MAGIC));
+    out.push_back(MANIFEST_VERSION);
+    putVarint(out, entries.size());
+
+    // Holes are stored as the gap since the previous one, then their length
+    for (const auto& [name, map] : entries) {
+        putVarint(out, name.size());
+        out.insert(out.end(), name.begin(), name.end());
+        putVarint(out, map.size);
+        putVarint(out, map.holes.size());
+        uint64_t end = 0;
+        for (const auto& hole : map.holes) {
+            putVarint(out, hole.offset - end);
+            putVarint(out, hole.length);
+            end = hole.offset + hole.length;
+        }
+    }
+
+    return out;
+}
+
+SparseManifest SparseManifest::parse(std::span<const uint8_t> data) {
+    ByteCursor cursor(data, "sparse manifest");
+    cursor.expect(MANIFEST_MAGIC);
+    if (cursor.take(1)[0] != MANIFEST_VERSION) {
+        throw std::runtime_error("Unsupported sparse manifest version");
+    }
+
+    SparseManifest manifest;
+    uint64_t count = cursor.varint();
+    for (uint64_t i = 0; i < count; ++i) {
+        auto name = cursor.take(cursor.varint());
+        SparseMap map;
+        map.size = cursor.varint();
+        uint64_t holes = cursor.varint();
+        uint64_t end = 0;
+        for (uint64_t j = 0; j < holes; ++j) {
+            SparseRegion hole;
+            uint64_t gap = cursor.varint();
+            hole.length = cursor.varint();
+            if (gap > map.size - end || hole.length > map.size - end - gap) {
+                throw std::runtime_error("Invalid sparse manifest: hole outside the file");
+            }
+            hole.offset = end + gap;
+            end = hole.offset + hole.length;
+            map.holes.push_back(hole);
+        }
+        manifest.entries.emplace(std::string(name.begin(), name.end()), std::move(map));
+    }
+
+    return manifest;
+}
+
+void addHole(std::vector<SparseRegion>& holes, uint64_t offset, uint64_t length) {
+    if (!holes.empty() && holes.back().offset + holes.back().length == offset) {
+        holes.back().length += length;
+    } else {
+        holes.push_back({offset, length});
+    }
+}
+
+size_t removeZeroBlocks(std::span<uint8_t> chunk, uint64_t offset,
+                        std::vector<SparseRegion>& holes) {
+    size_t kept = 0;
+    size_t position = 0;
+
+    // Bytes before the first block boundary are kept
+    size_t length = static_cast<size_t>((SPARSE_BLOCK_SIZE - offset % SPARSE_BLOCK_SIZE) % SPARSE_BLOCK_SIZE);
+    if (length == 0) {
+        length = SPARSE_BLOCK_SIZE;
+    }
+
+    while (position < chunk.size()) {
+        length = std::min(length, chunk.size() - position);
+        auto block = chunk.subspan(position, length);
+        if (length == SPARSE_BLOCK_SIZE && isZero(block)) {
+            addHole(holes, offset + position, length);
+        } else {
+            if (kept != position) {
+                std::memmove(chunk.data() + kept, block.data(), length);
+            }
+            kept += length;
+        }
+        position += length;
+        length = SPARSE_BLOCK_SIZE;
+    }
+    return kept;
+}
+
+void expandSparse(std::span<const uint8_t> packed, const SparseMap& map, Buffer& out) {
+    uint64_t holeBytes = 0;
+    for (const auto& hole : map.holes) {
+        holeBytes += hole.length;
+    }
+    if (holeBytes + packed.size() != map.size) {
+        throw std::runtime_error("Sparse map does not match the entry size");
+    }
+
+    out.resize(static_cast<size_t>(map.size));
+    uint64_t position = 0;
+    size_t consumed = 0;
+    for (const auto& hole : map.holes) {
+        size_t count = static_cast<size_t>(hole.offset - position);
+        std::memcpy(out.data() + position, packed.data() + consumed, count);
+        std::memset(out.data() + hole.offset, 0, static_cast<size_t>(hole.length));
+        consumed += count;
+        position = hole.offset + hole.length;
+    }
+    std::memcpy(out.data() + position, packed.data() + consumed, packed.size() - consumed);
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../util/Buffer.h"
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace miniwr {
+
+/// Archive entry listing the entries stored without their holes
+inline constexpr const char* SPARSE_MANIFEST_NAME = ".miniwr/sparse.idx";
+
+/// Smaller files are archived whole, zero blocks included
+inline constexpr uint64_t SPARSE_MIN_SIZE = 1024 * 1024;
+
+/**
+ * @brief A range of a file
+ */
+struct SparseRegion {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+/**
+ * @brief Layout of a file stored without its holes
+ *
+ * The archive entry holds the data between the holes back to back; its CRC
+ * and sizes are those of this packed data.
+ */
+struct SparseMap {
+    uint64_t size = 0;                ///< Size of the file, holes included
+    std::vector<SparseRegion> holes;  ///< Sorted and disjoint
+};
+
+/**
+ * @brief Sparse entries of an archive, keyed by entry name
+ */
+struct SparseManifest {
+    std::map<std::string, SparseMap> entries;
+
+    std::vector<uint8_t> serialize() const;
+    static SparseManifest parse(std::span<const uint8_t> data);
+};
+
+/**
+ * @brief Append a hole, merging it with the last one when adjacent
+ */
+void addHole(std::vector<SparseRegion>& holes, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Cut the all-zero blocks out of a chunk of a file
+ *
+ * Only whole SPARSE_BLOCK_SIZE blocks at aligned file offsets are removed.
+ * The remaining bytes are moved to the front of the chunk.
+ *
+ * @param chunk Bytes read at offset, compacted in place
+ * @param offset Offset of the chunk in the file
+ * @param holes Receives the removed blocks, merged with the last hole when adjacent
+ * @return Number of bytes left at the front of the chunk
+ */
+size_t removeZeroBlocks(std::span<uint8_t> chunk, uint64_t offset,
+                        std::vector<SparseRegion>& holes);
+
+/**
+ * @brief Rebuild a file from its packed data, with zeros for the holes
+ * @param packed Data between the holes
+ * @param map Layout of the file
+ * @param out Receives the content
+ */
+void expandSparse(std::span<const uint8_t> packed, const SparseMap& map, Buffer& out);
+}
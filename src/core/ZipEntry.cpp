@@ -0,0 +1,42 @@
+#include "ZipEntry.h"
+#include <chrono>
+#include <ctime>
+
+namespace miniwr {
+
+std::pair<uint16_t, uint16_t> toDosDateTime(std::filesystem::file_time_type ftime) {
+    // Exact conversion, so a time restored by fromDosDateTime() maps back
+    // to the same fields
+    using namespace std::chrono;
+    std::time_t tt = system_clock::to_time_t(
+        time_point_cast<system_clock::duration>(file_clock::to_sys(ftime)));
+    std::tm tm{};
+    localtime_r(&tt, &tm);
+
+    uint16_t time = static_cast<uint16_t>(
+        (tm.tm_hour << 11) |    // 5 bits
+        (tm.tm_min << 5) |      // 6 bits
+        (tm.tm_sec >> 1));      // 5 bits
+
+    uint16_t date = static_cast<uint16_t>(
+        ((tm.tm_year - 80) << 9) |  // 7 bits
+        ((tm.tm_mon + 1) << 5) |    // 4 bits
+        tm.tm_mday);                // 5 bits
+
+    return {time, date};
+}
+
+std::filesystem::file_time_type fromDosDateTime(uint16_t time, uint16_t date) {
+    using namespace std::chrono;
+    std::tm tm{};
+    tm.tm_year = (date >> 9) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0F) - 1;
+    tm.tm_mday = date & 0x1F;
+    tm.tm_hour = time >> 11;
+    tm.tm_min = (time >> 5) & 0x3F;
+    tm.tm_sec = (time & 0x1F) * 2;
+    tm.tm_isdst = -1;  // Let mktime() work out daylight saving
+
+    return file_clock::from_sys(system_clock::from_time_t(std::mktime(&tm)));
+}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+namespace miniwr {
+
+/// Prefix of the entries the archive keeps for itself (indexes, dictionary,
+/// solid blocks); file names may not start with it
+inline constexpr const char* INTERNAL_ENTRY_PREFIX = ".miniwr/";
+
+/**
+ * @brief ZIP file entry metadata
+ */
+struct ZipEntry {
+    std::string filename;
+    uint32_t crc32 = 0;
+    uint32_t compressedSize = 0;
+    uint32_t uncompressedSize = 0;
+    uint16_t modificationTime = 0;  // DOS format
+    uint16_t modificationDate = 0;  // DOS format
+    uint32_t externalAttrs = 0;     // POSIX permissions in high 16 bits
+    uint16_t flags = 0;             // General purpose bit flag
+    uint16_t compressionMethod = 8; // 0 = store, 8 = deflate
+    uint64_t headerOffset = 0;      // Local file header position
+};
+
+/**
+ * @brief Convert a file time to DOS format (local time, 2 second resolution)
+ * @return Time and date fields
+ */
+std::pair<uint16_t, uint16_t> toDosDateTime(std::filesystem::file_time_type ftime);
+
+/**
+ * @brief Convert DOS time and date fields back to a file time
+ */
+std::filesystem::file_time_type fromDosDateTime(uint16_t time, uint16_t date);
+}
@@ -0,0 +1,452 @@
+#include "Buffer.h"
+#include "Trace.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+
+namespace miniwr {
+
+namespace {
+    constexpr size_t MIN_SHIFT = 12;  // log2(BufferPool::MIN_SIZE)
+    constexpr size_t CLASSES_PER_DOUBLING = 4;
+    constexpr size_t PAGE_SIZE = 4096;
+    constexpr size_t ALIGNMENT = 64;
+
+    // Cache-line aligned, or page aligned for buffers big enough for direct I/O
+    constexpr size_t alignmentFor(size_t capacity) {
+        return capacity >= BufferPool::PAGE_ALIGNED_SIZE ? PAGE_SIZE : ALIGNMENT;
+    }
+
+    constexpr size_t THREAD_CACHE_MAX_SIZE = 256 * 1024;
+    constexpr size_t THREAD_CACHE_SLOTS = 2;
+
+    constexpr size_t classIndex(size_t size) {
+        if (size <= BufferPool::MIN_SIZE) {
+            return 0;
+        }
+        size_t shift = static_cast<size_t>(std::bit_width(size - 1)) - 1;
+        size_t base = size_t{1} << shift;
+        size_t step = base / CLASSES_PER_DOUBLING;
+        return (shift - MIN_SHIFT) * CLASSES_PER_DOUBLING + (size - base + step - 1) / step;
+    }
+
+    constexpr size_t classSize(size_t index) {
+        size_t base = size_t{1} << (MIN_SHIFT + index / CLASSES_PER_DOUBLING);
+        return base + (base / CLASSES_PER_DOUBLING) * (index % CLASSES_PER_DOUBLING);
+    }
+
+    constexpr size_t THREAD_CLASS_COUNT = classIndex(THREAD_CACHE_MAX_SIZE) + 1;
+
+    static_assert(classSize(classIndex(BufferPool::MAX_POOLED_SIZE)) == BufferPool::MAX_POOLED_SIZE);
+}
+
+/**
+ * @brief Lock-free cache of recently released small buffers of one thread
+ */
+struct ThreadCache {
+    std::array<std::array<uint8_t*, THREAD_CACHE_SLOTS>, THREAD_CLASS_COUNT> slots{};
+    std::array<uint8_t, THREAD_CLASS_COUNT> counts{};
+
+    uint8_t* pop(size_t sizeClass) {
+        return counts[sizeClass] > 0 ? slots[sizeClass][--counts[sizeClass]] : nullptr;
+    }
+
+    bool push(size_t sizeClass, uint8_t* data) {
+        if (counts[sizeClass] == THREAD_CACHE_SLOTS) {
+            return false;
+        }
+        slots[sizeClass][counts[sizeClass]++] = data;
+        return true;
+    }
+
+    // Buffers of exiting threads (e.g. solid workers) move to the shared lists
+    ~ThreadCache() {
+        flush();
+    }
+
+    void flush() {
+        auto& pool = BufferPool::instance();
+        for (size_t sizeClass = 0; sizeClass < THREAD_CLASS_COUNT; ++sizeClass) {
+            while (uint8_t* data = pop(sizeClass)) {
+                pool.cachedBytes_ -= classSize(sizeClass);
+                if (!pool.pushShared(sizeClass, data)) {
+                    BufferPool::deallocate(data, classSize(sizeClass));
+                }
+            }
+        }
+    }
+};
+
+namespace {
+    thread_local ThreadCache threadCache;
+}
+
+Buffer::Buffer(size_t size) {
+    resize(size);
+}
+
+Buffer::Buffer(Buffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+Buffer::~Buffer() {
+    reset();
+}
+
+void Buffer::resize(size_t size) {
+    reserve(size);
+    size_ = size;
+}
+
+void Buffer::reserve(size_t capacity) {
+    if (capacity <= capacity_) {
+        return;
+    }
+
+    auto block = BufferPool::instance().acquire(capacity);
+    size_t size = size_;
+    if (size > 0) {
+        std::memcpy(block.data(), data_, size);
+    }
+    reset();
+
+    data_ = block.data();
+    capacity_ = block.size();
+    size_ = size;
+}
+
+void Buffer::append(std::span<const uint8_t> bytes) {
+    if (size_ + bytes.size() > capacity_) {
+        reserve(std::max(size_ + bytes.size(), 2 * capacity_));
+    }
+    if (!bytes.empty()) {
+        std::memcpy(data_ + size_, bytes.data(), bytes.size());
+    }
+    size_ += bytes.size();
+}
+
+void Buffer::reset() {
+    if (data_) {
+        BufferPool::instance().release(data_, capacity_);
+        data_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+}
+
+BufferPool& BufferPool::instance() {
+    // Never destroyed: buffers may still be released from static and
+    // thread-local destructors at exit
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+void BufferPool::setCacheLimit(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cacheLimit_ = bytes;
+        if (sharedBytes_ > cacheLimit_) {
+            dropShared(sharedBytes_ - cacheLimit_);
+        }
+    }
+    released_.notify_all();
+}
+
+void BufferPool::setMemoryLimit(size_t bytes) {
+    // Idle buffers of this thread become reachable for every allocation
+    if (bytes > 0) {
+        threadCache.flush();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        memoryLimit_ = bytes;
+        if (bytes == 0) {
+            owners_.clear();
+            ownedBytes_.clear();
+        }
+        size_t held = liveBytes_ + sharedBytes_;
+        if (bytes > 0 && held > bytes) {
+            dropShared(held - bytes);
+        }
+    }
+    released_.notify_all();
+}
+
+void BufferPool::setHugePages(bool enabled) {
+    hugePages_ = enabled;
+}
+
+void BufferPool::trim() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dropShared(sharedBytes_);
+    }
+    released_.notify_all();
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    Stats stats;
+    stats.allocations = allocations_;
+    stats.reuses = reuses_;
+    stats.cachedBytes = cachedBytes_;
+    stats.liveBytes = liveBytes_;
+    stats.peakBytes = peakBytes_;
+    return stats;
+}
+
+void BufferPool::resetPeak() {
+    peakBytes_ = liveBytes_ + sharedBytes_;
+}
+
+size_t BufferPool::roundUp(size_t size) {
+    if (size > MAX_POOLED_SIZE) {
+        return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    }
+    return classSize(classIndex(size));
+}
+
+std::span<uint8_t> BufferPool::acquire(size_t size) {
+    size_t capacity = roundUp(size);
+    bool limited = memoryLimit_ > 0;
+    if (size <= MAX_POOLED_SIZE) {
+        size_t sizeClass = classIndex(size);
+        uint8_t* data = !limited && sizeClass < THREAD_CLASS_COUNT ? threadCache.pop(sizeClass) : nullptr;
+        if (data) {
+            cachedBytes_ -= capacity;
+            liveBytes_ += capacity;
+        } else {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& list = freeLists_[sizeClass];
+            if (!list.empty()) {
+                data = list.back();
+                list.pop_back();
+                sharedBytes_ -= capacity;
+                cachedBytes_ -= capacity;
+                liveBytes_ += capacity;
+                if (limited) {
+                    track(data, capacity);
+                }
+            }
+        }
+        if (data) {
+            ++reuses_;
+            return {data, capacity};
+        }
+    }
+
+    ++allocations_;
+    if (limited) {
+        return allocateWithinLimit(capacity);
+    }
+    liveBytes_ += capacity;
+    updatePeak();
+    return {allocate(capacity), capacity};
+}
+
+std::span<uint8_t> BufferPool::allocateWithinLimit(size_t capacity) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (capacity > memoryLimit_) {
+            throw std::runtime_error("Buffer of " + std::to_string(capacity) +
+                " bytes exceeds the memory limit of " + std::to_string(memoryLimit_));
+        }
+
+        // Idle buffers go first; after that, only releases make room
+        auto over = [&] {
+            size_t limit = memoryLimit_;
+            return limit > 0 && liveBytes_ + sharedBytes_ + capacity > limit;
+        };
+        if (over()) {
+            TraceSpan span("wait-memory");
+            while (over()) {
+                dropShared(liveBytes_ + sharedBytes_ + capacity - memoryLimit_);
+                if (!over()) {
+                    break;
+                }
+
+                // Only buffers of other threads can still be released
+                auto own = ownedBytes_.find(std::this_thread::get_id());
+                size_t held = own != ownedBytes_.end() ? own->second : 0;
+                if (held >= liveBytes_) {
+                    throw std::runtime_error("Buffer of " + std::to_string(capacity) +
+                        " bytes does not fit the memory limit of " + std::to_string(memoryLimit_) +
+                        " next to the " + std::to_string(held) + " bytes this thread holds");
+                }
+                released_.wait(lock);
+            }
+        }
+        liveBytes_ += capacity;
+        updatePeak();
+    }
+
+    uint8_t* data;
+    try {
+        data = allocate(capacity);
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            liveBytes_ -= capacity;
+        }
+        released_.notify_all();
+        throw;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        track(data, capacity);
+    }
+    return {data, capacity};
+}
+
+void BufferPool::release(uint8_t* data, size_t capacity) {
+    if (memoryLimit_ > 0) {
+        bool cached = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            liveBytes_ -= capacity;
+            untrack(data, capacity);
+            if (capacity <= MAX_POOLED_SIZE && sharedBytes_ + capacity <= cacheLimit_) {
+                freeLists_[classIndex(capacity)].push_back(data);
+                sharedBytes_ += capacity;
+                cachedBytes_ += capacity;
+                cached = true;
+            }
+        }
+        if (!cached) {
+            deallocate(data, capacity);
+        }
+
+        // Even a cached buffer can now be dropped for a waiting allocation
+        released_.notify_all();
+        return;
+    }
+
+    liveBytes_ -= capacity;
+    if (capacity > MAX_POOLED_SIZE) {
+        deallocate(data, capacity);
+        return;
+    }
+
+    size_t sizeClass = classIndex(capacity);
+    if (sizeClass < THREAD_CLASS_COUNT && threadCache.push(sizeClass, data)) {
+        cachedBytes_ += capacity;
+        return;
+    }
+    if (!pushShared(sizeClass, data)) {
+        deallocate(data, capacity);
+    }
+}
+
+bool BufferPool::pushShared(size_t sizeClass, uint8_t* data) {
+    size_t capacity = classSize(sizeClass);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sharedBytes_ + capacity > cacheLimit_) {
+        return false;
+    }
+    freeLists_[sizeClass].push_back(data);
+    sharedBytes_ += capacity;
+    cachedBytes_ += capacity;
+    return true;
+}
+
+void BufferPool::dropShared(size_t bytes) {
+    // Drop the largest buffers first
+    size_t dropped = 0;
+    for (size_t sizeClass = CLASS_COUNT; sizeClass-- > 0 && dropped < bytes;) {
+        auto& list = freeLists_[sizeClass];
+        while (!list.empty() && dropped < bytes) {
+            deallocate(list.back(), classSize(sizeClass));
+            list.pop_back();
+            sharedBytes_ -= classSize(sizeClass);
+            cachedBytes_ -= classSize(sizeClass);
+            dropped += classSize(sizeClass);
+        }
+    }
+}
+
+void BufferPool::updatePeak() {
+    size_t held = liveBytes_ + sharedBytes_;
+    size_t peak = peakBytes_;
+    while (held > peak && !peakBytes_.compare_exchange_weak(peak, held)) {
+    }
+}
+
+void BufferPool::track(const uint8_t* data, size_t capacity) {
+    auto owner = std::this_thread::get_id();
+    owners_[data] = owner;
+    ownedBytes_[owner] += capacity;
+}
+
+void BufferPool::untrack(const uint8_t* data, size_t capacity) {
+    auto it = owners_.find(data);
+    if (it == owners_.end()) {
+        return;
+    }
+    auto owned = ownedBytes_.find(it->second);
+    owned->second -= capacity;
+    if (owned->second == 0) {
+        ownedBytes_.erase(owned);
+    }
+    owners_.erase(it);
+}
+
+uint8_t* BufferPool::allocate(size_t capacity) {
+    if (capacity < HUGE_PAGE_SIZE) {
+        return static_cast<uint8_t*>(::operator new(capacity, std::align_val_t{alignmentFor(capacity)}));
+    }
+
+    // Large buffers are mapped directly; with huge pages the mapping is
+    // aligned to a huge page boundary so the kernel can back it with them
+    bool huge = hugePages_;
+    size_t length = huge ? capacity + HUGE_PAGE_SIZE : capacity;
+    void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    if (!huge) {
+        return static_cast<uint8_t*>(mapping);
+    }
+
+    auto address = reinterpret_cast<uintptr_t>(mapping);
+    uintptr_t aligned = (address + HUGE_PAGE_SIZE - 1) & ~(uintptr_t{HUGE_PAGE_SIZE} - 1);
+    if (aligned > address) {
+        munmap(mapping, aligned - address);
+    }
+    size_t tail = address + length - (aligned + capacity);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + capacity), tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), capacity, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<uint8_t*>(aligned);
+}
+
+void BufferPool::deallocate(uint8_t* data, size_t capacity) {
+    if (capacity < HUGE_PAGE_SIZE) {
+        ::operator delete(data, std::align_val_t{alignmentFor(capacity)});
+    } else {
+        munmap(data, capacity);
+    }
+}
+}
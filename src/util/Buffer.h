@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace miniwr {
+
+/**
+ * @brief Move-only handle to a pooled byte buffer
+ *
+ * Memory comes from BufferPool::instance() and goes back to it when the
+ * handle is destroyed, so buffers of recurring sizes are recycled instead of
+ * being mapped and faulted in again for every entry. Content is not
+ * initialized.
+ */
+class Buffer {
+public:
+    Buffer() = default;
+
+    /**
+     * @param size Initial size in bytes
+     */
+    explicit Buffer(size_t size);
+
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    ~Buffer();
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    uint8_t* begin() { return data_; }
+    uint8_t* end() { return data_ + size_; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+
+    uint8_t& operator[](size_t index) { return data_[index]; }
+    uint8_t operator[](size_t index) const { return data_[index]; }
+
+    std::span<uint8_t> span() { return {data_, size_}; }
+    std::span<const uint8_t> span() const { return {data_, size_}; }
+
+    /**
+     * @brief Change the size, keeping the existing content
+     *
+     * Growing past the capacity moves the content to a larger size class.
+     *
+     * @param size New size in bytes
+     */
+    void resize(size_t size);
+
+    /**
+     * @brief Make room for at least capacity bytes without changing the size
+     */
+    void reserve(size_t capacity);
+
+    /**
+     * @brief Append bytes, growing geometrically
+     */
+    void append(std::span<const uint8_t> bytes);
+
+    void clear() { size_ = 0; }
+
+    /**
+     * @brief Return the memory to the pool
+     */
+    void reset();
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+/**
+ * @brief Process-wide size-class allocator behind Buffer
+ *
+ * Sizes are rounded up to classes four per power of two (at most 25% slack)
+ * between MIN_SIZE and MAX_POOLED_SIZE. Released buffers are kept in a small
+ * per-thread cache for the smaller classes and in shared free lists up to
+ * the cache limit; larger or excess buffers go back to the system. Buffers of
+ * HUGE_PAGE_SIZE and more are mapped directly and can be backed by
+ * transparent huge pages. Buffers of PAGE_ALIGNED_SIZE and more start on a
+ * page boundary, as O_DIRECT requires.
+ *
+ * With a memory limit, the buffers handed out and those idle in the shared
+ * free lists together never exceed it: idle buffers are dropped to make room, and acquire()
+ * blocks until other buffers are released when none are left to drop. It
+ * throws instead if every live buffer belongs to the calling thread, since
+ * nothing could then be released. The limit is a backstop: callers reserve
+ * their buffers from a MemoryBudget first, so waiting here is the exception.
+ */
+class BufferPool {
+public:
+    static constexpr size_t MIN_SIZE = 4 * 1024;
+    static constexpr size_t MAX_POOLED_SIZE = 1024 * 1024 * 1024;
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    static constexpr size_t PAGE_ALIGNED_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_CACHE_LIMIT = 256 * 1024 * 1024;
+
+    /**
+     * @brief Allocation counters, for tuning and tests
+     */
+    struct Stats {
+        uint64_t allocations = 0;  ///< Buffers obtained from the system
+        uint64_t reuses = 0;       ///< Buffers served from a cache
+        size_t cachedBytes = 0;    ///< Idle bytes held by the caches
+        size_t liveBytes = 0;      ///< Bytes of the buffers handed out
+        size_t peakBytes = 0;      ///< Most live and shared idle bytes held at once
+    };
+
+    static BufferPool& instance();
+
+    /**
+     * @brief Cap the idle memory kept in the shared free lists
+     * @param bytes Maximum cached bytes (0 disables caching)
+     */
+    void setCacheLimit(size_t bytes);
+
+    /**
+     * @brief Cap the live and idle bytes of all buffers together
+     *
+     * Counts capacities as rounded up to their size class. Small buffers
+     * skip the per-thread caches while a limit is set, so every idle byte
+     * counted can be dropped for a new allocation; set the limit before
+     * other threads allocate, as their caches are not reachable from here.
+     *
+     * @param bytes Maximum bytes (0 removes the limit)
+     */
+    void setMemoryLimit(size_t bytes);
+
+    /**
+     * @brief Advise transparent huge pages for large buffers
+     */
+    void setHugePages(bool enabled);
+
+    /**
+     * @brief Return all idle shared memory to the system
+     */
+    void trim();
+
+    Stats stats() const;
+
+    /**
+     * @brief Restart the peak from the bytes held now
+     */
+    void resetPeak();
+
+    /**
+     * @brief Capacity of the size class a request is rounded up to
+     */
+    static size_t roundUp(size_t size);
+
+private:
+    friend class Buffer;
+    friend struct ThreadCache;
+
+    static constexpr size_t CLASS_COUNT = 73;  // 4 KB .. 1 GB
+
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+    std::array<std::vector<uint8_t*>, CLASS_COUNT> freeLists_;
+    std::atomic<size_t> sharedBytes_{0};
+    size_t cacheLimit_ = DEFAULT_CACHE_LIMIT;
+    std::atomic<size_t> memoryLimit_{0};
+    std::atomic<bool> hugePages_{false};
+    std::atomic<uint64_t> allocations_{0};
+    std::atomic<uint64_t> reuses_{0};
+    std::atomic<size_t> cachedBytes_{0};
+    std::atomic<size_t> liveBytes_{0};
+    std::atomic<size_t> peakBytes_{0};
+
+    // Under a limit: the thread each live buffer was handed to, and the
+    // bytes handed to each thread (buffers from before the limit excluded)
+    std::unordered_map<const uint8_t*, std::thread::id> owners_;
+    std::unordered_map<std::thread::id, size_t> ownedBytes_;
+
+    BufferPool() = default;
+
+    std::span<uint8_t> acquire(size_t size);
+    void release(uint8_t* data, size_t capacity);
+    bool pushShared(size_t sizeClass, uint8_t* data);
+    std::span<uint8_t> allocateWithinLimit(size_t capacity);
+    void dropShared(size_t bytes);
+    void updatePeak();
+    void track(const uint8_t* data, size_t capacity);
+    void untrack(const uint8_t* data, size_t capacity);
+    uint8_t* allocate(size_t capacity);
+    static void deallocate(uint8_t* data, size_t capacity);
+};
+}
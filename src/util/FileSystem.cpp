@@ -0,0 +1,521 @@
+#include "FileSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace miniwr {
+
+namespace {
+    // Largest single copy request; the kernel caps them below 2 GB anyway
+    constexpr size_t COPY_CHUNK_SIZE = 1024 * 1024 * 1024;
+
+    // Gathers unaligned O_DIRECT writes (a multiple of DIRECT_IO_ALIGNMENT)
+    constexpr size_t STAGING_SIZE = 1024 * 1024;
+
+    std::atomic<CachePolicy> currentPolicy{CachePolicy::Default};
+
+    std::runtime_error systemError(const std::string& what) {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    // Errors meaning "not between these descriptors", not I/O failures
+    bool copyUnsupported(int error) {
+        return error == EXDEV || error == EINVAL || error == ENOSYS ||
+               error == EOPNOTSUPP || error == EBADF;
+    }
+}
+
+void setCachePolicy(CachePolicy policy) {
+    currentPolicy.store(policy, std::memory_order_relaxed);
+}
+
+CachePolicy cachePolicy() {
+    return currentPolicy.load(std::memory_order_relaxed);
+}
+
+void CacheDropper::advance(int fd, uint64_t position) {
+    if (cachePolicy() != CachePolicy::DropBehind || position < flushed_ + DROP_BEHIND_SIZE) {
+        return;
+    }
+    if (!written_) {
+        ::posix_fadvise(fd, static_cast<off_t>(dropped_), static_cast<off_t>(position - dropped_),
+                        POSIX_FADV_DONTNEED);
+        dropped_ = flushed_ = position;
+        return;
+    }
+
+    // Start writing this window; the previous one has had a window's time
+    // to reach the device, so waiting for it rarely blocks
+    ::sync_file_range(fd, static_cast<off_t>(flushed_), static_cast<off_t>(position - flushed_),
+                      SYNC_FILE_RANGE_WRITE);
+    if (flushed_ > dropped_) {
+        ::sync_file_range(fd, static_cast<off_t>(dropped_), static_cast<off_t>(flushed_ - dropped_),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(fd, static_cast<off_t>(dropped_), static_cast<off_t>(flushed_ - dropped_),
+                        POSIX_FADV_DONTNEED);
+        dropped_ = flushed_;
+    }
+    flushed_ = position;
+}
+
+void CacheDropper::finish(int fd, uint64_t position) {
+    if (cachePolicy() != CachePolicy::DropBehind || position <= dropped_) {
+        return;
+    }
+    if (written_) {
+        ::sync_file_range(fd, static_cast<off_t>(dropped_), static_cast<off_t>(position - dropped_),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    ::posix_fadvise(fd, static_cast<off_t>(dropped_), static_cast<off_t>(position - dropped_),
+                    POSIX_FADV_DONTNEED);
+    dropped_ = flushed_ = position;
+}
+
+InputFile::InputFile(const std::filesystem::path& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw systemError("Failed to open file " + path.string());
+    }
+
+    struct stat info;
+    if (::fstat(fd_, &info) != 0) {
+        ::close(fd_);
+        throw systemError("Failed to stat file " + path.string());
+    }
+    size_ = static_cast<uint64_t>(info.st_size);
+    holes_ = static_cast<uint64_t>(info.st_blocks) * 512 < size_;
+
+    if (cachePolicy() == CachePolicy::DropBehind) {
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        // Filesystems without direct I/O refuse the flag; they stay buffered
+        direct_ = size_ >= DIRECT_IO_THRESHOLD &&
+                  ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_DIRECT) == 0;
+    }
+}
+
+InputFile::InputFile(InputFile&& other) noexcept
+    : fd_(other.fd_),
+      size_(other.size_),
+      position_(other.position_),
+      direct_(other.direct_),
+      holes_(other.holes_),
+      inHole_(other.inHole_),
+      extentEnd_(other.extentEnd_),
+      dropper_(other.dropper_) {
+    other.fd_ = -1;
+}
+
+InputFile::~InputFile() {
+    if (fd_ >= 0) {
+        dropper_.finish(fd_, size_);
+        ::close(fd_);
+    }
+}
+
+size_t InputFile::read(std::span<uint8_t> buffer) {
+    size_t total = 0;
+    if (!holes_) {
+        total = readData(buffer);
+    }
+
+    // Holes are filled in, not read; the kernel would only return zeros
+    while (holes_ && total < buffer.size()) {
+        bool hole;
+        uint64_t length = extent(hole);
+        if (length == 0) {
+            break;
+        }
+        auto part = buffer.subspan(total, static_cast<size_t>(
+            std::min<uint64_t>(buffer.size() - total, length)));
+        if (hole) {
+            std::memset(part.data(), 0, part.size());
+            position_ += part.size();
+            total += part.size();
+        } else if (size_t count = readData(part)) {
+            total += count;
+        } else {
+            break;
+        }
+    }
+    dropper_.advance(fd_, position_);
+    return total;
+}
+
+uint64_t InputFile::extent(bool& hole) {
+    hole = false;
+    if (position_ >= size_) {
+        return 0;
+    }
+    if (!holes_) {
+        return size_ - position_;
+    }
+
+    if (position_ >= extentEnd_) {
+        off_t data = ::lseek(fd_, static_cast<off_t>(position_), SEEK_DATA);
+        if (data < 0 && errno != ENXIO) {
+            holes_ = false;  // No SEEK_DATA: everything is data
+            return size_ - position_;
+        }
+
+        // ENXIO: no data left, the rest of the file is a hole
+        uint64_t dataStart = data < 0 ? size_ : static_cast<uint64_t>(data);
+        if (dataStart > position_) {
+            inHole_ = true;
+            extentEnd_ = std::min(dataStart, size_);
+        } else {
+            off_t end = ::lseek(fd_, static_cast<off_t>(position_), SEEK_HOLE);
+            inHole_ = false;
+            extentEnd_ = end > static_cast<off_t>(position_)
+                ? std::min(static_cast<uint64_t>(end), size_) : size_;
+        }
+    }
+    hole = inHole_;
+    return extentEnd_ - position_;
+}
+
+size_t InputFile::readData(std::span<uint8_t> buffer) {
+    size_t total = direct_ ? readDirect(buffer) : 0;
+    if (total < buffer.size() && direct_) {
+        disableDirect();
+    }
+
+    while (total < buffer.size()) {
+        ssize_t count = ::pread(fd_, buffer.data() + total, buffer.size() - total,
+                                static_cast<off_t>(position_));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw systemError("Failed to read file");
+        }
+        if (count == 0) {
+            break;
+        }
+        total += static_cast<size_t>(count);
+        position_ += static_cast<uint64_t>(count);
+    }
+    return total;
+}
+
+size_t InputFile::readDirect(std::span<uint8_t> buffer) {
+    size_t total = 0;
+    while (true) {
+        uint8_t* destination = buffer.data() + total;
+        size_t length = (buffer.size() - total) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        if (length == 0 || position_ % DIRECT_IO_ALIGNMENT != 0 ||
+            reinterpret_cast<uintptr_t>(destination) % DIRECT_IO_ALIGNMENT != 0) {
+            return total;
+        }
+
+        ssize_t count = ::pread(fd_, destination, length, static_cast<off_t>(position_));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL) {
+                return total;  // Stricter alignment than assumed
+            }
+            throw systemError("Failed to read file");
+        }
+        total += static_cast<size_t>(count);
+        position_ += static_cast<uint64_t>(count);
+        if (static_cast<size_t>(count) < length) {
+            return total;  // End of file
+        }
+    }
+}
+
+void InputFile::disableDirect() {
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+    direct_ = false;
+}
+
+size_t OutputFile::memoryFor(uint64_t expectedSize) {
+    bool direct = cachePolicy() == CachePolicy::DropBehind && expectedSize >= DIRECT_IO_THRESHOLD;
+    return direct ? STAGING_SIZE : 0;
+}
+
+OutputFile::OutputFile(const std::filesystem::path& path, uint64_t expectedSize, bool sparse)
+    : sparse_(sparse) {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd_ < 0) {
+        throw systemError("Failed to create output file " + path.string());
+    }
+
+    // Filesystems without fallocate() allocate blocks as data arrives; a
+    // failed one (out of space) may leave part of the range allocated
+    if (expectedSize >= PREALLOCATE_THRESHOLD) {
+        allocated_ = ::fallocate(fd_, 0, 0, static_cast<off_t>(expectedSize)) == 0;
+        if (!allocated_ && ::ftruncate(fd_, 0) != 0) {
+            ::close(fd_);
+            throw systemError("Failed to truncate file " + path.string());
+        }
+        resize_ = allocated_;
+    }
+
+    if (cachePolicy() == CachePolicy::DropBehind && expectedSize >= DIRECT_IO_THRESHOLD &&
+        ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_DIRECT) == 0) {
+        direct_ = true;
+        staging_ = Buffer(STAGING_SIZE);
+    }
+}
+
+OutputFile::OutputFile(OutputFile&& other) noexcept
+    : fd_(other.fd_),
+      position_(other.position_),
+      direct_(other.direct_),
+      sparse_(other.sparse_),
+      allocated_(other.allocated_),
+      resize_(other.resize_),
+      hole_(other.hole_),
+      staging_(std::move(other.staging_)),
+      staged_(other.staged_),
+      dropper_(other.dropper_) {
+    other.fd_ = -1;
+}
+
+OutputFile::~OutputFile() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void OutputFile::write(std::span<const uint8_t> data) {
+    if (!sparse_) {
+        append(data);
+        return;
+    }
+
+    // Runs of whole zero blocks become holes; partial blocks at either end
+    // of the data are written as they are
+    while (!data.empty()) {
+        uint64_t offset = position_ + staged_ + hole_;
+        size_t head = static_cast<size_t>((SPARSE_BLOCK_SIZE - offset % SPARSE_BLOCK_SIZE) % SPARSE_BLOCK_SIZE);
+        if (head > 0 || data.size() < SPARSE_BLOCK_SIZE) {
+            size_t count = head > 0 ? std::min(head, data.size()) : data.size();
+            append(data.first(count));
+            data = data.subspan(count);
+            continue;
+        }
+
+        bool zero = isZero(data.first(SPARSE_BLOCK_SIZE));
+        size_t run = SPARSE_BLOCK_SIZE;
+        while (data.size() - run >= SPARSE_BLOCK_SIZE &&
+               isZero(data.subspan(run, SPARSE_BLOCK_SIZE)) == zero) {
+            run += SPARSE_BLOCK_SIZE;
+        }
+        if (zero) {
+            hole_ += run;
+        } else {
+            append(data.first(run));
+        }
+        data = data.subspan(run);
+    }
+}
+
+void OutputFile::skip(uint64_t length) {
+    hole_ += length;
+}
+
+void OutputFile::append(std::span<const uint8_t> data) {
+    if (hole_ > 0) {
+        skipHole();
+    }
+
+    if (!direct_) {
+        writeAll(data.data(), data.size());
+        position_ += data.size();
+        dropper_.advance(fd_, position_);
+        return;
+    }
+
+    // Whole aligned runs are written in place; the rest is staged until a
+    // full staging buffer can go out aligned
+    while (!data.empty()) {
+        size_t aligned = data.size() / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        if (staged_ == 0 && aligned > 0 &&
+            reinterpret_cast<uintptr_t>(data.data()) % DIRECT_IO_ALIGNMENT == 0) {
+            writeAll(data.data(), aligned);
+            position_ += aligned;
+            data = data.subspan(aligned);
+            continue;
+        }
+
+        size_t count = std::min(data.size(), staging_.size() - staged_);
+        std::memcpy(staging_.data() + staged_, data.data(), count);
+        staged_ += count;
+        data = data.subspan(count);
+        if (staged_ == staging_.size()) {
+            flushStaging();
+        }
+    }
+}
+
+void OutputFile::skipHole() {
+    // The hole starts after the staged data
+    flushStaging();
+
+    // Preallocated blocks read back as zeros even where punching fails
+    if (allocated_) {
+        ::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    static_cast<off_t>(position_), static_cast<off_t>(hole_));
+    }
+    if (::lseek(fd_, static_cast<off_t>(hole_), SEEK_CUR) < 0) {
+        throw systemError("Failed to seek file");
+    }
+    position_ += hole_;
+    hole_ = 0;
+    resize_ = true;
+}
+
+void OutputFile::flushStaging() {
+    if (staged_ > 0) {
+        writeAll(staging_.data(), staged_);
+        position_ += staged_;
+        staged_ = 0;
+    }
+}
+
+void OutputFile::writeAll(const uint8_t* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t count = ::write(fd_, data + total, size - total);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && direct_) {
+                disableDirect();  // Stricter alignment than assumed
+                continue;
+            }
+            throw systemError("Failed to write file");
+        }
+        total += static_cast<size_t>(count);
+    }
+}
+
+void OutputFile::disableDirect() {
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+    direct_ = false;
+}
+
+void OutputFile::close() {
+    if (fd_ >= 0) {
+        if (hole_ > 0) {
+            skipHole();
+        }
+        // The unaligned tail goes through the page cache
+        if (staged_ > 0) {
+            disableDirect();
+            flushStaging();
+        }
+        // A trailing hole is not part of the file until it is extended, and
+        // the preallocated size may differ from what was written
+        if (resize_ && ::ftruncate(fd_, static_cast<off_t>(position_)) != 0) {
+            throw systemError("Failed to set file size");
+        }
+        dropper_.finish(fd_, position_);
+    }
+
+    int fd = fd_;
+    fd_ = -1;
+    if (fd >= 0 && ::close(fd) != 0) {
+        throw systemError("Failed to close file");
+    }
+}
+
+MappedRange::MappedRange(int fd, uint64_t offset, size_t length) : length_(length) {
+    if (length == 0) {
+        return;
+    }
+
+    // Mappings start on a page boundary
+    static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    uint64_t start = offset - offset % pageSize;
+    mappingLength_ = static_cast<size_t>(offset - start) + length;
+    mapping_ = ::mmap(nullptr, mappingLength_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(start));
+    if (mapping_ == MAP_FAILED) {
+        mapping_ = nullptr;
+        throw systemError("Failed to map file");
+    }
+    ::madvise(mapping_, mappingLength_, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t*>(mapping_) + (offset - start);
+}
+
+MappedRange::~MappedRange() {
+    if (mapping_) {
+        ::munmap(mapping_, mappingLength_);
+    }
+}
+
+uint64_t copyRange(int in, uint64_t inOffset, int out, uint64_t length) {
+    uint64_t copied = 0;
+    bool copyFileRange = true;
+
+    while (copied < length) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - copied, COPY_CHUNK_SIZE));
+        ssize_t count;
+        if (copyFileRange) {
+            loff_t position = static_cast<loff_t>(inOffset + copied);
+            count = ::copy_file_range(in, &position, out, nullptr, chunk, 0);
+            if (count < 0 && copyUnsupported(errno)) {
+                copyFileRange = false;
+                continue;
+            }
+        } else {
+            off_t position = static_cast<off_t>(inOffset + copied);
+            count = ::sendfile(out, in, &position, chunk);
+            if (count < 0 && copyUnsupported(errno)) {
+                return copied;
+            }
+        }
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw systemError("Failed to copy file data");
+        }
+        if (count == 0) {
+            break;  // The source is shorter than expected
+        }
+        copied += static_cast<uint64_t>(count);
+    }
+    return copied;
+}
+
+bool isZero(std::span<const uint8_t> data) {
+    const uint8_t* bytes = data.data();
+    size_t size = data.size();
+    for (; size >= 64; bytes += 64, size -= 64) {
+        uint64_t words[8];
+        std::memcpy(words, bytes, sizeof(words));
+        uint64_t any = 0;
+        for (uint64_t word : words) {
+            any |= word;
+        }
+        if (any != 0) {
+            return false;
+        }
+    }
+    return std::all_of(bytes, bytes + size, [](uint8_t byte) { return byte == 0; });
+}
+
+void readFile(const std::filesystem::path& path, Buffer& out) {
+    InputFile file(path);
+    size_t start = out.size();
+    out.resize(start + static_cast<size_t>(file.size()));
+
+    // A file that shrank since it was opened yields fewer bytes
+    size_t count = file.read(out.span().subspan(start));
+    out.resize(start + count);
+}
+}
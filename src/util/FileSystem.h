@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Buffer.h"
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+namespace miniwr {
+
+/**
+ * @brief How file I/O treats the page cache
+ */
+enum class CachePolicy {
+    Default,    ///< Buffered I/O with the kernel's defaults
+    DropBehind  ///< Keep archive jobs from evicting other processes' pages
+};
+
+/**
+ * @brief Set the process-wide cache policy (before files are opened)
+ *
+ * Under DropBehind, files of DIRECT_IO_THRESHOLD and more are read and
+ * written with O_DIRECT where the filesystem allows it. Everything else,
+ * including the archive itself, goes through the page cache but is read
+ * with sequential read-ahead and released as soon as it has been consumed;
+ * written data is flushed first, since dirty pages cannot be dropped.
+ */
+void setCachePolicy(CachePolicy policy);
+CachePolicy cachePolicy();
+
+/// Files at least this large bypass the page cache under DropBehind
+constexpr uint64_t DIRECT_IO_THRESHOLD = 16 * 1024 * 1024;
+
+/// Offset, length and memory alignment of O_DIRECT transfers
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+/// Output files at least this large get their blocks allocated up front
+constexpr uint64_t PREALLOCATE_THRESHOLD = 1024 * 1024;
+
+/// Granularity of holes in sparse files (one filesystem block)
+constexpr size_t SPARSE_BLOCK_SIZE = 4096;
+
+/**
+ * @brief Whether every byte is zero
+ *
+ * Scans 64 bytes per step so the compiler turns the loop into vector loads
+ * and a single test; all-zero blocks are written as holes.
+ */
+bool isZero(std::span<const uint8_t> data);
+
+/**
+ * @brief Releases the page cache behind a sequential reader or writer
+ *
+ * Works in DROP_BEHIND_SIZE windows and does nothing under the Default
+ * policy. For written files each window is flushed asynchronously, then
+ * waited for and dropped once the next one is full.
+ */
+class CacheDropper {
+public:
+    static constexpr uint64_t DROP_BEHIND_SIZE = 8 * 1024 * 1024;
+
+    /**
+     * @param written Whether the pages are written (and must be flushed first)
+     */
+    explicit CacheDropper(bool written) : written_(written) {}
+
+    /**
+     * @brief Account data up to an offset, dropping whole windows behind it
+     */
+    void advance(int fd, uint64_t position);
+
+    /**
+     * @brief Drop everything up to an offset (written pages once flushed)
+     */
+    void finish(int fd, uint64_t position);
+
+private:
+    bool written_;
+    uint64_t flushed_ = 0;  // Writeback started below this offset
+    uint64_t dropped_ = 0;  // Released below this offset
+};
+
+/**
+ * @brief Unbuffered read-only file handle
+ *
+ * Data is read straight into the caller's (pooled) buffer, without the
+ * per-stream allocations of std::ifstream. Under CachePolicy::DropBehind,
+ * large files are read with O_DIRECT while the caller's buffer, length and
+ * position are DIRECT_IO_ALIGNMENT aligned (pool buffers of 64 KB and more
+ * are); the unaligned tail is read through the page cache.
+ *
+ * In files with holes (fewer blocks allocated than their size), the holes
+ * are located with SEEK_DATA/SEEK_HOLE and filled with zeros by read()
+ * instead of being read.
+ */
+class InputFile {
+public:
+    explicit InputFile(const std::filesystem::path& path);
+    InputFile(InputFile&& other) noexcept;
+    InputFile& operator=(InputFile&&) = delete;
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+    ~InputFile();
+
+    /**
+     * @brief Read until the buffer is full or the end of the file
+     * @param buffer Destination
+     * @return Number of bytes read (0 at end of file)
+     */
+    size_t read(std::span<uint8_t> buffer);
+
+    /**
+     * @brief Length of the data or hole run at the current position
+     * @param hole Set to whether the run is a hole
+     * @return Bytes up to the next change, up to size() (0 at the end)
+     */
+    uint64_t extent(bool& hole);
+
+    /**
+     * @brief Move the read position forward without reading
+     */
+    void skip(uint64_t length) { position_ += length; }
+
+    /**
+     * @brief Size of the file when it was opened
+     */
+    uint64_t size() const { return size_; }
+
+    int descriptor() const { return fd_; }
+
+private:
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    uint64_t position_ = 0;
+    bool direct_ = false;
+    bool holes_ = false;       // Has unallocated ranges
+    bool inHole_ = false;      // Kind of the run ending at extentEnd_
+    uint64_t extentEnd_ = 0;
+    CacheDropper dropper_{false};
+
+    size_t readData(std::span<uint8_t> buffer);
+    size_t readDirect(std::span<uint8_t> buffer);
+    void disableDirect();
+};
+
+/**
+ * @brief Unbuffered write-only file handle (created or truncated)
+ *
+ * Files expected to be PREALLOCATE_THRESHOLD or larger are allocated with
+ * fallocate() before the first write, so they are laid out contiguously.
+ * Sparse files turn skip() and, optionally, every all-zero
+ * SPARSE_BLOCK_SIZE block into holes: punched out of the preallocated
+ * range, or seeked over where nothing was preallocated.
+ *
+ * Under CachePolicy::DropBehind, files expected to be large are written with
+ * O_DIRECT: aligned runs of the caller's data go straight to the device and
+ * the rest is gathered in an aligned staging buffer.
+ */
+class OutputFile {
+public:
+    /**
+     * @param path File to create
+     * @param expectedSize Final size if known, 0 otherwise
+     * @param sparse Write all-zero blocks as holes
+     */
+    explicit OutputFile(const std::filesystem::path& path, uint64_t expectedSize = 0,
+                        bool sparse = false);
+
+    /**
+     * @brief Buffer memory a file of this expected size allocates
+     *
+     * Only the O_DIRECT staging buffer; callers reserve it with the data.
+     */
+    static size_t memoryFor(uint64_t expectedSize);
+    OutputFile(OutputFile&& other) noexcept;
+    OutputFile& operator=(OutputFile&&) = delete;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile();
+
+    /**
+     * @brief Write all bytes
+     * @param data Bytes to write
+     */
+    void write(std::span<const uint8_t> data);
+
+    /**
+     * @brief Leave a hole of zero bytes
+     * @param length Length of the hole
+     */
+    void skip(uint64_t length);
+
+    /**
+     * @brief Close the file, reporting errors the destructor would ignore
+     */
+    void close();
+
+    /**
+     * @brief Descriptor, for writes that bypass write() (never under O_DIRECT)
+     */
+    int descriptor() const { return fd_; }
+
+private:
+    int fd_ = -1;
+    uint64_t position_ = 0;  // Bytes written or skipped, staged data and hole_ excluded
+    bool direct_ = false;
+    bool sparse_ = false;
+    bool allocated_ = false;
+    bool resize_ = false;    // Preallocated or seeked, so the size is set on close
+    uint64_t hole_ = 0;      // Zero bytes not yet skipped
+    Buffer staging_;
+    size_t staged_ = 0;
+    CacheDropper dropper_{true};
+
+    void append(std::span<const uint8_t> data);
+    void skipHole();
+    void flushStaging();
+    void writeAll(const uint8_t* data, size_t size);
+    void disableDirect();
+};
+
+/**
+ * @brief Read-only memory mapping of a range of a file
+ *
+ * Checksums run over the page cache directly instead of a copy of it.
+ */
+class MappedRange {
+public:
+    /**
+     * @param fd Open file (may be closed once mapped)
+     * @param offset Start of the range, any alignment
+     * @param length Length of the range (0 maps nothing)
+     */
+    MappedRange(int fd, uint64_t offset, size_t length);
+    ~MappedRange();
+
+    MappedRange(const MappedRange&) = delete;
+    MappedRange& operator=(const MappedRange&) = delete;
+
+    std::span<const uint8_t> data() const { return {data_, length_}; }
+
+private:
+    void* mapping_ = nullptr;
+    size_t mappingLength_ = 0;
+    const uint8_t* data_ = nullptr;
+    size_t length_ = 0;
+};
+
+/**
+ * @brief Copy a range of a file to another descriptor inside the kernel
+ *
+ * Uses copy_file_range(), which shares extents on filesystems with reflink
+ * support (btrfs, XFS) when the ranges are block aligned, and sendfile()
+ * when the destination is not a regular file on the same kind of mount.
+ * Data is appended at the current position of the destination.
+ *
+ * @return Number of bytes copied from the start of the range; less than
+ *         length (possibly 0) if the kernel cannot copy between these
+ *         descriptors, and the caller writes the rest
+ */
+uint64_t copyRange(int in, uint64_t inOffset, int out, uint64_t length);
+
+/**
+ * @brief Append the content of a file to a buffer
+ * @param path File to read
+ * @param out Destination buffer
+ */
+void readFile(const std::filesystem::path& path, Buffer& out);
+}
@@ -0,0 +1,535 @@
+#include "IoEngine.h"
+#include "Buffer.h"
+#include "FileSystem.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace miniwr {
+
+namespace {
+    constexpr int READ_FLAGS = O_RDONLY | O_CLOEXEC;
+    constexpr int WRITE_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    constexpr mode_t CREATE_MODE = 0666;
+
+    std::runtime_error fileError(const std::string& what, const std::filesystem::path& path, int error) {
+        return std::runtime_error(what + " " + path.string() + ": " + std::strerror(error));
+    }
+
+    IoEngine::FileInfo describe(uint64_t size, uint32_t mode, int64_t seconds, uint32_t nanoseconds) {
+        auto since = std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds);
+        auto modified = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(since));
+        return {size, static_cast<std::filesystem::perms>(mode & 07777),
+                std::chrono::file_clock::from_sys(modified)};
+    }
+
+    // Neither backend has an asynchronous chmod or utimes; both calls only
+    // touch the inode, so they run inline between the write and the close
+    void applyMetadata(int fd, const IoEngine::FileWrite& file) {
+        if (file.permissions != std::filesystem::perms::unknown &&
+            ::fchmod(fd, static_cast<mode_t>(file.permissions) & 07777) != 0) {
+            throw fileError("Failed to set permissions of", file.path, errno);
+        }
+        if (file.modified) {
+            auto since = std::chrono::file_clock::to_sys(*file.modified).time_since_epoch();
+            auto seconds = std::chrono::floor<std::chrono::seconds>(since);
+            struct timespec times[2] = {};
+            times[0].tv_nsec = UTIME_OMIT;
+            times[1].tv_sec = static_cast<time_t>(seconds.count());
+            times[1].tv_nsec = static_cast<long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(since - seconds).count());
+            if (::futimens(fd, times) != 0) {
+                throw fileError("Failed to set the modification time of", file.path, errno);
+            }
+        }
+    }
+
+    // Finishes a short read; returns the length actually read (less if the
+    // file shrank since it was stat'ed)
+    size_t readRest(int fd, const std::filesystem::path& path, std::span<uint8_t> content, size_t done) {
+        while (done < content.size()) {
+            ssize_t count = ::pread(fd, content.data() + done, content.size() - done,
+                                    static_cast<off_t>(done));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw fileError("Failed to read file", path, errno);
+            }
+            if (count == 0) {
+                break;
+            }
+            done += static_cast<size_t>(count);
+        }
+        return done;
+    }
+
+    void writeRest(int fd, const IoEngine::FileWrite& file, size_t done) {
+        while (done < file.data.size()) {
+            ssize_t count = ::pwrite(fd, file.data.data() + done, file.data.size() - done,
+                                     static_cast<off_t>(done));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw fileError("Failed to write file", file.path, errno);
+            }
+            done += static_cast<size_t>(count);
+        }
+    }
+
+    class ThreadPoolEngine : public IoEngine {
+    public:
+        ThreadPoolEngine(unsigned threads, std::shared_ptr<MemoryBudget> budget)
+            : IoEngine(std::move(budget)), threads_(threads) {}
+
+        void readFiles(std::span<const std::filesystem::path> paths, const Consume& consume) override {
+            if (slots_.empty()) {
+                slotsReservation_ = reserveSlots();
+                slots_ = Buffer(depth() * SLOT_SIZE);
+            }
+
+            for (size_t first = 0; first < paths.size(); first += depth()) {
+                size_t count = std::min(depth(), paths.size() - first);
+                std::vector<FileInfo> infos(count);
+                std::vector<size_t> lengths(count);
+                auto errors = forEach(count, [&](size_t i) {
+                    InputFile file(paths[first + i]);
+                    struct stat status;
+                    if (::fstat(file.descriptor(), &status) != 0) {
+                        throw fileError("Failed to stat file", paths[first + i], errno);
+                    }
+                    infos[i] = describe(file.size(), status.st_mode, status.st_mtim.tv_sec,
+                                        static_cast<uint32_t>(status.st_mtim.tv_nsec));
+                    if (file.size() <= SLOT_SIZE) {
+                        lengths[i] = readRest(file.descriptor(), paths[first + i],
+                                              slot(i).first(static_cast<size_t>(file.size())), 0);
+                        infos[i].size = lengths[i];
+                    }
+                });
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (errors[i]) {
+                        std::rethrow_exception(errors[i]);
+                    }
+                    consume(first + i, infos[i], slot(i).first(lengths[i]));
+                }
+            }
+        }
+
+        void writeFiles(std::span<const FileWrite> files) override {
+            auto errors = forEach(files.size(), [&](size_t i) {
+                OutputFile out(files[i].path);
+                writeRest(out.descriptor(), files[i], 0);
+                applyMetadata(out.descriptor(), files[i]);
+                out.close();
+            });
+            for (const auto& error : errors) {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        }
+
+        const char* name() const override {
+            return "threads";
+        }
+
+    private:
+        unsigned threads_;
+        MemoryBudget::Reservation slotsReservation_;
+        Buffer slots_;
+
+        std::span<uint8_t> slot(size_t index) {
+            return slots_.span().subspan(index * SLOT_SIZE, SLOT_SIZE);
+        }
+
+        // Runs the task for every index as scheduler I/O tasks and waits;
+        // errors are kept per index
+        std::vector<std::exception_ptr> forEach(size_t count, const std::function<void(size_t)>& task) {
+            std::vector<std::exception_ptr> errors(count);
+            TaskGroup group(threads_);
+            for (size_t i = 0; i < count; ++i) {
+                group.run([&task, &errors, i] {
+                    try {
+                        task(i);
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                }, TaskPriority::Io);
+            }
+            group.wait();
+            return errors;
+        }
+    };
+
+#ifdef HAVE_IO_URING
+    // Largest single write request; the rest of a file is written inline
+    constexpr size_t MAX_WRITE_SIZE = 1024 * 1024 * 1024;
+
+    /**
+     * io_uring through the raw system calls (no liburing). Each step of a
+     * batch is one submission that is fully reaped before the next, so the
+     * submission queue never wraps onto entries the kernel has not consumed.
+     */
+    class UringEngine : public IoEngine {
+    public:
+        // Throws if the kernel lacks io_uring or one of the operations used
+        explicit UringEngine(std::shared_ptr<MemoryBudget> budget)
+            : IoEngine(std::move(budget)), slotsReservation_(reserveSlots()), slots_(depth() * SLOT_SIZE) {
+            // Two entries per file: open and statx, or read and close
+            io_uring_params params{};
+            ringFd_ = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(2 * depth()),
+                                                 &params));
+            if (ringFd_ < 0) {
+                throw std::runtime_error(std::string("io_uring unavailable: ") + std::strerror(errno));
+            }
+            try {
+                mapRings(params);
+                probe();
+                registerSlots();
+            } catch (...) {
+                release();
+                throw;
+            }
+        }
+
+        ~UringEngine() override {
+            release();
+        }
+
+        void readFiles(std::span<const std::filesystem::path> paths, const Consume& consume) override {
+            for (size_t first = 0; first < paths.size(); first += depth()) {
+                auto batch = paths.subspan(first, std::min(depth(), paths.size() - first));
+                size_t count = batch.size();
+                std::vector<std::exception_ptr> errors(count);
+                std::vector<FileInfo> infos(count);
+                std::vector<size_t> lengths(count);
+                std::vector<struct statx> status(count);
+                std::vector<int> results(2 * count);
+
+                // Open and stat every file
+                for (size_t i = 0; i < count; ++i) {
+                    auto& open = next(IORING_OP_OPENAT, AT_FDCWD, i);
+                    open.addr = reinterpret_cast<uint64_t>(batch[i].c_str());
+                    open.open_flags = READ_FLAGS;
+
+                    auto& stat = next(IORING_OP_STATX, AT_FDCWD, count + i);
+                    stat.addr = reinterpret_cast<uint64_t>(batch[i].c_str());
+                    stat.len = STATX_MODE | STATX_SIZE | STATX_MTIME;
+                    stat.off = reinterpret_cast<uint64_t>(&status[i]);
+                }
+                submitAndWait(results);
+
+                // Read the small ones into their slot, then close
+                std::vector<int> fds(results.begin(), results.begin() + static_cast<ptrdiff_t>(count));
+                for (size_t i = 0; i < count; ++i) {
+                    if (fds[i] < 0) {
+                        errors[i] = std::make_exception_ptr(fileError("Failed to open file", batch[i], -fds[i]));
+                        continue;
+                    }
+                    if (results[count + i] < 0) {
+                        errors[i] = std::make_exception_ptr(fileError("Failed to stat file", batch[i], -results[count + i]));
+                    } else {
+                        const auto& stx = status[i];
+                        infos[i] = describe(stx.stx_size, stx.stx_mode, stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec);
+                        lengths[i] = stx.stx_size <= SLOT_SIZE ? static_cast<size_t>(stx.stx_size) : 0;
+                    }
+
+                    results[i] = 0;
+                    if (!errors[i] && lengths[i] > 0) {
+                        auto& read = next(fixedSlots_ ? IORING_OP_READ_FIXED : IORING_OP_READ, fds[i], i);
+                        read.addr = reinterpret_cast<uint64_t>(slot(i).data());
+                        read.len = static_cast<uint32_t>(lengths[i]);
+                        read.buf_index = static_cast<uint16_t>(i);
+                        read.flags = IOSQE_IO_LINK;
+                    }
+                    next(IORING_OP_CLOSE, fds[i], count + i);
+                }
+                submitAndWait(results);
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (fds[i] < 0) {
+                        continue;
+                    }
+                    // A short read breaks the link and cancels the close
+                    try {
+                        if (results[i] < 0) {
+                            throw fileError("Failed to read file", batch[i], -results[i]);
+                        }
+                        if (!errors[i] && static_cast<size_t>(results[i]) < lengths[i]) {
+                            lengths[i] = readRest(fds[i], batch[i], slot(i).first(lengths[i]),
+                                                  static_cast<size_t>(results[i]));
+                        }
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                    if (results[count + i] == -ECANCELED) {
+                        ::close(fds[i]);
+                    }
+                    if (!errors[i] && lengths[i] > 0) {
+                        infos[i].size = lengths[i];
+                    }
+                }
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (errors[i]) {
+                        std::rethrow_exception(errors[i]);
+                    }
+                    consume(first + i, infos[i], slot(i).first(lengths[i]));
+                }
+            }
+        }
+
+        void writeFiles(std::span<const FileWrite> files) override {
+            for (size_t first = 0; first < files.size(); first += depth()) {
+                auto batch = files.subspan(first, std::min(depth(), files.size() - first));
+                size_t count = batch.size();
+                std::vector<std::exception_ptr> errors(count);
+                std::vector<int> results(count);
+
+                for (size_t i = 0; i < count; ++i) {
+                    auto& open = next(IORING_OP_OPENAT, AT_FDCWD, i);
+                    open.addr = reinterpret_cast<uint64_t>(batch[i].path.c_str());
+                    open.len = CREATE_MODE;
+                    open.open_flags = WRITE_FLAGS;
+                }
+                submitAndWait(results);
+
+                std::vector<int> fds = results;
+                for (size_t i = 0; i < count; ++i) {
+                    results[i] = 0;
+                    if (fds[i] < 0) {
+                        errors[i] = std::make_exception_ptr(
+                            fileError("Failed to create output file", batch[i].path, -fds[i]));
+                    } else if (!batch[i].data.empty()) {
+                        auto& write = next(IORING_OP_WRITE, fds[i], i);
+                        write.addr = reinterpret_cast<uint64_t>(batch[i].data.data());
+                        write.len = static_cast<uint32_t>(std::min(batch[i].data.size(), MAX_WRITE_SIZE));
+                    }
+                }
+                submitAndWait(results);
+
+                // Times are set after the data, which would update them
+                for (size_t i = 0; i < count; ++i) {
+                    if (fds[i] < 0) {
+                        continue;
+                    }
+                    try {
+                        if (results[i] < 0) {
+                            throw fileError("Failed to write file", batch[i].path, -results[i]);
+                        }
+                        writeRest(fds[i], batch[i], static_cast<size_t>(results[i]));
+                        applyMetadata(fds[i], batch[i]);
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                    next(IORING_OP_CLOSE, fds[i], i);
+                }
+                submitAndWait(results);
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (!errors[i] && results[i] < 0) {
+                        errors[i] = std::make_exception_ptr(fileError("Failed to close file", batch[i].path, -results[i]));
+                    }
+                }
+                for (const auto& error : errors) {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                }
+            }
+        }
+
+        const char* name() const override {
+            return "io_uring";
+        }
+
+    private:
+        int ringFd_ = -1;
+        void* rings_ = MAP_FAILED;
+        size_t ringsSize_ = 0;
+        io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t sqesSize_ = 0;
+
+        unsigned* sqTail_ = nullptr;
+        unsigned* sqArray_ = nullptr;
+        unsigned sqMask_ = 0;
+        unsigned* cqHead_ = nullptr;
+        unsigned* cqTail_ = nullptr;
+        unsigned cqMask_ = 0;
+        io_uring_cqe* cqes_ = nullptr;
+
+        unsigned localTail_ = 0;
+        unsigned queued_ = 0;
+
+        MemoryBudget::Reservation slotsReservation_;
+        Buffer slots_;
+        bool fixedSlots_ = false;
+
+        std::span<uint8_t> slot(size_t index) {
+            return slots_.span().subspan(index * SLOT_SIZE, SLOT_SIZE);
+        }
+
+        void mapRings(const io_uring_params& params) {
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                throw std::runtime_error("io_uring too old");
+            }
+            ringsSize_ = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+            rings_ = ::mmap(nullptr, ringsSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ringFd_, IORING_OFF_SQ_RING);
+            if (rings_ == MAP_FAILED) {
+                throw std::runtime_error("Failed to map io_uring");
+            }
+            sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe*>(::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+            if (sqes_ == MAP_FAILED) {
+                throw std::runtime_error("Failed to map io_uring");
+            }
+
+            auto field = [&](uint32_t offset) {
+                return reinterpret_cast<unsigned*>(static_cast<char*>(rings_) + offset);
+            };
+            sqTail_ = field(params.sq_off.tail);
+            sqArray_ = field(params.sq_off.array);
+            sqMask_ = *field(params.sq_off.ring_mask);
+            cqHead_ = field(params.cq_off.head);
+            cqTail_ = field(params.cq_off.tail);
+            cqMask_ = *field(params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(rings_) + params.cq_off.cqes);
+            localTail_ = *sqTail_;
+        }
+
+        void probe() {
+            std::vector<uint8_t> storage(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+            auto* result = reinterpret_cast<io_uring_probe*>(storage.data());
+            if (::syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PROBE, result, IORING_OP_LAST) < 0) {
+                throw std::runtime_error("io_uring probe unsupported");
+            }
+            for (uint8_t op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                               IORING_OP_READ_FIXED, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+                if (op > result->last_op || !(result->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                    throw std::runtime_error("io_uring operation unsupported");
+                }
+            }
+        }
+
+        // Pinned once, so reads skip the per-request page lookups; plain
+        // reads into the same slots if the memlock limit refuses
+        void registerSlots() {
+            std::vector<iovec> iovecs(depth());
+            for (size_t i = 0; i < depth(); ++i) {
+                iovecs[i] = {slot(i).data(), SLOT_SIZE};
+            }
+            fixedSlots_ = ::syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS,
+                                    iovecs.data(), static_cast<unsigned>(depth())) == 0;
+        }
+
+        void release() {
+            if (sqes_ != MAP_FAILED) {
+                ::munmap(sqes_, sqesSize_);
+            }
+            if (rings_ != MAP_FAILED) {
+                ::munmap(rings_, ringsSize_);
+            }
+            if (ringFd_ >= 0) {
+                ::close(ringFd_);
+            }
+        }
+
+        io_uring_sqe& next(uint8_t opcode, int fd, uint64_t userData) {
+            unsigned index = localTail_++ & sqMask_;
+            io_uring_sqe& sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = opcode;
+            sqe.fd = fd;
+            sqe.user_data = userData;
+            sqArray_[index] = index;
+            ++queued_;
+            return sqe;
+        }
+
+        // Submits the queued entries and stores each result at its user data
+        void submitAndWait(std::vector<int>& results) {
+            std::atomic_ref<unsigned>(*sqTail_).store(localTail_, std::memory_order_release);
+            unsigned toSubmit = queued_;
+            unsigned completed = 0;
+            while (completed < queued_) {
+                long submitted = ::syscall(__NR_io_uring_enter, ringFd_, toSubmit, queued_ - completed,
+                                           IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (submitted < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+                }
+                toSubmit -= static_cast<unsigned>(submitted);
+
+                unsigned head = *cqHead_;
+                unsigned tail = std::atomic_ref<unsigned>(*cqTail_).load(std::memory_order_acquire);
+                for (; head != tail; ++head) {
+                    const auto& cqe = cqes_[head & cqMask_];
+                    results[cqe.user_data] = cqe.res;
+                    ++completed;
+                }
+                std::atomic_ref<unsigned>(*cqHead_).store(head, std::memory_order_release);
+            }
+            queued_ = 0;
+        }
+    };
+#endif
+}
+
+IoEngine::IoEngine(std::shared_ptr<MemoryBudget> budget) : budget_(std::move(budget)) {
+    if (budget_) {
+        // Powers of two keep the slots at an exact BufferPool size class
+        size_t fitting = std::max<size_t>(budget_->limit() / 4 / SLOT_SIZE, 1);
+        depth_ = std::min(QUEUE_DEPTH, std::bit_floor(fitting));
+    }
+}
+
+MemoryBudget::Reservation IoEngine::reserveSlots() {
+    if (!budget_) {
+        return {};
+    }
+    return budget_->acquire(depth_ * SLOT_SIZE);
+}
+
+std::unique_ptr<IoEngine> IoEngine::create(IoBackend backend, unsigned threads,
+                                           std::shared_ptr<MemoryBudget> budget) {
+#ifdef HAVE_IO_URING
+    if (backend == IoBackend::Uring) {
+        try {
+            return std::make_unique<UringEngine>(budget);
+        } catch (const std::exception&) {
+            // Old kernel, seccomp filter or io_uring disabled: use threads
+        }
+    }
+#else
+    (void)backend;
+#endif
+    return std::make_unique<ThreadPoolEngine>(threads, std::move(budget));
+}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "MemoryBudget.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+
+namespace miniwr {
+
+/**
+ * @brief System call path used for batched file I/O
+ */
+enum class IoBackend {
+    Uring,   ///< io_uring, or Threads where the kernel does not offer it
+    Threads  ///< Blocking system calls as scheduler I/O tasks
+};
+
+/**
+ * @brief Batched open/stat/read/write/close of many small files
+ *
+ * Archiving and extracting trees of small files is dominated by the system
+ * calls around each file rather than by its data. The engine issues them for
+ * up to QUEUE_DEPTH files at once: with io_uring every step of a batch is a
+ * single submission, otherwise scheduler I/O tasks overlap the blocking calls.
+ *
+ * Under a memory budget the batch slots are reserved from it for as long as
+ * they are allocated, and batches shrink so the slots take at most a quarter
+ * of the limit.
+ *
+ * Methods are called from one thread at a time.
+ */
+class IoEngine {
+public:
+    /// Files per batch (fewer under a small memory budget, see depth())
+    static constexpr size_t QUEUE_DEPTH = 64;
+
+    /// Largest file read by readFiles(); one registered buffer per batch slot
+    static constexpr size_t SLOT_SIZE = 256 * 1024;
+
+    /**
+     * @brief Metadata of a file read by readFiles()
+     */
+    struct FileInfo {
+        uint64_t size = 0;
+        std::filesystem::perms permissions = std::filesystem::perms::none;
+        std::filesystem::file_time_type modified;
+    };
+
+    /**
+     * @brief File created (or truncated) by writeFiles()
+     */
+    struct FileWrite {
+        std::filesystem::path path;
+        std::span<const uint8_t> data;
+        std::filesystem::perms permissions = std::filesystem::perms::unknown;  ///< Left as created if unknown
+        std::optional<std::filesystem::file_time_type> modified;                ///< Left as written if empty
+    };
+
+    /**
+     * @brief Receives the files of readFiles() in request order
+     *
+     * The content is valid during the call only. It is empty for files
+     * larger than SLOT_SIZE, which the caller reads another way.
+     */
+    using Consume = std::function<void(size_t index, const FileInfo& info,
+                                       std::span<const uint8_t> content)>;
+
+    virtual ~IoEngine() = default;
+
+    /**
+     * @brief Stat and read whole files
+     * @throws std::runtime_error if a file cannot be opened or read; files
+     *         before it in the list have been consumed
+     */
+    virtual void readFiles(std::span<const std::filesystem::path> paths, const Consume& consume) = 0;
+
+    /**
+     * @brief Create files with their content, permissions and times
+     * @throws std::runtime_error naming the first file that failed
+     */
+    virtual void writeFiles(std::span<const FileWrite> files) = 0;
+
+    /**
+     * @brief Backend actually in use, e.g. "io_uring"
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Files per batch, QUEUE_DEPTH unless the memory budget is small
+     */
+    size_t depth() const { return depth_; }
+
+    /**
+     * @param backend Preferred backend
+     * @param threads Calls in flight for the Threads backend (0 = one per scheduler worker)
+     * @param budget Memory budget the batch slots are reserved from (optional)
+     */
+    static std::unique_ptr<IoEngine> create(IoBackend backend, unsigned threads = 0,
+                                            std::shared_ptr<MemoryBudget> budget = nullptr);
+
+protected:
+    explicit IoEngine(std::shared_ptr<MemoryBudget> budget);
+
+    /**
+     * @brief Reserve the slots of depth() files from the budget, if any
+     * @return Reservation to hold while the slots are allocated
+     */
+    MemoryBudget::Reservation reserveSlots();
+
+private:
+    std::shared_ptr<MemoryBudget> budget_;
+    size_t depth_ = QUEUE_DEPTH;
+};
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+
+namespace miniwr {
+
+/**
+ * @brief Write a string as a quoted JSON string
+ *
+ * Quotes and backslashes are escaped, as are control characters: newlines
+ * and tabs by their short forms, the rest as \uXXXX. Other bytes are
+ * written unchanged, so UTF-8 names stay readable.
+ */
+void writeJsonString(std::ostream& out, std::string_view value);
+}
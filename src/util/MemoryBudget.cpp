@@ -0,0 +1,88 @@
+#include "MemoryBudget.h"
+#include "Trace.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace miniwr {
+
+MemoryBudget::Reservation::Reservation(Reservation&& other) noexcept
+    : budget_(other.budget_), bytes_(other.bytes_) {
+    other.budget_ = nullptr;
+    other.bytes_ = 0;
+}
+
+MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(Reservation&& other) noexcept {
+    if (this != &other) {
+        release();
+        budget_ = other.budget_;
+        bytes_ = other.bytes_;
+        other.budget_ = nullptr;
+        other.bytes_ = 0;
+    }
+    return *this;
+}
+
+MemoryBudget::Reservation::~Reservation() {
+    release();
+}
+
+void MemoryBudget::Reservation::release() {
+    if (budget_) {
+        budget_->release(bytes_);
+        budget_ = nullptr;
+        bytes_ = 0;
+    }
+}
+
+MemoryBudget::MemoryBudget(size_t limit) : limit_(limit) {}
+
+MemoryBudget::Reservation MemoryBudget::acquire(size_t bytes) {
+    if (!fits(bytes)) {
+        throw std::runtime_error("Request of " + std::to_string(bytes) +
+            " bytes exceeds the memory limit of " + std::to_string(limit_));
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (inUse_ + bytes > limit_) {
+        TraceSpan span("wait-memory");
+        released_.wait(lock, [&] { return inUse_ + bytes <= limit_; });
+    }
+    inUse_ += bytes;
+    peak_ = std::max(peak_, inUse_);
+    return Reservation(this, bytes);
+}
+
+bool MemoryBudget::tryAcquire(size_t bytes, Reservation& reservation) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (inUse_ + bytes > limit_) {
+            return false;
+        }
+        inUse_ += bytes;
+        peak_ = std::max(peak_, inUse_);
+    }
+
+    // Assigned outside the lock: dropping a previous reservation releases
+    reservation = Reservation(this, bytes);
+    return true;
+}
+
+size_t MemoryBudget::inUse() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return inUse_;
+}
+
+size_t MemoryBudget::peak() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+void MemoryBudget::release(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inUse_ -= bytes;
+    }
+    released_.notify_all();
+}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace miniwr {
+
+/**
+ * @brief Global cap on the bytes held by in-flight archive buffers
+ *
+ * Producers reserve the memory an operation needs before allocating it and
+ * block while the cap is reached. Reservations are released when the
+ * returned handle goes out of scope. They count buffers at the size
+ * BufferPool rounds them to, so admitted work fits under the pool's own
+ * memory limit, which is the hard ceiling.
+ */
+class MemoryBudget {
+public:
+    /**
+     * @brief Owning handle for reserved bytes
+     */
+    class Reservation {
+    public:
+        Reservation() = default;
+        Reservation(Reservation&& other) noexcept;
+        Reservation& operator=(Reservation&& other) noexcept;
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+        ~Reservation();
+
+        /**
+         * @brief Return the bytes to the budget early
+         */
+        void release();
+
+        size_t size() const { return bytes_; }
+
+    private:
+        friend class MemoryBudget;
+        Reservation(MemoryBudget* budget, size_t bytes) : budget_(budget), bytes_(bytes) {}
+
+        MemoryBudget* budget_ = nullptr;
+        size_t bytes_ = 0;
+    };
+
+    /**
+     * @param limit Maximum number of bytes reserved at any time
+     */
+    explicit MemoryBudget(size_t limit);
+
+    /**
+     * @brief Reserve bytes, blocking until they are available
+     * @param bytes Number of bytes (must not exceed the limit)
+     * @return Reservation handle
+     */
+    Reservation acquire(size_t bytes);
+
+    /**
+     * @brief Reserve bytes if they are available right now
+     * @param bytes Number of bytes
+     * @param reservation Receives the reservation on success
+     * @return True if the bytes were reserved
+     */
+    bool tryAcquire(size_t bytes, Reservation& reservation);
+
+    /**
+     * @brief Check whether a single reservation of this size can ever succeed
+     */
+    bool fits(size_t bytes) const { return bytes <= limit_; }
+
+    size_t limit() const { return limit_; }
+    size_t inUse() const;
+    size_t peak() const;
+
+private:
+    const size_t limit_;
+    size_t inUse_ = 0;
+    size_t peak_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+
+    void release(size_t bytes);
+};
+}
@@ -0,0 +1,149 @@
+#include "ProgressBar.h"
+#include "Json.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+namespace miniwr {
+
+namespace {
+    constexpr int BAR_WIDTH = 40;
+    constexpr double MB = 1024.0 * 1024.0;
+
+    std::string formatDuration(double seconds) {
+        auto total = static_cast<long>(seconds + 0.5);
+        char text[32];
+        if (total >= 3600) {
+            std::snprintf(text, sizeof(text), "%ld:%02ld:%02ld",
+                          total / 3600, total / 60 % 60, total % 60);
+        } else {
+            std::snprintf(text, sizeof(text), "%ld:%02ld", total / 60, total % 60);
+        }
+        return text;
+    }
+}
+
+ProgressBar::ProgressBar(std::string operation, uint64_t totalBytes, uint64_t totalFiles,
+                         ProgressMode mode)
+    : operation_(std::move(operation)),
+      totalBytes_(totalBytes),
+      totalFiles_(totalFiles),
+      mode_(mode),
+      start_(std::chrono::steady_clock::now()) {
+
+    if (mode_ == ProgressMode::Auto) {
+        mode_ = isatty(STDOUT_FILENO) ? ProgressMode::Bar : ProgressMode::None;
+    }
+    if (mode_ != ProgressMode::None) {
+        renderer_ = std::thread(&ProgressBar::run, this);
+    }
+}
+
+ProgressBar::~ProgressBar() {
+    finish();
+}
+
+void ProgressBar::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    stopped_.notify_all();
+
+    if (renderer_.joinable()) {
+        renderer_.join();
+        render(true);
+    }
+}
+
+void ProgressBar::pause() {
+    std::lock_guard<std::mutex> lock(renderMutex_);
+    if (!paused_ && renderer_.joinable() && mode_ == ProgressMode::Bar) {
+        std::cout << "\n" << std::flush;
+    }
+    paused_ = true;
+}
+
+void ProgressBar::resume() {
+    std::lock_guard<std::mutex> lock(renderMutex_);
+    paused_ = false;
+}
+
+void ProgressBar::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_.wait_for(lock, RENDER_INTERVAL, [&] { return stopping_; })) {
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> renderLock(renderMutex_);
+            if (!paused_) {
+                render(false);
+            }
+        }
+        lock.lock();
+    }
+}
+
+void ProgressBar::render(bool final) {
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    if (mode_ == ProgressMode::Bar) {
+        renderBar(bytes(), files(), elapsed, final);
+    } else if (mode_ == ProgressMode::Json) {
+        renderJson(bytes(), files(), elapsed, final);
+    }
+}
+
+void ProgressBar::renderBar(uint64_t bytes, uint64_t files, double elapsed, bool final) {
+    double fraction = totalBytes_ > 0
+        ? std::min(1.0, static_cast<double>(bytes) / static_cast<double>(totalBytes_))
+        : (totalFiles_ > 0 ? static_cast<double>(files) / static_cast<double>(totalFiles_) : 1.0);
+    int pos = static_cast<int>(BAR_WIDTH * fraction);
+    double rate = elapsed > 0 ? static_cast<double>(bytes) / elapsed : 0.0;
+
+    // Built in one piece so a redraw is a single write
+    std::ostringstream line;
+    line << "\r" << operation_ << ": [";
+    for (int i = 0; i < BAR_WIDTH; ++i) {
+        line << (i < pos ? '=' : i == pos ? '>' : ' ');
+    }
+    line << "] " << std::fixed << std::setprecision(1) << fraction * 100.0 << "% "
+         << rate / MB << " MB/s";
+    if (!final && rate > 0 && totalBytes_ > bytes) {
+        line << " ETA " << formatDuration(static_cast<double>(totalBytes_ - bytes) / rate);
+    } else {
+        line << " " << formatDuration(elapsed);
+    }
+    line << " (" << files << "/" << totalFiles_ << " files)   ";
+    if (final) {
+        line << "\n";
+    }
+
+    std::cout << line.str() << std::flush;
+}
+
+void ProgressBar::renderJson(uint64_t bytes, uint64_t files, double elapsed, bool final) {
+    double rate = elapsed > 0 ? static_cast<double>(bytes) / elapsed : 0.0;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3) << "{\"operation\": ";
+    writeJsonString(line, operation_);
+    line << ", \"bytes\": " << bytes << ", \"total_bytes\": " << totalBytes_
+         << ", \"files\": " << files << ", \"total_files\": " << totalFiles_
+         << ", \"elapsed_s\": " << elapsed
+         << ", \"bytes_per_s\": " << std::setprecision(0) << rate << std::setprecision(3)
+         << ", \"eta_s\": ";
+    if (rate > 0 && totalBytes_ >= bytes) {
+        line << static_cast<double>(totalBytes_ - bytes) / rate;
+    } else {
+        line << "null";
+    }
+    line << ", \"done\": " << (final ? "true" : "false") << "}\n";
+
+    std::cerr << line.str() << std::flush;
+}
+}
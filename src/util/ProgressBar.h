@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace miniwr {
+
+/**
+ * @brief How progress is reported
+ */
+enum class ProgressMode {
+    Auto,  ///< Bar when stdout is a terminal, otherwise nothing
+    Bar,   ///< Redrawn progress bar on stdout
+    Json,  ///< One JSON object per line on stderr
+    None   ///< No progress output
+};
+
+/**
+ * @brief Byte-based progress reporting from a separate render thread
+ *
+ * Workers only bump atomic counters; the render thread redraws at most
+ * every RENDER_INTERVAL, so output cost does not grow with the file count.
+ */
+class ProgressBar {
+public:
+    static constexpr std::chrono::milliseconds RENDER_INTERVAL{100};
+
+    /**
+     * @param operation Label, e.g. "Compressing"
+     * @param totalBytes Expected number of bytes
+     * @param totalFiles Expected number of files
+     * @param mode Output mode (nothing is started for None)
+     */
+    ProgressBar(std::string operation, uint64_t totalBytes, uint64_t totalFiles,
+                ProgressMode mode);
+    ~ProgressBar();
+
+    ProgressBar(const ProgressBar&) = delete;
+    ProgressBar& operator=(const ProgressBar&) = delete;
+
+    /**
+     * @brief Account processed bytes (thread-safe, lock-free)
+     */
+    void addBytes(uint64_t bytes) { bytes_.fetch_add(bytes, std::memory_order_relaxed); }
+
+    /**
+     * @brief Account completed files (thread-safe, lock-free)
+     */
+    void addFiles(uint64_t files = 1) { files_.fetch_add(files, std::memory_order_relaxed); }
+
+    uint64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+    uint64_t files() const { return files_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Stop redrawing, e.g. while a prompt waits for input
+     *
+     * Returns once no redraw is in progress; a bar in progress is ended with
+     * a newline so the next output starts on a line of its own.
+     */
+    void pause();
+
+    /**
+     * @brief Redraw again after pause()
+     */
+    void resume();
+
+    /**
+     * @brief Stop the render thread and draw the final state
+     */
+    void finish();
+
+private:
+    std::string operation_;
+    uint64_t totalBytes_;
+    uint64_t totalFiles_;
+    ProgressMode mode_;
+    std::chrono::steady_clock::time_point start_;
+
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> files_{0};
+
+    std::mutex mutex_;
+    std::condition_variable stopped_;
+    bool stopping_ = false;
+    std::mutex renderMutex_;  // Held while drawing
+    bool paused_ = false;
+    std::thread renderer_;
+
+    void run();
+    void render(bool final);
+    void renderBar(uint64_t bytes, uint64_t files, double elapsed, bool final);
+    void renderJson(uint64_t bytes, uint64_t files, double elapsed, bool final);
+};
+}
@@ -0,0 +1,363 @@
+#include "Scheduler.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace miniwr {
+
+namespace {
+    // Worker of the scheduler running on this thread, if any
+    thread_local Scheduler* currentScheduler = nullptr;
+    thread_local size_t currentWorker = 0;
+
+    std::mutex sharedMutex;
+    std::unique_ptr<Scheduler> sharedScheduler;
+    SchedulerOptions sharedOptions;
+
+    struct Placement {
+        int cpu;
+        unsigned node;
+    };
+
+    // "0-3,8,10-11" as in /sys/devices/system/node/node*/cpulist
+    std::vector<int> parseCpuList(const std::string& text) {
+        std::vector<int> cpus;
+        std::istringstream in(text);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            if (range.empty() || range == "\n") {
+                continue;
+            }
+            size_t dash = range.find('-');
+            try {
+                int first = std::stoi(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            } catch (const std::exception&) {
+                return {};
+            }
+        }
+        return cpus;
+    }
+
+    // CPUs the process may run on, grouped by NUMA node
+    std::vector<Placement> usableCpus() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return {};
+        }
+
+        std::map<unsigned, std::vector<int>> nodes;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            std::string name = entry.path().filename().string();
+            if (!name.starts_with("node") || name.size() == 4 ||
+                !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                continue;
+            }
+            std::ifstream list(entry.path() / "cpulist");
+            std::string text;
+            std::getline(list, text);
+            nodes[static_cast<unsigned>(std::stoul(name.substr(4)))] = parseCpuList(text);
+        }
+
+        std::vector<Placement> placements;
+        for (const auto& [node, cpus] : nodes) {
+            for (int cpu : cpus) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                    placements.push_back({cpu, node});
+                }
+            }
+        }
+        if (placements.empty()) {
+            // No NUMA information: a single node
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    placements.push_back({cpu, 0});
+                }
+            }
+        }
+        return placements;
+    }
+}
+
+Scheduler::Scheduler(const SchedulerOptions& options) {
+    auto placements = usableCpus();
+    unsigned threads = options.threads;
+    if (threads == 0) {
+        threads = placements.empty() ? std::max(1u, std::thread::hardware_concurrency())
+                                     : static_cast<unsigned>(placements.size());
+    }
+
+    for (unsigned i = 0; i < threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+        if (!placements.empty()) {
+            worker->node = placements[i % placements.size()].node;
+        }
+        workers_.push_back(std::move(worker));
+    }
+
+    // Steal from the workers of the same node first, each worker starting
+    // after itself so that thieves spread over their victims
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        std::vector<size_t> others;
+        for (size_t step = 1; step < workers_.size(); ++step) {
+            others.push_back((i + step) % workers_.size());
+        }
+        std::stable_partition(others.begin(), others.end(), [&](size_t other) {
+            return workers_[other]->node == workers_[i]->node;
+        });
+        workers_[i]->victims = std::move(others);
+    }
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        int cpu = options.pinThreads && !placements.empty()
+            ? placements[i % placements.size()].cpu : -1;
+        workers_[i]->thread = std::thread(&Scheduler::run, this, i, cpu);
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+Scheduler& Scheduler::shared() {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    if (!sharedScheduler) {
+        sharedScheduler = std::make_unique<Scheduler>(sharedOptions);
+    }
+    return *sharedScheduler;
+}
+
+void Scheduler::configure(const SchedulerOptions& options) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    if (sharedScheduler) {
+        throw std::runtime_error("Scheduler already started");
+    }
+    sharedOptions = options;
+}
+
+void Scheduler::submit(Task task, TaskPriority priority) {
+    size_t target = currentScheduler == this
+        ? currentWorker : nextWorker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+        workers_[target]->queues[static_cast<size_t>(priority)].push_back(std::move(task));
+        ++queued_;
+    }
+
+    // Taking the lock orders the push before a worker deciding to sleep
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    wake_.notify_one();
+}
+
+bool Scheduler::runPending() {
+    Task task;
+    if (currentScheduler == this) {
+        if (!take(currentWorker, task)) {
+            return false;
+        }
+    } else {
+        std::vector<size_t> all(workers_.size());
+        for (size_t i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        if (!steal(all, TaskPriority::Io, task) && !steal(all, TaskPriority::Cpu, task)) {
+            return false;
+        }
+    }
+    task();
+    return true;
+}
+
+void Scheduler::run(size_t index, int cpu) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    }
+    currentScheduler = this;
+    currentWorker = index;
+
+    // Workers outlive traces; they are named once one is recording
+    bool named = false;
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            if (!named && Trace::enabled()) {
+                Trace::nameThread("worker " + std::to_string(index));
+                named = true;
+            }
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [&] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+bool Scheduler::take(size_t index, Task& task) {
+    Worker& self = *workers_[index];
+    for (TaskPriority priority : {TaskPriority::Io, TaskPriority::Cpu}) {
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            auto& queue = self.queues[static_cast<size_t>(priority)];
+            if (!queue.empty()) {
+                task = std::move(queue.back());
+                queue.pop_back();
+                --queued_;
+                return true;
+            }
+        }
+        if (steal(self.victims, priority, task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::steal(const std::vector<size_t>& victims, TaskPriority priority, Task& task) {
+    for (size_t victim : victims) {
+        Worker& worker = *workers_[victim];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        auto& queue = worker.queues[static_cast<size_t>(priority)];
+        if (!queue.empty()) {
+            task = std::move(queue.front());
+            queue.pop_front();
+            --queued_;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct TaskGroup::State {
+    Scheduler& scheduler;
+    CancellationToken token;
+    unsigned limit;
+
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;    // Added and not finished
+    unsigned running = 0;  // Handed to the scheduler
+    std::deque<std::pair<std::function<void()>, TaskPriority>> waiting;
+    std::exception_ptr error;
+
+    State(Scheduler& scheduler, CancellationToken token, unsigned limit)
+        : scheduler(scheduler), token(std::move(token)), limit(limit) {}
+};
+
+TaskGroup::TaskGroup(unsigned limit, CancellationToken token, Scheduler& scheduler)
+    : scheduler_(scheduler),
+      token_(token),
+      state_(std::make_shared<State>(scheduler, std::move(token),
+                                     limit == 0 ? scheduler.threads() : limit)) {}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // Destructor shouldn't throw; wait() reports errors
+    }
+}
+
+void TaskGroup::run(std::function<void()> task, TaskPriority priority) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        ++state_->pending;
+        if (state_->running >= state_->limit) {
+            state_->waiting.emplace_back(std::move(task), priority);
+            return;
+        }
+        ++state_->running;
+    }
+    dispatch(state_, std::move(task), priority);
+}
+
+void TaskGroup::dispatch(const std::shared_ptr<State>& state, std::function<void()> task,
+                         TaskPriority priority) {
+    state->scheduler.submit([state, task = std::move(task)]() mutable {
+        if (!state->token.cancelled()) {
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+                state->token.cancel();
+            }
+        }
+        // Captures go before wait() can return to the frame they refer to
+        task = nullptr;
+
+        // The slot passes to the next waiting task of the group
+        std::pair<std::function<void()>, TaskPriority> next;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            --state->pending;
+            if (!state->waiting.empty()) {
+                next = std::move(state->waiting.front());
+                state->waiting.pop_front();
+            } else {
+                --state->running;
+            }
+            if (state->pending == 0) {
+                state->done.notify_all();
+            }
+        }
+        if (next.first) {
+            dispatch(state, std::move(next.first), next.second);
+        }
+    }, priority);
+}
+
+void TaskGroup::wait() {
+    // Help with queued tasks, then sleep while the last ones run elsewhere
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            if (state_->pending == 0) {
+                break;
+            }
+        }
+        if (!scheduler_.runPending()) {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            state_->done.wait(lock, [&] { return state_->pending == 0; });
+            break;
+        }
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        error = std::exchange(state_->error, nullptr);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace miniwr {
+
+/**
+ * @brief What a task mostly waits for
+ */
+enum class TaskPriority {
+    Cpu,  ///< Compression, checksums: runs after the queued I/O tasks
+    Io    ///< Blocking system calls: started first so they overlap computation
+};
+
+/**
+ * @brief Thrown by CancellationToken::throwIfCancelled()
+ */
+class Cancelled : public std::runtime_error {
+public:
+    Cancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+/**
+ * @brief Shared flag asking the tasks of an operation to stop early
+ *
+ * Copies share the flag. Tasks not started yet are skipped; running tasks
+ * poll cancelled() or throwIfCancelled() between steps.
+ */
+class CancellationToken {
+public:
+    CancellationToken() : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { cancelled_->store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelled_->load(std::memory_order_relaxed); }
+
+    void throwIfCancelled() const {
+        if (cancelled()) {
+            throw Cancelled();
+        }
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/**
+ * @brief Worker placement of a Scheduler
+ */
+struct SchedulerOptions {
+    unsigned threads = 0;     ///< Workers (0 = one per CPU the process may use)
+    bool pinThreads = false;  ///< Pin each worker to one CPU, filling one NUMA node after another
+};
+
+/**
+ * @brief Work-stealing pool of worker threads
+ *
+ * Every worker owns a deque of tasks per priority. Tasks submitted from a
+ * worker go to the back of its own deque and are taken back LIFO, so
+ * nested work stays on the thread (and in the cache) that produced it;
+ * idle workers steal from the front of the others' deques, workers of the
+ * same NUMA node first. Tasks submitted from other threads are spread
+ * round-robin. I/O tasks are always taken before CPU tasks.
+ *
+ * Operations submit through a TaskGroup, which bounds their concurrency,
+ * collects errors and supports cancellation.
+ */
+class Scheduler {
+public:
+    using Task = std::function<void()>;
+
+    explicit Scheduler(const SchedulerOptions& options = {});
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * @brief Process-wide scheduler, created on first use
+     */
+    static Scheduler& shared();
+
+    /**
+     * @brief Set the options of shared() before its first use
+     * @throws std::runtime_error if shared() already exists
+     */
+    static void configure(const SchedulerOptions& options);
+
+    unsigned threads() const { return static_cast<unsigned>(workers_.size()); }
+
+    /**
+     * @brief Queue a task; it must not throw (TaskGroup wraps tasks that may)
+     */
+    void submit(Task task, TaskPriority priority = TaskPriority::Cpu);
+
+    /**
+     * @brief Run one queued task on the calling thread, if there is one
+     * @return Whether a task was run
+     */
+    bool runPending();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[2];  // Indexed by TaskPriority
+        unsigned node = 0;
+        std::vector<size_t> victims;  // Same node first
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> nextWorker_{0};
+    std::atomic<size_t> queued_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+
+    void run(size_t index, int cpu);
+    bool take(size_t index, Task& task);
+    bool steal(const std::vector<size_t>& victims, TaskPriority priority, Task& task);
+};
+
+/**
+ * @brief Tasks of one operation, run on a Scheduler
+ *
+ * At most `limit` tasks of the group are queued or running at once; the
+ * rest wait in the group, in order. The first exception thrown by a task
+ * cancels the group and is rethrown by wait(). Groups nest: a task may
+ * create its own group and wait for it.
+ */
+class TaskGroup {
+public:
+    /**
+     * @param limit Tasks running at once (0 = as many as the scheduler has workers)
+     * @param token Cancellation shared with other groups, e.g. a parent operation
+     * @param scheduler Scheduler running the tasks
+     */
+    explicit TaskGroup(unsigned limit = 0, CancellationToken token = {},
+                       Scheduler& scheduler = Scheduler::shared());
+
+    /**
+     * @brief Waits for the running tasks; errors are dropped
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * @brief Add a task; skipped if the group is cancelled before it starts
+     */
+    void run(std::function<void()> task, TaskPriority priority = TaskPriority::Cpu);
+
+    /**
+     * @brief Run queued tasks on this thread until every task of the group is done
+     * @throws The first exception thrown by a task
+     */
+    void wait();
+
+    /**
+     * @brief Skip the tasks that have not started
+     */
+    void cancel() { token_.cancel(); }
+
+    const CancellationToken& token() const { return token_; }
+
+private:
+    struct State;
+
+    Scheduler& scheduler_;
+    CancellationToken token_;
+    std::shared_ptr<State> state_;
+
+    static void dispatch(const std::shared_ptr<State>& state, std::function<void()> task,
+                         TaskPriority priority);
+};
+}
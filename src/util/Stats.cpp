@@ -0,0 +1,297 @@
+#include "Stats.h"
+#include "Json.h"
+#include "Trace.h"
+#include <algorithm>
+#include <iomanip>
+#include <sys/resource.h>
+#include <time.h>
+
+namespace miniwr {
+
+namespace {
+    constexpr const char* PHASE_NAMES[PHASE_COUNT] = {
+        "scan", "read", "crc", "compress", "inflate", "write", "mkdir", "permissions", "flush"
+    };
+    constexpr double MB = 1024.0 * 1024.0;
+    constexpr int HISTOGRAM_WIDTH = 40;
+
+    double seconds(int64_t ns) {
+        return static_cast<double>(ns) / 1e9;
+    }
+
+    // Throughput on the larger side, i.e. the uncompressed data for deflate and inflate
+    double megabytesPerSecond(const Stats::PhaseTotals& totals) {
+        if (totals.wallNs <= 0) {
+            return 0.0;
+        }
+        return static_cast<double>(std::max(totals.bytesIn, totals.bytesOut)) / MB /
+               seconds(totals.wallNs);
+    }
+
+    uint64_t peakRss() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // Reported in KB
+    }
+
+    bool slower(const Stats::EntryRecord& a, const Stats::EntryRecord& b) {
+        return a.wallNs > b.wallNs;
+    }
+}
+
+const char* phaseName(Phase phase) {
+    return PHASE_NAMES[static_cast<size_t>(phase)];
+}
+
+TimePoint TimePoint::now() {
+    TimePoint point;
+    point.wallNs = Trace::now();
+
+    timespec cpu{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    point.cpuNs = static_cast<int64_t>(cpu.tv_sec) * 1000000000 + cpu.tv_nsec;
+    return point;
+}
+
+Stats::Stats() : start_(TimePoint::now()) {}
+
+void Stats::addPhase(Phase phase, int64_t wallNs, int64_t cpuNs,
+                     uint64_t bytesIn, uint64_t bytesOut) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& totals = phases_[static_cast<size_t>(phase)];
+    ++totals.count;
+    totals.wallNs += wallNs;
+    totals.cpuNs += cpuNs;
+    totals.bytesIn += bytesIn;
+    totals.bytesOut += bytesOut;
+
+    auto [it, inserted] = threads_.try_emplace(std::this_thread::get_id());
+    if (inserted) {
+        it->second.index = threads_.size() - 1;
+    }
+    it->second.busyWallNs += wallNs;
+    it->second.busyCpuNs += cpuNs;
+}
+
+void Stats::addEntry(const std::string& name, uint64_t bytesIn, uint64_t bytesOut, int64_t wallNs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++entries_;
+    totalIn_ += bytesIn;
+    totalOut_ += bytesOut;
+
+    if (bytesIn > 0) {
+        size_t bucket = static_cast<size_t>(10 * bytesOut / bytesIn);
+        ++ratioHistogram_[std::min(bucket, RATIO_BUCKETS - 1)];
+    }
+
+    // Keep the slowest entries in a bounded min-heap
+    if (slowest_.size() < SLOWEST_ENTRIES) {
+        slowest_.push_back({name, bytesIn, bytesOut, wallNs});
+        std::push_heap(slowest_.begin(), slowest_.end(), slower);
+    } else if (wallNs > slowest_.front().wallNs) {
+        std::pop_heap(slowest_.begin(), slowest_.end(), slower);
+        slowest_.back() = {name, bytesIn, bytesOut, wallNs};
+        std::push_heap(slowest_.begin(), slowest_.end(), slower);
+    }
+}
+
+void Stats::finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (elapsedNs_ < 0) {
+        elapsedNs_ = TimePoint::now().wallNs - start_.wallNs;
+    }
+}
+
+Stats::PhaseTotals Stats::phase(Phase phase) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return phases_[static_cast<size_t>(phase)];
+}
+
+int64_t Stats::elapsedNs() const {
+    return elapsedNs_ >= 0 ? elapsedNs_ : TimePoint::now().wallNs - start_.wallNs;
+}
+
+std::vector<Stats::ThreadTotals> Stats::threadsByIndex() const {
+    std::vector<ThreadTotals> threads(threads_.size());
+    for (const auto& [id, totals] : threads_) {
+        threads[totals.index] = totals;
+    }
+    return threads;
+}
+
+void Stats::printReport(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t elapsed = elapsedNs();
+    auto flags = out.flags();
+    out << std::fixed;
+
+    out << "\nStatistics\n"
+        << "  Elapsed " << std::setprecision(3) << seconds(elapsed) << " s, "
+        << entries_ << " entries, " << std::setprecision(1)
+        << totalIn_ / MB << " MB in, " << totalOut_ / MB << " MB out";
+    if (totalIn_ > 0) {
+        out << " (" << 100.0 * static_cast<double>(totalOut_) / static_cast<double>(totalIn_) << "%)";
+    }
+    out << ", peak RSS " << peakRss() / MB << " MB\n";
+
+    out << "\n  " << std::left << std::setw(12) << "Phase" << std::right
+        << std::setw(8) << "Count" << std::setw(10) << "Wall s" << std::setw(10) << "CPU s"
+        << std::setw(11) << "In MB" << std::setw(11) << "Out MB" << std::setw(10) << "MB/s" << "\n";
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        const auto& totals = phases_[i];
+        if (totals.count == 0) {
+            continue;
+        }
+        out << "  " << std::left << std::setw(12) << PHASE_NAMES[i] << std::right
+            << std::setw(8) << totals.count
+            << std::setprecision(3)
+            << std::setw(10) << seconds(totals.wallNs)
+            << std::setw(10) << seconds(totals.cpuNs)
+            << std::setprecision(1)
+            << std::setw(11) << totals.bytesIn / MB
+            << std::setw(11) << totals.bytesOut / MB
+            << std::setw(10) << megabytesPerSecond(totals) << "\n";
+    }
+
+    out << "\n  Threads\n";
+    for (const auto& thread : threadsByIndex()) {
+        double utilization = elapsed > 0
+            ? 100.0 * static_cast<double>(thread.busyWallNs) / static_cast<double>(elapsed) : 0.0;
+        out << "    #" << std::left << std::setw(4) << thread.index << std::right
+            << std::setprecision(3) << "busy " << seconds(thread.busyWallNs) << " s"
+            << " (" << std::setprecision(1) << utilization << "%), cpu "
+            << std::setprecision(3) << seconds(thread.busyCpuNs) << " s\n";
+    }
+
+    uint64_t largest = *std::max_element(ratioHistogram_.begin(), ratioHistogram_.end());
+    if (largest > 0) {
+        out << "\n  Compression ratio (compressed / original)\n";
+        for (size_t i = 0; i < RATIO_BUCKETS; ++i) {
+            std::string label = i + 1 < RATIO_BUCKETS
+                ? std::to_string(i * 10) + "-" + std::to_string(i * 10 + 10) + "%"
+                : ">=100%";
+            auto width = static_cast<int>(HISTOGRAM_WIDTH * ratioHistogram_[i] / largest);
+            out << "    " << std::left << std::setw(8) << label << std::right
+                << std::setw(8) << ratioHistogram_[i] << " " << std::string(width, '#') << "\n";
+        }
+    }
+
+    auto slowest = slowest_;
+    std::sort_heap(slowest.begin(), slowest.end(), slower);
+    if (!slowest.empty()) {
+        out << "\n  Slowest entries\n";
+        for (const auto& file : slowest) {
+            out << "    " << std::setprecision(3) << std::setw(8) << seconds(file.wallNs) << " s"
+                << std::setprecision(1) << std::setw(10) << file.bytesIn / MB << " MB  "
+                << file.name << "\n";
+        }
+    }
+
+    out << std::flush;
+    out.flags(flags);
+}
+
+void Stats::writeJson(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t elapsed = elapsedNs();
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::setprecision(6);
+
+    out << "{\n  \"elapsed_s\": " << seconds(elapsed)
+        << ",\n  \"entries\": " << entries_
+        << ",\n  \"bytes_in\": " << totalIn_
+        << ",\n  \"bytes_out\": " << totalOut_
+        << ",\n  \"peak_rss_bytes\": " << peakRss()
+        << ",\n  \"phases\": [";
+
+    bool first = true;
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        const auto& totals = phases_[i];
+        if (totals.count == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n")
+            << "    {\"name\": \"" << PHASE_NAMES[i] << "\", \"count\": " << totals.count
+            << ", \"wall_s\": " << seconds(totals.wallNs)
+            << ", \"cpu_s\": " << seconds(totals.cpuNs)
+            << ", \"bytes_in\": " << totals.bytesIn
+            << ", \"bytes_out\": " << totals.bytesOut
+            << ", \"mb_per_s\": " << megabytesPerSecond(totals) << "}";
+        first = false;
+    }
+
+    out << "\n  ],\n  \"threads\": [";
+    first = true;
+    for (const auto& thread : threadsByIndex()) {
+        double utilization = elapsed > 0
+            ? static_cast<double>(thread.busyWallNs) / static_cast<double>(elapsed) : 0.0;
+        out << (first ? "\n" : ",\n")
+            << "    {\"thread\": " << thread.index
+            << ", \"busy_s\": " << seconds(thread.busyWallNs)
+            << ", \"cpu_s\": " << seconds(thread.busyCpuNs)
+            << ", \"utilization\": " << utilization << "}";
+        first = false;
+    }
+
+    out << "\n  ],\n  \"ratio_histogram\": [";
+    for (size_t i = 0; i < RATIO_BUCKETS; ++i) {
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"from\": " << 0.1 * static_cast<double>(i)
+            << ", \"to\": ";
+        if (i + 1 < RATIO_BUCKETS) {
+            out << 0.1 * static_cast<double>(i + 1);
+        } else {
+            out << "null";
+        }
+        out << ", \"entries\": " << ratioHistogram_[i] << "}";
+    }
+
+    auto slowest = slowest_;
+    std::sort_heap(slowest.begin(), slowest.end(), slower);
+    out << "\n  ],\n  \"slowest_entries\": [";
+    first = true;
+    for (const auto& file : slowest) {
+        out << (first ? "\n" : ",\n") << "    {\"name\": ";
+        writeJsonString(out, file.name);
+        out << ", \"wall_s\": " << seconds(file.wallNs)
+            << ", \"bytes_in\": " << file.bytesIn
+            << ", \"bytes_out\": " << file.bytesOut << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+
+    out.precision(precision);
+    out.flags(flags);
+}
+
+PhaseTimer::PhaseTimer(Stats* stats, Phase phase, uint64_t bytesIn)
+    : stats_(stats), traced_(Trace::enabled()), phase_(phase), bytesIn_(bytesIn) {
+    if (stats_ || traced_) {
+        start_ = TimePoint::now();
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    stop();
+}
+
+TimePoint PhaseTimer::stop() {
+    TimePoint elapsed;
+    if (!stats_ && !traced_) {
+        return elapsed;
+    }
+    auto end = TimePoint::now();
+    elapsed.wallNs = end.wallNs - start_.wallNs;
+    elapsed.cpuNs = end.cpuNs - start_.cpuNs;
+    if (stats_) {
+        stats_->addPhase(phase_, elapsed.wallNs, elapsed.cpuNs, bytesIn_, bytesOut_);
+        stats_ = nullptr;
+    }
+    if (traced_) {
+        Trace::record(phaseName(phase_), start_.wallNs, end.wallNs, std::max(bytesIn_, bytesOut_));
+        traced_ = false;
+    }
+    return elapsed;
+}
+}
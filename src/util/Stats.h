@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace miniwr {
+
+/**
+ * @brief Pipeline stages timed by Stats
+ */
+enum class Phase {
+    Scan,        ///< Directory walking
+    Read,        ///< Reading input files or archive data
+    Crc,         ///< CRC32 computation
+    Compress,    ///< Deflate (and delta encoding)
+    Inflate,     ///< Inflate (and delta decoding)
+    Write,       ///< Writing archive or output data
+    Mkdir,       ///< Creating output directories
+    Permissions, ///< Applying file permissions
+    Flush        ///< Flushing and closing the archive
+};
+
+inline constexpr size_t PHASE_COUNT = 9;
+
+const char* phaseName(Phase phase);
+
+/**
+ * @brief Wall clock and CPU time of the calling thread, in nanoseconds
+ */
+struct TimePoint {
+    int64_t wallNs = 0;
+    int64_t cpuNs = 0;
+
+    static TimePoint now();
+
+    TimePoint& operator+=(const TimePoint& other) {
+        wallNs += other.wallNs;
+        cpuNs += other.cpuNs;
+        return *this;
+    }
+};
+
+/**
+ * @brief Per-phase timing and throughput counters of one archive job
+ *
+ * Thread-safe. Components receive a pointer and skip all timing when it is
+ * null, so disabled statistics cost one branch per phase.
+ */
+class Stats {
+public:
+    static constexpr size_t SLOWEST_ENTRIES = 10;
+    static constexpr size_t RATIO_BUCKETS = 11;  ///< 10% steps, last one >= 100%
+
+    struct PhaseTotals {
+        uint64_t count = 0;
+        int64_t wallNs = 0;
+        int64_t cpuNs = 0;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+    };
+
+    struct EntryRecord {
+        std::string name;
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        int64_t wallNs = 0;
+    };
+
+    Stats();
+
+    /**
+     * @brief Account time spent in a phase by the calling thread
+     */
+    void addPhase(Phase phase, int64_t wallNs, int64_t cpuNs,
+                  uint64_t bytesIn, uint64_t bytesOut);
+
+    /**
+     * @brief Account a processed archive entry (a solid block counts as one)
+     * @param name Entry name
+     * @param bytesIn Uncompressed size
+     * @param bytesOut Compressed size
+     * @param wallNs Time spent on the entry
+     */
+    void addEntry(const std::string& name, uint64_t bytesIn, uint64_t bytesOut, int64_t wallNs);
+
+    /**
+     * @brief Stop the job clock (reports before this use the current time)
+     */
+    void finish();
+
+    /**
+     * @brief Print a human-readable report
+     */
+    void printReport(std::ostream& out) const;
+
+    /**
+     * @brief Write the report as a JSON object
+     */
+    void writeJson(std::ostream& out) const;
+
+    PhaseTotals phase(Phase phase) const;
+
+private:
+    struct ThreadTotals {
+        size_t index = 0;
+        int64_t busyWallNs = 0;
+        int64_t busyCpuNs = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::array<PhaseTotals, PHASE_COUNT> phases_{};
+    std::map<std::thread::id, ThreadTotals> threads_;
+    std::array<uint64_t, RATIO_BUCKETS> ratioHistogram_{};
+    std::vector<EntryRecord> slowest_;  // Min-heap on wallNs
+    uint64_t entries_ = 0;
+    uint64_t totalIn_ = 0;
+    uint64_t totalOut_ = 0;
+    TimePoint start_;
+    int64_t elapsedNs_ = -1;
+
+    int64_t elapsedNs() const;
+    std::vector<ThreadTotals> threadsByIndex() const;
+};
+
+/**
+ * @brief Times a scope as one phase of the calling thread
+ *
+ * While tracing is enabled the scope is also recorded as a trace span
+ * named after the phase.
+ */
+class PhaseTimer {
+public:
+    /**
+     * @param stats Collector (nullptr disables the timer unless tracing)
+     * @param phase Phase being timed
+     * @param bytesIn Input bytes, if known up front
+     */
+    PhaseTimer(Stats* stats, Phase phase, uint64_t bytesIn = 0);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    void setBytes(uint64_t bytesIn, uint64_t bytesOut) {
+        bytesIn_ = bytesIn;
+        bytesOut_ = bytesOut;
+    }
+
+    /**
+     * @brief Record now instead of at the end of the scope
+     * @return Wall and CPU time recorded (zero when disabled or already stopped)
+     */
+    TimePoint stop();
+
+private:
+    Stats* stats_;
+    bool traced_;
+    Phase phase_;
+    uint64_t bytesIn_;
+    uint64_t bytesOut_ = 0;
+    TimePoint start_;
+};
+}
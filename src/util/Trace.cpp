@@ -0,0 +1,142 @@
+#include "Trace.h"
+#include "Json.h"
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace miniwr {
+
+namespace {
+    struct TraceEvent {
+        const char* name;
+        int64_t startNs;
+        int64_t durationNs;
+        uint64_t bytes;
+    };
+
+    // Written by its thread only; readers see complete events up to head
+    struct TraceRing {
+        std::array<TraceEvent, Trace::RING_CAPACITY> events;
+        std::atomic<uint64_t> head{0};
+        uint32_t tid = 0;
+        std::string name;
+    };
+
+    struct TraceRegistry {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<TraceRing>> rings;
+        int64_t epochNs = 0;
+    };
+
+    // Leaked so rings outlive threads exiting during static destruction
+    TraceRegistry& registry() {
+        static auto* instance = new TraceRegistry();
+        return *instance;
+    }
+
+    thread_local TraceRing* localRing = nullptr;
+
+    TraceRing& threadRing() {
+        if (!localRing) {
+            auto& reg = registry();
+            auto ring = std::make_shared<TraceRing>();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            ring->tid = static_cast<uint32_t>(reg.rings.size());
+            ring->name = "thread " + std::to_string(ring->tid);
+            reg.rings.push_back(ring);
+            localRing = ring.get();
+        }
+        return *localRing;
+    }
+}
+
+void Trace::start() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& ring : reg.rings) {
+        ring->head.store(0, std::memory_order_relaxed);
+    }
+    reg.epochNs = now();
+    enabled_.store(true, std::memory_order_release);
+}
+
+void Trace::stop() {
+    enabled_.store(false, std::memory_order_release);
+}
+
+void Trace::nameThread(const std::string& name) {
+    if (!enabled()) {
+        return;
+    }
+    auto& ring = threadRing();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    ring.name = name;
+}
+
+void Trace::record(const char* name, int64_t startNs, int64_t endNs, uint64_t bytes) {
+    auto& ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % RING_CAPACITY] = {name, startNs, endNs - startNs, bytes};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::writeJson(std::ostream& out) {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"miniwr\"}}";
+
+    for (const auto& ring : reg.rings) {
+        out << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->tid
+            << ", \"args\": {\"name\": ";
+        writeJsonString(out, ring->name);
+        out << "}}";
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            const auto& event = ring->events[i % RING_CAPACITY];
+            if (event.startNs < reg.epochNs) {
+                continue;  // Span started before the trace
+            }
+
+            // Timestamps are in microseconds
+            out << ",\n  {\"name\": \"" << event.name << "\", \"cat\": \"miniwr\", \"ph\": \"X\""
+                << ", \"pid\": 1, \"tid\": " << ring->tid
+                << ", \"ts\": " << (event.startNs - reg.epochNs) / 1000.0
+                << ", \"dur\": " << event.durationNs / 1000.0;
+            if (event.bytes > 0) {
+                out << ", \"args\": {\"bytes\": " << event.bytes << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    out.precision(precision);
+    out.flags(flags);
+}
+
+uint64_t Trace::dropped() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    uint64_t count = 0;
+    for (const auto& ring : reg.rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        count += head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+    }
+    return count;
+}
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace miniwr {
+
+/**
+ * @brief Process-wide span recorder with Chrome Trace Event output
+ *
+ * Every thread appends to its own fixed-size ring, so recording takes no
+ * lock; once a ring is full the oldest spans are overwritten. While tracing
+ * is disabled a span costs one relaxed atomic load.
+ */
+class Trace {
+public:
+    static constexpr size_t RING_CAPACITY = 1 << 16;  ///< Spans kept per thread
+
+    /**
+     * @brief Start recording, discarding spans from earlier runs
+     */
+    static void start();
+
+    /**
+     * @brief Stop recording
+     */
+    static void stop();
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Name the calling thread in the trace (default: "thread N")
+     */
+    static void nameThread(const std::string& name);
+
+    /**
+     * @brief Append a completed span to the calling thread's ring
+     * @param name Span name (must outlive the trace, e.g. a literal)
+     * @param startNs Start time from now()
+     * @param endNs End time from now()
+     * @param bytes Bytes processed by the span (0 if not applicable)
+     */
+    static void record(const char* name, int64_t startNs, int64_t endNs, uint64_t bytes);
+
+    /**
+     * @brief Write all recorded spans as a Chrome Trace Event JSON object
+     *
+     * Call after the traced threads are idle; the output loads in
+     * chrome://tracing and Perfetto.
+     */
+    static void writeJson(std::ostream& out);
+
+    /**
+     * @brief Number of spans overwritten because a ring was full
+     */
+    static uint64_t dropped();
+
+    /**
+     * @brief Monotonic time in nanoseconds
+     */
+    static int64_t now();
+
+private:
+    static inline std::atomic<bool> enabled_{false};
+};
+
+/**
+ * @brief Records the enclosing scope as a trace span
+ */
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+        : name_(Trace::enabled() ? name : nullptr),
+          start_(name_ ? Trace::now() : 0) {}
+
+    ~TraceSpan() {
+        if (name_) {
+            Trace::record(name_, start_, Trace::now(), bytes_);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+private:
+    const char* name_;
+    int64_t start_;
+    uint64_t bytes_ = 0;
+};
+}
@@ -0,0 +1,1463 @@
+#include <gtest/gtest.h>
+#include "../src/cli/MiniWrApp.h"
+#include "../src/core/ArchiveReader.h"
+#include "../src/core/ArchiveWriter.h"
+#include "../src/core/Compaction.h"
+#include "../src/core/Dictionary.h"
+#include "../src/core/Merge.h"
+#include "../src/core/Recompress.h"
+#include "../src/util/FileSystem.h"
+#include "../src/util/IoEngine.h"
+#include "../src/util/MemoryBudget.h"
+#include "../src/util/ProgressBar.h"
+#include "../src/util/Stats.h"
+#include "../src/util/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <vector>
+#include <zlib.h>
+
+namespace miniwr {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class ArchiveTest : public ::testing::Test {
+protected:
+    fs::path workDir;
+    fs::path previousDir;
+
+    // Entry names are the paths given to the writer, so the tests work
+    // with relative paths inside a scratch directory
+    void SetUp() override {
+        previousDir = fs::current_path();
+        workDir = fs::temp_directory_path() /
+            ("miniwr_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(workDir);
+        fs::create_directories(workDir);
+        fs::current_path(workDir);
+    }
+
+    void TearDown() override {
+        fs::current_path(previousDir);
+        fs::remove_all(workDir);
+    }
+
+    static void writeFile(const fs::path& path, const std::string& content) {
+        fs::create_directories(path.parent_path());
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    static std::string readFile(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    }
+};
+
+TEST_F(ArchiveTest, SolidRoundTrip) {
+    std::vector<std::pair<std::string, std::string>> files = {
+        {"src/a.cpp", "int main() { return 0; }\n"},
+        {"src/b.cpp", "int helper() { return 1; }\n"},
+        {"src/a.h", "#pragma once\nint helper();\n"},
+        {"docs/readme.txt", std::string(5000, 'x')},
+        {"docs/empty.txt", ""},
+    };
+    for (const auto& [name, content] : files) {
+        writeFile(name, content);
+    }
+
+    {
+        ArchiveWriter writer("solid.zip");
+        writer.setSolidMode(64, 2);  // Tiny blocks to force several of them
+        for (const auto& [name, content] : files) {
+            writer.addFile(name);
+        }
+        writer.close();
+    }
+
+    ArchiveReader reader("solid.zip");
+    auto listed = reader.listFiles();
+    ASSERT_EQ(listed.size(), files.size()) << "Internal solid entries should be hidden";
+
+    reader.extractAll("out", true);
+    for (const auto& [name, content] : files) {
+        ASSERT_EQ(readFile(fs::path("out") / name), content) << name;
+    }
+
+    // Single-file extraction only needs the member's own block
+    reader.extract("src/b.cpp", "single", true);
+    ASSERT_EQ(readFile("single/src/b.cpp"), files[1].second);
+}
+
+TEST_F(ArchiveTest, SolidBlocksKeepEachFileLevel) {
+    writeFile("data/stored.txt", std::string(20000, 's'));
+    writeFile("data/packed.txt", std::string(20000, 'p'));
+    {
+        ArchiveWriter writer("levels.zip");
+        writer.setSolidMode(1024 * 1024);
+        writer.addFile("data/stored.txt", CompressionLevel::Store);
+        writer.addFile("data/packed.txt", CompressionLevel::Maximum);
+        writer.close();
+    }
+
+    // One block per level, each compressed with its own
+    ArchiveReader reader("levels.zip");
+    auto blockOf = [&](const std::string& name) {
+        return reader.solidBlock(reader.solidMember(*reader.findEntry(name))->block);
+    };
+    ASSERT_NE(blockOf("data/stored.txt").filename, blockOf("data/packed.txt").filename);
+    ASSERT_GE(blockOf("data/stored.txt").compressedSize, 20000u);
+    ASSERT_LT(blockOf("data/packed.txt").compressedSize, 1000u);
+
+    reader.extractAll("out");
+    ASSERT_EQ(readFile("out/data/stored.txt"), std::string(20000, 's'));
+    ASSERT_EQ(readFile("out/data/packed.txt"), std::string(20000, 'p'));
+}
+
+TEST_F(ArchiveTest, SolidIndexSerialization) {
+    SolidIndex index;
+    index.blockCount = 2;
+    for (uint32_t i = 0; i < 3; ++i) {
+        SolidMember member;
+        member.block = i / 2;
+        member.entry.filename = "file" + std::to_string(i);
+        member.entry.uncompressedSize = 100 + i;
+        member.entry.crc32 = 0xDEADBEEF + i;
+        member.entry.externalAttrs = 0644u << 16;
+        index.members.push_back(member);
+    }
+
+    auto parsed = SolidIndex::parse(index.serialize());
+    ASSERT_EQ(parsed.blockCount, 2u);
+    ASSERT_EQ(parsed.members.size(), 3u);
+    EXPECT_EQ(parsed.members[1].offset, 100u) << "Offsets follow member sizes";
+    EXPECT_EQ(parsed.members[2].offset, 0u) << "Offsets restart in each block";
+    EXPECT_EQ(parsed.members[2].entry.crc32, 0xDEADBEEF + 2);
+    EXPECT_EQ(parsed.members[0].entry.externalAttrs, 0644u << 16);
+
+    EXPECT_EQ(SolidIndex::blockIndex(SolidIndex::blockName(7)), 7u);
+    for (const char* name : {".miniwr/solid/", ".miniwr/solid/12x", ".miniwr/solid/-1",
+                             ".miniwr/solid/+1", ".miniwr/solid/ 1", ".miniwr/solid/99999999999"}) {
+        EXPECT_FALSE(SolidIndex::blockIndex(name)) << name;
+    }
+}
+
+TEST_F(ArchiveTest, InternalNamesAreReserved) {
+    writeFile(".miniwr/solid/notes.txt", "user data");
+    std::string content = "data";
+    std::span<const uint8_t> data(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+
+    ArchiveWriter writer("reserved.zip");
+    EXPECT_THROW(writer.addFile(".miniwr/solid/notes.txt"), std::runtime_error);
+    EXPECT_THROW(writer.addEntry(".miniwr/solid.idx", data), std::runtime_error);
+    EXPECT_THROW(writer.addEntry(".miniwr/x", [](std::span<uint8_t>) { return size_t{0}; }),
+                 std::runtime_error);
+    writer.addEntry("miniwr/solid/000000", data);
+
+    writer.setSolidMode(64, 1);
+    writeFile("in/small.txt", "small");
+    writer.addFile("in/small.txt");
+
+    // Other tools may have written names that only look like blocks
+    ZipEntry stray;
+    stray.filename = ".miniwr/solid/abc";
+    stray.compressionMethod = 0;
+    stray.uncompressedSize = static_cast<uint32_t>(content.size());
+    stray.crc32 = static_cast<uint32_t>(crc32(0, data.data(), static_cast<uInt>(data.size())));
+    writer.addCompressedEntry(stray, data);
+    writer.close();
+
+    ArchiveReader reader("reserved.zip");
+    ASSERT_EQ(reader.listFiles(),
+              (std::vector<std::string>{"miniwr/solid/000000", ".miniwr/solid/abc", "in/small.txt"}));
+    reader.extractAll("out", true);
+    ASSERT_EQ(readFile("out/in/small.txt"), "small");
+}
+
+TEST_F(ArchiveTest, DictionaryRoundTrip) {
+    std::vector<fs::path> paths;
+    for (int i = 0; i < 50; ++i) {
+        std::string name = "docs/doc" + std::to_string(i) + ".json";
+        writeFile(name, "{\"id\": " + std::to_string(i) +
+                        ", \"kind\": \"document\", \"tags\": [\"alpha\", \"beta\"]}");
+        paths.push_back(name);
+    }
+
+    auto dictionary = trainDictionary(paths, 1024);
+    ASSERT_FALSE(dictionary.empty());
+    ASSERT_LE(dictionary.size(), 1024u);
+
+    {
+        ArchiveWriter writer("dict.zip");
+        writer.setDictionary(dictionary);
+        for (const auto& path : paths) {
+            writer.addFile(path);
+        }
+        writer.close();
+    }
+
+    ArchiveReader reader("dict.zip");
+    ASSERT_EQ(reader.listFiles().size(), paths.size()) << "Dictionary entry should be hidden";
+
+    reader.extractAll("out", true);
+    for (const auto& path : paths) {
+        ASSERT_EQ(readFile("out" / path), readFile(path)) << path;
+    }
+}
+
+TEST_F(ArchiveTest, DictionaryTrainingStaysWithinBudget) {
+    std::vector<fs::path> paths;
+    uint32_t state = 5;
+    for (int i = 0; i < 100; ++i) {
+        std::string text;
+        while (text.size() < 120000) {
+            state = state * 1103515245 + 12345;
+            text += "{\"id\": " + std::to_string(state >> 16) + ", \"kind\": \"record\"}\n";
+        }
+        std::string name = "docs/doc" + std::to_string(i) + ".json";
+        writeFile(name, text);
+        paths.push_back(name);
+    }
+
+    // Every training buffer is pooled and covered by the reservation
+    auto& pool = BufferPool::instance();
+    pool.trim();
+    pool.resetPeak();
+    size_t baseline = pool.stats().peakBytes;
+    auto budget = std::make_shared<MemoryBudget>(4 * 1024 * 1024);
+    auto dictionary = trainDictionary(paths, 1024, budget);
+
+    ASSERT_FALSE(dictionary.empty());
+    ASSERT_EQ(budget->inUse(), 0u);
+    ASSERT_LE(budget->peak(), budget->limit() / 2);
+    ASSERT_LE(pool.stats().peakBytes - baseline, budget->peak());
+}
+
+TEST_F(ArchiveTest, DeltaAgainstBaseArchive) {
+    std::string version1(100000, 'a');
+    for (size_t i = 0; i < version1.size(); i += 97) {
+        version1[i] = static_cast<char>('a' + (i / 97) % 26);
+    }
+    std::string version2 = version1;
+    version2.replace(50000, 5, "EDIT!");
+
+    writeFile("data/big.bin", version1);
+    writeFile("data/small.txt", "unchanged");
+    {
+        ArchiveWriter writer("base.zip");
+        writer.addFile("data/big.bin");
+        writer.addFile("data/small.txt");
+        writer.close();
+    }
+
+    writeFile("data/big.bin", version2);
+    writeFile("data/new.txt", "only in the delta archive");
+    {
+        ArchiveWriter writer("delta.zip");
+        writer.setDeltaBase(std::make_shared<ArchiveReader>("base.zip"));
+        writer.addFile("data/big.bin");
+        writer.addFile("data/small.txt");
+        writer.addFile("data/new.txt");
+        writer.close();
+    }
+    ASSERT_LT(fs::file_size("delta.zip"), fs::file_size("base.zip"));
+
+    ArchiveReader withoutBase("delta.zip");
+    ASSERT_THROW(withoutBase.extractAll("missing", true), std::runtime_error);
+
+    ArchiveReader reader("delta.zip");
+    reader.setDeltaBase(std::make_shared<ArchiveReader>("base.zip"));
+    reader.extractAll("out", true);
+    ASSERT_EQ(readFile("out/data/big.bin"), version2);
+    ASSERT_EQ(readFile("out/data/small.txt"), "unchanged");
+    ASSERT_EQ(readFile("out/data/new.txt"), "only in the delta archive");
+}
+
+TEST_F(ArchiveTest, StreamingUnderMemoryLimit) {
+    constexpr size_t LIMIT = 4 * 1024 * 1024;
+    std::string large;
+    for (size_t i = 0; large.size() < 3 * LIMIT; ++i) {
+        large += "line " + std::to_string(i * 7919 % 100003) + "\n";
+    }
+    writeFile("data/large.txt", large);
+    writeFile("data/small.txt", "small");
+
+    // As with --memory-limit: the budget admits work, the pool caps what
+    // is actually allocated, idle buffers included
+    auto& pool = BufferPool::instance();
+    pool.trim();
+    pool.setMemoryLimit(pool.stats().liveBytes + LIMIT);
+    pool.resetPeak();
+    size_t baseline = pool.stats().liveBytes;
+
+    auto budget = std::make_shared<MemoryBudget>(LIMIT);
+    {
+        ArchiveWriter writer("limited.zip");
+        writer.setMemoryBudget(budget);
+        writer.addFile("data/large.txt");
+        writer.addFile("data/small.txt");
+        writer.close();
+    }
+    size_t reservedAfterWrite = budget->inUse();
+
+    ArchiveReader reader("limited.zip");
+    reader.setMemoryBudget(budget);
+    reader.extractAll("out", true);
+    auto stats = pool.stats();
+    pool.setMemoryLimit(0);
+
+    ASSERT_EQ(reservedAfterWrite, 0u);
+    ASSERT_EQ(readFile("out/data/large.txt"), large);
+    ASSERT_EQ(readFile("out/data/small.txt"), "small");
+    ASSERT_LE(stats.peakBytes - baseline, LIMIT);
+}
+
+TEST_F(ArchiveTest, SteadyStateReusesBuffers) {
+    for (int i = 0; i < 8; ++i) {
+        writeFile("data/file" + std::to_string(i) + ".txt",
+                  std::string(200000 + i * 1000, static_cast<char>('a' + i)));
+    }
+
+    auto roundTrip = [&](const std::string& name) {
+        {
+            ArchiveWriter writer(name);
+            writer.addDirectory("data");
+            writer.close();
+        }
+        ArchiveReader reader(name);
+        reader.extractAll("out_" + name, true);
+    };
+
+    // The first pass fills the pool; later ones only recycle
+    roundTrip("first.zip");
+    auto before = BufferPool::instance().stats();
+    roundTrip("second.zip");
+    ASSERT_EQ(BufferPool::instance().stats().allocations, before.allocations);
+    ASSERT_EQ(readFile("out_second.zip/data/file7.txt"), readFile("data/file7.txt"));
+}
+
+TEST_F(ArchiveTest, StatsAccountPhasesAndEntries) {
+    writeFile("data/text.txt", std::string(100000, 'a'));
+    writeFile("data/small.txt", "hello");
+
+    auto writeStats = std::make_shared<Stats>();
+    {
+        ArchiveWriter writer("stats.zip");
+        writer.setStats(writeStats);
+        writer.addDirectory("data");
+        writer.close();
+    }
+    auto extractStats = std::make_shared<Stats>();
+    ArchiveReader reader("stats.zip");
+    reader.setStats(extractStats);
+    reader.extractAll("out", true);
+
+    ASSERT_EQ(writeStats->phase(Phase::Read).count, 2u);
+    ASSERT_EQ(writeStats->phase(Phase::Compress).bytesIn, 100005u);
+    ASSERT_LT(writeStats->phase(Phase::Compress).bytesOut, 100005u);
+    // "hello" does not shrink, so it is stored and never inflated
+    ASSERT_EQ(extractStats->phase(Phase::Inflate).bytesOut, 100000u);
+    ASSERT_EQ(extractStats->phase(Phase::Write).bytesIn, 100005u);
+    ASSERT_EQ(extractStats->phase(Phase::Compress).count, 0u);
+
+    std::ostringstream json;
+    extractStats->writeJson(json);
+    ASSERT_NE(json.str().find("\"entries\": 2"), std::string::npos);
+    ASSERT_NE(json.str().find("data/text.txt"), std::string::npos);
+}
+
+TEST_F(ArchiveTest, TraceRecordsSpansPerThread) {
+    for (int i = 0; i < 4; ++i) {
+        writeFile("data/file" + std::to_string(i) + ".txt", std::string(50000, 'a' + i));
+    }
+
+    Trace::start();
+    {
+        ArchiveWriter writer("trace.zip");
+        writer.setSolidMode(60000, 2);
+        writer.addDirectory("data");
+        writer.close();
+    }
+    Trace::stop();
+
+    std::ostringstream json;
+    Trace::writeJson(json);
+    ASSERT_NE(json.str().find("\"traceEvents\""), std::string::npos);
+    ASSERT_NE(json.str().find("\"worker "), std::string::npos);
+    ASSERT_NE(json.str().find("\"name\": \"compress\""), std::string::npos);
+    ASSERT_NE(json.str().find("\"name\": \"wait-block\""), std::string::npos);
+
+    // Nothing is recorded once stopped
+    { TraceSpan span("after-stop"); }
+    std::ostringstream after;
+    Trace::writeJson(after);
+    ASSERT_EQ(after.str().find("after-stop"), std::string::npos);
+}
+
+TEST_F(ArchiveTest, ProgressCountsBytesAndFiles) {
+    writeFile("data/a.txt", std::string(3000, 'a'));
+    writeFile("data/b.txt", std::string(5000, 'b'));
+    writeFile("data/large.txt", std::string(2000000, 'c'));
+
+    auto addProgress = std::make_shared<ProgressBar>("Compressing", 2008000, 3, ProgressMode::None);
+    {
+        ArchiveWriter writer("progress.zip");
+        writer.setSolidMode(1024 * 1024);
+        writer.setMemoryBudget(std::make_shared<MemoryBudget>(4 * 1024 * 1024));
+        writer.setProgress(addProgress);
+        writer.addDirectory("data");
+        writer.close();
+    }
+    ASSERT_EQ(addProgress->bytes(), 2008000u);
+    ASSERT_EQ(addProgress->files(), 3u);
+
+    ArchiveReader reader("progress.zip");
+    ASSERT_EQ(reader.totalSize(), 2008000u);
+    auto extractProgress = std::make_shared<ProgressBar>("Extracting", reader.totalSize(), 3,
+                                                         ProgressMode::None);
+    reader.setProgress(extractProgress);
+    reader.extractAll("out", true);
+    ASSERT_EQ(extractProgress->bytes(), 2008000u);
+    ASSERT_EQ(extractProgress->files(), 3u);
+}
+
+TEST_F(ArchiveTest, SolidBlocksFitTheMemoryLimit) {
+    // Blocks are sized so that their rounded-up buffers fit the budget
+    uint32_t state = 99;
+    for (int i = 0; i < 60; ++i) {
+        std::string text;
+        while (text.size() < 100000 + static_cast<size_t>(i) * 1999) {
+            state = state * 1103515245 + 12345;
+            text += "word" + std::to_string(state >> 22) + " ";
+        }
+        writeFile("data/f" + std::to_string(i) + ".txt", text);
+    }
+
+    auto budget = std::make_shared<MemoryBudget>(8 * 1024 * 1024);
+    {
+        ArchiveWriter writer("solid.zip");
+        writer.setSolidMode(8 * 1024 * 1024, 2);
+        writer.setMemoryBudget(budget);
+        writer.addDirectory("data");
+        writer.close();
+    }
+    ArchiveReader reader("solid.zip");
+    reader.setMemoryBudget(budget);
+    reader.extractAll("out");
+    for (const auto& entry : fs::directory_iterator("data")) {
+        ASSERT_EQ(readFile("out" / entry.path()), readFile(entry.path())) << entry.path();
+    }
+}
+
+TEST_F(ArchiveTest, ProgressStaysQuietWhilePaused) {
+    ProgressBar progress("Extracting", 100, 1, ProgressMode::Json);
+    progress.pause();
+    testing::internal::CaptureStderr();
+    std::this_thread::sleep_for(3 * ProgressBar::RENDER_INTERVAL);
+    std::string whilePaused = testing::internal::GetCapturedStderr();
+    progress.resume();
+    progress.finish();
+    ASSERT_TRUE(whilePaused.empty()) << whilePaused;
+}
+
+TEST_F(ArchiveTest, InMemoryRoundTrip) {
+    std::string small(1000, 'x');
+    std::string large(300000, 'y');
+    auto asBytes = [](const std::string& text) {
+        return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    };
+    auto streamOf = [](const std::string& text) {
+        size_t offset = 0;
+        return [&text, offset](std::span<uint8_t> buffer) mutable {
+            size_t count = std::min(buffer.size(), text.size() - offset);
+            std::copy_n(text.data() + offset, count, buffer.data());
+            offset += count;
+            return count;
+        };
+    };
+    auto contentOf = [](const Buffer& data) {
+        return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+    };
+
+    // Seekable memory sink: streamed entries get their header rewritten
+    Buffer archive;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(archive));
+        writer.addEntry("small.txt", asBytes(small));
+        writer.addEntry("large.txt", streamOf(large));
+        writer.close();
+    }
+    {
+        ArchiveReader reader(ArchiveSource::memory(archive.span()));
+        ASSERT_EQ(reader.listFiles().size(), 2u);
+        ASSERT_EQ(contentOf(reader.read("small.txt")), small);
+        ASSERT_EQ(contentOf(reader.read("large.txt")), large);
+    }
+
+    // Non-seekable sink: streamed entries are finished by a data descriptor
+    Buffer streamed;
+    {
+        ArchiveWriter writer(ArchiveSink::callback([&](std::span<const uint8_t> chunk) {
+            streamed.append(chunk);
+        }));
+        writer.addEntry("large.txt", streamOf(large));
+        writer.close();
+    }
+    ArchiveReader reader(ArchiveSource::callback(streamed.size(),
+        [&](uint64_t offset, std::span<uint8_t> buffer) {
+            std::copy_n(streamed.data() + offset, buffer.size(), buffer.data());
+        }));
+    ASSERT_NE(reader.findEntry("large.txt"), nullptr);
+    ASSERT_EQ(reader.findEntry("large.txt")->flags & 0x0008, 0x0008);
+    ASSERT_EQ(contentOf(reader.read("large.txt")), large);
+}
+
+TEST_F(ArchiveTest, OpenStreamsEntriesWithoutExtracting) {
+    writeFile("data/small.txt", "small file");
+    writeFile("data/empty.txt", "");
+    writeFile("data/large.txt", std::string(3000000, 'l'));
+    writeFile("solid/a.txt", std::string(1000, 'a'));
+    writeFile("solid/b.txt", std::string(2000, 'b'));
+
+    {
+        ArchiveWriter writer("stream.zip");
+        writer.addDirectory("data");
+        writer.setSolidMode(1024 * 1024);
+        writer.addDirectory("solid");
+        writer.close();
+    }
+
+    ArchiveReader reader("stream.zip");
+    size_t count = 0;
+    for (const auto& entry : reader.entries()) {
+        auto stream = reader.open(entry);
+        ASSERT_EQ(stream.entry().filename, entry.filename);
+
+        // Small reads, so large entries take many decoder calls
+        std::string content;
+        uint8_t chunk[1000];
+        while (size_t n = stream.read(chunk)) {
+            content.append(reinterpret_cast<const char*>(chunk), n);
+        }
+        ASSERT_EQ(content, readFile(entry.filename)) << entry.filename;
+        ++count;
+    }
+    ASSERT_EQ(count, 5u);
+}
+
+TEST_F(ArchiveTest, CompletionOrderWritesEntriesAsTheyFinish) {
+    // One large file ahead of many small ones
+    std::vector<std::pair<std::string, std::string>> files;
+    std::string large;
+    for (int i = 0; i < 200000; ++i) {
+        large += std::to_string(i * 7919 % 100003) + ' ';
+    }
+    files.emplace_back("data/0-large.txt", large);
+    for (int i = 0; i < 40; ++i) {
+        files.emplace_back("data/small-" + std::to_string(39 - i) + ".txt",
+                           std::string(100 + i * 50, static_cast<char>('a' + i % 26)));
+    }
+    for (const auto& [name, content] : files) {
+        writeFile(name, content);
+    }
+
+    for (size_t solidBlock : {size_t{0}, size_t{1024}}) {
+        std::string archive = "ooo-" + std::to_string(solidBlock) + ".zip";
+        {
+            ArchiveWriter writer(archive);
+            writer.setCommitOrder(CommitOrder::Completion, 4);
+            writer.setSolidMode(solidBlock, 4);
+            for (const auto& [name, content] : files) {
+                writer.addFile(name);
+            }
+            writer.close();
+        }
+
+        ArchiveReader reader(archive);
+        auto listed = reader.listFiles();
+        ASSERT_EQ(listed.size(), files.size()) << archive;
+        if (solidBlock == 0) {
+            // Solid members follow the plain entries in block order
+            ASSERT_TRUE(std::is_sorted(listed.begin(), listed.end())) << "Listing should be by name";
+        }
+        ASSERT_TRUE(reader.test(2).ok()) << archive;
+
+        fs::path out = "out-" + std::to_string(solidBlock);
+        reader.extractAll(out, true);
+        for (const auto& [name, content] : files) {
+            ASSERT_EQ(readFile(out / name), content) << archive << ": " << name;
+        }
+    }
+
+    // Files streamed under the memory limit: the compressible log is kept
+    // in memory and gets a range of its exact size, so the small files
+    // commit alongside it; the other one outgrows that and is written in place
+    std::string huge;
+    while (huge.size() < 5 * 1024 * 1024) {
+        huge += large;
+    }
+    writeFile("data/huge.txt", huge);
+    std::string log;
+    for (int i = 0; log.size() < 6 * 1024 * 1024; ++i) {
+        log += "request " + std::to_string(i % 1000) + " served in 3 ms\n";
+    }
+    writeFile("data/log.txt", log);
+    {
+        ArchiveWriter writer("ooo-streamed.zip");
+        writer.setCommitOrder(CommitOrder::Completion, 4);
+        writer.setMemoryBudget(std::make_shared<MemoryBudget>(4 * 1024 * 1024));
+        writer.addFile("data/log.txt");
+        writer.addFile("data/huge.txt");
+        for (const auto& [name, content] : files) {
+            writer.addFile(name);
+        }
+        writer.close();
+    }
+    {
+        ArchiveReader reader("ooo-streamed.zip");
+        ASSERT_TRUE(reader.test(2).ok());
+        auto data = reader.read("data/huge.txt");
+        ASSERT_EQ(std::string(data.begin(), data.end()), huge);
+        data = reader.read("data/log.txt");
+        ASSERT_EQ(std::string(data.begin(), data.end()), log);
+
+        // No gaps: only headers and the central directory come on top
+        uint64_t compressed = 0;
+        size_t count = 0;
+        for (const auto& entry : reader.entries()) {
+            compressed += entry.compressedSize;
+            ++count;
+        }
+        ASSERT_LE(fs::file_size("ooo-streamed.zip"), compressed + count * 256);
+        reader.extractAll("out-streamed", true);
+        for (const auto& [name, content] : files) {
+            ASSERT_EQ(readFile(fs::path("out-streamed") / name), content) << name;
+        }
+    }
+
+    // Sinks without positional writes commit under the lock instead
+    Buffer memory;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(memory));
+        writer.setCommitOrder(CommitOrder::Completion, 4);
+        for (const auto& [name, content] : files) {
+            writer.addFile(name);
+        }
+        writer.close();
+    }
+    ArchiveReader reader(ArchiveSource::memory(memory.span()));
+    ASSERT_TRUE(reader.test(1).ok());
+    ASSERT_EQ(reader.read("data/0-large.txt").size(), large.size());
+}
+
+TEST_F(ArchiveTest, ThreadsKeepInputOrderAndExtractSideBySide) {
+    std::vector<std::pair<std::string, std::string>> files;
+    for (int i = 0; i < 30; ++i) {
+        std::string content;
+        for (int j = 0; j < 2000 * (i % 7 + 1); ++j) {
+            content += std::to_string(j * (i + 3) % 9973) + ' ';
+        }
+        files.emplace_back("data/f" + std::to_string(i) + ".txt", content);
+    }
+    for (int i = 0; i < 10; ++i) {
+        files.emplace_back("data/small-" + std::to_string(i) + ".txt",
+                           std::string(500 + i, static_cast<char>('a' + i)));
+    }
+    for (const auto& [name, content] : files) {
+        writeFile(name, content);
+    }
+
+    for (size_t solidBlock : {size_t{0}, size_t{16 * 1024}}) {
+        std::string archive = "threads-" + std::to_string(solidBlock) + ".zip";
+        {
+            ArchiveWriter writer(archive);
+            writer.setCommitOrder(CommitOrder::Input, 4);
+            writer.setSolidMode(solidBlock, 4);
+            for (const auto& [name, content] : files) {
+                writer.addFile(name);
+            }
+            writer.addEntry("memory.txt", std::span<const uint8_t>(
+                reinterpret_cast<const uint8_t*>("written last"), 12));
+            writer.close();
+        }
+
+        // Files compressed on tasks are still written in input order
+        ArchiveReader reader(archive);
+        if (solidBlock == 0) {
+            std::vector<std::string> expected;
+            for (const auto& [name, content] : files) {
+                expected.push_back(name);
+            }
+            expected.push_back("memory.txt");
+            ASSERT_EQ(reader.listFiles(), expected);
+            uint64_t previous = 0;
+            for (const auto& entry : reader.entries()) {
+                ASSERT_GE(entry.headerOffset, previous) << entry.filename;
+                previous = entry.headerOffset;
+            }
+        }
+
+        fs::path out = "out-" + archive;
+        reader.setThreads(4);
+        reader.extractAll(out, true);
+        for (const auto& [name, content] : files) {
+            ASSERT_EQ(readFile(out / name), content) << archive << ": " << name;
+        }
+        ASSERT_EQ(readFile(out / "memory.txt"), "written last");
+
+        // Update mode never asks either; nothing has changed since
+        ArchiveReader update(archive);
+        update.setThreads(4);
+        update.setExtractMode(ExtractMode::Update);
+        update.extractAll(out);
+        ASSERT_EQ(update.skippedFiles(), files.size() + 1) << archive;
+    }
+}
+
+TEST_F(ArchiveTest, TestVerifiesWithoutExtracting) {
+    writeFile("data/a.txt", std::string(100000, 'a'));
+    writeFile("data/b.txt", std::string(200000, 'b'));
+    writeFile("solid/c.txt", std::string(3000, 'c'));
+    writeFile("solid/d.txt", std::string(4000, 'd'));
+    {
+        ArchiveWriter writer("test.zip");
+        writer.addDirectory("data");
+        writer.setSolidMode(1024 * 1024);
+        writer.addDirectory("solid");
+        writer.close();
+    }
+
+    {
+        ArchiveReader reader("test.zip");
+        auto report = reader.test(4);
+        ASSERT_TRUE(report.ok());
+        ASSERT_EQ(report.entries, 4u);
+        ASSERT_EQ(report.bytes, 307000u);
+    }
+    {
+        // Under a memory limit, with a solid block cached beforehand
+        ArchiveReader reader("test.zip");
+        reader.setMemoryBudget(std::make_shared<MemoryBudget>(4 * 1024 * 1024));
+        ASSERT_EQ(reader.read("solid/c.txt").size(), 3000u);
+        ASSERT_TRUE(reader.test(4).ok());
+    }
+    ASSERT_FALSE(fs::exists("out"));
+
+    // Flip a byte inside the compressed data of the first entry
+    std::string archive = readFile("test.zip");
+    archive[100] ^= 0x55;
+    std::ofstream("test.zip", std::ios::binary) << archive;
+
+    ArchiveReader reader("test.zip");
+    auto report = reader.test(2);
+    ASSERT_FALSE(report.ok());
+    ASSERT_EQ(report.errors.size(), 1u);
+}
+
+TEST_F(ArchiveTest, ListingReadsOnlyCentralDirectory) {
+    Buffer archive;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(archive));
+        std::string content(100000, 'x');
+        writer.setDictionary(std::vector<uint8_t>(content.begin(), content.begin() + 1024));
+        for (int i = 0; i < 10; ++i) {
+            writer.addEntry("file" + std::to_string(i) + ".txt",
+                std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(content.data()), content.size()));
+        }
+        writer.close();
+    }
+
+    // The central directory offset is the last field but one of the end record
+    uint64_t centralDirOffset = 0;
+    std::memcpy(&centralDirOffset, archive.data() + archive.size() - 6, 4);
+
+    uint64_t lowestRead = archive.size();
+    ArchiveReader reader(ArchiveSource::callback(archive.size(),
+        [&](uint64_t offset, std::span<uint8_t> buffer) {
+            lowestRead = std::min(lowestRead, offset);
+            std::copy_n(archive.data() + offset, buffer.size(), buffer.data());
+        }));
+
+    size_t count = 0;
+    for (const auto& entry : reader.entries()) {
+        ASSERT_EQ(entry.uncompressedSize, 100000u);
+        ASSERT_LT(entry.compressedSize, 1000u);
+        ASSERT_EQ(reader.storage(entry), EntryStorage::Deflated);
+        ++count;
+    }
+    ASSERT_EQ(count, 10u);
+    ASSERT_GE(lowestRead, centralDirOffset) << "Listing should not read the dictionary";
+
+    // The dictionary is read on first decompression
+    Buffer data = reader.read("file3.txt");
+    ASSERT_EQ(std::string(data.begin(), data.end()), std::string(100000, 'x'));
+    ASSERT_EQ(reader.dictionary().size(), 1024u);
+}
+
+TEST_F(ArchiveTest, JsonListingEscapesControlCharacters) {
+    std::string content = "content";
+    {
+        ArchiveWriter writer("names.zip");
+        writer.addEntry("tab\there/new\nline\x01.txt",
+                        {reinterpret_cast<const uint8_t*>(content.data()), content.size()});
+        writer.close();
+    }
+
+    std::vector<std::string> arguments = {"miniwr", "l", "names.zip", "--json"};
+    std::vector<char*> argv;
+    for (auto& argument : arguments) {
+        argv.push_back(argument.data());
+    }
+    testing::internal::CaptureStdout();
+    int result = MiniWrApp::run(static_cast<int>(argv.size()), argv.data());
+    std::string listing = testing::internal::GetCapturedStdout();
+
+    ASSERT_EQ(result, 0);
+    ASSERT_NE(listing.find("{\"name\": \"tab\\there/new\\nline\\u0001.txt\""), std::string::npos)
+        << listing;
+}
+
+TEST_F(ArchiveTest, UpdateAndFreshenSkipUnchangedFiles) {
+    writeFile("data/same.txt", std::string(5000, 's'));
+    writeFile("data/touched.txt", std::string(6000, 't'));
+    writeFile("data/changed.txt", std::string(7000, 'c'));
+    writeFile("data/removed.txt", std::string(8000, 'r'));
+    {
+        ArchiveWriter writer("update.zip");
+        writer.addDirectory("data");
+        writer.close();
+    }
+    {
+        ArchiveReader reader("update.zip");
+        reader.extractAll("out", true);
+    }
+
+    // Same size, other time: the CRC decides. Same size and time: skipped
+    fs::last_write_time("out/data/touched.txt", fs::file_time_type::clock::now() + std::chrono::hours(1));
+    writeFile("out/data/changed.txt", std::string(7000, 'x'));
+    fs::last_write_time("out/data/changed.txt", fs::file_time_type::clock::now() + std::chrono::hours(2));
+    fs::remove("out/data/removed.txt");
+
+    {
+        ArchiveReader reader("update.zip");
+        reader.setExtractMode(ExtractMode::Freshen);
+        reader.extractAll("out");
+        ASSERT_EQ(reader.skippedFiles(), 3u);
+        ASSERT_FALSE(fs::exists("out/data/removed.txt"));
+        ASSERT_EQ(readFile("out/data/changed.txt"), std::string(7000, 'c'));
+    }
+    {
+        ArchiveReader reader("update.zip");
+        reader.setExtractMode(ExtractMode::Update);
+        reader.extractAll("out");
+        ASSERT_EQ(reader.skippedFiles(), 3u);
+        ASSERT_EQ(readFile("out/data/removed.txt"), std::string(8000, 'r'));
+    }
+}
+
+TEST_F(ArchiveTest, StoredEntriesAreCopiedVerbatim) {
+    std::string text(300000, 'a');
+    std::string noise;
+    uint32_t state = 12345;
+    for (int i = 0; i < 100000; ++i) {
+        state = state * 1103515245 + 12345;
+        noise += static_cast<char>(state >> 24);
+    }
+    writeFile("data/text.txt", text);
+    writeFile("data/noise.bin", noise);
+    {
+        ArchiveWriter writer("stored.zip");
+        writer.addFile("data/text.txt", CompressionLevel::Store);
+        writer.addFile("data/noise.bin");
+        writer.close();
+    }
+
+    // Incompressible data is stored even when compression was asked for
+    ArchiveReader reader("stored.zip");
+    for (const auto& entry : reader.entries()) {
+        ASSERT_EQ(entry.compressionMethod, 0u);
+        ASSERT_EQ(entry.compressedSize, entry.uncompressedSize);
+        ASSERT_EQ(reader.storage(entry), EntryStorage::Stored);
+    }
+    reader.extractAll("out");
+    ASSERT_EQ(readFile("out/data/text.txt"), text);
+    ASSERT_EQ(readFile("out/data/noise.bin"), noise);
+    ASSERT_TRUE(reader.test(2).ok());
+
+    auto stream = reader.open(*reader.findEntry("data/noise.bin"));
+    std::string streamed(noise.size(), '\0');
+    size_t total = 0;
+    while (size_t count = stream.read(std::span<uint8_t>(
+               reinterpret_cast<uint8_t*>(streamed.data()) + total, streamed.size() - total))) {
+        total += count;
+    }
+    ASSERT_EQ(streamed, noise);
+}
+
+TEST_F(ArchiveTest, IoEnginesBatchSmallFiles) {
+    for (int i = 0; i < 150; ++i) {
+        writeFile("data/f" + std::to_string(i) + ".txt", std::string(100 + i, 'a' + i % 26));
+    }
+    writeFile("data/empty.txt", "");
+    writeFile("data/large.txt", std::string(IoEngine::SLOT_SIZE + 1000, 'L'));
+    fs::permissions("data/f7.txt", fs::perms::owner_read | fs::perms::owner_write | fs::perms::owner_exec);
+    auto modified = fs::last_write_time("data/f9.txt") - std::chrono::hours(48);
+    fs::last_write_time("data/f9.txt", modified);
+
+    for (auto backend : {IoBackend::Uring, IoBackend::Threads}) {
+        std::shared_ptr<IoEngine> engine = IoEngine::create(backend, 4);
+        std::string name = engine->name();
+        {
+            ArchiveWriter writer(name + ".zip");
+            writer.setIoEngine(engine);
+            writer.addDirectory("data");
+            writer.close();
+        }
+        ArchiveReader reader(name + ".zip");
+        ASSERT_EQ(reader.listFiles().size(), 152u);
+        reader.setIoEngine(engine);
+        fs::path out = "out_" + name;
+        reader.extractAll(out);
+
+        for (const auto& entry : fs::directory_iterator("data")) {
+            auto copy = out / entry.path();
+            ASSERT_EQ(readFile(copy), readFile(entry.path())) << copy;
+        }
+        auto copy = out / "data/f7.txt";
+        ASSERT_EQ(fs::status(copy).permissions(),
+                  fs::perms::owner_read | fs::perms::owner_write | fs::perms::owner_exec);
+        auto restored = fs::last_write_time(out / "data/f9.txt");
+        ASSERT_LT(std::chrono::abs(restored - modified), std::chrono::seconds(3));
+    }
+}
+
+TEST_F(ArchiveTest, IoEnginesUnderMemoryLimit) {
+    // As with --io and --memory-limit 20M: the slots must come out of the
+    // budget, or it admits more than the pool can hold
+    constexpr size_t LIMIT = 20 * 1024 * 1024;
+    std::string text;
+    for (size_t i = 0; text.size() < IoEngine::SLOT_SIZE - 1000; ++i) {
+        text += "line " + std::to_string(i * 7919 % 100003) + "\n";
+    }
+    for (int i = 0; i < 40; ++i) {
+        writeFile("data/f" + std::to_string(i) + ".txt", text + std::to_string(i));
+    }
+
+    auto& pool = BufferPool::instance();
+    pool.trim();
+    pool.setMemoryLimit(pool.stats().liveBytes + LIMIT);
+
+    for (auto backend : {IoBackend::Uring, IoBackend::Threads}) {
+        auto budget = std::make_shared<MemoryBudget>(LIMIT);
+        std::shared_ptr<IoEngine> engine = IoEngine::create(backend, 4, budget);
+        ASSERT_LE(engine->depth() * IoEngine::SLOT_SIZE, LIMIT / 4);
+        std::string name = engine->name();
+        {
+            ArchiveWriter writer(name + ".zip");
+            writer.setMemoryBudget(budget);
+            writer.setIoEngine(engine);
+            writer.addDirectory("data");
+            writer.close();
+        }
+        fs::path out = "out_" + name;
+        {
+            ArchiveReader reader(name + ".zip");
+            reader.setMemoryBudget(budget);
+            reader.setIoEngine(engine);
+            reader.extractAll(out);
+        }
+        engine.reset();
+        ASSERT_EQ(budget->inUse(), 0u);
+
+        for (const auto& entry : fs::directory_iterator("data")) {
+            ASSERT_EQ(readFile(out / entry.path()), readFile(entry.path())) << entry.path();
+        }
+    }
+    pool.setMemoryLimit(0);
+}
+
+TEST_F(ArchiveTest, DropCacheRoundTrip) {
+    // Above the O_DIRECT threshold, with a tail that is not block aligned
+    std::string large;
+    uint32_t state = 777;
+    while (large.size() < DIRECT_IO_THRESHOLD + 12345) {
+        state = state * 1103515245 + 12345;
+        large += "line " + std::to_string(state >> 20) + "\n";
+    }
+    writeFile("data/large.txt", large);
+    writeFile("data/small.txt", "small file");
+
+    setCachePolicy(CachePolicy::DropBehind);
+    {
+        ArchiveWriter writer("drop.zip");
+        writer.addDirectory("data");
+        writer.close();
+    }
+    ArchiveReader reader("drop.zip");
+    reader.extractAll("out");
+    setCachePolicy(CachePolicy::Default);
+
+    ASSERT_EQ(readFile("out/data/large.txt"), large);
+    ASSERT_EQ(readFile("out/data/small.txt"), "small file");
+    ASSERT_TRUE(reader.test(1).ok());
+}
+
+TEST_F(ArchiveTest, EntriesOf4GBAreRefused) {
+    // A hole, so nothing is written or read
+    writeFile("data/small.txt", "small");
+    writeFile("data/huge.bin", "");
+    fs::resize_file("data/huge.bin", uint64_t{4} << 30);
+    {
+        ArchiveWriter writer("test.zip");
+        writer.addFile("data/small.txt");
+        for (CompressionLevel level : {CompressionLevel::Store, CompressionLevel::Default}) {
+            try {
+                writer.addFile("data/huge.bin", level);
+                FAIL() << "The entry sizes would have been truncated";
+            } catch (const std::runtime_error& e) {
+                EXPECT_NE(std::string(e.what()).find("4 GB"), std::string::npos) << e.what();
+            }
+        }
+        writer.close();
+    }
+
+    ArchiveReader reader("test.zip");
+    ASSERT_EQ(reader.listFiles(), std::vector<std::string>{"data/small.txt"});
+    ASSERT_TRUE(reader.test().ok());
+}
+
+TEST_F(ArchiveTest, SparseFilesKeepTheirHoles) {
+    std::string text;
+    for (int i = 0; text.size() < 100000; ++i) {
+        text += "record " + std::to_string(i) + "\n";
+    }
+    std::string image = std::string(2 * 1024 * 1024, '\0') + text +
+                        std::string(3 * 1024 * 1024, '\0') + text.substr(0, 5000) +
+                        std::string(1024 * 1024 + 123, '\0');
+    std::string small = std::string(512 * 1024, '\0') + text;
+    writeFile("data/disk.img", image);
+    writeFile("data/small.bin", small);
+    {
+        ArchiveWriter writer("sparse.zip");
+        writer.setSparse(true);
+        writer.addDirectory("data");
+        writer.close();
+    }
+
+    // Only the data of the image is in the archive
+    ArchiveReader reader("sparse.zip");
+    const ZipEntry* entry = reader.findEntry("data/disk.img");
+    ASSERT_NE(entry, nullptr);
+    ASSERT_EQ(reader.storage(*entry), EntryStorage::Sparse);
+    ASSERT_LT(entry->uncompressedSize, 2 * text.size());
+    ASSERT_EQ(reader.storage(*reader.findEntry("data/small.bin")), EntryStorage::Deflated);
+    ASSERT_EQ(reader.read("data/disk.img").size(), image.size());
+
+    // Sizes, totals and progress count the holes
+    ASSERT_EQ(reader.fileSize(*entry), image.size());
+    ASSERT_EQ(reader.totalSize(), image.size() + small.size());
+    auto testProgress = std::make_shared<ProgressBar>("Testing", reader.totalSize(), 2, ProgressMode::None);
+    reader.setProgress(testProgress);
+    auto report = reader.test(1);
+    ASSERT_TRUE(report.ok());
+    ASSERT_EQ(report.bytes, reader.totalSize());
+    ASSERT_EQ(testProgress->bytes(), reader.totalSize());
+    auto extractProgress = std::make_shared<ProgressBar>("Extracting", reader.totalSize(), 2,
+                                                         ProgressMode::None);
+    reader.setProgress(extractProgress);
+
+    auto allocated = [](const fs::path& path) {
+        struct stat info;
+        ::stat(path.c_str(), &info);
+        return static_cast<uint64_t>(info.st_blocks) * 512;
+    };
+
+    // Recorded holes come back as holes; zero blocks only when asked to
+    reader.extractAll("out");
+    ASSERT_EQ(readFile("out/data/disk.img"), image);
+    ASSERT_EQ(readFile("out/data/small.bin"), small);
+    ASSERT_LT(allocated("out/data/disk.img"), image.size() / 4);
+    ASSERT_EQ(extractProgress->bytes(), reader.totalSize());
+
+    reader.setSparse(true);
+    reader.extractAll("sparse_out");
+    ASSERT_EQ(readFile("sparse_out/data/disk.img"), image);
+    ASSERT_EQ(readFile("sparse_out/data/small.bin"), small);
+    ASSERT_LT(allocated("sparse_out/data/small.bin"), small.size() / 2);
+}
+
+TEST_F(ArchiveTest, HolesAreNotRead) {
+    // 64 MB file with two data blocks; the rest was never written
+    std::string head(100000, 'h');
+    std::string middle(3000, 'm');
+    writeFile("data/thin.img", head);
+    fs::resize_file("data/thin.img", 64 * 1024 * 1024);
+    {
+        std::fstream file("data/thin.img", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(40 * 1024 * 1024);
+        file.write(middle.data(), static_cast<std::streamsize>(middle.size()));
+    }
+    std::string image = readFile("data/thin.img");
+    ASSERT_EQ(image.size(), 64u * 1024 * 1024);
+
+    // Holes read back as zeros, with or without a sparse archive
+    {
+        ArchiveWriter writer("thin.zip");
+        writer.addFile("data/thin.img");
+        writer.close();
+    }
+    {
+        ArchiveWriter writer("thin_sparse.zip");
+        writer.setSparse(true);
+        writer.addFile("data/thin.img");
+        writer.close();
+    }
+
+    ArchiveReader sparse("thin_sparse.zip");
+    const ZipEntry* entry = sparse.findEntry("data/thin.img");
+    ASSERT_EQ(sparse.storage(*entry), EntryStorage::Sparse);
+    ASSERT_LT(entry->uncompressedSize, 2 * (head.size() + middle.size()));
+    sparse.extractAll("out_sparse");
+    ASSERT_EQ(readFile("out_sparse/data/thin.img"), image);
+
+    ArchiveReader plain("thin.zip");
+    ASSERT_EQ(plain.storage(*plain.findEntry("data/thin.img")), EntryStorage::Deflated);
+    plain.extractAll("out_plain");
+    ASSERT_EQ(readFile("out_plain/data/thin.img"), image);
+}
+
+TEST_F(ArchiveTest, MergeCopiesEntriesWithoutRecompressing) {
+    writeFile("src/a.cpp", "int main() { return 0; }\n");
+    writeFile("src/b.cpp", "int helper() { return 1; }\n");
+    writeFile("src/a.h", "#pragma once\nint helper();\n");
+    {
+        // One solid block holding every file
+        ArchiveWriter writer("one.zip");
+        writer.setSolidMode(1024 * 1024);
+        writer.addFile("src/a.cpp");
+        writer.addFile("src/b.cpp");
+        writer.addFile("src/a.h");
+        writer.close();
+    }
+
+    std::string image(100000, 'd');
+    image.resize(2 * 1024 * 1024);
+    writeFile("data/disk.img", image);
+    writeFile("src/a.cpp", "int main() { return 2; }\n");
+    writeFile("docs/notes.txt", std::string(20000, 'n'));
+    {
+        ArchiveWriter writer("two.zip");
+        writer.setSparse(true);
+        writer.addFile("data/disk.img");
+        writer.addFile("src/a.cpp");
+        writer.addFile("docs/notes.txt");
+        writer.close();
+    }
+
+    auto inputs = std::vector<std::shared_ptr<ArchiveReader>>{
+        std::make_shared<ArchiveReader>("one.zip"), std::make_shared<ArchiveReader>("two.zip")};
+    {
+        ArchiveWriter writer("refused.zip");
+        ASSERT_THROW(mergeArchives(writer, inputs), std::runtime_error);
+    }
+
+    // The later src/a.cpp wins and leaves a gap at the start of the block
+    {
+        ArchiveWriter writer("merged.zip");
+        auto report = mergeArchives(writer, inputs, DuplicatePolicy::Last);
+        writer.close();
+        ASSERT_EQ(report.entries, 5u);
+        ASSERT_EQ(report.duplicates, 1u);
+    }
+
+    ArchiveReader merged("merged.zip");
+    ASSERT_EQ(merged.listFiles().size(), 5u);
+    EXPECT_EQ(merged.storage(*merged.findEntry("src/b.cpp")), EntryStorage::Solid);
+    EXPECT_EQ(merged.storage(*merged.findEntry("data/disk.img")), EntryStorage::Sparse);
+    EXPECT_EQ(merged.findEntry("docs/notes.txt")->compressedSize,
+              inputs[1]->findEntry("docs/notes.txt")->compressedSize);
+    ASSERT_TRUE(merged.test().ok());
+
+    merged.extractAll("out");
+    EXPECT_EQ(readFile("out/src/a.cpp"), "int main() { return 2; }\n");
+    EXPECT_EQ(readFile("out/src/b.cpp"), "int helper() { return 1; }\n");
+    EXPECT_EQ(readFile("out/src/a.h"), "#pragma once\nint helper();\n");
+    EXPECT_EQ(readFile("out/data/disk.img"), image);
+    EXPECT_EQ(readFile("out/docs/notes.txt"), std::string(20000, 'n'));
+}
+
+TEST_F(ArchiveTest, MergeResolvesDuplicatesWithinOneInput) {
+    auto bytes = [](const std::string& text) {
+        return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    };
+    std::string first = "first", second = "second", other = "other";
+    Buffer input;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(input));
+        writer.addEntry("a.txt", bytes(first));
+        writer.addEntry("b.txt", bytes(other));
+        writer.addEntry("a.txt", bytes(second));
+        writer.close();
+    }
+    auto inputs = std::vector<std::shared_ptr<ArchiveReader>>{
+        std::make_shared<ArchiveReader>(ArchiveSource::memory(input.span()))};
+    {
+        Buffer refused;
+        ArchiveWriter writer(ArchiveSink::memory(refused));
+        ASSERT_THROW(mergeArchives(writer, inputs), std::runtime_error);
+    }
+
+    for (auto [policy, kept] : {std::pair{DuplicatePolicy::First, first}, std::pair{DuplicatePolicy::Last, second}}) {
+        Buffer archive;
+        {
+            ArchiveWriter writer(ArchiveSink::memory(archive));
+            auto report = mergeArchives(writer, inputs, policy);
+            writer.close();
+            ASSERT_EQ(report.entries, 2u);
+            ASSERT_EQ(report.duplicates, 1u);
+        }
+
+        ArchiveReader merged(ArchiveSource::memory(archive.span()));
+        ASSERT_EQ(merged.listFiles().size(), 2u);
+        Buffer data = merged.read("a.txt");
+        EXPECT_EQ(std::string(data.begin(), data.end()), kept);
+    }
+}
+
+TEST_F(ArchiveTest, MergePromotesLargeDirectoriesToZip64) {
+    // Together the inputs hold more entries than the classic record can count
+    std::vector<Buffer> archives(2);
+    std::vector<std::shared_ptr<ArchiveReader>> inputs;
+    uint8_t byte = 'z';
+    for (size_t i = 0; i < archives.size(); ++i) {
+        ArchiveWriter writer(ArchiveSink::memory(archives[i]));
+        for (int j = 0; j < 40000; ++j) {
+            writer.addEntry(std::to_string(i) + "/" + std::to_string(j), {&byte, 1}, {},
+                            CompressionLevel::Store);
+        }
+        writer.close();
+        inputs.push_back(std::make_shared<ArchiveReader>(ArchiveSource::memory(archives[i].span())));
+    }
+
+    Buffer archive;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(archive));
+        mergeArchives(writer, inputs);
+        writer.close();
+    }
+
+    ArchiveReader reader(ArchiveSource::memory(archive.span()));
+    ASSERT_EQ(reader.listFiles().size(), 80000u);
+    auto data = reader.read("1/39999");
+    ASSERT_EQ(data.size(), 1u);
+    ASSERT_EQ(data[0], 'z');
+}
+
+TEST_F(ArchiveTest, DeleteCompactsArchiveInPlace) {
+    // Incompressible contents keep every record at a predictable size
+    std::vector<std::pair<std::string, std::string>> files;
+    uint32_t seed = 1;
+    for (int i = 0; i < 8; ++i) {
+        std::string content(30000 + i * 1000, '\0');
+        for (char& c : content) {
+            seed = seed * 1103515245 + 12345;
+            c = static_cast<char>(seed >> 24);
+        }
+        files.emplace_back("data/f" + std::to_string(i), content);
+        writeFile(files.back().first, content);
+    }
+    writeFile("src/a.cpp", "int main() { return 0; }\n");
+    writeFile("src/b.cpp", "int helper() { return 1; }\n");
+    {
+        ArchiveWriter writer("test.zip");
+        for (const auto& [name, content] : files) {
+            writer.addFile(name);
+        }
+        writer.setSolidMode(1024 * 1024);
+        writer.addFile("src/a.cpp");
+        writer.addFile("src/b.cpp");
+        writer.close();
+    }
+    uint64_t before = fs::file_size("test.zip");
+
+    {
+        Compaction compaction("test.zip", [](const ZipEntry& entry) {
+            return entry.filename == "data/f0" || entry.filename == "data/f5" ||
+                entry.filename == "src/a.cpp";
+        });
+        EXPECT_EQ(compaction.removedEntries(), 3u);
+        EXPECT_EQ(compaction.originalSize(), before);
+        compaction.finish();
+    }
+    EXPECT_LT(fs::file_size("test.zip"), before - 60000);
+    EXPECT_FALSE(fs::exists(std::string("test.zip") + COMPACTION_JOURNAL_SUFFIX));
+
+    ArchiveReader reader("test.zip");
+    ASSERT_EQ(reader.listFiles().size(), 7u);
+    EXPECT_EQ(reader.findEntry("data/f0"), nullptr);
+    EXPECT_EQ(reader.findEntry("src/a.cpp"), nullptr);
+    ASSERT_TRUE(reader.test().ok());
+    reader.extractAll("out");
+    for (int i : {1, 2, 3, 4, 6, 7}) {
+        EXPECT_EQ(readFile("out/" + files[i].first), files[i].second) << files[i].first;
+    }
+    EXPECT_EQ(readFile("out/src/b.cpp"), "int helper() { return 1; }\n");
+}
+
+TEST_F(ArchiveTest, InterruptedCompactionIsRecovered) {
+    std::vector<std::pair<std::string, std::string>> files;
+    uint32_t seed = 7;
+    for (int i = 0; i < 12; ++i) {
+        std::string content(20000 + i * 3000, '\0');
+        for (char& c : content) {
+            seed = seed * 1103515245 + 12345;
+            c = static_cast<char>(seed >> 24);
+        }
+        files.emplace_back("data/f" + std::to_string(i), content);
+        writeFile(files.back().first, content);
+    }
+    {
+        ArchiveWriter writer("test.zip");
+        for (const auto& [name, content] : files) {
+            writer.addFile(name);
+        }
+        writer.close();
+    }
+    auto removed = [](const ZipEntry& entry) {
+        return entry.filename == "data/f1" || entry.filename == "data/f2";
+    };
+
+    // Stop after a few small windows, as a crash would
+    {
+        Compaction compaction("test.zip", removed, 16 * 1024);
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_TRUE(compaction.step());
+        }
+    }
+    ASSERT_TRUE(fs::exists(std::string("test.zip") + COMPACTION_JOURNAL_SUFFIX));
+    ASSERT_TRUE(Compaction::recover("test.zip"));
+    ASSERT_FALSE(Compaction::recover("test.zip"));
+
+    ArchiveReader reader("test.zip");
+    ASSERT_EQ(reader.listFiles().size(), 10u);
+    ASSERT_TRUE(reader.test().ok());
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (i == 1 || i == 2) {
+            continue;
+        }
+        auto data = reader.read(files[i].first);
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(data.data()), data.size()), files[i].second)
+            << files[i].first;
+    }
+}
+
+TEST_F(ArchiveTest, FailedCompactionClosesTheArchive) {
+    std::ofstream("test.zip", std::ios::binary) << std::string(100, 'x');
+    auto openDescriptors = [] {
+        return std::distance(fs::directory_iterator("/proc/self/fd"), fs::directory_iterator());
+    };
+
+    auto before = openDescriptors();
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_THROW(Compaction("test.zip", [](const ZipEntry&) { return true; }), std::runtime_error);
+    }
+    EXPECT_EQ(openDescriptors(), before);
+}
+
+TEST_F(ArchiveTest, RecompressKeepsOnlyEntriesThatShrink) {
+    std::string text;
+    for (int i = 0; i < 4000; ++i) {
+        text += "line " + std::to_string(i % 97) + " of a rather repetitive log\n";
+    }
+    std::string noise(50000, '\0');
+    uint32_t seed = 3;
+    for (char& c : noise) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<char>(seed >> 24);
+    }
+    auto bytes = [](const std::string& content) {
+        return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+    };
+
+    Buffer original;
+    {
+        ArchiveWriter writer(ArchiveSink::memory(original));
+        writer.addEntry("logs/fast.log", bytes(text), {}, CompressionLevel::Fast);
+        writer.addEntry("logs/stored.log", bytes(text), {}, CompressionLevel::Store);
+        writer.addEntry("logs/small.log", bytes(text.substr(0, 2000)), {}, CompressionLevel::Store);
+        writer.addEntry("data/noise.bin", bytes(noise), {}, CompressionLevel::Store);
+        writer.addEntry("data/best.log", bytes(text), {}, CompressionLevel::Maximum);
+        writer.close();
+    }
+    ArchiveReader input(ArchiveSource::memory(original.span()));
+
+    Buffer archive;
+    RecompressReport report;
+    {
+        RecompressOptions options;
+        options.minSize = 4096;
+        options.threads = 3;
+        ArchiveWriter writer(ArchiveSink::memory(archive));
+        report = recompressArchive(writer, input, options);
+        writer.close();
+    }
+
+    // The noise and the entry already at -m9 cannot shrink, the small one is filtered out
+    std::vector<std::string> names;
+    for (const auto& entry : report.recompressed) {
+        names.push_back(entry.name);
+        EXPECT_LT(entry.newSize, entry.originalSize) << entry.name;
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"logs/fast.log", "logs/stored.log"}));
+    EXPECT_EQ(report.copied, 3u);
+    EXPECT_GT(report.savedBytes(), static_cast<int64_t>(text.size() / 2));
+
+    ArchiveReader reader(ArchiveSource::memory(archive.span()));
+    ASSERT_EQ(reader.listFiles().size(), 5u);
+    ASSERT_TRUE(reader.test().ok());
+    EXPECT_EQ(reader.storage(*reader.findEntry("logs/stored.log")), EntryStorage::Deflated);
+    EXPECT_EQ(reader.storage(*reader.findEntry("logs/small.log")), EntryStorage::Stored);
+    EXPECT_EQ(reader.findEntry("data/best.log")->compressedSize,
+              input.findEntry("data/best.log")->compressedSize);
+    for (const char* name : {"logs/fast.log", "logs/stored.log", "data/best.log"}) {
+        auto data = reader.read(name);
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(data.data()), data.size()), text) << name;
+    }
+    auto data = reader.read("data/noise.bin");
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(data.data()), data.size()), noise);
+
+    // Under a memory limit the stored log no longer fits a worker and is streamed
+    auto budget = std::make_shared<MemoryBudget>(
+        Compressor::WORKING_MEMORY + Compressor::STREAMING_MEMORY + 64 * 1024);
+    Buffer limited;
+    {
+        RecompressOptions options;
+        options.minSize = 4096;
+        options.threads = 3;
+        options.memoryBudget = budget;
+        ArchiveWriter writer(ArchiveSink::memory(limited));
+        report = recompressArchive(writer, input, options);
+        writer.close();
+    }
+    names.clear();
+    for (const auto& entry : report.recompressed) {
+        names.push_back(entry.name);
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"logs/fast.log", "logs/stored.log"}));
+    EXPECT_EQ(budget->inUse(), 0u);
+    ArchiveReader limitedReader(ArchiveSource::memory(limited.span()));
+    ASSERT_TRUE(limitedReader.test().ok());
+    data = limitedReader.read("logs/stored.log");
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(data.data()), data.size()), text);
+}
+
+} // namespace test
+} // namespace miniwr
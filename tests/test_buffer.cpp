@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include "../src/core/DeflateCompressor.h"
+#include "../src/util/Buffer.h"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace miniwr {
+namespace test {
+
+TEST(BufferTest, SizeClasses) {
+    EXPECT_EQ(BufferPool::roundUp(1), BufferPool::MIN_SIZE);
+    EXPECT_EQ(BufferPool::roundUp(4097), 5u * 1024);
+    EXPECT_EQ(BufferPool::roundUp(8 * 1024), 8u * 1024);
+    EXPECT_EQ(BufferPool::roundUp(BufferPool::MAX_POOLED_SIZE), BufferPool::MAX_POOLED_SIZE);
+
+    for (size_t size = 4096; size < 64 * 1024 * 1024; size = size * 3 / 2 + 1) {
+        size_t rounded = BufferPool::roundUp(size);
+        ASSERT_GE(rounded, size);
+        ASSERT_LE(rounded, size + size / 4) << "Slack above 25% for " << size;
+    }
+}
+
+TEST(BufferTest, GrowthKeepsContent) {
+    Buffer buffer;
+    std::string expected;
+    for (int i = 0; i < 5000; ++i) {
+        std::string line = "line " + std::to_string(i) + "\n";
+        buffer.append({reinterpret_cast<const uint8_t*>(line.data()), line.size()});
+        expected += line;
+    }
+
+    ASSERT_EQ(std::string(buffer.begin(), buffer.end()), expected);
+    ASSERT_GE(buffer.capacity(), buffer.size());
+
+    Buffer moved = std::move(buffer);
+    ASSERT_TRUE(buffer.empty());
+    ASSERT_EQ(moved.size(), expected.size());
+}
+
+TEST(BufferTest, ReleasedBuffersAreReused) {
+    auto& pool = BufferPool::instance();
+    { Buffer warmup(300 * 1024); }
+
+    auto before = pool.stats();
+    for (int i = 0; i < 10; ++i) {
+        Buffer buffer(300 * 1024);
+        buffer[0] = 1;
+    }
+    auto after = pool.stats();
+
+    ASSERT_EQ(after.allocations, before.allocations);
+    ASSERT_EQ(after.reuses, before.reuses + 10);
+}
+
+TEST(BufferTest, MemoryLimitCapsLiveAndIdleBytes) {
+    auto& pool = BufferPool::instance();
+    pool.trim();
+    const size_t limit = pool.stats().liveBytes + 1024 * 1024;
+    pool.setMemoryLimit(limit);
+    pool.trim();
+    pool.resetPeak();
+
+    // The idle buffer is dropped to make room for a larger one
+    { Buffer idle(512 * 1024); }
+    Buffer held(768 * 1024);
+
+    // With nothing idle left, the next allocation waits for a release
+    std::atomic<bool> allocated{false};
+    std::thread waiter([&] {
+        Buffer next(512 * 1024);
+        allocated = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    bool allocatedEarly = allocated;
+    held.reset();
+    waiter.join();
+
+    bool refused = false;
+    try {
+        Buffer tooLarge(limit + 1);
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    auto stats = pool.stats();
+    pool.setMemoryLimit(0);
+
+    ASSERT_FALSE(allocatedEarly);
+    ASSERT_TRUE(allocated);
+    ASSERT_TRUE(refused);
+    ASSERT_LE(stats.peakBytes, limit);
+}
+
+TEST(BufferTest, MemoryLimitRefusesWhatOnlyThisThreadCouldRelease) {
+    auto& pool = BufferPool::instance();
+    pool.trim();
+    const size_t limit = pool.stats().liveBytes + 1024 * 1024;
+    pool.setMemoryLimit(limit);
+
+    // No other thread holds a buffer, so waiting would never end
+    Buffer held(768 * 1024);
+    bool refused = false;
+    try {
+        Buffer next(512 * 1024);
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+
+    // Once released, the same request fits
+    held.reset();
+    Buffer next(512 * 1024);
+    next.reset();
+    pool.setMemoryLimit(0);
+
+    ASSERT_TRUE(refused);
+}
+
+TEST(BufferTest, CompressorSteadyStateDoesNotAllocate) {
+    std::vector<uint8_t> input(512 * 1024);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>((i * 7) % 251);
+    }
+
+    DeflateCompressor compressor;
+    auto roundTrip = [&] {
+        Buffer compressed;
+        Buffer decompressed;
+        compressor.compress(input, compressed);
+        compressor.decompress(compressed, decompressed, input.size());
+        ASSERT_TRUE(std::equal(input.begin(), input.end(),
+                               decompressed.begin(), decompressed.end()));
+    };
+
+    roundTrip();
+    auto before = BufferPool::instance().stats();
+    for (int i = 0; i < 5; ++i) {
+        roundTrip();
+    }
+    ASSERT_EQ(BufferPool::instance().stats().allocations, before.allocations);
+}
+
+} // namespace test
+} // namespace miniwr
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "../src/core/DeflateCompressor.h"
+#include "../src/core/Delta.h"
 #include <string>
 #include <vector>
 
@@ -66,5 +67,48 @@ TEST_F(CompressionTest, CompressLargeData) {
     ASSERT_EQ(decompressed, input) << "Decompressed data mismatch";
 }
 
+TEST_F(CompressionTest, CompressWithDictionary) {
+    std::string dictText = "{\"name\": \"\", \"version\": \"\", \"dependencies\": {}}";
+    std::string testData = "{\"name\": \"miniwr\", \"version\": \"1.0.0\", \"dependencies\": {}}";
+    std::vector<uint8_t> dictionary(dictText.begin(), dictText.end());
+    std::vector<uint8_t> input(testData.begin(), testData.end());
+
+    auto plain = compressor->compress(input);
+    compressor->setDictionary(dictionary);
+    auto withDict = compressor->compress(input);
+    ASSERT_LT(withDict.size(), plain.size()) << "Dictionary should improve ratio";
+
+    auto decompressed = compressor->decompress(withDict, input.size());
+    ASSERT_EQ(decompressed, input) << "Decompressed data mismatch";
+
+    // Without the dictionary the stream cannot be inflated
+    DeflateCompressor fresh;
+    ASSERT_THROW(fresh.decompress(withDict, input.size()), std::runtime_error);
+}
+
+TEST_F(CompressionTest, DeltaEncodeAndApply) {
+    // 256KB of pseudo-random base data, larger than the deflate window
+    std::vector<uint8_t> base(256 * 1024);
+    uint32_t state = 12345;
+    for (auto& byte : base) {
+        state = state * 1103515245 + 12345;
+        byte = static_cast<uint8_t>(state >> 16);
+    }
+
+    // Target: a few edits, an insertion and a block moved to the front
+    std::vector<uint8_t> target(base.begin() + 200000, base.begin() + 210000);
+    target.insert(target.end(), base.begin(), base.end());
+    target[70000] ^= 0xFF;
+    target.insert(target.begin() + 150000, 300, 0x42);
+
+    auto delta = encodeDelta(base, target);
+    ASSERT_LT(delta.size(), 2048u) << "Delta should only hold the changes";
+    ASSERT_EQ(applyDelta(base, delta), target) << "Reconstructed data mismatch";
+
+    // Unrelated content degrades to literals but still round-trips
+    std::vector<uint8_t> unrelated(1000, 0x17);
+    ASSERT_EQ(applyDelta(base, encodeDelta(base, unrelated)), unrelated);
+}
+
 } // namespace test
 } // namespace miniwr 
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include "../src/util/Scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace miniwr {
+namespace test {
+
+TEST(SchedulerTest, GroupRunsEveryTask) {
+    std::atomic<int> count{0};
+    TaskGroup group;
+    for (int i = 0; i < 1000; ++i) {
+        group.run([&] { ++count; });
+    }
+    group.wait();
+    ASSERT_EQ(count, 1000);
+}
+
+TEST(SchedulerTest, LimitBoundsConcurrency) {
+    Scheduler scheduler({4, false});
+    std::atomic<int> running{0};
+    std::atomic<int> peak{0};
+    TaskGroup group(2, {}, scheduler);
+    for (int i = 0; i < 40; ++i) {
+        group.run([&] {
+            int now = ++running;
+            int seen = peak.load();
+            while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --running;
+        });
+    }
+    group.wait();
+    ASSERT_LE(peak, 2);
+}
+
+TEST(SchedulerTest, NestedGroupsBalance) {
+    // More waiting tasks than workers: waits must run queued work themselves
+    Scheduler scheduler({2, false});
+    std::atomic<int> count{0};
+    TaskGroup outer(0, {}, scheduler);
+    for (int i = 0; i < 8; ++i) {
+        outer.run([&] {
+            TaskGroup inner(0, {}, scheduler);
+            for (int j = 0; j < 50; ++j) {
+                inner.run([&] { ++count; });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+    ASSERT_EQ(count, 400);
+}
+
+TEST(SchedulerTest, FirstErrorCancelsTheRest) {
+    Scheduler scheduler({2, false});
+    std::atomic<int> started{0};
+    TaskGroup group(1, {}, scheduler);
+    group.run([] { throw std::runtime_error("broken entry"); });
+    for (int i = 0; i < 20; ++i) {
+        group.run([&] { ++started; });
+    }
+    try {
+        group.wait();
+        FAIL() << "The error was not rethrown";
+    } catch (const std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "broken entry");
+    }
+    EXPECT_TRUE(group.token().cancelled());
+    EXPECT_EQ(started, 0);
+
+    // A shared token stops other groups too
+    CancellationToken token;
+    TaskGroup child(0, token, scheduler);
+    token.cancel();
+    child.run([&] { ++started; });
+    child.wait();
+    EXPECT_EQ(started, 0);
+    EXPECT_THROW(token.throwIfCancelled(), Cancelled);
+}
+
+TEST(SchedulerTest, IoTasksRunFirst) {
+    Scheduler scheduler({1, false});
+    std::atomic<bool> busy{false};
+    std::atomic<bool> release{false};
+    std::mutex mutex;
+    std::string order;
+
+    // The only worker is held until every task is queued
+    scheduler.submit([&] {
+        busy = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    while (!busy) {
+        std::this_thread::yield();
+    }
+
+    TaskGroup group(6, {}, scheduler);
+    for (int i = 0; i < 3; ++i) {
+        group.run([&] { std::lock_guard<std::mutex> lock(mutex); order += 'c'; }, TaskPriority::Cpu);
+        group.run([&] { std::lock_guard<std::mutex> lock(mutex); order += 'i'; }, TaskPriority::Io);
+    }
+    release = true;
+    while (true) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (order.size() == 6) {
+            break;
+        }
+    }
+    group.wait();
+    ASSERT_EQ(order, "iiiccc");
+}
+
+TEST(SchedulerTest, PinnedWorkersStayOnOneCpu) {
+    Scheduler scheduler({2, true});
+    std::atomic<int> done{0};
+    std::atomic<int> pinned{0};
+    for (int i = 0; i < 2; ++i) {
+        scheduler.submit([&] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (::pthread_getaffinity_np(::pthread_self(), sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+                ++pinned;
+            }
+            ++done;
+        });
+    }
+    while (done < 2) {
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(pinned, 2);
+}
+
+} // namespace test
+} // namespace miniwr
@@ -30,6 +30,11 @@ fi
 # Initialize results file
 echo "File,Size,Tool,Level,CompressedSize,Ratio,Time,SHA256" > "$RESULT_FILE"
 
+# Size in bytes of a file or directory (portable: no GNU/BSD stat flags)
+size_of() {
+    find "$1" -type f -exec cat {} + | wc -c | tr -d ' '
+}
+
 # Function to run compression test
 run_test() {
     local file="$1"
@@ -38,7 +43,7 @@ run_test() {
     local outfile="$4"
     
     # Get original size and hash
-    local size=$(stat -f%z "$file")
+    local size=$(size_of "$file")
     local orig_hash=$(sha256sum "$file" | cut -d' ' -f1)
     
     # Time compression
@@ -54,7 +59,7 @@ run_test() {
     local time=$(echo "$end - $start" | bc)
     
     # Get compressed size and ratio
-    local comp_size=$(stat -f%z "$outfile")
+    local comp_size=$(size_of "$outfile")
     local ratio=$(echo "scale=2; $comp_size * 100 / $size" | bc)
     
     # Extract and verify
@@ -0,0 +1,569 @@
+/**
+ * @file miniwr_corpus.cpp
+ * @brief Deterministic benchmark corpus generator and scenario runner
+ *
+ *   miniwr_corpus generate <root> [--shape NAME|all] [--seed N] [--scale F]
+ *                                 [--compressibility P]
+ *   miniwr_corpus run <root> [--miniwr PATH] [--work DIR] [--json FILE]
+ *                            [-- extra miniwr a options]
+ *
+ * `generate` writes one directory per shape under root; the same seed and
+ * scale always produce the same bytes. `run` archives, extracts, lists and
+ * tests every shape directory with the miniwr binary and records wall time,
+ * CPU time, peak RSS, bytes read and written and the archive ratio.
+ */
+
+#include "../benchmarks/BenchData.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace miniwr {
+namespace corpus {
+
+namespace fs = std::filesystem;
+using bench::InputClass;
+
+namespace {
+    constexpr uint64_t KB = 1024;
+    constexpr uint64_t MB = 1024 * KB;
+    constexpr uint64_t GB = 1024 * MB;
+
+    constexpr size_t HUGE_CHUNK_SIZE = 4 * MB;
+    constexpr size_t FILES_PER_DIR = 1000;
+    constexpr size_t DEEP_FILES_PER_DIR = 16;
+    constexpr size_t DEEP_CHAIN_LEVELS = 16;
+
+    struct Options {
+        std::string command;
+        fs::path root;
+        std::string shape = "all";
+        uint32_t seed = 1;
+        double scale = 1.0;
+        double compressibility = 0.5;
+        fs::path miniwr = "./miniwr";
+        fs::path workDir;
+        fs::path jsonPath;
+        std::vector<std::string> extraArgs;
+    };
+
+    /**
+     * @brief Deterministic generator for sizes and names (mt19937 output is
+     *        specified by the standard, unlike the distributions)
+     */
+    class Sequence {
+    public:
+        explicit Sequence(uint32_t seed) : engine_(seed) {}
+
+        uint64_t below(uint64_t limit) {
+            return limit == 0 ? 0 : engine_() % limit;
+        }
+
+        // Log-uniform between low and high, like real file size distributions
+        uint64_t logUniform(uint64_t low, uint64_t high) {
+            double fraction = static_cast<double>(engine_()) / 4294967296.0;
+            return static_cast<uint64_t>(static_cast<double>(low) *
+                std::pow(static_cast<double>(high) / static_cast<double>(low), fraction));
+        }
+
+    private:
+        std::mt19937 engine_;
+    };
+
+    uint64_t scaled(uint64_t value, double scale) {
+        return std::max<uint64_t>(1, static_cast<uint64_t>(static_cast<double>(value) * scale));
+    }
+
+    uint32_t fileSeed(const Options& options, uint32_t shape, uint64_t index) {
+        return options.seed * 1000003u + shape * 7919u + static_cast<uint32_t>(index);
+    }
+
+    void writeFile(const fs::path& path, const std::vector<uint8_t>& data) {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            throw std::runtime_error("Failed to write " + path.string());
+        }
+    }
+
+    // Millions of files below 1 KB, 1000 per directory
+    uint64_t generateTiny(const fs::path& dir, const Options& options) {
+        uint64_t count = scaled(1000000, options.scale);
+        Sequence sequence(options.seed);
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            auto subdir = dir / ("d" + std::to_string(i / FILES_PER_DIR));
+            if (i % FILES_PER_DIR == 0) {
+                fs::create_directories(subdir);
+            }
+            auto data = bench::generateCompressible(
+                static_cast<size_t>(sequence.below(KB)), options.compressibility,
+                fileSeed(options, 1, i));
+            writeFile(subdir / ("f" + std::to_string(i) + ".txt"), data);
+            total += data.size();
+        }
+        return total;
+    }
+
+    // One 10 GB file, generated in chunks
+    uint64_t generateHuge(const fs::path& dir, const Options& options) {
+        fs::create_directories(dir);
+        uint64_t size = scaled(10 * GB, options.scale);
+        auto path = dir / "huge.bin";
+        std::ofstream file(path, std::ios::binary);
+
+        uint64_t total = 0;
+        for (uint64_t chunk = 0; total < size; ++chunk) {
+            auto data = bench::generateCompressible(
+                static_cast<size_t>(std::min<uint64_t>(HUGE_CHUNK_SIZE, size - total)),
+                options.compressibility, fileSeed(options, 2, chunk));
+            file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+            total += data.size();
+        }
+        if (!file) {
+            throw std::runtime_error("Failed to write " + path.string());
+        }
+        return total;
+    }
+
+    // 1 GB of text and binary files from 1 KB to 16 MB
+    uint64_t generateMixed(const fs::path& dir, const Options& options) {
+        static const char* TEXT_EXTENSIONS[] = {".txt", ".log", ".csv", ".json", ".cpp"};
+        static const char* BINARY_EXTENSIONS[] = {".bin", ".so", ".dat", ".db"};
+
+        uint64_t size = scaled(GB, options.scale);
+        Sequence sequence(options.seed + 3);
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; total < size; ++i) {
+            auto subdir = dir / ("d" + std::to_string(i / 64));
+            if (i % 64 == 0) {
+                fs::create_directories(subdir);
+            }
+            size_t fileSize = static_cast<size_t>(std::min(sequence.logUniform(KB, 16 * MB), size - total));
+
+            std::vector<uint8_t> data;
+            std::string name = "f" + std::to_string(i);
+            if (i % 2 == 0) {
+                data = bench::generateCompressible(fileSize, options.compressibility, fileSeed(options, 3, i));
+                name += TEXT_EXTENSIONS[i / 2 % std::size(TEXT_EXTENSIONS)];
+            } else {
+                data = bench::generateInput(InputClass::Binary, fileSize, fileSeed(options, 3, i));
+                name += BINARY_EXTENSIONS[i / 2 % std::size(BINARY_EXTENSIONS)];
+            }
+            writeFile(subdir / name, data);
+            total += data.size();
+        }
+        return total;
+    }
+
+    // 1 GB of already-compressed files from 256 KB to 32 MB
+    uint64_t generateMedia(const fs::path& dir, const Options& options) {
+        static const char* EXTENSIONS[] = {".jpg", ".png", ".mp4", ".zip", ".gz"};
+
+        fs::create_directories(dir);
+        uint64_t size = scaled(GB, options.scale);
+        Sequence sequence(options.seed + 4);
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; total < size; ++i) {
+            size_t fileSize = static_cast<size_t>(std::min(sequence.logUniform(256 * KB, 32 * MB), size - total));
+            auto data = bench::generateInput(InputClass::Compressed, fileSize, fileSeed(options, 4, i));
+            writeFile(dir / ("m" + std::to_string(i) + EXTENSIONS[i % std::size(EXTENSIONS)]), data);
+            total += data.size();
+        }
+        return total;
+    }
+
+    // 100k small files, 16 per directory, about 25 levels deep
+    uint64_t generateDeep(const fs::path& dir, const Options& options) {
+        uint64_t count = scaled(100000, options.scale);
+        Sequence sequence(options.seed + 5);
+        uint64_t total = 0;
+        fs::path leaf;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            if (i % DEEP_FILES_PER_DIR == 0) {
+                // Base-4 digits of the leaf index, then a fixed chain
+                leaf = dir;
+                for (uint64_t rest = i / DEEP_FILES_PER_DIR, level = 0; level < 9; ++level, rest /= 4) {
+                    leaf /= "b" + std::to_string(rest % 4);
+                }
+                for (size_t level = 0; level < DEEP_CHAIN_LEVELS; ++level) {
+                    leaf /= "level" + std::to_string(level);
+                }
+                fs::create_directories(leaf);
+            }
+
+            auto data = bench::generateCompressible(
+                static_cast<size_t>(sequence.logUniform(512, 8 * KB)), options.compressibility,
+                fileSeed(options, 5, i));
+            writeFile(leaf / ("f" + std::to_string(i) + ".txt"), data);
+            total += data.size();
+        }
+        return total;
+    }
+
+    struct Shape {
+        const char* name;
+        const char* description;
+        std::function<uint64_t(const fs::path&, const Options&)> generate;
+    };
+
+    const std::vector<Shape>& shapes() {
+        static const std::vector<Shape> all = {
+            {"tiny", "1M files below 1 KB", generateTiny},
+            {"huge", "one 10 GB file", generateHuge},
+            {"mixed", "1 GB of text and binary files, 1 KB - 16 MB", generateMixed},
+            {"media", "1 GB of already-compressed files", generateMedia},
+            {"deep", "100k small files in a 25-level tree", generateDeep},
+        };
+        return all;
+    }
+
+    int generate(const Options& options) {
+        bool found = false;
+        for (const auto& shape : shapes()) {
+            if (options.shape != "all" && options.shape != shape.name) {
+                continue;
+            }
+            found = true;
+
+            auto dir = options.root / shape.name;
+            fs::remove_all(dir);
+            std::cout << shape.name << " (" << shape.description << ", scale "
+                      << options.scale << ")... " << std::flush;
+
+            auto start = std::chrono::steady_clock::now();
+            uint64_t bytes = shape.generate(dir, options);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << bytes / MB << " MB in " << std::fixed << std::setprecision(1)
+                      << elapsed.count() << " s" << std::defaultfloat << std::endl;
+        }
+
+        if (!found) {
+            throw std::runtime_error("Unknown shape: " + options.shape);
+        }
+        return 0;
+    }
+
+    struct Measurement {
+        std::string scenario;
+        std::string operation;
+        int exitCode = 0;
+        double wallSeconds = 0;
+        double cpuSeconds = 0;
+        uint64_t peakRssBytes = 0;
+        uint64_t bytesRead = 0;      ///< Logical input of the operation
+        uint64_t bytesWritten = 0;   ///< Logical output of the operation
+        uint64_t blockReads = 0;     ///< Physical I/O reported by the kernel
+        uint64_t blockWrites = 0;
+        double ratio = 0;
+        bool roundTrip = true;       ///< The archive extracted to the input, every CRC checked
+    };
+
+    uint64_t treeSize(const fs::path& path) {
+        if (!fs::exists(path)) {
+            return 0;
+        }
+        if (fs::is_regular_file(path)) {
+            return fs::file_size(path);
+        }
+        uint64_t total = 0;
+        for (const auto& entry : fs::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file()) {
+                total += entry.file_size();
+            }
+        }
+        return total;
+    }
+
+    /**
+     * @brief Run a command in a child process and collect its resource usage
+     */
+    Measurement execute(const std::vector<std::string>& command, const fs::path& cwd) {
+        std::vector<char*> argv;
+        for (const auto& arg : command) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error(std::string("fork failed: ") + std::strerror(errno));
+        }
+        if (pid == 0) {
+            // Progress output would dominate small scenarios
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+            if (chdir(cwd.c_str()) != 0) {
+                _exit(126);
+            }
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+
+        int status = 0;
+        struct rusage usage {};
+        wait4(pid, &status, 0, &usage);
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+        Measurement measurement;
+        measurement.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        measurement.wallSeconds = wall.count();
+        measurement.cpuSeconds =
+            static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+            static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        measurement.peakRssBytes = static_cast<uint64_t>(usage.ru_maxrss) * KB;
+        measurement.blockReads = static_cast<uint64_t>(usage.ru_inblock) * 512;
+        measurement.blockWrites = static_cast<uint64_t>(usage.ru_oublock) * 512;
+        return measurement;
+    }
+
+    std::string captureHelp(const fs::path& miniwr) {
+        std::string output;
+        std::string command = miniwr.string() + " --help 2>&1";
+        if (FILE* pipe = popen(command.c_str(), "r")) {
+            char chunk[4096];
+            size_t count;
+            while ((count = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+                output.append(chunk, count);
+            }
+            pclose(pipe);
+        }
+        return output;
+    }
+
+    void printTable(const std::vector<Measurement>& results) {
+        std::cout << std::left << std::setw(9) << "scenario" << std::setw(9) << "op"
+                  << std::right << std::setw(10) << "wall s" << std::setw(10) << "cpu s"
+                  << std::setw(10) << "rss MB" << std::setw(11) << "read MB"
+                  << std::setw(11) << "write MB" << std::setw(10) << "MB/s"
+                  << std::setw(8) << "ratio" << "\n";
+
+        std::cout << std::fixed;
+        for (const auto& m : results) {
+            double throughput = m.wallSeconds > 0
+                ? static_cast<double>(std::max(m.bytesRead, m.bytesWritten)) / MB / m.wallSeconds : 0;
+            std::cout << std::left << std::setw(9) << m.scenario << std::setw(9) << m.operation
+                      << std::right << std::setprecision(2)
+                      << std::setw(10) << m.wallSeconds << std::setw(10) << m.cpuSeconds
+                      << std::setprecision(1)
+                      << std::setw(10) << static_cast<double>(m.peakRssBytes) / MB
+                      << std::setw(11) << static_cast<double>(m.bytesRead) / MB
+                      << std::setw(11) << static_cast<double>(m.bytesWritten) / MB
+                      << std::setw(10) << throughput
+                      << std::setprecision(3) << std::setw(8) << m.ratio;
+            if (m.exitCode != 0) {
+                std::cout << "  FAILED (exit " << m.exitCode << ")";
+            } else if (!m.roundTrip) {
+                std::cout << "  FAILED (archive does not round-trip)";
+            }
+            std::cout << "\n";
+        }
+        std::cout << std::defaultfloat;
+    }
+
+    void writeJson(const fs::path& path, const std::vector<Measurement>& results) {
+        std::ofstream out(path);
+        out << "{\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& m = results[i];
+            out << "    {\"scenario\": \"" << m.scenario << "\", \"operation\": \"" << m.operation
+                << "\", \"exit_code\": " << m.exitCode
+                << ", \"wall_seconds\": " << m.wallSeconds
+                << ", \"cpu_seconds\": " << m.cpuSeconds
+                << ", \"peak_rss_bytes\": " << m.peakRssBytes
+                << ", \"bytes_read\": " << m.bytesRead
+                << ", \"bytes_written\": " << m.bytesWritten
+                << ", \"block_read_bytes\": " << m.blockReads
+                << ", \"block_write_bytes\": " << m.blockWrites
+                << ", \"ratio\": " << m.ratio
+                << ", \"round_trip\": " << (m.roundTrip ? "true" : "false") << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        if (!out) {
+            throw std::runtime_error("Failed to write " + path.string());
+        }
+    }
+
+    int run(const Options& options) {
+        auto miniwr = fs::absolute(options.miniwr);
+        auto root = fs::absolute(options.root);
+        auto work = fs::absolute(options.workDir.empty() ? root / ".runs" : options.workDir);
+        fs::create_directories(work);
+
+        // list and test only run where the binary supports them
+        std::string help = captureHelp(miniwr);
+        bool canList = help.find("\n    l ") != std::string::npos;
+        bool canTest = help.find("\n    t ") != std::string::npos;
+
+        std::vector<Measurement> results;
+        for (const auto& shape : shapes()) {
+            std::string name = shape.name;
+            if (!fs::is_directory(root / name) || (options.shape != "all" && options.shape != name)) {
+                continue;
+            }
+
+            auto archive = work / (name + ".zip");
+            auto output = work / ("out_" + name);
+            fs::remove(archive);
+            fs::remove_all(output);
+            uint64_t inputSize = treeSize(root / name);
+            std::cerr << "Running " << name << "..." << std::endl;
+
+            // Entry names are relative to the corpus root
+            std::vector<std::string> add = {miniwr.string(), "a", archive.string(), name};
+            add.insert(add.end(), options.extraArgs.begin(), options.extraArgs.end());
+            auto added = execute(add, root);
+            uint64_t archiveSize = treeSize(archive);
+            auto extracted = execute({miniwr.string(), "x", archive.string(), "-C", output.string(),
+                                      "--force"}, root);
+            uint64_t outputSize = treeSize(output);
+
+            // A ratio only means something for an archive that gives the
+            // input back; extraction checks the CRC of every entry
+            bool roundTrip = added.exitCode == 0 && extracted.exitCode == 0 && outputSize == inputSize;
+            if (!roundTrip) {
+                std::cerr << "  " << name << ": the archive does not round-trip, no ratio recorded"
+                          << std::endl;
+            }
+            double ratio = roundTrip && inputSize
+                ? static_cast<double>(archiveSize) / static_cast<double>(inputSize) : 0;
+            auto record = [&](Measurement measurement, const char* operation,
+                              uint64_t bytesRead, uint64_t bytesWritten) {
+                measurement.scenario = name;
+                measurement.operation = operation;
+                measurement.bytesRead = bytesRead;
+                measurement.bytesWritten = bytesWritten;
+                measurement.ratio = ratio;
+                measurement.roundTrip = roundTrip;
+                results.push_back(measurement);
+            };
+            record(added, "add", inputSize, archiveSize);
+            record(extracted, "extract", archiveSize, outputSize);
+
+            if (canList) {
+                record(execute({miniwr.string(), "l", archive.string()}, root), "list", archiveSize, 0);
+            }
+            if (canTest) {
+                record(execute({miniwr.string(), "t", archive.string()}, root), "test", archiveSize, 0);
+            }
+
+            fs::remove(archive);
+            fs::remove_all(output);
+        }
+
+        printTable(results);
+        if (!options.jsonPath.empty()) {
+            writeJson(options.jsonPath, results);
+        }
+
+        bool failed = std::any_of(results.begin(), results.end(),
+            [](const Measurement& m) { return m.exitCode != 0 || !m.roundTrip; });
+        return failed ? 1 : 0;
+    }
+
+    void printUsage() {
+        std::cout << R"(Usage:
+    miniwr_corpus generate <root> [--shape NAME|all] [--seed N] [--scale F]
+                                  [--compressibility P]
+    miniwr_corpus run <root> [--shape NAME|all] [--miniwr PATH] [--work DIR]
+                             [--json FILE] [-- extra options for 'miniwr a']
+
+Shapes:
+)";
+        for (const auto& shape : shapes()) {
+            std::cout << "    " << std::left << std::setw(8) << shape.name << shape.description << "\n";
+        }
+        std::cout << R"(
+--scale multiplies file counts and sizes (e.g. 0.001 for a quick run);
+--compressibility sets the share of text in generated content (0..1).
+)";
+    }
+
+    Options parseOptions(int argc, char* argv[]) {
+        if (argc < 3) {
+            throw std::invalid_argument("missing command or root");
+        }
+
+        Options options;
+        options.command = argv[1];
+        options.root = argv[2];
+
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument(arg + " needs a value");
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--") {
+                options.extraArgs.assign(argv + i + 1, argv + argc);
+                break;
+            } else if (arg == "--shape") {
+                options.shape = value();
+            } else if (arg == "--seed") {
+                options.seed = static_cast<uint32_t>(std::stoul(value()));
+            } else if (arg == "--scale") {
+                options.scale = std::stod(value());
+            } else if (arg == "--compressibility") {
+                options.compressibility = std::stod(value());
+            } else if (arg == "--miniwr") {
+                options.miniwr = value();
+            } else if (arg == "--work") {
+                options.workDir = value();
+            } else if (arg == "--json") {
+                options.jsonPath = value();
+            } else {
+                throw std::invalid_argument("unknown option " + arg);
+            }
+        }
+        return options;
+    }
+}
+
+} // namespace corpus
+} // namespace miniwr
+
+int main(int argc, char* argv[]) {
+    using namespace miniwr::corpus;
+    try {
+        Options options = parseOptions(argc, argv);
+        if (options.command == "generate") {
+            return generate(options);
+        }
+        if (options.command == "run") {
+            return run(options);
+        }
+        throw std::invalid_argument("unknown command " + options.command);
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << "Error: " << e.what() << "\n\n";
+        printUsage();
+        return 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 2;
+    }
+}